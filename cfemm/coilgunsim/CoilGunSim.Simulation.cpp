@@ -1,26 +1,45 @@
 ﻿#include "CoilGunSim.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
 
 // TODO: Coil shape option
 // TODO: Projectile shape option (default, pointed [45 degrees], ball with hollow variants [default-hollow, ball-hollow etc.])
 
-CoilGunSim::SimData CoilGunSim::Simulate(const char* fileName, const SimParameters& parameters)
+namespace
+{
+    constexpr double forceThreshold = 0.1; // Around 0.1N of difference is small enough, to just stop the force mapping
+}
+
+void CoilGunSim::CgsCreateModel(const char* fileName, SimData& data, const SimParameters& parameters)
 {
-    SimData data = {};
-    // Calculate the maximal distance that the projectile can travel inside the boundary height
-    data.NumSteps = 100;
-    
-    constexpr int currents[] = { 10, 100, 1000 };
-    constexpr int numCurrents = std::size(currents);
-    constexpr int defaultCurrent = 5;
-    
     m_api = {};
     m_api.femm_init(fileName);
+    m_api.solverthreads(SolverThreads);
+    m_api.solverpreconditioner(SolverPreconditioner);
+    m_api.solveriterations(SolverMaxIterations, SolverMaxNewtonIterations);
 
     CgsConfigure(parameters);
     CgsCreateBoundary(parameters);
     CgsCreateCoil(data, parameters);
     
     CgsCreateProjectile(data, parameters);
+}
+
+double CoilGunSim::CgsPrepare(const char* fileName, SimData& data, const SimParameters& parameters)
+{
+    // Calculate the maximal distance that the projectile can travel inside the boundary height
+    data.NumSteps = 100;
+    
+    constexpr int currents[] = { 10, 100, 1000 };
+    constexpr int numCurrents = std::size(currents);
+    constexpr int defaultCurrent = 5;
+    
+    CgsCreateModel(fileName, data, parameters);
+    m_position = 0;
 
     // Move the projectile to it's maximal position
     // This is needed, so we simulate the raw inductance correctly, as it might be a bit different, when
@@ -28,7 +47,12 @@ CoilGunSim::SimData CoilGunSim::Simulate(const char* fileName, const SimParamete
     FemmExtensions::MoveGroup(m_api, 0, -data.NumSteps, GROUP_PROJECTILE);
     
     // Integral a inductance
-    auto rawInductance = FemmExtensions::IntegrateInductance(m_api, "Coil", defaultCurrent, "temp.fem");
+    CComplex rawInductance = 0;
+    if (!FemmExtensions::IntegrateInductance(m_api, "Coil", defaultCurrent, rawInductance))
+    {
+        printf("Failed to solve the raw inductance of coil '%s'\n", parameters.GetPairName().c_str());
+        data.Failed = true;
+    }
 
     // Move the projectile back to the center
     // Note: The boundary is at 150mm from the center, so we have max 100mm projectile length limit at 100 steps (100mm + 100mm / 2 < 150mm)
@@ -42,68 +66,363 @@ CoilGunSim::SimData CoilGunSim::Simulate(const char* fileName, const SimParamete
         step.Inductance = rawInductance.Abs();
         step.Forces = {};
         for (int currentIdx = 0; currentIdx < numCurrents; currentIdx++)
+        {
             step.Forces.push_back(0);
+            step.Inductances.push_back(rawInductance.Abs());
+            step.DifferentialInductances.push_back(rawInductance.Abs());
+        }
         data.Steps.push_back(step);
     }
     
     // Copy currents into sim data
     for (const int current : currents)
         data.Currents.push_back(current);
+
+    // Without saturation the forces scale with the square of the current, so one solution per step is enough
+    data.Linear = m_api.islinear();
+    if (EnableLogging && data.Linear) printf("All materials are linear, solving once per step.\n");
+
+    return rawInductance.Abs();
+}
+
+bool CoilGunSim::CgsSimulateStep(SimData::StepData& step, const SimData& data)
+{
+    const int numCurrents = static_cast<int>(data.Currents.size());
     
-    // Simulate inductance
-    for(int stepIdx = 0; stepIdx < data.NumSteps; stepIdx++)
-    {
-        constexpr double inductanceThreshold = 0.25; // Around 0.11uH of difference is small enough, to just stop the inductance mapping
-        
-        auto inductance = FemmExtensions::IntegrateInductance(m_api, "Coil", defaultCurrent, "temp.fem");
-        if (EnableLogging) printf("%dmm Inductance=%.1fuH (raw: %.1fuH)\n", stepIdx, inductance.Abs(), rawInductance.Abs());
+    // Simulate forces and inductances on all the currents
+    // The model is symmetric, so the inductance does not depend on the direction of the displacement
+    const std::vector<double> sweepCurrents(data.Currents.begin(), data.Currents.end());
+    const std::vector<double> referenceCurrent = { sweepCurrents.back() };
 
-        // Add inductance to the current vector, to feed that later into sim data steps.
-        auto& step = data.Steps[stepIdx];
-        step.Inductance = inductance.Abs();
+    // All currents of a step share one mesh and are solved back to back
+    auto points = FemmExtensions::IntegrateCurrentSweep(m_api, "Coil", data.Linear ? referenceCurrent : sweepCurrents, GROUP_PROJECTILE);
+    if (points.empty())
+        return false;
 
-        // Stop simulation when the inductance is close to the raw coil inductance
-        if((rawInductance - inductance).Abs() <= inductanceThreshold)
+    // Flux linkage of each current [Wb]
+    std::vector<double> fluxLinkages;
+    for (int currentIdx = 0; currentIdx < numCurrents; currentIdx++)
+    {
+        if (data.Linear)
         {
-            // Reset the projectile group position to 0
-            FemmExtensions::MoveGroup(m_api, 0, stepIdx, GROUP_PROJECTILE);
-            break;
+            // Solved for the highest current only, scale down to the others
+            const double scale = sweepCurrents[currentIdx] / referenceCurrent[0];
+            step.Forces[currentIdx] = points[0].Force.Abs() * scale * scale;
+            fluxLinkages.push_back(points[0].FluxLinkage.Abs() * scale);
         }
+        else
+        {
+            step.Forces[currentIdx] = points[currentIdx].Force.Abs();
+            fluxLinkages.push_back(points[currentIdx].FluxLinkage.Abs());
+        }
+    }
+
+    // Apparent inductance L = flux linkage / I, differential inductance dL = d flux linkage / dI
+    for (int currentIdx = 0; currentIdx < numCurrents; currentIdx++)
+    {
+        step.Inductances[currentIdx] = fluxLinkages[currentIdx] / sweepCurrents[currentIdx] * 1E6;
 
-        FemmExtensions::MoveGroup(m_api, 0, -1, GROUP_PROJECTILE);
+        const int lo = currentIdx > 0 ? currentIdx - 1 : currentIdx;
+        const int hi = currentIdx < numCurrents - 1 ? currentIdx + 1 : currentIdx;
+        step.DifferentialInductances[currentIdx] = (hi == lo) ? step.Inductances[currentIdx] :
+            (fluxLinkages[hi] - fluxLinkages[lo]) / (sweepCurrents[hi] - sweepCurrents[lo]) * 1E6;
     }
+    step.Inductance = step.Inductances[0];
+    return true;
+}
+
+bool CoilGunSim::CgsReachedForceThreshold(const SimData::StepData& step, const SimData& data, const SimParameters& parameters)
+{
+    // Stop the force sim when projectile is out of the coil and the force at max current falls down to 0N
+    return step.Distance > parameters.CoilLength && step.Forces[data.Currents.size() - 1] < forceThreshold;
+}
+
+void CoilGunSim::CgsLogStep(const SimData::StepData& step, const SimData& data, const double rawInductance) const
+{
+    if (!EnableLogging)
+        return;
     
-    // Simulate forces on all the currents
-    for (int i = 0; i < data.NumSteps; i++)
+    const int distance = static_cast<int>(step.Distance);
+    printf("%dmm Inductance=%.1fuH (raw: %.1fuH)\n", distance, step.Inductance, rawInductance);
+    for (int currentIdx = 0; currentIdx < static_cast<int>(data.Currents.size()); currentIdx++)
     {
-        bool reachedForceThreshold = false;
-        auto& step = data.Steps[i];
+        printf("%dmm %dA Force=%.1fN L=%.1fuH dL=%.1fuH\n", distance, data.Currents[currentIdx], step.Forces[currentIdx],
+            step.Inductances[currentIdx], step.DifferentialInductances[currentIdx]);
+    }
+}
 
-        for (int currentIdx = 0; currentIdx < numCurrents; currentIdx++)
+int CoilGunSim::CgsSolveSteps(const char* fileName, const SimParameters& parameters, SimData& data,
+                              std::vector<SimData::StepData>& steps, ThreadPool* pool, const bool stopAtThreshold, const double rawInductance)
+{
+    const int numSteps = static_cast<int>(steps.size());
+    const auto inputSteps = steps;
+
+    // Steps are handed out in order, every step at or past 'endStep' is cancelled
+    std::atomic<int> nextStep{ 0 };
+    std::atomic<int> endStep{ numSteps };
+    // The first step that failed and the first step that reached the force threshold
+    std::atomic<int> failedStep{ numSteps };
+    std::atomic<int> thresholdStep{ numSteps };
+    const auto lowerTo = [] (std::atomic<int>& value, const int stepIdx) {
+        int current = value.load();
+        while (stepIdx < current && !value.compare_exchange_weak(current, stepIdx)) {}
+    };
+    const auto cancelFrom = [&] (const int stepIdx) { lowerTo(endStep, stepIdx); };
+
+    // Takes the next steps and moves the projectile of 'sim' there, the model is created on the first step
+    const auto runSteps = [&] (CoilGunSim& sim, int& position, bool created) {
+        for (int i = nextStep++; i < endStep.load(); i = nextStep++)
         {
-            constexpr double forceThreshold = 0.1; // Around 0.1N of difference is small enough, to just stop the force mapping
-            
-            const auto current = currents[currentIdx];
-            auto force = FemmExtensions::IntegrateBlockForce(m_api, "Coil", current, GROUP_PROJECTILE, "temp.fem");
-
-            // Set the force if the current step and current
-            step.Forces[currentIdx] = force.Abs();
-            
-            if (EnableLogging) printf("%dmm %dA Force=%.1fN\n", i, current, force.Abs());
-
-            // Stop the force sim when projectile is out of the coil and the force falls down to 0N
-            if(currentIdx == numCurrents - 1 && step.Distance > parameters.CoilLength && force.Abs() < forceThreshold)
+            if (!created)
+            {
+                SimData model = {};
+                sim.CgsCreateModel(fileName, model, parameters);
+                created = true;
+            }
+            auto& step = steps[i];
+            const int distance = static_cast<int>(step.Distance);
+            FemmExtensions::MoveGroup(sim.m_api, 0, distance - position, GROUP_PROJECTILE);
+            position = distance;
+
+            if (!sim.CgsSimulateStep(step, data))
             {
-                if (EnableLogging) printf("%dmm reached minimum force, stopping.\n", i);
-                reachedForceThreshold = true;
+                printf("%dmm could not be solved, stopping.\n", distance);
+                lowerTo(failedStep, i);
+                cancelFrom(i);
                 break;
             }
+            CgsLogStep(step, data, rawInductance);
+
+            // Stop the simulation, as the simulation reached 0N at max current
+            if (stopAtThreshold && CgsReachedForceThreshold(step, data, parameters))
+            {
+                if (EnableLogging) printf("%dmm reached minimum force, stopping.\n", distance);
+                lowerTo(thresholdStep, i);
+                cancelFrom(i + 1);
+            }
+        }
+        return created;
+    };
+
+    // A single step is not worth building another model
+    if (pool == nullptr || numSteps == 1)
+    {
+        runSteps(*this, m_position, true);
+    }
+    else
+    {
+        // Every runner owns a model, the runners do not save it, so they can share the file name
+        const auto runner = [&] (uint32_t) {
+            CoilGunSim sim = {};
+            sim.EnableLogging = false;
+            sim.SolverThreads = SolverThreads;
+            sim.SolverPreconditioner = SolverPreconditioner;
+            sim.SolverMaxIterations = SolverMaxIterations;
+            sim.SolverMaxNewtonIterations = SolverMaxNewtonIterations;
+            int position = 0;
+            if (runSteps(sim, position, false))
+                sim.m_api.femm_close();
+        };
+
+        const auto numRunners = std::min(pool->GetNumThreads(), static_cast<uint32_t>(numSteps));
+        std::vector<std::future<void>> runners;
+        for (uint32_t i = 0; i < numRunners; i++)
+            runners.push_back(pool->QueueJob(runner));
+        for (auto& future : runners)
+            pool->Wait(future);
+    }
+
+    // Steps past the cut-off may have been solved before it was known, the serial simulation never reaches them.
+    // For the same reason only a failed step before the cut-off fails the coil.
+    const int numSolved = endStep.load();
+    for (int i = numSolved; i < numSteps; i++)
+        steps[i] = inputSteps[i];
+    if (failedStep.load() < thresholdStep.load())
+        data.Failed = true;
+
+    return numSolved;
+}
+
+namespace
+{
+    using StepData = CoilGunSim::SimData::StepData;
+
+    /**
+     * \brief Returns the values of all sampled curves of a step: the force and the inductance for each current.
+     */
+    std::vector<double> CurveValues(const StepData& step)
+    {
+        std::vector<double> values(step.Forces);
+        values.insert(values.end(), step.Inductances.begin(), step.Inductances.end());
+        return values;
+    }
+
+    /**
+     * \brief Returns the middle of every interval, whose linear interpolation misses the curves by more than
+     *  \c tolerance times the largest value of the curve. The error is estimated from the second differences
+     *  at both ends of the interval.
+     *  Force errors below the force threshold are accepted, they are mostly mesh noise of the low currents.
+     */
+    std::vector<int> FindRefinement(const std::map<int, StepData>& samples, const double tolerance)
+    {
+        std::vector<double> x;
+        std::vector<std::vector<double>> f;
+        for (const auto& sample : samples)
+        {
+            x.push_back(sample.first);
+            f.push_back(CurveValues(sample.second));
+        }
+        const int numSamples = static_cast<int>(x.size());
+        if (numSamples < 2)
+            return {};
+        const int numCurves = static_cast<int>(f[0].size());
+
+        const int numForces = static_cast<int>(samples.begin()->second.Forces.size());
+        std::vector<double> scale(numCurves, 0.0);
+        for (int j = 0; j < numSamples; j++)
+            for (int c = 0; c < numCurves; c++)
+                scale[c] = std::max(scale[c], fabs(f[j][c]));
+        
+        std::vector<double> allowed(numCurves);
+        for (int c = 0; c < numCurves; c++)
+            allowed[c] = std::max(tolerance * scale[c], c < numForces ? forceThreshold : 0.0);
+
+        // Second derivative at the inner samples, 0 at the ends
+        std::vector<std::vector<double>> d2(numSamples, std::vector<double>(numCurves, 0.0));
+        for (int j = 1; j < numSamples - 1; j++)
+        {
+            for (int c = 0; c < numCurves; c++)
+            {
+                const double left = (f[j][c] - f[j - 1][c]) / (x[j] - x[j - 1]);
+                const double right = (f[j + 1][c] - f[j][c]) / (x[j + 1] - x[j]);
+                d2[j][c] = 2.0 * (right - left) / (x[j + 1] - x[j - 1]);
+            }
+        }
+
+        std::vector<int> middles;
+        for (int k = 0; k < numSamples - 1; k++)
+        {
+            const double h = x[k + 1] - x[k];
+            if (h <= 1.0)
+                continue;
+
+            // Two samples do not tell anything about the curvature
+            bool refine = (numSamples == 2);
+            for (int c = 0; c < numCurves && !refine; c++)
+            {
+                const double curvature = std::max(fabs(d2[k][c]), fabs(d2[k + 1][c]));
+                refine = curvature * h * h / 8.0 > allowed[c];
+            }
+            if (refine)
+                middles.push_back(static_cast<int>(x[k] + x[k + 1]) / 2);
         }
+        return middles;
+    }
+
+    std::vector<double> Interpolate(const std::vector<double>& a, const std::vector<double>& b, const double t)
+    {
+        std::vector<double> result(a.size());
+        for (size_t i = 0; i < a.size(); i++)
+            result[i] = a[i] + (b[i] - a[i]) * t;
+        return result;
+    }
+}
 
-        // Stop the simulation, as the simulation reached 0N at max current
-        if(reachedForceThreshold) break;
+void CoilGunSim::CgsSampleAdaptive(const char* fileName, const SimParameters& parameters, SimData& data, ThreadPool* pool, const double rawInductance)
+{
+    constexpr int coarseStep = 8;          // Spacing of the first pass (mm)
+    constexpr double tolerance = 0.02;     // Allowed interpolation error, relative to the largest value of a curve
+
+    // Solves the distances in order and adds them to the samples, returns the number of solved distances
+    std::map<int, SimData::StepData> samples;
+    const auto solve = [&] (const std::vector<int>& distances, const bool stopAtThreshold) {
+        std::vector<SimData::StepData> steps;
+        for (const int distance : distances)
+            steps.push_back(data.Steps[distance]);
+        const int numSolved = CgsSolveSteps(fileName, parameters, data, steps, pool, stopAtThreshold, rawInductance);
+        for (int i = 0; i < numSolved; i++)
+            samples[distances[i]] = steps[i];
+        return numSolved;
+    };
+
+    // Coarse pass up to the first sample past the force threshold
+    std::vector<int> coarse;
+    for (int distance = 0; distance < data.NumSteps; distance += coarseStep)
+        coarse.push_back(distance);
+    if (coarse.back() != data.NumSteps - 1)
+        coarse.push_back(data.NumSteps - 1);
+    
+    // A failed coil is discarded, so there is no point in solving more positions
+    const int numCoarse = solve(coarse, true);
+    if (numCoarse == 0 || data.Failed)
+        return;
+
+    // Bracket the cut-off between the last two coarse samples down to a single step
+    int last = coarse[numCoarse - 1];
+    if (numCoarse > 1 && CgsReachedForceThreshold(samples[last], data, parameters))
+    {
+        int below = coarse[numCoarse - 2];
+        while (last - below > 1)
+        {
+            const int middle = (below + last) / 2;
+            if (solve({ middle }, false) == 0 || data.Failed)
+                return;
+            if (CgsReachedForceThreshold(samples[middle], data, parameters))
+                last = middle;
+            else
+                below = middle;
+        }
+        samples.erase(samples.upper_bound(last), samples.end());
+    }
+
+    // Refine where the curves bend, until linear interpolation between the samples is good enough
+    while (true)
+    {
+        const auto middles = FindRefinement(samples, tolerance);
+        if (middles.empty())
+            break;
+        solve(middles, false);
+        if (data.Failed)
+            return;
+    }
+    if (EnableLogging) printf("Sampled %d of %d steps.\n", static_cast<int>(samples.size()), last + 1);
+
+    // Interpolate the uniform steps, past the cut-off they keep 0N and the raw inductance
+    data.Samples.clear();
+    for (const auto& sample : samples)
+        data.Samples.push_back(sample.second);
+    
+    for (int i = 0; i <= last; i++)
+    {
+        auto& step = data.Steps[i];
+        const auto upper = samples.lower_bound(i);
+        if (upper->first == i)
+        {
+            step = upper->second;
+            continue;
+        }
         
-        FemmExtensions::MoveGroup(m_api, 0, 1, GROUP_PROJECTILE);
+        const auto lower = std::prev(upper);
+        const double t = static_cast<double>(i - lower->first) / (upper->first - lower->first);
+        step.Forces = Interpolate(lower->second.Forces, upper->second.Forces, t);
+        step.Inductances = Interpolate(lower->second.Inductances, upper->second.Inductances, t);
+        step.DifferentialInductances = Interpolate(lower->second.DifferentialInductances, upper->second.DifferentialInductances, t);
+        step.Inductance = step.Inductances[0];
+    }
+}
+
+CoilGunSim::SimData CoilGunSim::CgsSimulate(const char* fileName, const SimParameters& parameters, ThreadPool* pool)
+{
+    SimData data = {};
+    const auto rawInductance = CgsPrepare(fileName, data, parameters);
+
+    // The steps start from the raw inductance, without it there is nothing to solve
+    if (!data.Failed)
+    {
+        if (AdaptiveSampling)
+            CgsSampleAdaptive(fileName, parameters, data, pool, rawInductance);
+        else
+            CgsSolveSteps(fileName, parameters, data, data.Steps, pool, true, rawInductance);
     }
     
     m_api.femm_save(fileName);
@@ -111,3 +430,13 @@ CoilGunSim::SimData CoilGunSim::Simulate(const char* fileName, const SimParamete
 
     return data;
 }
+
+CoilGunSim::SimData CoilGunSim::Simulate(const char* fileName, const SimParameters& parameters)
+{
+    return CgsSimulate(fileName, parameters, nullptr);
+}
+
+CoilGunSim::SimData CoilGunSim::Simulate(const char* fileName, const SimParameters& parameters, ThreadPool& pool)
+{
+    return CgsSimulate(fileName, parameters, &pool);
+}
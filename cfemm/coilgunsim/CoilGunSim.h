@@ -16,6 +16,8 @@
 #define COPPER_WIRE_RESISTANCE 1.68e-8
 #pragma endregion
 
+class ThreadPool;
+
 class CoilGunSim
 {
 public:
@@ -189,8 +191,22 @@ public:
         {
             double Distance;
             
+            /**
+             * \brief Apparent inductance at the lowest current of the sweep, 10A (uH).
+             * Same as Inductances[0]. Positions that aren't solved keep the inductance of the coil without the projectile, solved at 5A.
+             */
             double Inductance;
             std::vector<double> Forces;
+
+            /**
+             * \brief Apparent inductance (flux linkage / current) for each current (uH).
+             */
+            std::vector<double> Inductances;
+
+            /**
+             * \brief Differential inductance (d flux linkage / d current) for each current (uH).
+             */
+            std::vector<double> DifferentialInductances;
         };
         
     public:
@@ -237,19 +253,111 @@ public:
         std::vector<int> Currents = {};
         std::vector<StepData> Steps = {};
         int NumSteps = 0;
+
+        /**
+         * \brief The solved steps of the adaptive sampling, ordered by distance. \c Steps are interpolated from them.
+         *  Empty when every step was solved.
+         */
+        std::vector<StepData> Samples = {};
+
+        /**
+         * \brief True, if all materials are linear and the forces were scaled from a single solution per step.
+         */
+        bool Linear = false;
+
+        /**
+         * \brief True, if the solver failed on the raw inductance or on a position. The positions from there on
+         *  keep 0N and the raw inductance, so the data is not a valid result and must not be stored.
+         */
+        bool Failed = false;
     };
 
 public:
     bool EnableLogging = true;
+
+    /**
+     * \brief Samples the positions adaptively instead of at every step.
+     *  The distances are solved on a coarse grid first, refined where the force and inductance curves bend
+     *  and the steps are interpolated from the samples.
+     */
+    bool AdaptiveSampling = false;
+
+    /**
+     * \brief Number of threads that assemble the matrix of a single solve.
+     *  The results do not depend on it. Useful when fewer coils are simulated than there are cores.
+     */
+    int SolverThreads = 1;
+
+    /**
+     * \brief Preconditioner of the linear solver. Use CBigLinProb::PreconditionerColouredSSOR
+     *  to let SolverThreads also work on the preconditioner.
+     */
+    CBigLinProb::PreconditionerType SolverPreconditioner = CBigLinProb::PreconditionerSSOR;
+
+    /**
+     * \brief Iteration limits of the linear solver and of the Newton iteration, see FemmAPI::solveriterations().
+     *  A position that the solver fails on ends the simulation of the coil there and sets SimData::Failed.
+     */
+    int SolverMaxIterations = 10000;
+    int SolverMaxNewtonIterations = 200;
     
 private:
     FemmAPI m_api;
 
+    /**
+     * \brief The distance the projectile of \c m_api was moved by (mm).
+     */
+    int m_position = 0;
+
 private:
     void CgsConfigure(const SimParameters& parameters);
     void CgsCreateBoundary(const SimParameters& parameters);
     void CgsCreateCoil(SimData& data, const SimParameters& parameters);
     void CgsCreateProjectile(SimData& data, const SimParameters& parameters);
+
+    /**
+     * \brief Creates the whole model with the projectile at the center of the coil.
+     */
+    void CgsCreateModel(const char* fileName, SimData& data, const SimParameters& parameters);
+
+    /**
+     * \brief Creates the model and fills all the steps with 0N forces and the raw inductance.
+     * Sets \c data.Failed if the raw inductance could not be solved.
+     * \return The raw inductance of the coil (uH).
+     */
+    double CgsPrepare(const char* fileName, SimData& data, const SimParameters& parameters);
+
+    /**
+     * \brief Solves the step at the current projectile position and fills its forces and inductances.
+     * \return false if the model could not be solved. The step is left unchanged then.
+     */
+    bool CgsSimulateStep(SimData::StepData& step, const SimData& data);
+
+    /**
+     * \return true if the force at the highest current fell below the threshold outside of the coil.
+     */
+    static bool CgsReachedForceThreshold(const SimData::StepData& step, const SimData& data, const SimParameters& parameters);
+    void CgsLogStep(const SimData::StepData& step, const SimData& data, double rawInductance) const;
+
+    /**
+     * \brief Solves \p steps in order at their distances.
+     * Without a pool (or for a single step) the projectile of this model is moved, otherwise the steps are spread
+     * over the pool and every job builds its own model.
+     * \param stopAtThreshold Cancels the steps after the first step that reached the force threshold.
+     * \return The number of solved steps. The remaining steps are left unchanged.
+     *  If a step could not be solved, the steps from there on are cancelled and \c data.Failed is set,
+     *  unless an earlier step reached the force threshold, as the serial simulation would have stopped there.
+     */
+    int CgsSolveSteps(const char* fileName, const SimParameters& parameters, SimData& data,
+                      std::vector<SimData::StepData>& steps, ThreadPool* pool, bool stopAtThreshold, double rawInductance);
+
+    /**
+     * \brief Solves a coarse set of distances, brackets the cut-off and refines where the curves bend.
+     * Fills \c data.Samples and interpolates \c data.Steps from them.
+     */
+    void CgsSampleAdaptive(const char* fileName, const SimParameters& parameters, SimData& data, ThreadPool* pool, double rawInductance);
+
+    SimData CgsSimulate(const char* fileName, const SimParameters& parameters, ThreadPool* pool);
     
 public:
     
@@ -258,6 +366,19 @@ public:
      * \param fileName The temporary FEMM file name.
      * \param parameters The parameters of the simulation. Includes coil and projectile configuration.
      * \return The simulated coil data. Make sure to pass it to Cleanup method, once finished processing the data.
+     *  Check \c SimData::Failed before using it.
      */
     SimData Simulate(const char* fileName, const SimParameters& parameters);
+
+    /**
+     * \brief Simulates the coil like Simulate(), but solves the projectile positions in parallel on \p pool.
+     * Every job builds its own model and takes the next position in order, so the single coil latency scales with the
+     * number of idle workers. The positions past the force threshold are cancelled.
+     * May be called from a job of \p pool, the calling worker keeps running jobs while it waits.
+     * \param fileName The temporary FEMM file name.
+     * \param parameters The parameters of the simulation. Includes coil and projectile configuration.
+     * \param pool The pool to run the positions on.
+     * \return The simulated coil data, equal to the data returned by Simulate().
+     */
+    SimData Simulate(const char* fileName, const SimParameters& parameters, ThreadPool& pool);
 };
@@ -4,7 +4,7 @@
 #include <fsolver.h>
 #include <fmesher.h>
 #include <fpproc.h>
-#include <MatlibReader.h>
+#include <MatlibCache.h>
 
 #include <memory>
 #include <sstream>
@@ -35,6 +35,53 @@ void FemmAPI::smartmesh(bool enable)
     doc->DoSmartMesh = enable;
 }
 
+void FemmAPI::writesolution(bool enable)
+{
+    writeSolutionFile = enable;
+}
+
+void FemmAPI::solverthreads(int numThreads)
+{
+    solverThreads = numThreads;
+}
+
+void FemmAPI::solverpreconditioner(CBigLinProb::PreconditionerType preconditioner)
+{
+    solverPreconditioner = preconditioner;
+}
+
+void FemmAPI::solveriterations(int maxIterations, int maxNewtonIterations)
+{
+    solverMaxIterations = maxIterations;
+    solverMaxNewtonIterations = maxNewtonIterations;
+}
+
+std::string FemmAPI::mi_getstate() const
+{
+    std::ostringstream state;
+    doc->writeProblemDescription(state);
+    // the mesher settings are not part of the document
+    state << "[SmartMesh] = " << doc->DoSmartMesh << "\n";
+    return state.str();
+}
+
+bool FemmAPI::islinear() const
+{
+    for (const auto &label: doc->labellist)
+    {
+        for (const auto &block: doc->blockproplist)
+        {
+            if (label->BlockTypeName != block->BlockName)
+                continue;
+
+            const femm::CMMaterialProp *prop = dynamic_cast<femm::CMMaterialProp*>(block.get());
+            if (prop->BHpoints != 0 || prop->H_c != 0 || prop->J != 0)
+                return false;
+        }
+    }
+    return true;
+}
+
 void FemmAPI::mi_probdef(int frequency, femm::LengthUnit lengthUnits, femm::ProblemType problemType, double precision, double depth, double min_angle)
 {
     doc->Frequency = frequency;
@@ -47,12 +94,12 @@ void FemmAPI::mi_probdef(int frequency, femm::LengthUnit lengthUnits, femm::Prob
 
 void FemmAPI::mi_getmaterial(const char* matname)
 {
-    femm::MatlibReader reader( doc->filetype );
+    // matlib.dat is parsed once per process, the materials are copied from there
     std::stringstream err;
-    if ( reader.parse("matlib.dat", err, matname) == femm::MatlibParseResult::OK )
+    auto prop = femm::MatlibCache::instance().cloneMaterial(doc->filetype, "matlib.dat", matname, err);
+    if (prop)
     {
-        auto prop = reader.takeMaterial(matname);
-        doc->blockproplist.push_back(std::unique_ptr<femm::CMaterialProp>(prop));
+        doc->blockproplist.push_back(std::move(prop));
         doc->updateBlockMap();
     }
 }
@@ -357,7 +404,7 @@ void FemmAPI::mi_saveas(const char* filename)
     (void) doc->saveFEMFile(filename);
 }
 
-int FemmAPI::mi_analyze()
+bool FemmAPI::prepareAnalysis(femm::MeshData &mesh, bool &inMemoryMesh)
 {
     if (doc->problemType==femm::AXISYMMETRIC)
     {
@@ -365,7 +412,7 @@ int FemmAPI::mi_analyze()
         for (int k=0; k<(int)doc->nodelist.size(); k++)
         {
             if (doc->nodelist[k]->x < -(1.e-6))
-                return 0;
+                return false;
         }
 
         // check to see if all block defined to be in an axisymmetric external region are linear.
@@ -392,36 +439,55 @@ int FemmAPI::mi_analyze()
             }
         }
         if (hasAnisotropicMaterial)
-            return 0;
+            return false;
 
         if (!hasExteriorProps)
-            return 0;
+            return false;
     }
 
+    // without periodic boundaries the mesh is handed to the solver in memory,
+    // so no .node/.ele/.edge/.pbc files are written and parsed again
+    mesh.clear();
+    inMemoryMesh = !mesher->HasPeriodicBC();
+
+    // the solver takes the problem description straight from the document;
+    // the .fem file is only needed as the header of the .ans file
     std::string pathName = doc->pathName;
-    if (pathName.empty())
-        return 0;
-    if (!doc->saveFEMFile(pathName))
-        return 0;
+    if (pathName.empty() && (writeSolutionFile || !inMemoryMesh))
+        return false;
+    if (writeSolutionFile && !doc->saveFEMFile(pathName))
+        return false;
     if (!doc->consistencyCheckOK())
-        return 0;
+        return false;
 
     //BeginWaitCursor();
     // allow setting verbosity from lua:
     mesher->Verbose = false;
-    if (mesher->HasPeriodicBC()){
+    if (!inMemoryMesh){
         if (mesher->DoPeriodicBCTriangulation(pathName) != 0)
         {
             mesher->problem->unselectAll();
-            return 0;
+            return false;
         }
     }
     else{
-        if (mesher->DoNonPeriodicBCTriangulation(pathName) != 0)
+        if (mesher->DoNonPeriodicBCTriangulation(mesh) != 0)
         {
-            return 0;
+            return false;
         }
     }
+    meshRevision++;
+    return true;
+}
+
+int FemmAPI::mi_analyze()
+{
+    solution.clear();
+
+    femm::MeshData mesh;
+    bool inMemoryMesh;
+    if (!prepareAnalysis(mesh, inMemoryMesh))
+        return 0;
 
     FSolver theFSolver;
     // filename.fem -> filename
@@ -429,19 +495,85 @@ int FemmAPI::mi_analyze()
     theFSolver.PathName = doc->pathName.substr(0,dotpos);
     //theFSolver.WarnMessage = &PrintWarningMsg;
     //theFSolver.PrintMessage = &PrintWarningMsg;
-    // not supported yet, but set the previous solution so that we can detect this case afterwards:
-    theFSolver.previousSolutionFile = doc->previousSolutionFile;
-    if (!theFSolver.LoadProblemFile())
+    theFSolver.writeSolutionFile = writeSolutionFile;
+    theFSolver.NumThreads = solverThreads;
+    theFSolver.Preconditioner = solverPreconditioner;
+    theFSolver.MaxLinearIterations = solverMaxIterations;
+    theFSolver.MaxNewtonIterations = solverMaxNewtonIterations;
+    if (!theFSolver.loadFromProblem(*doc))
         return 0;
     
-    if (!theFSolver.runSolver(false))
+    if (inMemoryMesh ? !theFSolver.runSolver(mesh, false) : !theFSolver.runSolver(false))
     {
         return 0;
     }
+    solution = std::move(theFSolver.solution);
+    solutionMesh = meshRevision;
     
     return 1;
 }
 
+int FemmAPI::mi_analyzecurrents(const char* circuit, const std::vector<double>& currents)
+{
+    sweepSolutions.clear();
+
+    auto searchResult = doc->circuitMap.find(circuit);
+    if (searchResult == doc->circuitMap.end())
+        return 0;
+    femm::CMCircuit *prop = dynamic_cast<femm::CMCircuit*>(doc->circproplist[searchResult->second].get());
+    sweepCircuit = searchResult->second;
+    sweepCurrents = currents;
+
+    // the sweep reuses the solver state between currents, which is only done for static problems
+    // with an in-memory mesh; everything else is solved one current at a time
+    if (doc->Frequency != 0 || !doc->previousSolutionFile.empty() || mesher->HasPeriodicBC())
+    {
+        const CComplex amps = prop->Amps;
+        for (double current: currents)
+        {
+            prop->Amps = current;
+            if (!mi_analyze())
+            {
+                prop->Amps = amps;
+                sweepSolutions.clear();
+                return 0;
+            }
+            sweepSolutions.push_back(std::move(solution));
+            solution.clear();
+        }
+        prop->Amps = amps;
+        // every current got its own mesh
+        sweepMesh = 0;
+        return 1;
+    }
+
+    solution.clear();
+
+    femm::MeshData mesh;
+    bool inMemoryMesh;
+    if (!prepareAnalysis(mesh, inMemoryMesh))
+        return 0;
+
+    FSolver theFSolver;
+    std::size_t dotpos = doc->pathName.find_last_of(".");
+    theFSolver.PathName = doc->pathName.substr(0,dotpos);
+    theFSolver.NumThreads = solverThreads;
+    theFSolver.Preconditioner = solverPreconditioner;
+    theFSolver.MaxLinearIterations = solverMaxIterations;
+    theFSolver.MaxNewtonIterations = solverMaxNewtonIterations;
+    if (!theFSolver.loadFromProblem(*doc))
+        return 0;
+
+    if (!theFSolver.runCurrentSweep(mesh, circuit, currents, sweepSolutions, false))
+    {
+        sweepSolutions.clear();
+        return 0;
+    }
+    sweepMesh = meshRevision;
+
+    return 1;
+}
+
 int FemmAPI::mi_loadsolution()
 {
     std::size_t dotpos = doc->pathName.find_last_of(".");
@@ -451,10 +583,44 @@ int FemmAPI::mi_loadsolution()
     if(postProcessor)
         postProcessor.reset();
     postProcessor = std::make_shared<FPProc>();
-    if (!postProcessor->OpenDocument(solutionFile))
+    postProcessor->MaskPreconditioner = solverPreconditioner;
+    postProcessor->NumThreads = solverThreads;
+    loadedMesh = 0;
+    if (!solution.empty())
+    {
+        // take the solution over from memory, no file is read
+        if (!postProcessor->OpenDocument(*doc, solution))
+        {
+            return 0;
+        }
+        loadedMesh = solutionMesh;
+    }
+    else if (!postProcessor->OpenDocument(solutionFile))
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+int FemmAPI::mi_loadsolution(int index)
+{
+    if (index < 0 || index >= (int)sweepSolutions.size())
+        return 0;
+
+    if(postProcessor)
+        postProcessor.reset();
+    postProcessor = std::make_shared<FPProc>();
+    postProcessor->MaskPreconditioner = solverPreconditioner;
+    postProcessor->NumThreads = solverThreads;
+    loadedMesh = 0;
+    if (!postProcessor->OpenDocument(*doc, sweepSolutions[index]))
     {
         return 0;
     }
+    // the post processor takes the circuit current from the document, which was not changed by the sweep
+    postProcessor->circproplist[sweepCircuit].Amps = sweepCurrents[index];
+    loadedMesh = sweepMesh;
 
     return 1;
 }
@@ -494,6 +660,20 @@ FemmAPI::CircuitProperties FemmAPI::mo_getcircuitproperties(const char* circuit)
 
 CComplex FemmAPI::mo_blockintegral(int type)
 {
+    return mo_blockintegrals(std::vector<int>(1, type))[0];
+}
+
+std::vector<CComplex> FemmAPI::mo_blockintegrals(const std::vector<int>& types, const char* circuit, CComplex* fluxLinkage)
+{
+    int circuitIdx = -1;
+    if (circuit && fluxLinkage)
+    {
+        *fluxLinkage = 0;
+        const auto searchResult = doc->circuitMap.find(circuit);
+        if (searchResult != doc->circuitMap.end())
+            circuitIdx = searchResult->second;
+    }
+
     bool hasSelectedBlocks = false;
     for (const auto &block: postProcessor->blocklist )
     {
@@ -505,14 +685,44 @@ CComplex FemmAPI::mo_blockintegral(int type)
     }
 
     if (!hasSelectedBlocks)
-        return 0;
+    {
+        if (circuitIdx >= 0)
+            postProcessor->BlockIntegrals(std::vector<int>(), circuitIdx, fluxLinkage);
+        return std::vector<CComplex>(types.size(), CComplex(0,0));
+    }
 
-    if ((type>=18) && (type<=23))
+    bool needsMask = false;
+    for (int type: types)
+        if ((type>=18) && (type<=23))
+            needsMask = true;
+
+    if (needsMask)
     {
-        postProcessor->MakeMask();
+        std::vector<bool> selection;
+        for (const auto &block: postProcessor->blocklist)
+            selection.push_back(block.IsSelected);
+
+        // building the mask takes a linear solve, take it from the last integral on the same mesh if possible
+        const bool canUseCache = loadedMesh != 0 && maskCache.mesh == loadedMesh && maskCache.selection == selection
+            && maskCache.nodes.size() == postProcessor->meshnode.size();
+        if (!postProcessor->bHasMask && canUseCache)
+        {
+            for (int i=0; i<(int)maskCache.nodes.size(); i++)
+                postProcessor->meshnode[i].msk = maskCache.nodes[i];
+            postProcessor->bHasMask = true;
+        }
+
+        if (postProcessor->MakeMask() && !canUseCache && loadedMesh != 0)
+        {
+            maskCache.mesh = loadedMesh;
+            maskCache.selection = selection;
+            maskCache.nodes.resize(postProcessor->meshnode.size());
+            for (int i=0; i<(int)maskCache.nodes.size(); i++)
+                maskCache.nodes[i] = postProcessor->meshnode[i].msk;
+        }
     }
 
-    return postProcessor->BlockIntegral(type);
+    return postProcessor->BlockIntegrals(types, circuitIdx, fluxLinkage);
 }
 
 
@@ -2,6 +2,9 @@
 
 #include <femmcomplex.h>
 #include <FemmProblem.h>
+#include <MagneticsSolution.h>
+#include <MeshData.h>
+#include <spars.h>
 
 #ifndef FEMM_CAPI_H
 #define FEMM_CAPI_H
@@ -33,6 +36,45 @@ private:
     std::shared_ptr<femm::FemmProblem> doc;
     std::shared_ptr<fmesher::FMesher> mesher;
     std::shared_ptr<FPProc> postProcessor;
+
+    /// \brief Solution of the last mi_analyze() call, handed to the post processor without an .ans file
+    femm::MagneticsSolution solution;
+    /// \brief Solutions of the last mi_analyzecurrents() call, one per current
+    std::vector<femm::MagneticsSolution> sweepSolutions;
+    /// \brief Circuit and currents of \c sweepSolutions; the document keeps the original current of the circuit
+    int sweepCircuit = -1;
+    std::vector<double> sweepCurrents;
+    bool writeSolutionFile = false;
+    int solverThreads = 1;
+    CBigLinProb::PreconditionerType solverPreconditioner = CBigLinProb::PreconditionerSSOR;
+    int solverMaxIterations = 10000;
+    int solverMaxNewtonIterations = 200;
+
+    /// \brief Counts the meshes created by prepareAnalysis(); 0 stands for an unknown mesh
+    int meshRevision = 0;
+    int solutionMesh = 0;   ///< \brief mesh of \c solution
+    int sweepMesh = 0;      ///< \brief mesh shared by all \c sweepSolutions
+    int loadedMesh = 0;     ///< \brief mesh of the solution in the post processor
+
+    /**
+     * \brief Node mask of the last weighted stress tensor integral.
+     * The mask only depends on the mesh and on the selected blocks,
+     * so it is reused for all solutions of a current sweep.
+     */
+    struct
+    {
+        int mesh = 0;
+        std::vector<bool> selection;
+        std::vector<double> nodes;
+    } maskCache;
+
+    /**
+     * \brief Checks the document and meshes it.
+     * \param mesh receives the mesh if \p inMemoryMesh is set
+     * \param inMemoryMesh is set to \c false if the mesh was written to disk (periodic boundaries)
+     * \return \c true on success
+     */
+    bool prepareAnalysis(femm::MeshData &mesh, bool &inMemoryMesh);
     
 public:
     void femm_init(const char* file);
@@ -40,6 +82,40 @@ public:
     void femm_close();
 
     void smartmesh(bool enable);
+    /**
+     * \brief Enables writing the .ans file in mi_analyze.
+     * The solution is always kept in memory; the file is only needed for external post processing.
+     */
+    void writesolution(bool enable);
+    /**
+     * \brief Sets the number of threads that assemble the matrix of a static axisymmetric problem and solve it. The default is 1.
+     * The solution doesn't depend on the number of threads.
+     */
+    void solverthreads(int numThreads);
+    /**
+     * \brief Selects the preconditioner of the linear solver. The default is CBigLinProb::PreconditionerSSOR,
+     * whose sweeps can't use more than one thread.
+     * The postprocessor solves the mask of the weighted stress tensor with it, too.
+     */
+    void solverpreconditioner(CBigLinProb::PreconditionerType preconditioner);
+    /**
+     * \brief Limits the iterations of the linear solver and of the Newton iteration of nonlinear problems.
+     * The defaults are 10000 and 200. The linear solver also stops if its residual doesn't halve within
+     * a twentieth of \p maxIterations and solves again with CBigLinProb::PreconditionerCholesky.
+     * The Newton iteration relaxes the updates more. If that doesn't help either, the analysis fails.
+     */
+    void solveriterations(int maxIterations, int maxNewtonIterations);
+    /**
+     * \brief Checks whether the field depends linearly on the circuit currents.
+     * This is the case if no block uses a material with a BH curve, a magnetization or an applied current density.
+     * Forces and energies then scale with the square of the current.
+     */
+    bool islinear() const;
+    /**
+     * \brief Describes everything the solution depends on: the document and the mesher settings.
+     * Equal descriptions give equal solutions, so the description can be used as a cache key.
+     */
+    std::string mi_getstate() const;
     void mi_probdef(int frequency,
         femm::LengthUnit lengthUnits,
         femm::ProblemType problemType,
@@ -68,11 +144,35 @@ public:
     void mi_selectgroup(int group);
     void mi_modifycircprop(const char* circuit, int prop_id, void* value);
     void mi_saveas(const char* filename);
+    /**
+     * \brief Meshes and solves the problem.
+     * \return 1 on success, 0 on error, e.g. if the solver didn't converge
+     */
     int mi_analyze();
+    /**
+     * \brief Solves the problem once per current in \p currents, varying the total current of \p circuit.
+     * The problem is meshed once and each solution is used as starting point for the next one.
+     * The document itself is not modified.
+     * Use mi_loadsolution(int) to post process one of the solutions.
+     * \return 1 on success, 0 on error, e.g. if the solver didn't converge for one of the currents
+     */
+    int mi_analyzecurrents(const char* circuit, const std::vector<double>& currents);
     int mi_loadsolution();
+    /**
+     * \brief Loads the solution for the current at position \p index of the last mi_analyzecurrents() call.
+     * \return 1 on success, 0 on error
+     */
+    int mi_loadsolution(int index);
     void mo_groupselectblock(int group);
     CircuitProperties mo_getcircuitproperties(const char* circuit) const;
     CComplex mo_blockintegral(int type);
+    /**
+     * \brief Computes several block integrals over the selected blocks in one pass over the mesh.
+     * \param circuit if not null, the flux linkage of this circuit is computed in the same pass
+     * \param fluxLinkage receives the flux linkage of \p circuit, the same as mo_getcircuitproperties()
+     * \return one result per entry of \p types
+     */
+    std::vector<CComplex> mo_blockintegrals(const std::vector<int>& types, const char* circuit = nullptr, CComplex* fluxLinkage = nullptr);
 
     BoundingBox mi_getboundingbox() const;
     void mi_addboundprop(const char* boundName, double A0, double A1, double A2, double phi, double Mu, double Sig, double c0, double c1, int format);
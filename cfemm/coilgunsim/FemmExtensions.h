@@ -1,11 +1,25 @@
 ﻿#pragma once
 
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
 #include <femmcomplex.h>
 #include "FemmAPI.h"
+#include "SolutionCache.h"
 
 class FemmExtensions
 {
 public:
+    /**
+     * \brief Results of one solution of a current sweep.
+     */
+    struct SweepPoint
+    {
+        CComplex Force;
+        CComplex FluxLinkage;
+    };
+
     static void AddLine(FemmAPI& api, const double x0, const double y0, const double x1, const double y1, const int group = 0)
     {
         api.mi_addnode(x0, y0);
@@ -41,30 +55,104 @@ public:
         api.mi_modifycircprop(circuit, 1, &current);
     }
 
-    static void Analyze(FemmAPI& api, const char* fileName)
+    /**
+     * \return true if the problem was solved and the solution is loaded
+     */
+    static bool Analyze(FemmAPI& api)
     {
-        api.mi_saveas(fileName);
-        api.mi_analyze();
-        api.mi_loadsolution();
+        return api.mi_analyze() && api.mi_loadsolution();
     }
 
-    static CComplex IntegrateBlockForce(FemmAPI& api, const char* circuit, const int current, const int block, const char* fileName)
+    /**
+     * \brief Integrates the force on \p block for one circuit current.
+     * The result is taken from the SolutionCache if the same problem was solved before.
+     * \return false if the analysis failed, \p force is left unchanged then
+     */
+    static bool IntegrateBlockForce(FemmAPI& api, const char* circuit, const int current, const int block, CComplex& force)
     {
         api.mi_clearselected();
         
         SetCircuitCurrent(api, circuit, current);
-        Analyze(api, fileName);
-        api.mo_groupselectblock(block);
-        return api.mo_blockintegral(19);
+        const auto key = SolutionCache::MakeKey(api.mi_getstate(), "BlockForce " + std::to_string(block));
+        std::vector<CComplex> values;
+        if (!SolutionCache::Instance().Lookup(key, values))
+        {
+            // the post processor still holds the previous solution if the analysis failed
+            if (!Analyze(api))
+                return false;
+            api.mo_groupselectblock(block);
+            values = api.mo_blockintegrals({ 19 });
+            SolutionCache::Instance().Store(key, values);
+        }
+        force = values[0];
+        return true;
+    }
+
+    /**
+     * \brief Integrates the force on \p block and the flux linkage of \p circuit for several circuit currents.
+     * The problem is meshed once and solved for all currents back to back.
+     * The results are taken from the SolutionCache if the same sweep was solved before.
+     * \return one result per current, or an empty vector if the analysis failed
+     */
+    static std::vector<SweepPoint> IntegrateCurrentSweep(FemmAPI& api, const char* circuit, const std::vector<double>& currents, const int block)
+    {
+        std::vector<SweepPoint> points;
+        api.mi_clearselected();
+
+        // The sweep doesn't use the current of the circuit in the document, but the currents are part of the query
+        std::ostringstream query;
+        query << std::setprecision(17) << "CurrentSweep " << circuit << " " << block;
+        for (const double current : currents)
+            query << " " << current;
+        const auto key = SolutionCache::MakeKey(api.mi_getstate(), query.str());
+        std::vector<CComplex> values;
+        if (SolutionCache::Instance().Lookup(key, values) && values.size() == 2 * currents.size())
+        {
+            for (size_t i = 0; i < currents.size(); i++)
+                points.push_back({ values[2 * i], values[2 * i + 1] });
+            return points;
+        }
+
+        if (!api.mi_analyzecurrents(circuit, currents))
+            return points;
+
+        values.clear();
+        for (int i = 0; i < (int)currents.size(); i++)
+        {
+            api.mi_loadsolution(i);
+            api.mo_groupselectblock(block);
+            // the force and the flux linkage in one pass over the mesh
+            CComplex fluxLinkage = 0;
+            const auto force = api.mo_blockintegrals({ 19 }, circuit, &fluxLinkage)[0];
+            points.push_back({ force, fluxLinkage });
+            values.push_back(points.back().Force);
+            values.push_back(points.back().FluxLinkage);
+        }
+        SolutionCache::Instance().Store(key, values);
+        return points;
     }
 
-    static CComplex IntegrateInductance(FemmAPI& api, const char* circuit, const int current, const char* fileName)
+    /**
+     * \brief Computes the inductance (uH) of \p circuit from its flux linkage.
+     * The flux linkage is taken from the SolutionCache if the same problem was solved before.
+     * \return false if the analysis failed, \p inductance is left unchanged then
+     */
+    static bool IntegrateInductance(FemmAPI& api, const char* circuit, const int current, CComplex& inductance)
     {
         api.mi_clearselected();
         
         SetCircuitCurrent(api, circuit, current);
-        Analyze(api, fileName);
-        api.mo_groupselectblock(0);
-        return (api.mo_blockintegral(2) * 2.0) / (current * current) * 1E6;
+        const auto key = SolutionCache::MakeKey(api.mi_getstate(), std::string("FluxLinkage ") + circuit);
+        std::vector<CComplex> values;
+        if (!SolutionCache::Instance().Lookup(key, values))
+        {
+            if (!Analyze(api))
+                return false;
+            values = { 0 };
+            api.mo_blockintegrals({}, circuit, &values[0]);
+            SolutionCache::Instance().Store(key, values);
+        }
+        inductance = values[0] / current * 1E6;
+        return true;
     }
 };
@@ -0,0 +1,253 @@
+#include "SolutionCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Identifies the file format. Change the version when the layout or the solver results change.
+    const char bucketMagic[8] = { 'C', 'G', 'S', 'C', '0', '0', '0', '1' };
+    constexpr uint32_t numBuckets = 256;
+    // Guards against reading garbage as a huge record
+    constexpr uint32_t maxValuesPerRecord = 1024;
+
+    // Bucket files are rewritten as a whole, so the threads of this process take turns
+    std::mutex g_bucketMutex;
+
+    template <class T>
+    bool WriteValue(FILE* fp, const T& value)
+    {
+        return fwrite(&value, sizeof(T), 1, fp) == 1;
+    }
+
+    template <class T>
+    bool ReadValue(FILE* fp, T& value)
+    {
+        return fread(&value, sizeof(T), 1, fp) == 1;
+    }
+
+    int ProcessId()
+    {
+#ifdef _WIN32
+        return _getpid();
+#else
+        return getpid();
+#endif
+    }
+
+    bool ReplaceFile(const std::string& from, const std::string& to)
+    {
+#ifdef _WIN32
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+}
+
+SolutionCache& SolutionCache::Instance()
+{
+    static SolutionCache cache;
+    return cache;
+}
+
+SolutionCache::Key SolutionCache::MakeKey(const std::string& state, const std::string& query)
+{
+    fmesher::MeshCache::Hasher hasher;
+    hasher.add(state);
+    hasher.add(query);
+    return hasher.key();
+}
+
+void SolutionCache::SetCapacity(size_t entries)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_capacity = entries;
+    while (m_entries.size() > m_capacity)
+    {
+        m_index.erase(m_entries.back().Id);
+        m_entries.pop_back();
+    }
+}
+
+void SolutionCache::SetDirectory(const std::string& directory, size_t maxEntries)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_directory = directory;
+    m_bucketSize = (maxEntries + numBuckets - 1) / numBuckets;
+}
+
+bool SolutionCache::Lookup(const Key& key, std::vector<CComplex>& values)
+{
+    std::string bucket;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it = m_index.find(key);
+        if (it != m_index.end())
+        {
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            values = it->second->Values;
+            m_statistics.Hits++;
+            return true;
+        }
+        bucket = BucketName(key);
+    }
+
+    // The bucket is read without holding the lock
+    if (!bucket.empty())
+    {
+        std::vector<Record> records;
+        ReadBucket(bucket, records);
+        for (const auto& record : records)
+        {
+            if (record.Id == key)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                Insert(key, record.Values);
+                m_statistics.DiskHits++;
+                values = record.Values;
+                return true;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_statistics.Misses++;
+    return false;
+}
+
+void SolutionCache::Store(const Key& key, const std::vector<CComplex>& values)
+{
+    std::string bucket;
+    size_t bucketSize;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Insert(key, values);
+        bucket = BucketName(key);
+        bucketSize = m_bucketSize;
+    }
+    if (bucket.empty() || bucketSize == 0)
+        return;
+
+    // Newest first, the oldest records fall out of a full bucket
+    std::lock_guard<std::mutex> lock(g_bucketMutex);
+    std::vector<Record> records;
+    ReadBucket(bucket, records);
+    std::vector<Record> updated;
+    updated.push_back({ key, values });
+    for (auto& record : records)
+    {
+        if (updated.size() >= bucketSize)
+            break;
+        if (!(record.Id == key))
+            updated.push_back(std::move(record));
+    }
+    WriteBucket(bucket, updated);
+}
+
+SolutionCache::Statistics SolutionCache::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_statistics;
+}
+
+void SolutionCache::Insert(const Key& key, const std::vector<CComplex>& values)
+{
+    if (m_capacity == 0)
+        return;
+    const auto it = m_index.find(key);
+    if (it != m_index.end())
+    {
+        it->second->Values = values;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return;
+    }
+    m_entries.push_front({ key, values });
+    m_index[key] = m_entries.begin();
+    while (m_entries.size() > m_capacity)
+    {
+        m_index.erase(m_entries.back().Id);
+        m_entries.pop_back();
+    }
+}
+
+std::string SolutionCache::BucketName(const Key& key) const
+{
+    if (m_directory.empty())
+        return std::string();
+    // The memory index uses h0, so the buckets are picked by h1
+    char name[32];
+    snprintf(name, sizeof(name), "solutions-%02x.bin", (unsigned)((key.h1 >> 56) % numBuckets));
+    std::string path = m_directory;
+    if (path.back() != '/' && path.back() != '\\')
+        path += '/';
+    return path + name;
+}
+
+bool SolutionCache::ReadBucket(const std::string& name, std::vector<Record>& records)
+{
+    records.clear();
+    FILE* fp = fopen(name.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    char magic[sizeof(bucketMagic)];
+    uint32_t numRecords = 0;
+    bool ok = fread(magic, sizeof(magic), 1, fp) == 1
+        && memcmp(magic, bucketMagic, sizeof(magic)) == 0
+        && ReadValue(fp, numRecords);
+    for (uint32_t i = 0; ok && i < numRecords; i++)
+    {
+        Record record;
+        uint32_t numValues = 0;
+        ok = ReadValue(fp, record.Id.h0) && ReadValue(fp, record.Id.h1)
+            && ReadValue(fp, numValues) && numValues <= maxValuesPerRecord;
+        record.Values.resize(ok ? numValues : 0);
+        for (auto& value : record.Values)
+            ok = ok && ReadValue(fp, value.re) && ReadValue(fp, value.im);
+        if (ok)
+            records.push_back(std::move(record));
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool SolutionCache::WriteBucket(const std::string& name, const std::vector<Record>& records)
+{
+    // Unique for every thread of every process that shares the directory
+    const std::string tempName = name + "." + std::to_string(ProcessId()) + "."
+        + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    FILE* fp = fopen(tempName.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    const uint32_t numRecords = static_cast<uint32_t>(records.size());
+    bool ok = fwrite(bucketMagic, sizeof(bucketMagic), 1, fp) == 1 && WriteValue(fp, numRecords);
+    for (const auto& record : records)
+    {
+        const uint32_t numValues = static_cast<uint32_t>(record.Values.size());
+        ok = ok && WriteValue(fp, record.Id.h0) && WriteValue(fp, record.Id.h1) && WriteValue(fp, numValues);
+        for (const auto& value : record.Values)
+            ok = ok && WriteValue(fp, value.re) && WriteValue(fp, value.im);
+    }
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || !ReplaceFile(tempName, name))
+    {
+        remove(tempName.c_str());
+        return false;
+    }
+    return true;
+}
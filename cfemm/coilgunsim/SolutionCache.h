@@ -0,0 +1,108 @@
+#pragma once
+
+#ifndef SOLUTIONCACHE_H
+#define SOLUTIONCACHE_H
+
+#include <femmcomplex.h>
+#include <MeshCache.h>
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * \brief Cache of post processing results, addressed by a hash of the problem and of the query.
+ * The same problem gives the same solution, so the integrals of a solution can be stored instead of solving again.
+ *
+ * The results are kept in memory and dropped in least recently used order.
+ * If a directory is set, the results are also written to a fixed number of bucket files in that directory.
+ * Several processes can share the directory: a bucket is written to a temporary file and then replaces the old one,
+ * so readers always see a complete bucket. Results stored by two processes at the same moment may get lost,
+ * which only costs a solution later.
+ *
+ * There is one cache per process. It can be used from several threads.
+ */
+class SolutionCache
+{
+public:
+    using Key = fmesher::MeshCache::Key;
+
+    struct Statistics
+    {
+        uint64_t Hits = 0;     ///< lookups answered from memory
+        uint64_t DiskHits = 0; ///< lookups answered from the cache directory
+        uint64_t Misses = 0;   ///< lookups that had to solve
+    };
+
+    /**
+     * \return the cache of the process
+     */
+    static SolutionCache& Instance();
+
+    /**
+     * \brief Computes the key of a query.
+     * \param state description of everything the solution depends on, see FemmAPI::mi_getstate()
+     * \param query what is computed from the solution, including all its parameters
+     */
+    static Key MakeKey(const std::string& state, const std::string& query);
+
+    /**
+     * \brief Sets the number of results kept in memory. 0 disables the memory cache. The default is 4096.
+     */
+    void SetCapacity(size_t entries);
+
+    /**
+     * \brief Sets the directory for the bucket files.
+     * The directory has to exist. An empty string (the default) disables the files.
+     * \param maxEntries upper bound for the number of results in the directory; the oldest results of a bucket are dropped first
+     */
+    void SetDirectory(const std::string& directory, size_t maxEntries = 65536);
+
+    /**
+     * \brief Looks up the results of a query.
+     * \return true on a hit, false if \p values is unchanged
+     */
+    bool Lookup(const Key& key, std::vector<CComplex>& values);
+
+    /**
+     * \brief Stores the results of a query.
+     */
+    void Store(const Key& key, const std::vector<CComplex>& values);
+
+    Statistics GetStatistics() const;
+
+private:
+    struct Record
+    {
+        Key Id;
+        std::vector<CComplex> Values;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const { return static_cast<size_t>(key.h0); }
+    };
+
+    SolutionCache() = default;
+    SolutionCache(const SolutionCache&) = delete;
+    SolutionCache& operator=(const SolutionCache&) = delete;
+
+    /// Inserts into memory; the caller holds the mutex
+    void Insert(const Key& key, const std::vector<CComplex>& values);
+    std::string BucketName(const Key& key) const;
+    static bool ReadBucket(const std::string& name, std::vector<Record>& records);
+    static bool WriteBucket(const std::string& name, const std::vector<Record>& records);
+
+    mutable std::mutex m_mutex;
+    std::list<Record> m_entries; ///< most recently used first
+    std::unordered_map<Key, std::list<Record>::iterator, KeyHash> m_index;
+    size_t m_capacity = 4096;
+    std::string m_directory;
+    size_t m_bucketSize = 0;
+    Statistics m_statistics;
+};
+
+#endif // SOLUTIONCACHE_H
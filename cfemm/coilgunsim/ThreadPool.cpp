@@ -1,31 +1,131 @@
 #include "ThreadPool.h"
 
-// source: https://stackoverflow.com/questions/15752659/thread-pooling-in-c11
+namespace
+{
+    // The pool and worker id of the current thread, if it is a worker
+    thread_local const ThreadPool* t_pool = nullptr;
+    thread_local uint32_t t_worker = 0;
+    // The id of the job that the current worker is running
+    thread_local uint64_t t_job = 0;
+}
+
+ThreadPool::~ThreadPool()
+{
+    if (!threads.empty())
+        Stop();
+}
+
+bool ThreadPool::TakeJob(const uint32_t id, QueuedJob& job)
+{
+    // Own jobs first, newest first
+    {
+        Worker& own = *workers[id];
+        std::unique_lock<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty())
+        {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+
+    // Steal the oldest job of another worker
+    const auto numWorkers = static_cast<uint32_t>(workers.size());
+    for (uint32_t i = 1; i < numWorkers; i++)
+    {
+        Worker& victim = *workers[(id + i) % numWorkers];
+        std::unique_lock<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::TakeGroupJob(const uint64_t group, QueuedJob& job)
+{
+    // The jobs of a group are queued to the deque of the job that queued them, but may have been stolen since
+    const auto numWorkers = static_cast<uint32_t>(workers.size());
+    for (uint32_t i = 0; i < numWorkers; i++)
+    {
+        Worker& worker = *workers[(t_worker + i) % numWorkers];
+        std::unique_lock<std::mutex> lock(worker.mutex);
+        for (auto it = worker.jobs.begin(); it != worker.jobs.end(); ++it)
+        {
+            if (it->group == group)
+            {
+                job = std::move(*it);
+                worker.jobs.erase(it);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::RunJob(const uint32_t id, QueuedJob& job)
+{
+    uint64_t jobId;
+    {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        num_jobs_queued--;
+        num_jobs_running++;
+        jobId = ++last_job_id;
+    }
+    space_available.notify_one();
+
+    // A job that waits within another job's Wait() restores the id of the waiting job afterwards
+    const uint64_t outerJob = t_job;
+    t_job = jobId;
+    job.job(id);
+    t_job = outerJob;
+
+    bool done;
+    {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        num_jobs_running--;
+        done = (num_jobs_queued == 0 && num_jobs_running == 0);
+    }
+    if (done)
+        all_done.notify_all();
+}
 
 void ThreadPool::ThreadLoop(const uint32_t id)
 {
+    t_pool = this;
+    t_worker = id;
+
     while (true)
     {
-        std::function<void(uint32_t)> job;
+        QueuedJob job;
+        if (!TakeJob(id, job))
         {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            mutex_condition.wait(lock, [this] {
-                return !jobs.empty() || should_terminate;
+            std::unique_lock<std::mutex> lock(state_mutex);
+            work_available.wait(lock, [this] {
+                return num_jobs_queued > 0 || should_terminate;
             });
-            if (should_terminate)
+            // Jobs are finished before terminating
+            if (should_terminate && num_jobs_queued == 0)
                 return;
-            job = jobs.front();
-            jobs.pop();
-            num_jobs_running.fetch_add(1);
+            continue;
         }
 
-        job(id);
-        num_jobs_running.fetch_sub(1);
+        RunJob(id, job);
     }
 }
 
-void ThreadPool::Start(const uint32_t numThreads)
+void ThreadPool::Start(const uint32_t numThreads, const uint32_t maxQueuedJobs)
 {
+    max_queued_jobs = maxQueuedJobs;
+    should_terminate = false;
+
+    workers.clear();
+    for (uint32_t i = 0; i < numThreads; i++)
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+
     threads.resize(numThreads);
     for (uint32_t i = 0; i < numThreads; i++)
     {
@@ -33,47 +133,96 @@ void ThreadPool::Start(const uint32_t numThreads)
     }
 }
 
-void ThreadPool::QueueJob(const std::function<void(uint32_t)>& job)
+std::future<void> ThreadPool::QueueJob(const Job& job)
 {
+    auto task = std::make_shared<std::packaged_task<void(uint32_t)>>(job);
+    std::future<void> result = task->get_future();
+    QueuedJob wrapped = { [task] (const uint32_t id) { (*task)(id); }, 0 };
+
+    const bool fromWorker = (t_pool == this);
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        jobs.push(job);
+        std::unique_lock<std::mutex> lock(state_mutex);
+
+        // Only block callers outside of the pool; a blocked worker could never free a slot
+        if (!fromWorker && max_queued_jobs > 0)
+        {
+            space_available.wait(lock, [this] {
+                return num_jobs_queued < max_queued_jobs;
+            });
+        }
+
+        uint32_t target;
+        if (fromWorker)
+        {
+            target = t_worker;
+            wrapped.group = t_job;
+        }
+        else
+        {
+            target = next_worker;
+            next_worker = (next_worker + 1) % static_cast<uint32_t>(workers.size());
+        }
+
+        num_jobs_queued++;
+        std::unique_lock<std::mutex> workerLock(workers[target]->mutex);
+        workers[target]->jobs.push_back(std::move(wrapped));
     }
-    mutex_condition.notify_one();
+    work_available.notify_one();
+
+    return result;
 }
 
-bool ThreadPool::IsBusy()
+void ThreadPool::Wait()
 {
-    bool busy;
+    std::unique_lock<std::mutex> lock(state_mutex);
+    all_done.wait(lock, [this] {
+        return num_jobs_queued == 0 && num_jobs_running == 0;
+    });
+}
+
+void ThreadPool::Wait(std::future<void>& future)
+{
+    // A blocked worker could wait for a job that sits in a deque while all other workers are busy, so it runs the
+    // jobs of its group itself. Only the waiting job queues jobs to its group, so once none of them is queued
+    // anymore, the others are running and the worker can block.
+    if (t_pool == this)
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        busy = jobs.empty();
+        const uint64_t group = t_job;
+        QueuedJob job;
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready && TakeGroupJob(group, job))
+            RunJob(t_worker, job);
     }
-    return busy || num_jobs_running.load() > 0;
+    future.get();
+}
+
+bool ThreadPool::IsBusy()
+{
+    std::unique_lock<std::mutex> lock(state_mutex);
+    return num_jobs_queued > 0 || num_jobs_running > 0;
 }
 
 uint32_t ThreadPool::GetNumJobs()
 {
-    // Lock and return the size of jobs queue
-    uint32_t numJobs;
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        numJobs = static_cast<uint32_t>(jobs.size());
-    }
+    std::unique_lock<std::mutex> lock(state_mutex);
+    return num_jobs_queued;
+}
 
-    return numJobs;
+uint32_t ThreadPool::GetNumThreads() const
+{
+    return static_cast<uint32_t>(threads.size());
 }
 
 void ThreadPool::Stop()
 {
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
+        std::unique_lock<std::mutex> lock(state_mutex);
         should_terminate = true;
     }
-    mutex_condition.notify_all();
+    work_available.notify_all();
     for (std::thread& active_thread : threads)
     {
         active_thread.join();
     }
     threads.clear();
+    workers.clear();
 }
@@ -5,28 +5,104 @@
 
 #include <thread>
 #include <functional>
+#include <future>
 #include <mutex>
-#include <queue>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <vector>
 
+/**
+ * \brief Work-stealing thread pool.
+ * Every worker owns a deque of jobs. A worker takes its own jobs from the back and
+ * steals from the front of the other deques when its own deque is empty.
+ * The jobs that a running job queues form its job group, see Wait(std::future<void>&).
+ */
 class ThreadPool
 {
 public:
-    void Start(uint32_t numThreads);
-    void QueueJob(const std::function<void(uint32_t)>& job);
+    using Job = std::function<void(uint32_t)>;
+
+    ~ThreadPool();
+
+    /**
+     * \brief Starts the worker threads.
+     * \param numThreads number of workers
+     * \param maxQueuedJobs QueueJob() blocks while this many jobs are waiting. 0 means no limit.
+     */
+    void Start(uint32_t numThreads, uint32_t maxQueuedJobs = 0);
+
+    /**
+     * \brief Queues a job. The job receives the id of the worker that runs it.
+     * Jobs queued from outside of the pool are spread over the workers and block while the queue is full.
+     * Jobs queued by a running job go to the deque of its worker and never block.
+     * \return a future that becomes ready when the job has finished
+     */
+    std::future<void> QueueJob(const Job& job);
+
+    /**
+     * \brief Blocks until all queued jobs have finished.
+     */
+    void Wait();
+
+    /**
+     * \brief Blocks until \p future is ready.
+     * A job that waits runs the queued jobs of its own job group first, so it can wait for the jobs it queued
+     * even if all other workers are busy. It never runs other jobs, which could block it for much longer.
+     */
+    void Wait(std::future<void>& future);
+
+    /**
+     * \brief Finishes all queued jobs and joins the worker threads.
+     */
     void Stop();
+
+    /**
+     * \return true if jobs are waiting or running
+     */
     bool IsBusy();
 
+    /**
+     * \return the number of jobs waiting to be run
+     */
     uint32_t GetNumJobs();
 
+    /**
+     * \return the number of worker threads
+     */
+    uint32_t GetNumThreads() const;
+
 private:
+    struct QueuedJob
+    {
+        Job job;
+        uint64_t group;                        // Id of the job that queued it, 0 if queued from outside
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<QueuedJob> jobs;
+    };
+
     void ThreadLoop(uint32_t id);
+    bool TakeJob(uint32_t id, QueuedJob& job);
+    bool TakeGroupJob(uint64_t group, QueuedJob& job);
+    void RunJob(uint32_t id, QueuedJob& job);
 
-    bool should_terminate = false;           // Tells threads to stop looking for jobs
-    std::mutex queue_mutex;                  // Prevents data races to the job queue
-    std::condition_variable mutex_condition; // Allows threads to wait on new jobs or termination 
-    std::atomic<int> num_jobs_running;
+    std::vector<std::unique_ptr<Worker>> workers;
     std::vector<std::thread> threads;
-    std::queue<std::function<void(uint32_t)>> jobs;
+    uint32_t next_worker = 0;                  // Round robin target for jobs queued from outside
+
+    std::mutex state_mutex;                    // Guards the counters below
+    std::condition_variable work_available;    // Wakes workers on new jobs or termination
+    std::condition_variable space_available;   // Wakes blocked QueueJob() calls
+    std::condition_variable all_done;          // Wakes Wait()
+    uint32_t max_queued_jobs = 0;
+    uint32_t num_jobs_queued = 0;
+    uint32_t num_jobs_running = 0;
+    uint64_t last_job_id = 0;                  // Ids of the running jobs, for their job groups
+    bool should_terminate = false;
 };
 
 #endif // THREADPOOL_H
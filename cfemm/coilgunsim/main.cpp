@@ -1,6 +1,8 @@
 #include "CoilGunSim.h"
 #include "CoilGen.h"
 #include "ThreadPool.h"
+#include "MeshCache.h"
+#include "SolutionCache.h"
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -11,6 +13,11 @@
 #define PRINT_TIME() printf("Time: %.2fs\n", static_cast<double>(clock() - g_now) / CLOCKS_PER_SEC)
 
 uint32_t num_threads = 20u;
+bool adaptive_sampling = false;
+int solver_threads = 1;
+CBigLinProb::PreconditionerType solver_preconditioner = CBigLinProb::PreconditionerSSOR;
+int solver_max_iterations = 10000;
+int solver_max_newton_iterations = 200;
 
 clock_t g_now;
 uint32_t g_skippedCoils = 0u;
@@ -40,6 +47,51 @@ bool CoilIsDone(const CoilGunSim::SimParameters& parameters)
     return true;
 }
 
+void WriteStepsToFile(const std::string& fileName, const CoilGunSim::SimData& data, const std::vector<CoilGunSim::SimData::StepData>& steps)
+{
+    const auto numCurrents = static_cast<int>(data.Currents.size());
+
+    FILE* file = nullptr;
+    fopen_s(&file, fileName.c_str(), "w");
+    
+    // Write step header
+    fprintf(file, "%s", "Distance, Inductance, ");
+    for (auto i = 0; i < numCurrents; ++i)
+    {
+        fprintf(file, "Force@%dA", data.Currents[i]);
+        if (i < numCurrents - 1)
+            fprintf(file, ", ");
+    }
+    // L(x, I) table: apparent and differential inductance per current
+    for (auto i = 0; i < numCurrents; ++i)
+        fprintf(file, ", Inductance@%dA", data.Currents[i]);
+    for (auto i = 0; i < numCurrents; ++i)
+        fprintf(file, ", DiffInductance@%dA", data.Currents[i]);
+    fprintf(file, "\n");
+    
+    // Write-out all of the simulation steps in the reverse order
+    for (auto&& step : steps)
+    {
+        // Write step Distance, Inductance and forces array
+        fprintf(file, "%f, %f, ", step.Distance, step.Inductance);
+        const auto numForces = static_cast<int>(step.Forces.size());
+        for (auto i = 0; i < numForces; ++i)
+        {
+            fprintf(file, "%f", step.Forces[i]);
+            if (i < numForces - 1)
+                fprintf(file, ", ");
+        }
+        for (const auto inductance : step.Inductances)
+            fprintf(file, ", %f", inductance);
+        for (const auto inductance : step.DifferentialInductances)
+            fprintf(file, ", %f", inductance);
+        fprintf(file, "\n");
+    }
+
+    fflush(file);
+    fclose(file);
+}
+
 void WriteDataToFile(const CoilGunSim::SimParameters& parameters, const CoilGunSim::SimData& data)
 {
     const auto numCurrents = static_cast<int>(data.Currents.size());
@@ -52,6 +104,7 @@ void WriteDataToFile(const CoilGunSim::SimParameters& parameters, const CoilGunS
 
     fprintf(file, "{\n");
     fprintf(file, "\t\"Name\": \"%s\",\n", parameters.GetPairName().c_str());
+    fprintf(file, "\t\"Linear\": %s,\n", data.Linear ? "true" : "false");
 
     // Write Currents
     fprintf(file, "\t\"Currents\": [\n");
@@ -101,38 +154,10 @@ void WriteDataToFile(const CoilGunSim::SimParameters& parameters, const CoilGunS
     fflush(file);
     fclose(file);
     
-    // Write CSV
-    file = nullptr;
-    const auto outputFileNameCSV = "./Data/" + parameters.GetPairName() + ".csv";
-    fopen_s(&file, outputFileNameCSV.c_str(), "w");
-    
-    // Write step header
-    fprintf(file, "%s", "Distance, Inductance, ");
-    for (auto i = 0; i < numCurrents; ++i)
-    {
-        fprintf(file, "Force@%dA", data.Currents[i]);
-        if (i < numCurrents - 1)
-            fprintf(file, ", ");
-    }
-    fprintf(file, "\n");
-    
-    // Write-out all of the simulation steps in the reverse order
-    for (auto&& step : data.Steps)
-    {
-        // Write step Distance, Inductance and forces array
-        fprintf(file, "%f, %f, ", step.Distance, step.Inductance);
-        const auto numForces = static_cast<int>(step.Forces.size());
-        for (auto i = 0; i < numForces; ++i)
-        {
-            fprintf(file, "%f", step.Forces[i]);
-            if (i < numForces - 1)
-                fprintf(file, ", ");
-        }
-        fprintf(file, "\n");
-    }
-
-    fflush(file);
-    fclose(file);
+    // Write CSV, the steps are interpolated from the samples when sampling adaptively
+    WriteStepsToFile("./Data/" + parameters.GetPairName() + ".csv", data, data.Steps);
+    if (!data.Samples.empty())
+        WriteStepsToFile("./Data/" + parameters.GetPairName() + ".samples.csv", data, data.Samples);
 }
 
 // Unused:
@@ -164,6 +189,11 @@ void ThreadWorker(const CoilGunSim::SimParameters* coil, const int coilId, const
     
     CoilGunSim sim = {};
     sim.EnableLogging = false;
+    sim.AdaptiveSampling = adaptive_sampling;
+    sim.SolverThreads = solver_threads;
+    sim.SolverPreconditioner = solver_preconditioner;
+    sim.SolverMaxIterations = solver_max_iterations;
+    sim.SolverMaxNewtonIterations = solver_max_newton_iterations;
     const auto parameters = *coil;
     
     printf("Simulating coil '%s' %d/%d (skipped %d)\n",
@@ -173,11 +203,19 @@ void ThreadWorker(const CoilGunSim::SimParameters* coil, const int coilId, const
            g_skippedCoils
     );
     
-    const auto data = sim.Simulate(fileName, parameters);
+    // Idle workers (e.g. at the end of the run) help with the positions of this coil
+    const auto data = sim.Simulate(fileName, parameters, g_threadPool);
+    const auto time = static_cast<double>(clock() - simStart) / CLOCKS_PER_SEC;
+
+    // A failed coil is not written, so a resumed run tries it again instead of skipping it
+    if (data.Failed)
+    {
+        printf("Failed coil '%s' %d/%d (after %.1fs), the solver did not converge\n", parameters.GetPairName().c_str(), coilId, numCoils, time);
+        return;
+    }
 
     // Write the simulation data to a file, inside "Data" folder
     WriteDataToFile(parameters, data);
-    const auto time = static_cast<double>(clock() - simStart) / CLOCKS_PER_SEC;
     printf("Finished coil '%s' %d/%d (done in %.1fs) \n", parameters.GetPairName().c_str(), coilId, numCoils, time);
 }
 
@@ -185,7 +223,8 @@ void SimulateVariants(const int numCoils, const std::vector<CoilGunSim::SimParam
 {
     constexpr int startCoil = 0; // Change this, if simulation failed and you want to continue from a specific coil
     
-    g_threadPool.Start(num_threads);
+    // Keep at most two jobs per thread queued (memory optimization), QueueJob blocks until there is space
+    g_threadPool.Start(num_threads, num_threads * 2);
     
     for(int coilId = startCoil; coilId < numCoils; coilId++)
     {
@@ -197,18 +236,13 @@ void SimulateVariants(const int numCoils, const std::vector<CoilGunSim::SimParam
             continue;
         }
 
-        // Wait if there are too many jobs queued (memory optimization)
-        while (g_threadPool.GetNumJobs() > num_threads * 2)
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        
         g_threadPool.QueueJob([=] (const uint32_t threadId) {
             ThreadWorker(&coils[coilId], coilId, numCoils, threadId);
         });
     }
     
-    while (g_threadPool.IsBusy()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
+    g_threadPool.Wait();
+    g_threadPool.Stop();
 }
 
 int LoadConfig(nlohmann::json& config)
@@ -248,6 +282,41 @@ int main(int argc, char** argv)
         return -1;
     
     num_threads = (uint32_t)config["NumThreads"].get<int>();
+    if (config.contains("AdaptiveSampling"))
+        adaptive_sampling = config["AdaptiveSampling"].get<bool>();
+    if (config.contains("SolverThreads"))
+        solver_threads = config["SolverThreads"].get<int>();
+    if (config.contains("SolverPreconditioner"))
+    {
+        const auto preconditioner = config["SolverPreconditioner"].get<std::string>();
+        if (preconditioner == "ColouredSSOR")
+            solver_preconditioner = CBigLinProb::PreconditionerColouredSSOR;
+        else if (preconditioner == "AMG")
+            solver_preconditioner = CBigLinProb::PreconditionerAMG;
+        else if (preconditioner == "IC0")
+            solver_preconditioner = CBigLinProb::PreconditionerIC0;
+        else if (preconditioner == "ICT")
+            solver_preconditioner = CBigLinProb::PreconditionerICT;
+        else if (preconditioner == "Cholesky")
+            solver_preconditioner = CBigLinProb::PreconditionerCholesky;
+        else if (preconditioner != "SSOR")
+            printf("Unknown SolverPreconditioner '%s', using SSOR\n", preconditioner.c_str());
+    }
+    if (config.contains("SolverMaxIterations"))
+        solver_max_iterations = config["SolverMaxIterations"].get<int>();
+    if (config.contains("SolverMaxNewtonIterations"))
+        solver_max_newton_iterations = config["SolverMaxNewtonIterations"].get<int>();
+    if (config.contains("MeshCacheSize"))
+        fmesher::MeshCache::instance().setCapacity((size_t)config["MeshCacheSize"].get<int>());
+    std::string meshCacheDirectory;
+    if (config.contains("MeshCacheDirectory"))
+        meshCacheDirectory = config["MeshCacheDirectory"].get<std::string>();
+    std::string solutionCacheDirectory;
+    if (config.contains("SolutionCacheDirectory"))
+        solutionCacheDirectory = config["SolutionCacheDirectory"].get<std::string>();
+    size_t solutionCacheSize = 65536;
+    if (config.contains("SolutionCacheSize"))
+        solutionCacheSize = (size_t)config["SolutionCacheSize"].get<int>();
 
     PermutationConfig permConfig = {};
     permConfig.Read(config);
@@ -258,7 +327,13 @@ int main(int argc, char** argv)
 #ifdef _WIN32
     // Create Data directory if it doesn't exist (using Win32 API)
     CreateDirectory("Data", nullptr);
+    if (!meshCacheDirectory.empty())
+        CreateDirectory(meshCacheDirectory.c_str(), nullptr);
+    if (!solutionCacheDirectory.empty())
+        CreateDirectory(solutionCacheDirectory.c_str(), nullptr);
 #endif
+    fmesher::MeshCache::instance().setDirectory(meshCacheDirectory);
+    SolutionCache::Instance().SetDirectory(solutionCacheDirectory, solutionCacheSize);
     
     printf("Generated %d coil variants, took: ", numCoils);
     PRINT_TIME();
@@ -269,5 +344,14 @@ int main(int argc, char** argv)
     printf("Simulated all coils. Simulation time took: ");
     PRINT_TIME();
 
+    const auto meshCacheStats = fmesher::MeshCache::instance().statistics();
+    printf("Mesh cache: %llu hits (%llu from disk), %llu misses\n",
+        (unsigned long long)(meshCacheStats.hits + meshCacheStats.diskHits),
+        (unsigned long long)meshCacheStats.diskHits, (unsigned long long)meshCacheStats.misses);
+    const auto solutionCacheStats = SolutionCache::Instance().GetStatistics();
+    printf("Solution cache: %llu hits (%llu from disk), %llu misses\n",
+        (unsigned long long)(solutionCacheStats.Hits + solutionCacheStats.DiskHits),
+        (unsigned long long)solutionCacheStats.DiskHits, (unsigned long long)solutionCacheStats.Misses);
+
     system("pause");
 }
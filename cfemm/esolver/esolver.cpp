@@ -675,6 +675,9 @@ bool ESolver::runSolver(bool verbose)
     CBigLinProb L;
 
     L.Precision = Precision;
+    L.Preconditioner = Preconditioner;
+    L.MaxIterations = MaxLinearIterations;
+    L.WarnMessage = WarnMessage;
     if (!L.Create(NumNodes+NumCircProps,BandWidth))
     {
         WarnMessage("couldn't allocate enough space for matrices\n");
@@ -0,0 +1,302 @@
+/*
+ * This file is part of xfemm.
+ *
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+#include "MeshCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace fmesher;
+using femm::MeshData;
+
+namespace {
+
+// identifies the file format; change the version when the layout changes
+const char fileMagic[8] = { 'X', 'F', 'M', 'C', '0', '0', '0', '1' };
+
+template <class T>
+bool writeValue(FILE *fp, const T &value)
+{
+    return fwrite(&value, sizeof(T), 1, fp) == 1;
+}
+
+template <class T>
+bool readValue(FILE *fp, T &value)
+{
+    return fread(&value, sizeof(T), 1, fp) == 1;
+}
+
+int processId()
+{
+#ifdef _WIN32
+    return _getpid();
+#else
+    return getpid();
+#endif
+}
+
+}
+
+std::string MeshCache::Key::toString() const
+{
+    char text[33];
+    snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)h0, (unsigned long long)h1);
+    return text;
+}
+
+void MeshCache::Hasher::add(const void *data, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        // FNV-1a
+        h0 ^= bytes[i];
+        h0 *= 1099511628211ULL;
+        // multiply-rotate, unrelated to FNV
+        h1 = ((h1 ^ bytes[i]) * 0x9e3779b97f4a7c15ULL);
+        h1 = (h1 << 27) | (h1 >> 37);
+    }
+}
+
+void MeshCache::Hasher::add(const std::string &text)
+{
+    addArray(text.data(), static_cast<int>(text.size()));
+}
+
+MeshCache::Key MeshCache::Hasher::key() const
+{
+    Key key;
+    key.h0 = h0;
+    key.h1 = h1;
+    return key;
+}
+
+MeshCache &MeshCache::instance()
+{
+    static MeshCache cache;
+    return cache;
+}
+
+void MeshCache::setCapacity(size_t meshes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    maxEntries = meshes;
+    while (entries.size() > maxEntries)
+    {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+size_t MeshCache::capacity() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return maxEntries;
+}
+
+void MeshCache::setDirectory(const std::string &directory)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    cacheDirectory = directory;
+}
+
+std::string MeshCache::directory() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return cacheDirectory;
+}
+
+bool MeshCache::lookup(const Key &key, MeshData &mesh)
+{
+    std::shared_ptr<const MeshData> cached;
+    std::string name;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            entries.splice(entries.begin(), entries, it->second);
+            cached = it->second->second;
+            stats.hits++;
+        }
+        else
+            name = fileName(key);
+    }
+
+    // the file is read without holding the lock
+    if (!cached && !name.empty())
+    {
+        std::shared_ptr<MeshData> loaded = std::make_shared<MeshData>();
+        if (readFile(name, key, *loaded))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            insert(key, loaded);
+            stats.diskHits++;
+            cached = loaded;
+        }
+    }
+
+    if (!cached)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.misses++;
+        return false;
+    }
+    mesh.nodes = cached->nodes;
+    mesh.elements = cached->elements;
+    mesh.edges = cached->edges;
+    return true;
+}
+
+void MeshCache::store(const Key &key, const MeshData &mesh)
+{
+    std::shared_ptr<MeshData> copy = std::make_shared<MeshData>();
+    copy->nodes = mesh.nodes;
+    copy->elements = mesh.elements;
+    copy->edges = mesh.edges;
+
+    std::string name;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        insert(key, copy);
+        name = fileName(key);
+    }
+    if (!name.empty())
+        writeFile(name, key, *copy);
+}
+
+void MeshCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+}
+
+MeshCache::Statistics MeshCache::statistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void MeshCache::resetStatistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stats = Statistics();
+}
+
+void MeshCache::insert(const Key &key, std::shared_ptr<const MeshData> mesh)
+{
+    if (maxEntries == 0)
+        return;
+    auto it = index.find(key);
+    if (it != index.end())
+    {
+        // another thread stored the same mesh in the meantime
+        entries.splice(entries.begin(), entries, it->second);
+        return;
+    }
+    entries.push_front(Entry(key, std::move(mesh)));
+    index[key] = entries.begin();
+    while (entries.size() > maxEntries)
+    {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+std::string MeshCache::fileName(const Key &key) const
+{
+    if (cacheDirectory.empty())
+        return std::string();
+    std::string name = cacheDirectory;
+    if (name.back() != '/' && name.back() != '\\')
+        name += '/';
+    return name + key.toString() + ".mesh";
+}
+
+bool MeshCache::readFile(const std::string &name, const Key &key, MeshData &mesh) const
+{
+    FILE *fp = fopen(name.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    char magic[sizeof(fileMagic)];
+    Key fileKey;
+    uint64_t numNodes = 0, numElements = 0, numEdges = 0;
+    bool ok = fread(magic, sizeof(magic), 1, fp) == 1
+            && memcmp(magic, fileMagic, sizeof(magic)) == 0
+            && readValue(fp, fileKey.h0) && readValue(fp, fileKey.h1) && fileKey == key
+            && readValue(fp, numNodes) && readValue(fp, numElements) && readValue(fp, numEdges)
+            && numNodes < (1u << 30) && numElements < (1u << 30) && numEdges < (1u << 30);
+    if (ok)
+    {
+        mesh.nodes.resize(numNodes);
+        for (auto &node : mesh.nodes)
+            ok = ok && readValue(fp, node.x) && readValue(fp, node.y) && readValue(fp, node.marker);
+        mesh.elements.resize(numElements);
+        for (auto &element : mesh.elements)
+        {
+            ok = ok && readValue(fp, element.p[0]) && readValue(fp, element.p[1]) && readValue(fp, element.p[2])
+                    && readValue(fp, element.label);
+            for (int j = 0; ok && j < 3; j++)
+                ok = element.p[j] >= 0 && element.p[j] < (int)numNodes;
+        }
+        mesh.edges.resize(numEdges);
+        for (auto &edge : mesh.edges)
+        {
+            ok = ok && readValue(fp, edge.n0) && readValue(fp, edge.n1) && readValue(fp, edge.marker);
+            ok = ok && edge.n0 >= 0 && edge.n0 < (int)numNodes && edge.n1 >= 0 && edge.n1 < (int)numNodes;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool MeshCache::writeFile(const std::string &name, const Key &key, const MeshData &mesh) const
+{
+    // write to a file of this thread first, so that readers never see a partial file;
+    // thread ids are only unique within a process, and processes may share the directory
+    const std::string tempName = name + "." + std::to_string(processId()) + "."
+            + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    FILE *fp = fopen(tempName.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    const uint64_t numNodes = mesh.nodes.size();
+    const uint64_t numElements = mesh.elements.size();
+    const uint64_t numEdges = mesh.edges.size();
+    bool ok = fwrite(fileMagic, sizeof(fileMagic), 1, fp) == 1
+            && writeValue(fp, key.h0) && writeValue(fp, key.h1)
+            && writeValue(fp, numNodes) && writeValue(fp, numElements) && writeValue(fp, numEdges);
+    for (const auto &node : mesh.nodes)
+        ok = ok && writeValue(fp, node.x) && writeValue(fp, node.y) && writeValue(fp, node.marker);
+    for (const auto &element : mesh.elements)
+        ok = ok && writeValue(fp, element.p[0]) && writeValue(fp, element.p[1]) && writeValue(fp, element.p[2])
+                && writeValue(fp, element.label);
+    for (const auto &edge : mesh.edges)
+        ok = ok && writeValue(fp, edge.n0) && writeValue(fp, edge.n1) && writeValue(fp, edge.marker);
+    ok = (fclose(fp) == 0) && ok;
+
+    // rename fails if another process wrote the same mesh first, which is fine
+    if (!ok || rename(tempName.c_str(), name.c_str()) != 0)
+    {
+        remove(tempName.c_str());
+        return false;
+    }
+    return true;
+}
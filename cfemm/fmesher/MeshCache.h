@@ -0,0 +1,147 @@
+/*
+ * This file is part of xfemm.
+ *
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+#ifndef FMESHER_MESHCACHE_H
+#define FMESHER_MESHCACHE_H
+
+#include "MeshData.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace fmesher
+{
+
+/**
+ * @brief Cache of triangulations, addressed by a hash of the input of triangle.
+ *
+ * Triangle always creates the same mesh from the same input, so a cached mesh can replace the call to triangle.
+ * The meshes are kept in memory and dropped in least recently used order.
+ * If a cache directory is set, the meshes are also written to files in that directory,
+ * so that other processes (e.g. a resumed run) can use them.
+ *
+ * There is one cache per process. It is shared by all FMesher instances and can be used from several threads.
+ */
+class MeshCache
+{
+public:
+    /// 128 bit hash of the input of triangle
+    struct Key
+    {
+        uint64_t h0 = 0;
+        uint64_t h1 = 0;
+
+        bool operator==(const Key &other) const { return h0 == other.h0 && h1 == other.h1; }
+        /// 32 hex digits
+        std::string toString() const;
+    };
+
+    /**
+     * @brief Computes a Key from raw data.
+     * Two independent 64 bit hashes are combined, so that accidental collisions don't matter in practice.
+     */
+    class Hasher
+    {
+    public:
+        void add(const void *data, size_t size);
+        /// Adds the number of values and the values, so that adjacent arrays can't be confused
+        template <class T>
+        void addArray(const T *values, int count)
+        {
+            add(&count, sizeof(count));
+            if (values && count > 0)
+                add(values, sizeof(T) * count);
+        }
+        void add(const std::string &text);
+        Key key() const;
+    private:
+        uint64_t h0 = 14695981039346656037ULL; // FNV-1a offset basis
+        uint64_t h1 = 0x6a09e667f3bcc909ULL;
+    };
+
+    struct Statistics
+    {
+        uint64_t hits = 0;     ///< lookups answered from memory
+        uint64_t diskHits = 0; ///< lookups answered from the cache directory
+        uint64_t misses = 0;   ///< lookups that had to call triangle
+    };
+
+    /**
+     * @return the cache of the process
+     */
+    static MeshCache &instance();
+
+    /**
+     * @brief Set the number of meshes kept in memory.
+     * 0 disables the memory cache. The default is 32.
+     */
+    void setCapacity(size_t meshes);
+    size_t capacity() const;
+
+    /**
+     * @brief Set the directory for cached mesh files.
+     * The directory has to exist. An empty string (the default) disables the cache files.
+     */
+    void setDirectory(const std::string &directory);
+    std::string directory() const;
+
+    /**
+     * @brief Look up a mesh.
+     * Only nodes, elements and edges of \p mesh are set.
+     * @return \c true on a hit, \c false if \p mesh is unchanged
+     */
+    bool lookup(const Key &key, femm::MeshData &mesh);
+    /**
+     * @brief Store the nodes, elements and edges of \p mesh.
+     */
+    void store(const Key &key, const femm::MeshData &mesh);
+
+    /**
+     * @brief Drop all meshes from memory. The cache files are kept.
+     */
+    void clear();
+
+    Statistics statistics() const;
+    void resetStatistics();
+
+private:
+    MeshCache() = default;
+    MeshCache(const MeshCache &) = delete;
+    MeshCache &operator=(const MeshCache &) = delete;
+
+    /// Insert into memory; the caller holds the mutex
+    void insert(const Key &key, std::shared_ptr<const femm::MeshData> mesh);
+    std::string fileName(const Key &key) const;
+    bool readFile(const std::string &name, const Key &key, femm::MeshData &mesh) const;
+    bool writeFile(const std::string &name, const Key &key, const femm::MeshData &mesh) const;
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const { return static_cast<size_t>(key.h0); }
+    };
+    using Entry = std::pair<Key, std::shared_ptr<const femm::MeshData>>;
+
+    mutable std::mutex mutex;
+    std::list<Entry> entries; ///< most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    size_t maxEntries = 32;
+    std::string cacheDirectory;
+    Statistics stats;
+};
+
+}
+
+#endif
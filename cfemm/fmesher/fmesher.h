@@ -40,6 +40,7 @@
 #include "CSegment.h"
 #include "femmenums.h"
 #include "FemmProblem.h"
+#include "MeshData.h"
 
 #include <memory>
 #include <vector>
@@ -133,6 +134,13 @@ public:
 	 */
 	bool LoadMesh(std::string PathName);
 	int DoNonPeriodicBCTriangulation(std::string PathName);
+	/**
+	 * @brief Triangulate a problem without periodic boundary conditions and keep the result in memory.
+	 * No mesh files are written; the mesh can be handed to a solver directly.
+	 * @param mesh receives the triangulation
+	 * @return 0 on success, a non-zero status otherwise
+	 */
+	int DoNonPeriodicBCTriangulation(femm::MeshData &mesh);
 	int DoPeriodicBCTriangulation(std::string PathName);
 	bool HasPeriodicBC();
 
@@ -146,6 +154,11 @@ private:
 
     virtual bool Initialize(femm::FileType t);
 	void addFileStr (char * q);
+	/**
+	 * @brief Common implementation of both DoNonPeriodicBCTriangulation variants.
+	 * If \p mesh is set, the triangulation is copied into it, otherwise mesh files are written to \p PathName.
+	 */
+	int doNonPeriodicBCTriangulation(std::string PathName, femm::MeshData *mesh);
 };
 
 /**
@@ -667,9 +667,10 @@ REAL ccwerrboundA, ccwerrboundB, ccwerrboundC;
 REAL iccerrboundA, iccerrboundB, iccerrboundC;
 REAL o3derrboundA, o3derrboundB, o3derrboundC;
 
-/* Random number seed is not constant, but I've made it global anyway.       */
+/* Random number seed is not constant, but I've made it global anyway.  It  */
+/*   is kept per thread, so concurrent triangulations stay reproducible.     */
 
-unsigned long randomseed;                     /* Current random number seed. */
+TRI_THREAD_LOCAL unsigned long randomseed;    /* Current random number seed. */
 
 
 /* Mesh data structure.  Triangle operates on only one mesh, but the mesh    */
@@ -1427,7 +1428,8 @@ REAL area;                                      /* The area of the triangle. */
 /**                                                                         **/
 
 #ifdef TRILIBRARY
-static jmp_buf buf;
+/* Per thread, so that an error exit returns to the triangulating thread.   */
+static TRI_THREAD_LOCAL jmp_buf buf;
 #endif
 
 #ifdef ANSI_DECLARATORS
@@ -255,8 +255,18 @@
 #define XFEMM_BUILTIN_TRIANGLE
 #endif
 
+/* Storage class for the state of a triangulation in progress, so that      */
+/*   several threads can triangulate at the same time.                      */
+#ifndef TRI_THREAD_LOCAL
+    #ifdef _MSC_VER
+        #define TRI_THREAD_LOCAL __declspec(thread)
+    #else
+        #define TRI_THREAD_LOCAL __thread
+    #endif
+#endif
+
 #ifdef TRILIBRARY
-int trilibrary_exit_code = 0;
+TRI_THREAD_LOCAL int trilibrary_exit_code = 0;
 #endif
 
 #ifndef REAL
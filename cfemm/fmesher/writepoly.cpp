@@ -33,6 +33,7 @@
 #include "femmconstants.h"
 #include "CCommonPoint.h"
 #include "CAirGapElement.h"
+#include "MeshCache.h"
 //extern "C" {
 #include "triangle.h"
 #ifndef XFEMM_BUILTIN_TRIANGLE
@@ -148,6 +149,13 @@ public:
      */
     bool writePolyFile(std::string filename, std::string comment) const;
     bool writeTriangulationFiles(std::string Pathname) const;
+    /**
+     * @brief Copy the triangulation into memory instead of writing the \c .node, \c .edge and \c .ele files.
+     * The periodic boundary conditions of \p mesh are left untouched.
+     * @param mesh
+     * @return \c true on success, \c false otherwise.
+     */
+    bool copyTriangulation(MeshData &mesh) const;
 
     // pointer to function to call when issuing warning messages
     int (*WarnMessage)(const char*, ...);
@@ -166,6 +174,12 @@ public:
      * Therefore only used with nonperiodic triangulation.
      */
     void suppressUnusedVertices();
+    /**
+     * @brief Look up the triangulation in the MeshCache instead of calling triangle,
+     * and store new triangulations there.
+     * Only copyTriangulation() is served from the cache, so don't combine this with writeTriangulationFiles().
+     */
+    void useMeshCache();
 
 private:
 #ifdef XFEMM_BUILTIN_TRIANGLE
@@ -178,6 +192,10 @@ private:
     double m_minAngle = 0.;
     bool m_suppressExteriorSteinerPoints = false;
     bool m_suppressUnusedVertices = false;
+    bool m_useMeshCache = false;
+    bool m_cacheHit = false;
+    MeshCache::Key m_cacheKey;
+    MeshData m_cachedMesh;
 };
 
 /**
@@ -222,6 +240,43 @@ void initialize(triangleio &io)
     io.numberofedges = 0;
 }
 
+/**
+ * @brief Copy the nodes, edges and triangles of a triangle output struct into a MeshData object.
+ * @param io
+ * @param mesh
+ */
+template <class TriangleIO>
+void copyTriangleOutput(const TriangleIO &io, MeshData &mesh)
+{
+    mesh.nodes.resize(io.numberofpoints);
+    for (int i = 0; i < io.numberofpoints; i++)
+    {
+        mesh.nodes[i].x = io.pointlist[2*i];
+        mesh.nodes[i].y = io.pointlist[2*i+1];
+        mesh.nodes[i].marker = io.pointmarkerlist ? io.pointmarkerlist[i] : 0;
+    }
+
+    mesh.edges.resize(io.numberofedges);
+    for (int i = 0; i < io.numberofedges; i++)
+    {
+        mesh.edges[i].n0 = io.edgelist[2*i];
+        mesh.edges[i].n1 = io.edgelist[2*i+1];
+        mesh.edges[i].marker = io.edgemarkerlist ? io.edgemarkerlist[i] : 0;
+    }
+
+    mesh.elements.resize(io.numberoftriangles);
+    for (int i = 0; i < io.numberoftriangles; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            mesh.elements[i].p[j] = io.trianglelist[i*io.numberofcorners + j];
+        // the regional attribute is the block label index + 1
+        if (io.numberoftriangleattributes > 0)
+            mesh.elements[i].label = (int) io.triangleattributelist[i*io.numberoftriangleattributes];
+        else
+            mesh.elements[i].label = 0;
+    }
+}
+
 }
 
 double FMesher::averageLineLength() const
@@ -697,6 +752,53 @@ bool TriangulateHelper::writeTriangulationFiles(string PathName) const
     return true;
 }
 
+bool TriangulateHelper::copyTriangulation(MeshData &mesh) const
+{
+    if (m_cacheHit)
+    {
+        mesh.nodes = m_cachedMesh.nodes;
+        mesh.elements = m_cachedMesh.elements;
+        mesh.edges = m_cachedMesh.edges;
+        return true;
+    }
+#ifdef XFEMM_BUILTIN_TRIANGLE
+    if (out.numberofedges <= 0)
+    {
+        WarnMessage("No edges to write!\n");
+    }
+    copyTriangleOutput(out, mesh);
+#else
+    if (triangle_check_mesh(ctx)!=0)
+    {
+        WarnMessage("Mesh has topological inconsistencies!\n");
+        return false;
+    }
+
+    triangleio meshout;
+    initialize(meshout);
+    if (triangle_mesh_copy(ctx, &meshout, 1, 0) != TRI_OK)
+    {
+        WarnMessage("Failed to copy the triangulation\n");
+        return false;
+    }
+    copyTriangleOutput(meshout, mesh);
+
+    if (meshout.pointlist) { free(meshout.pointlist); }
+    if (meshout.pointattributelist) { free(meshout.pointattributelist); }
+    if (meshout.pointmarkerlist) { free(meshout.pointmarkerlist); }
+    if (meshout.trianglelist) { free(meshout.trianglelist); }
+    if (meshout.triangleattributelist) { free(meshout.triangleattributelist); }
+    if (meshout.neighborlist) { free(meshout.neighborlist); }
+    if (meshout.segmentlist) { free(meshout.segmentlist); }
+    if (meshout.segmentmarkerlist) { free(meshout.segmentmarkerlist); }
+    if (meshout.edgelist) { free(meshout.edgelist); }
+    if (meshout.edgemarkerlist) { free(meshout.edgemarkerlist); }
+#endif
+    if (m_useMeshCache)
+        MeshCache::instance().store(m_cacheKey, mesh);
+    return true;
+}
+
 /**
  * @brief FMesher::DoNonPeriodicBCTriangulation
  * What we do in the normal case is DoNonPeriodicBCTriangulation
@@ -709,6 +811,16 @@ bool TriangulateHelper::writeTriangulationFiles(string PathName) const
  *  * \femm42{femm/hd_writepoly.cpp,ChdrawDoc::OnWritePoly()}
  */
 int FMesher::DoNonPeriodicBCTriangulation(string PathName)
+{
+    return doNonPeriodicBCTriangulation(PathName, nullptr);
+}
+
+int FMesher::DoNonPeriodicBCTriangulation(MeshData &mesh)
+{
+    return doNonPeriodicBCTriangulation(problem->pathName, &mesh);
+}
+
+int FMesher::doNonPeriodicBCTriangulation(string PathName, MeshData *mesh)
 {
     // // if incremental permeability solution, we crib mesh from the previous problem.
     // // we can just bail out in that case.
@@ -771,14 +883,20 @@ int FMesher::DoNonPeriodicBCTriangulation(string PathName)
 //        }
 //    fclose(fp);
 
-    // write out a trivial pbc file
-    plyname = pn.substr(0,pn.find_last_of('.')) + ".pbc";
-    if ((fp=fopen(plyname.c_str(),"wt"))==NULL){
-        WarnMessage("Couldn't write to specified .pbc file");
-        return -1;
+    if (mesh)
+    {
+        // no periodic boundaries and no air gap elements
+        mesh->clear();
+    } else {
+        // write out a trivial pbc file
+        plyname = pn.substr(0,pn.find_last_of('.')) + ".pbc";
+        if ((fp=fopen(plyname.c_str(),"wt"))==NULL){
+            WarnMessage("Couldn't write to specified .pbc file");
+            return -1;
+        }
+        fprintf(fp,"0\n");
+        fclose(fp);
     }
-    fprintf(fp,"0\n");
-    fclose(fp);
 
     // **********         call triangle       ***********
 
@@ -794,7 +912,9 @@ int FMesher::DoNonPeriodicBCTriangulation(string PathName)
             return -1;
         triHelper.setMinAngle(std::min(problem->MinAngle+MINANGLE_BUMP,MINANGLE_MAX));
         triHelper.suppressUnusedVertices();
-        if (writePolyFiles)
+        if (mesh)
+            triHelper.useMeshCache();
+        if (writePolyFiles && !PathName.empty())
         {
             string plyname = PathName.substr(0, PathName.find_last_of('.')) + ".poly";
             triHelper.writePolyFile(plyname, triHelper.triangulateParams());
@@ -803,7 +923,13 @@ int FMesher::DoNonPeriodicBCTriangulation(string PathName)
         if (tristatus != 0)
             return tristatus;
 
-        triHelper.writeTriangulationFiles(PathName);
+        if (mesh)
+        {
+            if (!triHelper.copyTriangulation(*mesh))
+                return -1;
+        } else {
+            triHelper.writeTriangulationFiles(PathName);
+        }
     }
     problem->clearNotationTags();
 
@@ -2275,6 +2401,23 @@ bool TriangulateHelper::initHolesAndRegions(const FemmProblem &problem, bool for
 
 int TriangulateHelper::triangulate(bool verbose)
 {
+    if (m_useMeshCache)
+    {
+        // the verbosity doesn't change the mesh
+        MeshCache::Hasher hasher;
+        hasher.addArray(in.pointlist, 2 * in.numberofpoints);
+        hasher.addArray(in.pointmarkerlist, in.numberofpoints);
+        hasher.addArray(in.segmentlist, 2 * in.numberofsegments);
+        hasher.addArray(in.segmentmarkerlist, in.numberofsegments);
+        hasher.addArray(in.holelist, 2 * in.numberofholes);
+        hasher.addArray(in.regionlist, 4 * in.numberofregions);
+        hasher.add(triangulateParams(false));
+        m_cacheKey = hasher.key();
+        m_cacheHit = MeshCache::instance().lookup(m_cacheKey, m_cachedMesh);
+        if (m_cacheHit)
+            return 0;
+    }
+
     std::string triArgs = triangulateParams(verbose);
     // this is a mess, but building the string with std::string is more flexible than sprintf
     // (and the triangulate api is ancient)
@@ -2393,4 +2536,9 @@ void TriangulateHelper::suppressUnusedVertices()
     m_suppressUnusedVertices = true;
 }
 
+void TriangulateHelper::useMeshCache()
+{
+    m_useMeshCache = true;
+}
+
 
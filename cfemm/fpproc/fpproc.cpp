@@ -27,6 +27,7 @@
 // fpproc.cpp : implementation of the FPProc class
 //
 
+#include <algorithm>
 #include <cstdlib>
 #include <string>
 #include <cstring>
@@ -39,6 +40,7 @@
 #include "lua.h"
 #include "lualib.h"
 #include "fpproc.h"
+#include "ThreadTeam.h"
 
 
 #ifndef _MSC_VER
@@ -102,6 +104,8 @@ FPProc::FPProc()
     ConList = NULL;
     bHasMask = false;
     bIncremental = MS_LEGACY_FALSE;
+    MaskPreconditioner = CBigLinProb::PreconditionerSSOR;
+    NumThreads = 1;
     LengthConv = (double *)calloc(6,sizeof(double));
     LengthConv[0] = 0.0254;   //inches
     LengthConv[1] = 0.001;    //millimeters
@@ -182,6 +186,8 @@ void FPProc::ClearDocument()
     meshnode.shrink_to_fit();
     meshelem.clear();
     meshelem.shrink_to_fit();
+    elementArea.clear();
+    elementArea.shrink_to_fit();
     contour.clear();
     contour.shrink_to_fit();
     agelist.clear();
@@ -218,15 +224,11 @@ bool FPProc::NewDocument()
 }
 
 
-bool FPProc::OpenDocument(string pathname)
+bool FPProc::parseProblemHeader(FILE *fp, bool &foundSolution)
 {
-
-    FILE *fp;
-    int i,j,k,t, sscnt;
+    int i,j,k,t;
     char s[1024],q[1024];
     char *v;
-    double b,bi,br;
-    double zr,zi;
     bool flag = false;
     CMPointProp    PProp;
     CMBoundaryProp BProp;
@@ -235,20 +237,7 @@ bool FPProc::OpenDocument(string pathname)
     CNode         node;
     CSegment      segm;
     CArcSegment   asegm;
-    femmpostproc::CPostProcMElement      elm;
     CMBlockLabel   blk;
-    femmsolver::CMMeshNode     mnode;
-    //CPoint        mline;
-
-    // clear out all the document data and set defaults to standard values
-    NewDocument();
-
-    // attempt to open the file for reading
-    if ((fp = fopen(pathname.c_str(),"rt")) == NULL)
-    {
-        WarnMessage("Couldn't read from specified .ans file\n");
-        return false;
-    }
 
     // parse the file
     while ((flag==false) && (fgets(s,1024,fp) != NULL))
@@ -265,7 +254,6 @@ bool FPProc::OpenDocument(string pathname)
             if( ((int) vers)!=40 )
             {
                 WarnMessage("This file is from a different version of FEMM\nRe-analyze the problem using the current version.\n");
-                fclose(fp);
                 return false;
             }
             q[0] = '\0';
@@ -807,39 +795,7 @@ bool FPProc::OpenDocument(string pathname)
 
         if( _strnicmp(q,"<endblock>",9)==0)
         {
-
-            if (bIncremental != 0){
-                // first time through was just to get MuMax from AC curve...
-                CComplex *tmpHdata=(CComplex *)calloc(MProp.BHpoints,sizeof(CComplex));
-                double *tmpBdata=(double *)calloc(MProp.BHpoints,sizeof(double));
-                for(i=0;i<MProp.BHpoints;i++)
-                {
-                    tmpHdata[i]=MProp.Hdata[i];
-                    tmpBdata[i]=MProp.Bdata[i];
-                }
-                MProp.GetSlopes(Frequency*2.*PI);
-                for(i=0;i<MProp.BHpoints;i++)
-                {
-                    MProp.Hdata[i]=tmpHdata[i];
-                    MProp.Bdata[i]=tmpBdata[i];
-                }
-                free(tmpHdata);
-                free(tmpBdata);
-                MProp.slope.clear ();
-                MProp.slope.shrink_to_fit();
-
-                // set a flag for DC incremental permeability problems
-                if ((bIncremental == MS_LEGACY_TRUE) && (Frequency==0)) MProp.MuMax = 1;
-
-                // second time through is to get the DC curve
-                MProp.GetSlopes(0);
-            }
-            else{
-                MProp.GetSlopes(Frequency*2.*PI);
-                MProp.MuMax=0; // this is the hint to the materials prop that this is _not_ incremental
-            }
-
-
+            prepareMaterial(MProp);
             blockproplist.push_back(MProp);
 
             // reinitialise the material property, and free allocated memory
@@ -1065,6 +1021,38 @@ bool FPProc::OpenDocument(string pathname)
     MProp.Hdata.clear();
     MProp.slope.clear();
 
+    foundSolution = flag;
+    return true;
+}
+
+bool FPProc::OpenDocument(string pathname)
+{
+
+    FILE *fp;
+    int i,j,k, sscnt;
+    char s[1024];
+    double zr,zi;
+    bool flag = false;
+    femmpostproc::CPostProcMElement      elm;
+    femmsolver::CMMeshNode     mnode;
+
+    // clear out all the document data and set defaults to standard values
+    NewDocument();
+
+    // attempt to open the file for reading
+    if ((fp = fopen(pathname.c_str(),"rt")) == NULL)
+    {
+        WarnMessage("Couldn't read from specified .ans file\n");
+        return false;
+    }
+
+    // parse the problem description
+    if (!parseProblemHeader(fp, flag))
+    {
+        fclose(fp);
+        return false;
+    }
+
     if (flag == false)
     {
         // The flag was never set to true during the while loop.
@@ -1349,6 +1337,19 @@ bool FPProc::OpenDocument(string pathname)
 
 	fclose(fp);
 
+    return processSolution();
+}
+
+bool FPProc::processSolution()
+{
+    int i,j,k;
+    double b,bi,br;
+
+	// the mesh is complete now; the integrals need the element areas over and over
+	elementArea.resize(meshelem.size());
+	for (i=0; i<(int)meshelem.size(); i++)
+		elementArea[i] = ElmArea(&meshelem[i]);
+
 	// figure out amplitudes of harmonics for AGE boundary conditions
 	for (i=0;i<(int)agelist.size();i++)
 	{
@@ -1993,6 +1994,251 @@ bool FPProc::OpenDocument(string pathname)
     return true;
 }
 
+bool FPProc::OpenDocument(const femm::FemmProblem &problem, const femm::MagneticsSolution &solution)
+{
+    // clear out all the document data and set defaults to standard values
+    NewDocument();
+
+    // both the problem description and the solution are taken over from memory
+    if (!loadProblem(problem))
+        return false;
+
+    if (solution.empty() || solution.blocks.size() > blocklist.size())
+    {
+        WarnMessage("No solution found.\n");
+        return false;
+    }
+
+    // mesh nodes;
+    meshnode.resize(solution.nodes.size());
+    for(int i=0; i<(int)solution.nodes.size(); i++)
+    {
+        meshnode[i].x = solution.nodes[i].x;
+        meshnode[i].y = solution.nodes[i].y;
+        meshnode[i].A = solution.nodes[i].A;
+        if (Frequency==0)
+            meshnode[i].A.im = 0;
+    }
+    if (bIncremental)
+        Aprev = solution.Aprev;
+
+    // elements;
+    meshelem.resize(solution.elements.size());
+    for(int i=0; i<(int)solution.elements.size(); i++)
+    {
+        femmpostproc::CPostProcMElement &elm = meshelem[i];
+        elm.p[0] = solution.elements[i].p[0];
+        elm.p[1] = solution.elements[i].p[1];
+        elm.p[2] = solution.elements[i].p[2];
+        elm.lbl = solution.elements[i].lbl;
+        if (bIncremental)
+            elm.Jprev = solution.elements[i].Jprev;
+        elm.blk = blocklist[elm.lbl].BlockType;
+    }
+
+    // circuit data;
+    for(int i=0; i<(int)solution.blocks.size(); i++)
+    {
+        blocklist[i].Case = solution.blocks[i].Case;
+        if (Frequency==0)
+        {
+            if (blocklist[i].Case==0) blocklist[i].dVolts = solution.blocks[i].value.re;
+            else blocklist[i].J = solution.blocks[i].value.re;
+        } else {
+            if (blocklist[i].Case==0) blocklist[i].dVolts = solution.blocks[i].value;
+            else blocklist[i].J = solution.blocks[i].value;
+        }
+    }
+
+    // air gap elements;
+    for (const auto &solutionAge : solution.agelist)
+    {
+        if (solutionAge.totalArcElements>0)
+        {
+            femmsolver::CAirGapElement age = solutionAge;
+            age.BdryName = std::regex_replace (age.BdryName, std::regex("\""), "");
+            age.BdryName = std::regex_replace (age.BdryName, std::regex("\n"), "");
+            age.ri*=LengthConv[LengthUnits];
+            age.ro*=LengthConv[LengthUnits];
+            agelist.push_back (age);
+        }
+    }
+
+    return processSolution();
+}
+
+bool FPProc::loadProblem(const femm::FemmProblem &problem)
+{
+    // this mirrors what parseProblemHeader() reads from the file
+    Frequency = problem.Frequency;
+    Depth = problem.Depth;
+    Precision = problem.Precision;
+    LengthUnits = problem.LengthUnits;
+    problemType = problem.problemType;
+    Coords = problem.Coords;
+    ProblemNote = problem.comment;
+    extZo = problem.extZo;
+    extRo = problem.extRo;
+    extRi = problem.extRi;
+    PrevType = problem.PrevType;
+    PrevSoln = problem.previousSolutionFile;
+    if (PrevSoln.empty())
+        bIncremental = MS_LEGACY_FALSE;
+    else
+        bIncremental = PrevType;
+
+    for (const auto &prop : problem.nodeproplist)
+    {
+        const CMPointProp *p = dynamic_cast<const CMPointProp*>(prop.get());
+        if (!p)
+        {
+            WarnMessage("Point property is not a magnetics property\n");
+            return false;
+        }
+        CMPointProp PProp;
+        PProp.PointName = p->PointName;
+        PProp.A = p->A;
+        PProp.J = p->J;
+        nodeproplist.push_back(PProp);
+    }
+
+    for (const auto &prop : problem.lineproplist)
+    {
+        const CMBoundaryProp *p = dynamic_cast<const CMBoundaryProp*>(prop.get());
+        if (!p)
+        {
+            WarnMessage("Boundary property is not a magnetics property\n");
+            return false;
+        }
+        lineproplist.push_back(*p);
+    }
+
+    for (const auto &prop : problem.blockproplist)
+    {
+        const CMMaterialProp *p = dynamic_cast<const CMMaterialProp*>(prop.get());
+        if (!p)
+        {
+            WarnMessage("Material property is not a magnetics property\n");
+            return false;
+        }
+        CMMaterialProp MProp(*p);
+        MProp.Nrg = 0;
+        if (Frequency==0)
+            MProp.J.im = 0;
+        // the curve is prepared for the frequency of this problem:
+        MProp.clearSlopes();
+        prepareMaterial(MProp);
+        blockproplist.push_back(MProp);
+    }
+
+    for (const auto &prop : problem.circproplist)
+    {
+        const CMCircuit *p = dynamic_cast<const CMCircuit*>(prop.get());
+        if (!p)
+        {
+            WarnMessage("Circuit property is not a magnetics property\n");
+            return false;
+        }
+        CMCircuit CProp;
+        CProp.CircName = p->CircName;
+        CProp.CircType = p->CircType;
+        CProp.Amps = p->Amps;
+        if (Frequency==0)
+            CProp.Amps.im = 0;
+        circproplist.push_back(CProp);
+    }
+
+    for (const auto &n : problem.nodelist)
+    {
+        CNode node;
+        node.x = n->x;
+        node.y = n->y;
+        node.BoundaryMarker = n->BoundaryMarker;
+        nodelist.push_back(node);
+    }
+
+    for (const auto &line : problem.linelist)
+    {
+        CSegment segm;
+        segm.n0 = line->n0;
+        segm.n1 = line->n1;
+        segm.MaxSideLength = line->MaxSideLength;
+        segm.BoundaryMarker = line->BoundaryMarker;
+        segm.Hidden = line->Hidden;
+        linelist.push_back(segm);
+    }
+
+    for (const auto &arc : problem.arclist)
+    {
+        CArcSegment asegm;
+        asegm.n0 = arc->n0;
+        asegm.n1 = arc->n1;
+        asegm.ArcLength = arc->ArcLength;
+        asegm.MaxSideLength = arc->MaxSideLength;
+        asegm.BoundaryMarker = arc->BoundaryMarker;
+        asegm.Hidden = arc->Hidden;
+        arclist.push_back(asegm);
+    }
+
+    for (const auto &label : problem.labellist)
+    {
+        const CMBlockLabel *l = dynamic_cast<const CMBlockLabel*>(label.get());
+        if (!l)
+        {
+            WarnMessage("Block label is not a magnetics block label\n");
+            return false;
+        }
+        CMBlockLabel blk;
+        blk.x = l->x;
+        blk.y = l->y;
+        blk.BlockType = l->BlockType;
+        blk.MaxArea = l->MaxArea;
+        blk.InCircuit = l->InCircuit;
+        blk.MagDir = l->MagDir;
+        blk.MagDirFctn = l->MagDirFctn;
+        blk.InGroup = l->InGroup;
+        blk.Turns = l->Turns;
+        blk.IsExternal = l->IsExternal;
+        blocklist.push_back(blk);
+    }
+
+    return true;
+}
+
+void FPProc::prepareMaterial(CMMaterialProp &prop)
+{
+    if (bIncremental != 0){
+        // first time through was just to get MuMax from AC curve...
+        CComplex *tmpHdata=(CComplex *)calloc(prop.BHpoints,sizeof(CComplex));
+        double *tmpBdata=(double *)calloc(prop.BHpoints,sizeof(double));
+        for(int i=0;i<prop.BHpoints;i++)
+        {
+            tmpHdata[i]=prop.Hdata[i];
+            tmpBdata[i]=prop.Bdata[i];
+        }
+        prop.GetSlopes(Frequency*2.*PI);
+        for(int i=0;i<prop.BHpoints;i++)
+        {
+            prop.Hdata[i]=tmpHdata[i];
+            prop.Bdata[i]=tmpBdata[i];
+        }
+        free(tmpHdata);
+        free(tmpBdata);
+        prop.slope.clear ();
+        prop.slope.shrink_to_fit();
+
+        // set a flag for DC incremental permeability problems
+        if ((bIncremental == MS_LEGACY_TRUE) && (Frequency==0)) prop.MuMax = 1;
+
+        // second time through is to get the DC curve
+        prop.GetSlopes(0);
+    }
+    else{
+        prop.GetSlopes(Frequency*2.*PI);
+        prop.MuMax=0; // this is the hint to the materials prop that this is _not_ incremental
+    }
+}
+
 //bool FPProc::LoadPBCFromSolution(FILE* fp)
 //{
 //    char s[1024];
@@ -3357,6 +3603,8 @@ double FPProc::ElmArea(int i) const
     int j,n[3];
     double b0,b1,c0,c1;
 
+    if (i < (int)elementArea.size()) return elementArea[i];
+
     for(j=0; j<3; j++) n[j]=meshelem[i].p[j];
 
     b0=meshnode[n[1]].y - meshnode[n[2]].y;
@@ -3508,7 +3756,7 @@ CComplex FPProc::PlnInt(double a, CComplex *u, CComplex *v) const
 CComplex FPProc::AxiInt(double a, CComplex *u, CComplex *v,double *r) const
 {
     int i;
-    static CComplex M[3][3];
+    CComplex M[3][3];
     CComplex x, z[3];
 
     M[0][0]=6.*r[0]+2.*r[1]+2.*r[2];
@@ -3556,454 +3804,544 @@ CComplex FPProc::HenrotteVector(int k) const
 
 CComplex FPProc::BlockIntegral(const int inttype) const
 {
-    int i,k;
-    CComplex c,y,z,J,mu1,mu2,B1,B2,H1,H2,F1,F2;
-    CComplex A[3],Jn[3],U[3],V[3];
-    double a,sig,R = 0;
-    double r[3] = {0, 0, 0};
+    return BlockIntegrals(std::vector<int>(1, inttype))[0];
+}
 
-    z=0;
-    y.re = 0.; y.im = 0.;
-    for(i=0; i<3; i++) U[i]=1.;
+std::vector<CComplex> FPProc::BlockIntegrals(const std::vector<int> &inttypes, const int circnum, CComplex *fluxLinkage) const
+{
+    int k;
 
-    if(inttype==6)
+    // total losses and centroid are derived from other integrals;
+    // collect the distinct integrals that have to be summed over the mesh
+    std::vector<int> types;
+    auto require = [&types](int t) {
+        if (std::find(types.begin(), types.end(), t) == types.end())
+            types.push_back(t);
+    };
+    for (int t: inttypes)
     {
-        z = BlockIntegral(3) + BlockIntegral(4); //total losses
+        if (t==6)
+        {
+            require(3);
+            require(4);
+        }
+        else
+        {
+            require(t);
+            if (t==25) require(5);
+        }
+    }
+
+    // the flux linkage is the integral of A.J over the circuit, unless the circuit carries no current
+    const bool needLinkage = (circnum>=0) && (fluxLinkage!=NULL)
+            && ((circproplist[circnum].Amps.re!=0) || (circproplist[circnum].Amps.im!=0));
+
+    // The elements are summed in blocks of a fixed size, and the sums of the blocks
+    // are added in order, so the results don't depend on the number of threads.
+    const int blockSize = 4096;
+    const int numBlocks = ((int)meshelem.size()+blockSize-1)/blockSize;
+    const int numSums = (int)types.size()+1;
+    std::vector<CComplex> blockSums(numBlocks*numSums, CComplex(0,0));
+    const int linkageCircuit = needLinkage ? circnum : -1;
+    if ((NumThreads>1) && (numBlocks>1))
+    {
+        femm::ThreadTeam team(std::min(NumThreads,numBlocks));
+        team.run([&](int thread)
+        {
+            int first,last;
+            femm::ThreadTeam::split(thread,team.size(),0,numBlocks,first,last);
+            for(int b=first; b<last; b++)
+                sumBlockIntegrals(types,linkageCircuit,b*blockSize,std::min((b+1)*blockSize,(int)meshelem.size()),&blockSums[b*numSums]);
+        });
     }
     else
     {
-        for(i=0; i<(int)meshelem.size(); i++)
-        {
-            if(blocklist[meshelem[i].lbl].IsSelected==true)
-            {
-
-                // compute some useful quantities employed by most integrals...
-                J=GetJA(i,Jn,A);
-                a=ElmArea(i)*std::pow(LengthConv[LengthUnits],2.);
-                if(problemType==AXISYMMETRIC)
-                {
-                    for(k=0; k<3; k++)
-                        r[k]=meshnode[meshelem[i].p[k]].x*LengthConv[LengthUnits];
-                    R=(r[0]+r[1]+r[2])/3.;
-                }
-
-                // now, compute the desired integral;
-                switch(inttype)
-                {
-                case 0: //  A.J
-                    for(k=0; k<3; k++) V[k]=Jn[k].Conj();
-                    if(problemType==PLANAR)
-                        y=PlnInt(a,A,V)*Depth;
-                    else
-                        y=AxiInt(a,A,V,r);
-                    z+=y;
-
-                    break;
+        for(int b=0; b<numBlocks; b++)
+            sumBlockIntegrals(types,linkageCircuit,b*blockSize,std::min((b+1)*blockSize,(int)meshelem.size()),&blockSums[b*numSums]);
+    }
 
-                case 11: // x (or r) direction Lorentz force, SS part.
-                    B2=meshelem[i].B2;
-                    y= -(B2.re*J.re + B2.im*J.im);
-                    if (problemType==AXISYMMETRIC) y=0;
-                    else y*=Depth;
-                    if(Frequency!=0) y*=0.5;
-                    z+=(a*y);
-                    break;
+    std::vector<CComplex> z(types.size(), CComplex(0,0));
+    CComplex linkage = 0;
+    for(int b=0; b<numBlocks; b++)
+    {
+        for(k=0; k<(int)types.size(); k++)
+            z[k]+=blockSums[b*numSums+k];
+        linkage+=blockSums[b*numSums+numSums-1];
+    }
+    if (needLinkage)
+        *fluxLinkage = linkage/conj(circproplist[circnum].Amps);
+    else if ((circnum>=0) && (fluxLinkage!=NULL))
+        *fluxLinkage = GetFluxLinkage(circnum);
+
+    auto sum = [&types,&z](int t) {
+        return z[std::find(types.begin(), types.end(), t) - types.begin()];
+    };
+    std::vector<CComplex> result;
+    for (int t: inttypes)
+    {
+        if (t==6)
+        {
+            result.push_back(sum(3) + sum(4)); //total losses
+        }
+        else if (t==25) // 2D shape centroid
+        {
+            // divide sum of Cx*A and Cy*A by sum of A
+            CComplex y = sum(25);
+            CComplex temp = sum(5);
+            CComplex c;
+            c.re = y.Re() / temp.Re();
+            c.im = y.Im() / temp.Re();
+            result.push_back(c);
+        }
+        else result.push_back(sum(t));
+    }
 
-                case 12: // y (or z) direction Lorentz force, SS part.
-                    for(k=0; k<3; k++) V[k]=Re(meshelem[i].B1*Jn[k].Conj());
-                    if(problemType==PLANAR)
-                        y=PlnInt(a,U,V)*Depth;
-                    else
-                        y=AxiInt(-a,U,V,r);
-                    if(Frequency!=0) y*=0.5;
-                    z+=y;
+    return result;
+}
 
-                    break;
+void FPProc::sumBlockIntegrals(const std::vector<int> &types, const int circnum, const int first, const int last, CComplex *sums) const
+{
+    int i,k;
 
-                case 13: // x (or r) direction Lorentz force, 2x part.
-                    if((Frequency!=0) && (problemType==PLANAR))
-                    {
-                        B2=meshelem[i].B2;
-                        y= -(B2.re*J.re - B2.im*J.im) - I*(B2.re*J.im+B2.im*J.re);
-                        z+=0.5*(a*y*Depth);
-                    }
-                    break;
+    // integrals that need to be evaluated over all elements,
+    // regardless of which elements are actually selected.
+    bool needAllElements = false;
+    for (int t: types)
+        if ((t>=18) && (t<=23)) needAllElements = true;
+
+    const int numTypes = (int)types.size();
+    for(k=0; k<=numTypes; k++) sums[k]=0;
+    BlockIntegralElement e;
+    double a;
+    for(i=first; i<last; i++)
+    {
+        const bool isSelected = blocklist[meshelem[i].lbl].IsSelected;
+        const bool inCircuit = (circnum>=0) && (blocklist[meshelem[i].lbl].InCircuit==circnum);
+        if(isSelected || inCircuit)
+        {
+            // compute some useful quantities employed by most integrals...
+            e.J=GetJA(i,e.Jn,e.A);
+            if(inCircuit)
+                sums[numTypes]+=circuitElementLinkage(i,e.Jn,e.A);
+        }
 
-                case 14: // y (or z) direction Lorentz force, 2x part.
-                    if (Frequency!=0)
-                    {
-                        B1=meshelem[i].B1;
-                        B2=meshelem[i].B2;
-                        y= (B1.re*J.re - B1.im*J.im) + I*(B1.re*J.im+B1.im*J.re);
-                        if(problemType==AXISYMMETRIC) y=(-y*2.*PI*R);
-                        else y*=Depth;
-                        z+=(a*y)/2.;
-                    }
-                    break;
+        if(isSelected)
+        {
+            e.a=ElmArea(i)*std::pow(LengthConv[LengthUnits],2.);
+            if(problemType==AXISYMMETRIC)
+            {
+                for(k=0; k<3; k++)
+                    e.r[k]=meshnode[meshelem[i].p[k]].x*LengthConv[LengthUnits];
+                e.R=(e.r[0]+e.r[1]+e.r[2])/3.;
+            }
 
-                case 16: // Lorentz Torque, 2x
-                    if ((Frequency!=0) && (problemType==PLANAR))
-                    {
-                        B1=meshelem[i].B1;
-                        B2=meshelem[i].B2;
-                        c=Ctr(i)*LengthConv[LengthUnits];
-                        y= c.re*((B1.re*J.re - B1.im*J.im) + I*(B1.re*J.im+B1.im*J.re))
-                           +c.im*((B2.re*J.re - B2.im*J.im) + I*(B2.re*J.im+B2.im*J.re));
-                        z+=0.5*(a*y*Depth);
-                    }
-                    break;
+            for(k=0; k<numTypes; k++)
+                if ((types[k]<18) || (types[k]>23))
+                    sums[k]+=selectedElementIntegral(types[k],i,e);
+        }
 
-                case 15: // Lorentz Torque, SS part.
-                    if(problemType==PLANAR)
-                    {
-                        B1=meshelem[i].B1;
-                        B2=meshelem[i].B2;
-                        c=Ctr(i)*LengthConv[LengthUnits];
-                        y= c.im*(B2.re*J.re + B2.im*J.im) + c.re*(B1.re*J.re + B1.im*J.im);
-                        if(Frequency!=0) y*=0.5;
-                        z+=(a*y*Depth);
-                    }
-                    break;
+        // the weighted stress tensor vanishes where the mask is zero at all nodes
+        if(needAllElements && (meshnode[meshelem[i].p[0]].msk!=0
+                || meshnode[meshelem[i].p[1]].msk!=0 || meshnode[meshelem[i].p[2]].msk!=0))
+        {
+            a=ElmArea(i)*std::pow(LengthConv[LengthUnits],2.);
+            if(problemType==AXISYMMETRIC)
+            {
+                double r[3],R;
+                for(k=0; k<3; k++)
+                    r[k]=meshnode[meshelem[i].p[k]].x*LengthConv[LengthUnits];
+                R=(r[0]+r[1]+r[2])/3.;
+                a*=(2.*PI*R);
+            }
+            else a*=Depth;
 
-                case 1: // integrate A over the element;
-                    if(problemType==AXISYMMETRIC)
-                        y=AxiInt(a,U,A,r);
-                    else
-                        for(k=0,y=0; k<3; k++) y+=a*Depth*A[k]/3.;
+            const CComplex c=HenrotteVector(i);
+            const double aecf=AECF(i);
+            for(k=0; k<numTypes; k++)
+                if ((types[k]>=18) && (types[k]<=23))
+                    sums[k]+=weightedStressTensorIntegral(types[k],i,a,c,aecf);
+        }
+    }
+}
 
-                    z+=y;
-                    break;
+CComplex FPProc::selectedElementIntegral(const int inttype, const int i, const BlockIntegralElement &e) const
+{
+    int k;
+    CComplex c,y,mu1,mu2,B1,B2,H1,H2;
+    CComplex U[3],V[3];
+    CComplex J = e.J;
+    CComplex Jn[3] = {e.Jn[0], e.Jn[1], e.Jn[2]};
+    CComplex A[3] = {e.A[0], e.A[1], e.A[2]};
+    double r[3] = {e.r[0], e.r[1], e.r[2]};
+    double a = e.a;
+    double R = e.R;
+    double sig;
+
+    y=0;
+    for(k=0; k<3; k++) U[k]=1.;
+
+    switch(inttype)
+    {
+    case 0: //  A.J
+        for(k=0; k<3; k++) V[k]=Jn[k].Conj();
+        if(problemType==PLANAR)
+            y=PlnInt(a,A,V)*Depth;
+        else
+            y=AxiInt(a,A,V,r);
+        return y;
+
+    case 11: // x (or r) direction Lorentz force, SS part.
+        B2=meshelem[i].B2;
+        y= -(B2.re*J.re + B2.im*J.im);
+        if (problemType==AXISYMMETRIC) y=0;
+        else y*=Depth;
+        if(Frequency!=0) y*=0.5;
+        return (a*y);
+
+    case 12: // y (or z) direction Lorentz force, SS part.
+        for(k=0; k<3; k++) V[k]=Re(meshelem[i].B1*Jn[k].Conj());
+        if(problemType==PLANAR)
+            y=PlnInt(a,U,V)*Depth;
+        else
+            y=AxiInt(-a,U,V,r);
+        if(Frequency!=0) y*=0.5;
+        return y;
 
-                case 2: // stored energy
-                    if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
-                    else a*=Depth;
-                    B1=meshelem[i].B1;
-                    B2=meshelem[i].B2;
-                    if(Frequency!=0)
-                    {
-                        // have to compute the energy stored in a special way for
-                        // wound regions subject to prox and skin effects
-                        if (blockproplist[meshelem[i].blk].LamType>2)
-                        {
-                            CComplex mu;
-                            mu=muo*blocklist[meshelem[i].lbl].mu;
-                            double u=Im(1./blocklist[meshelem[i].lbl].o)/(2.e6*PI*Frequency);
-                            y=a*Re(B1*conj(B1)+B2*conj(B2))*Re(1./mu)/4.;
-                            y+=a*Re(J*conj(J))*u/4.;
-                        }
-                        else y=a*blockproplist[meshelem[i].blk].DoEnergy(B1,B2);
-                    }
-                    else
-                    {
-                        // correct H and energy stored in magnet for second-quadrant
-                        // representation of a PM.
-                        if (blockproplist[meshelem[i].blk].H_c!=0)
-                        {
-                            int bk=meshelem[i].blk;
+    case 13: // x (or r) direction Lorentz force, 2x part.
+        if((Frequency!=0) && (problemType==PLANAR))
+        {
+            B2=meshelem[i].B2;
+            y= -(B2.re*J.re - B2.im*J.im) - I*(B2.re*J.im+B2.im*J.re);
+            return 0.5*(a*y*Depth);
+        }
+        break;
 
-                            // in the linear case:
-                            if (blockproplist[bk].BHpoints==0)
-                            {
-                                CComplex Hc;
-                                mu1=blockproplist[bk].mu_x;
-                                mu2=blockproplist[bk].mu_y;
-                                H1=B1/(mu1*muo);
-                                H2=B2/(mu2*muo);
-                                Hc = blockproplist[bk].H_c*exp(I*PI*meshelem[i].magdir/180.);
-                                H1=H1-Re(Hc);
-                                H2=H2-Im(Hc);
-                                y = a*0.5*muo*(mu1.re*H1.re*H1.re + mu2.re*H2.re*H2.re);
-                            }
-                            else  // the material is nonlinear
-                            {
-                                y=blockproplist[bk].DoEnergy(B1.re,B2.re);
-                                y = y + blockproplist[bk].Nrg
-                                    - blockproplist[bk].H_c*Re((B1.re+I*B2.re)/exp(I*PI*meshelem[i].magdir/180.));
-                                y*=a;
-                            }
-                        }
-                        else y=a*blockproplist[meshelem[i].blk].DoEnergy(B1.re,B2.re);
+    case 14: // y (or z) direction Lorentz force, 2x part.
+        if (Frequency!=0)
+        {
+            B1=meshelem[i].B1;
+            B2=meshelem[i].B2;
+            y= (B1.re*J.re - B1.im*J.im) + I*(B1.re*J.im+B1.im*J.re);
+            if(problemType==AXISYMMETRIC) y=(-y*2.*PI*R);
+            else y*=Depth;
+            return (a*y)/2.;
+        }
+        break;
 
-                        // add in "local" stored energy for wound that would be subject to
-                        // prox and skin effect for nonzero frequency cases.
-                        if (blockproplist[meshelem[i].blk].LamType>2)
-                        {
-                            double u=Im(blocklist[meshelem[i].lbl].o);
-                            y+=a*Re(J*J)*u/2.;
-                        }
-                    }
-                    y*=AECF(i); // correction for axisymmetric external region;
+    case 16: // Lorentz Torque, 2x
+        if ((Frequency!=0) && (problemType==PLANAR))
+        {
+            B1=meshelem[i].B1;
+            B2=meshelem[i].B2;
+            c=Ctr(i)*LengthConv[LengthUnits];
+            y= c.re*((B1.re*J.re - B1.im*J.im) + I*(B1.re*J.im+B1.im*J.re))
+               +c.im*((B2.re*J.re - B2.im*J.im) + I*(B2.re*J.im+B2.im*J.re));
+            return 0.5*(a*y*Depth);
+        }
+        break;
 
-                    z+=y;
-                    break;
+    case 15: // Lorentz Torque, SS part.
+        if(problemType==PLANAR)
+        {
+            B1=meshelem[i].B1;
+            B2=meshelem[i].B2;
+            c=Ctr(i)*LengthConv[LengthUnits];
+            y= c.im*(B2.re*J.re + B2.im*J.im) + c.re*(B1.re*J.re + B1.im*J.im);
+            if(Frequency!=0) y*=0.5;
+            return (a*y*Depth);
+        }
+        break;
 
-                case 3:  // Hysteresis & Laminated eddy current losses
-                    if(Frequency!=0)
-                    {
-                        if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
-                        else a*=Depth;
-                        B1=meshelem[i].B1;
-                        B2=meshelem[i].B2;
-                        GetMu(B1,B2,mu1,mu2,i);
-                        H1=B1/(mu1*muo);
-                        H2=B2/(mu2*muo);
-
-                        y=a*PI*Frequency*Im(H1*B1.Conj() + H2*B2.Conj());
-                        z+=y;
-                    }
-                    break;
+    case 1: // integrate A over the element;
+        if(problemType==AXISYMMETRIC)
+            y=AxiInt(a,U,A,r);
+        else
+            for(k=0,y=0; k<3; k++) y+=a*Depth*A[k]/3.;
 
-                case 4: // Resistive Losses
-                    sig=1.e06/Re(1./blocklist[meshelem[i].lbl].o);
-                    if((blockproplist[meshelem[i].blk].Lam_d!=0) &&
-                            (blockproplist[meshelem[i].blk].LamType==0)) sig=0;
-                    if(sig!=0)
-                    {
+        return y;
 
-                        if (problemType==PLANAR)
-                        {
-                            for(k=0; k<3; k++) V[k]=Jn[k].Conj()/sig;
-                            y=PlnInt(a,Jn,V)*Depth;
-                        }
+    case 2: // stored energy
+        if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
+        else a*=Depth;
+        B1=meshelem[i].B1;
+        B2=meshelem[i].B2;
+        if(Frequency!=0)
+        {
+            // have to compute the energy stored in a special way for
+            // wound regions subject to prox and skin effects
+            if (blockproplist[meshelem[i].blk].LamType>2)
+            {
+                CComplex mu;
+                mu=muo*blocklist[meshelem[i].lbl].mu;
+                double u=Im(1./blocklist[meshelem[i].lbl].o)/(2.e6*PI*Frequency);
+                y=a*Re(B1*conj(B1)+B2*conj(B2))*Re(1./mu)/4.;
+                y+=a*Re(J*conj(J))*u/4.;
+            }
+            else y=a*blockproplist[meshelem[i].blk].DoEnergy(B1,B2);
+        }
+        else
+        {
+            // correct H and energy stored in magnet for second-quadrant
+            // representation of a PM.
+            if (blockproplist[meshelem[i].blk].H_c!=0)
+            {
+                int bk=meshelem[i].blk;
 
-                        if(problemType==AXISYMMETRIC)
-                            y=2.*PI*R*a*J*conj(J)/sig;
+                // in the linear case:
+                if (blockproplist[bk].BHpoints==0)
+                {
+                    CComplex Hc;
+                    mu1=blockproplist[bk].mu_x;
+                    mu2=blockproplist[bk].mu_y;
+                    H1=B1/(mu1*muo);
+                    H2=B2/(mu2*muo);
+                    Hc = blockproplist[bk].H_c*exp(I*PI*meshelem[i].magdir/180.);
+                    H1=H1-Re(Hc);
+                    H2=H2-Im(Hc);
+                    y = a*0.5*muo*(mu1.re*H1.re*H1.re + mu2.re*H2.re*H2.re);
+                }
+                else  // the material is nonlinear
+                {
+                    y=blockproplist[bk].DoEnergy(B1.re,B2.re);
+                    y = y + blockproplist[bk].Nrg
+                        - blockproplist[bk].H_c*Re((B1.re+I*B2.re)/exp(I*PI*meshelem[i].magdir/180.));
+                    y*=a;
+                }
+            }
+            else y=a*blockproplist[meshelem[i].blk].DoEnergy(B1.re,B2.re);
 
-                        if(Frequency!=0) y/=2.;
-                        z+=y;
-                    }
-                    break;
+            // add in "local" stored energy for wound that would be subject to
+            // prox and skin effect for nonzero frequency cases.
+            if (blockproplist[meshelem[i].blk].LamType>2)
+            {
+                double u=Im(blocklist[meshelem[i].lbl].o);
+                y+=a*Re(J*J)*u/2.;
+            }
+        }
+        y*=AECF(i); // correction for axisymmetric external region;
 
-                case 5: // cross-section area
-                    z+=a;
-                    break;
+        return y;
 
-                case 10: // volume
-                    if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
-                    else a*=Depth;
-                    z+=a;
-                    break;
+    case 3:  // Hysteresis & Laminated eddy current losses
+        if(Frequency!=0)
+        {
+            if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
+            else a*=Depth;
+            B1=meshelem[i].B1;
+            B2=meshelem[i].B2;
+            GetMu(B1,B2,mu1,mu2,i);
+            H1=B1/(mu1*muo);
+            H2=B2/(mu2*muo);
 
-                case 7: // total current in block;
-                    z+=a*J;
+            y=a*PI*Frequency*Im(H1*B1.Conj() + H2*B2.Conj());
+            return y;
+        }
+        break;
 
-                    break;
+    case 4: // Resistive Losses
+        sig=1.e06/Re(1./blocklist[meshelem[i].lbl].o);
+        if((blockproplist[meshelem[i].blk].Lam_d!=0) &&
+                (blockproplist[meshelem[i].blk].LamType==0)) sig=0;
+        if(sig!=0)
+        {
 
-                case 8: // integrate x or r part of b over the block
-                    if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
-                    else a*=Depth;
-                    z+=(a*meshelem[i].B1);
-                    break;
+            if (problemType==PLANAR)
+            {
+                for(k=0; k<3; k++) V[k]=Jn[k].Conj()/sig;
+                y=PlnInt(a,Jn,V)*Depth;
+            }
 
-                case 9: // integrate y or z part of b over the block
-                    if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
-                    else a*=Depth;
-                    z+=(a*meshelem[i].B2);
-                    break;
+            if(problemType==AXISYMMETRIC)
+                y=2.*PI*R*a*J*conj(J)/sig;
 
-                case 17: // Coenergy
-                    if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
-                    else a*=Depth;
-                    B1=meshelem[i].B1;
-                    B2=meshelem[i].B2;
-                    if(Frequency!=0)
-                    {
-                        // have to compute the energy stored in a special way for
-                        // wound regions subject to prox and skin effects
-                        if (blockproplist[meshelem[i].blk].LamType>2)
-                        {
-                            CComplex mu;
-                            mu=muo*blocklist[meshelem[i].lbl].mu;
-                            double u=Im(1./blocklist[meshelem[i].lbl].o)/(2.e6*PI*Frequency);
-                            y=a*Re(B1*conj(B1)+B2*conj(B2))*Re(1./mu)/4.;
-                            y+=a*Re(J*conj(J))*u/4.;
-                        }
-                        else y=a*blockproplist[meshelem[i].blk].DoCoEnergy(B1,B2);
-                    }
-                    else
-                    {
-                        y=a*blockproplist[meshelem[i].blk].DoCoEnergy(B1.re,B2.re);
+            if(Frequency!=0) y/=2.;
+            return y;
+        }
+        break;
 
-                        // add in "local" stored energy for wound that would be subject to
-                        // prox and skin effect for nonzero frequency cases.
-                        if (blockproplist[meshelem[i].blk].LamType>2)
-                        {
-                            double u=Im(blocklist[meshelem[i].lbl].o);
-                            y+=a*Re(J*J)*u/2.;
-                        }
-                    }
-                    y*=AECF(i); // correction for axisymmetric external region;
+    case 5: // cross-section area
+        return a;
 
-                    z+=y;
-                    break;
+    case 10: // volume
+        if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
+        else a*=Depth;
+        return a;
 
-                case 24: // Moment of Inertia-like integral
+    case 7: // total current in block;
+        return a*J;
 
-                    // For axisymmetric problems, compute the moment
-                    // of inertia about the r=0 axis.
-                    if(problemType==AXISYMMETRIC)
-                    {
-                        for(k=0; k<3; k++) V[k]=r[k];
-                        y=AxiInt(a,V,V,r);
-                    }
+    case 8: // integrate x or r part of b over the block
+        if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
+        else a*=Depth;
+        return (a*meshelem[i].B1);
 
-                    // For planar problems, compute the moment of
-                    // inertia about the z=axis.
-                    else
-                    {
-                        for(k=0; k<3; k++)
-                        {
-                            U[k]=meshnode[meshelem[i].p[k]].x*LengthConv[LengthUnits];
-                            V[k]=meshnode[meshelem[i].p[k]].y*LengthConv[LengthUnits];
-                        }
-                        y =U[0]*U[0] + U[1]*U[1] + U[2]*U[2];
-                        y+=U[0]*U[1] + U[0]*U[2] + U[1]*U[2];
-                        y+=V[0]*V[0] + V[1]*V[1] + V[2]*V[2];
-                        y+=V[0]*V[1] + V[0]*V[2] + V[1]*V[2];
-                        y*=(a*Depth/6.);
-                    }
+    case 9: // integrate y or z part of b over the block
+        if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
+        else a*=Depth;
+        return (a*meshelem[i].B2);
 
-                    z+=y;
-                    break;
+    case 17: // Coenergy
+        if(problemType==AXISYMMETRIC) a*=(2.*PI*R);
+        else a*=Depth;
+        B1=meshelem[i].B1;
+        B2=meshelem[i].B2;
+        if(Frequency!=0)
+        {
+            // have to compute the energy stored in a special way for
+            // wound regions subject to prox and skin effects
+            if (blockproplist[meshelem[i].blk].LamType>2)
+            {
+                CComplex mu;
+                mu=muo*blocklist[meshelem[i].lbl].mu;
+                double u=Im(1./blocklist[meshelem[i].lbl].o)/(2.e6*PI*Frequency);
+                y=a*Re(B1*conj(B1)+B2*conj(B2))*Re(1./mu)/4.;
+                y+=a*Re(J*conj(J))*u/4.;
+            }
+            else y=a*blockproplist[meshelem[i].blk].DoCoEnergy(B1,B2);
+        }
+        else
+        {
+            y=a*blockproplist[meshelem[i].blk].DoCoEnergy(B1.re,B2.re);
 
-                case 25: // 2D Shape centroid
+            // add in "local" stored energy for wound that would be subject to
+            // prox and skin effect for nonzero frequency cases.
+            if (blockproplist[meshelem[i].blk].LamType>2)
+            {
+                double u=Im(blocklist[meshelem[i].lbl].o);
+                y+=a*Re(J*J)*u/2.;
+            }
+        }
+        y*=AECF(i); // correction for axisymmetric external region;
 
-                    y.re += meshelem[i].ctr.re * a;
-                    y.im += meshelem[i].ctr.im * a;
+        return y;
 
-                    break;
+    case 24: // Moment of Inertia-like integral
 
-                default:
-                    break;
-                }
-            }
+        // For axisymmetric problems, compute the moment
+        // of inertia about the r=0 axis.
+        if(problemType==AXISYMMETRIC)
+        {
+            for(k=0; k<3; k++) V[k]=r[k];
+            y=AxiInt(a,V,V,r);
+        }
 
-CComplex temp;
-            // integrals that need to be evaluated over all elements,
-            // regardless of which elements are actually selected.
-            if((inttype>=18) || (inttype<=23))
+        // For planar problems, compute the moment of
+        // inertia about the z=axis.
+        else
+        {
+            for(k=0; k<3; k++)
             {
-                a=ElmArea(i)*std::pow(LengthConv[LengthUnits],2.);
-                if(problemType==AXISYMMETRIC)
-                {
-                    for(k=0; k<3; k++)
-                        r[k]=meshnode[meshelem[i].p[k]].x*LengthConv[LengthUnits];
-                    R=(r[0]+r[1]+r[2])/3.;
-                    a*=(2.*PI*R);
-                }
-                else a*=Depth;
-
-                switch(inttype)
-                {
-
-                case 18: // x (or r) direction Henrotte force, SS part.
-                    if(problemType!=0) break;
+                U[k]=meshnode[meshelem[i].p[k]].x*LengthConv[LengthUnits];
+                V[k]=meshnode[meshelem[i].p[k]].y*LengthConv[LengthUnits];
+            }
+            y =U[0]*U[0] + U[1]*U[1] + U[2]*U[2];
+            y+=U[0]*U[1] + U[0]*U[2] + U[1]*U[2];
+            y+=V[0]*V[0] + V[1]*V[1] + V[2]*V[2];
+            y+=V[0]*V[1] + V[0]*V[2] + V[1]*V[2];
+            y*=(a*Depth/6.);
+        }
 
-                    B1 = meshelem[i].B1;
+        return y;
 
-                    B2 = meshelem[i].B2;
+    case 25: // 2D Shape centroid
 
-                    c = HenrotteVector(i);
+        y.re = meshelem[i].ctr.re * a;
+        y.im = meshelem[i].ctr.im * a;
 
-                    y = (((B1*conj(B1)) - (B2*conj(B2)))*Re(c) + 2.*Re(B1*conj(B2))*Im(c))/(2.*muo);
+        return y;
 
-                    if(Frequency!=0)
-                    {
-                        y/=2.;
-                    }
+    default:
+        break;
+    }
 
-                    y*=AECF(i); // correction for axisymmetric external region;
+    return 0;
+}
 
-                    z+=(a*y);
-                    break;
+CComplex FPProc::weightedStressTensorIntegral(const int inttype, const int i, const double a, CComplex c, const double aecf) const
+{
+    int k;
+    CComplex y,B1,B2,F1,F2;
 
-                case 19: // y (or z) direction Henrotte force, SS part.
+    switch(inttype)
+    {
 
-                    B1=meshelem[i].B1;
-                    B2=meshelem[i].B2;
-                    c=HenrotteVector(i);
+    case 18: // x (or r) direction Henrotte force, SS part.
+        if(problemType!=0) break;
 
-                    y=(((B2*conj(B2)) - (B1*conj(B1)))*Im(c) + 2.*Re(B1*conj(B2))*Re(c))/(2.*muo);
+        B1 = meshelem[i].B1;
 
-                    y*=AECF(i); // correction for axisymmetric external region;
+        B2 = meshelem[i].B2;
 
-                    if(Frequency!=0) y/=2.;
-                    z+=(a*y);
+        y = (((B1*conj(B1)) - (B2*conj(B2)))*Re(c) + 2.*Re(B1*conj(B2))*Im(c))/(2.*muo);
 
-                    break;
+        if(Frequency!=0)
+        {
+            y/=2.;
+        }
 
-                case 20: // x (or r) direction Henrotte force, 2x part.
+        y*=aecf; // correction for axisymmetric external region;
 
-                    if(problemType!=0) break;
-                    B1=meshelem[i].B1;
-                    B2=meshelem[i].B2;
-                    c=HenrotteVector(i);
-                    z+=a*((((B1*B1) - (B2*B2))*Re(c) + 2.*B1*B2*Im(c))/(4.*muo)) * AECF(i);
+        return (a*y);
 
-                    break;
+    case 19: // y (or z) direction Henrotte force, SS part.
 
-                case 21: // y (or z) direction Henrotte force, 2x part.
+        B1=meshelem[i].B1;
+        B2=meshelem[i].B2;
+        y=(((B2*conj(B2)) - (B1*conj(B1)))*Im(c) + 2.*Re(B1*conj(B2))*Re(c))/(2.*muo);
 
-                    B1=meshelem[i].B1;
-                    B2=meshelem[i].B2;
-                    c=HenrotteVector(i);
-                    z+= a*((((B2*B2) - (B1*B1))*Im(c) + 2.*B1*B2*Re(c))/(4.*muo)) * AECF(i);
+        y*=aecf; // correction for axisymmetric external region;
 
-                    break;
+        if(Frequency!=0) y/=2.;
+        return (a*y);
 
-                case 22: // Henrotte torque, SS part.
-                    if(problemType!=PLANAR) break;
-                    B1=meshelem[i].B1;
-                    B2=meshelem[i].B2;
-                    c=HenrotteVector(i);
+    case 20: // x (or r) direction Henrotte force, 2x part.
 
-                    F1 = (((B1*conj(B1)) - (B2*conj(B2)))*Re(c) +
-                          2.*Re(B1*conj(B2))*Im(c))/(2.*muo);
-                    F2 = (((B2*conj(B2)) - (B1*conj(B1)))*Im(c) +
-                          2.*Re(B1*conj(B2))*Re(c))/(2.*muo);
+        if(problemType!=0) break;
+        B1=meshelem[i].B1;
+        B2=meshelem[i].B2;
+        return a*((((B1*B1) - (B2*B2))*Re(c) + 2.*B1*B2*Im(c))/(4.*muo)) * aecf;
 
-                    for(c=0,k=0; k<3; k++)
-                        c+=meshnode[meshelem[i].p[k]].CC()*LengthConv[LengthUnits]/3.;
+    case 21: // y (or z) direction Henrotte force, 2x part.
 
-                    y=Re(c)*F2 -Im(c)*F1;
-                    if(Frequency!=0) y/=2.;
-                    y*=AECF(i);
-                    z+=(a*y);
+        B1=meshelem[i].B1;
+        B2=meshelem[i].B2;
+        return a*((((B2*B2) - (B1*B1))*Im(c) + 2.*B1*B2*Re(c))/(4.*muo)) * aecf;
 
-                    break;
+    case 22: // Henrotte torque, SS part.
+        if(problemType!=PLANAR) break;
+        B1=meshelem[i].B1;
+        B2=meshelem[i].B2;
+        F1 = (((B1*conj(B1)) - (B2*conj(B2)))*Re(c) +
+              2.*Re(B1*conj(B2))*Im(c))/(2.*muo);
+        F2 = (((B2*conj(B2)) - (B1*conj(B1)))*Im(c) +
+              2.*Re(B1*conj(B2))*Re(c))/(2.*muo);
 
-                case 23: // Henrotte torque, 2x part.
+        for(c=0,k=0; k<3; k++)
+            c+=meshnode[meshelem[i].p[k]].CC()*LengthConv[LengthUnits]/3.;
 
-                    if(problemType!=PLANAR) break;
-                    B1=meshelem[i].B1;
-                    B2=meshelem[i].B2;
-                    c=HenrotteVector(i);
-                    F1 = (((B1*B1) - (B2*B2))*Re(c) + 2.*B1*B2*Im(c))/(4.*muo);
-                    F2 = (((B2*B2) - (B1*B1))*Im(c) + 2.*B1*B2*Re(c))/(4.*muo);
+        y=Re(c)*F2 -Im(c)*F1;
+        if(Frequency!=0) y/=2.;
+        y*=aecf;
+        return (a*y);
 
-                    for(c=0,k=0; k<3; k++)
-                        c+=meshnode[meshelem[i].p[k]].CC()*LengthConv[LengthUnits]/3;
+    case 23: // Henrotte torque, 2x part.
 
-                    z+=a*(Re(c)*F2 -Im(c)*F1)*AECF(i);
+        if(problemType!=PLANAR) break;
+        B1=meshelem[i].B1;
+        B2=meshelem[i].B2;
+        F1 = (((B1*B1) - (B2*B2))*Re(c) + 2.*B1*B2*Im(c))/(4.*muo);
+        F2 = (((B2*B2) - (B1*B1))*Im(c) + 2.*B1*B2*Re(c))/(4.*muo);
 
-                    break;
+        for(c=0,k=0; k<3; k++)
+            c+=meshnode[meshelem[i].p[k]].CC()*LengthConv[LengthUnits]/3;
 
-                default:
-                    break;
-                }
-            }
-        }
-    }
+        return a*(Re(c)*F2 -Im(c)*F1)*aecf;
 
-    if (inttype == 25) // 2D shape centroid
-    {
-        // divide sum of Cx*A and Cy*A by sum of A
-        CComplex temp = BlockIntegral(5);
-        z.re = y.Re() / temp.Re();
-        z.im = y.Im() / temp.Re();
+    default:
+        break;
     }
 
-    return z;
+    return 0;
 }
 
 void FPProc::LineIntegral(int inttype, CComplex *z) const
@@ -5069,12 +5407,44 @@ CComplex FPProc::GetVoltageDrop(int circnum) const
     return Volts;
 }
 
+CComplex FPProc::circuitElementLinkage(const int i, const CComplex *Jn, const CComplex *An) const
+{
+    int k;
+    CComplex A[3],J[3];
+    double a,r[3];
+
+    for(k=0; k<3; k++)
+    {
+        J[k]=Jn[k];
+        A[k]=An[k];
+    }
+    a=ElmArea(i)*LengthConv[LengthUnits]*LengthConv[LengthUnits];
+    if(problemType==AXISYMMETRIC)
+    {
+        for(k=0; k<3; k++)
+            r[k]=meshnode[meshelem[i].p[k]].x*LengthConv[LengthUnits];
+    }
+
+    // for a multiturn region, there can be some "local" flux linkage due to the complex-valued
+    // part of the conductivity.
+    if(Im(blocklist[meshelem[i].lbl].o)!=0)
+    {
+        double u;
+        if(Frequency==0) u=Im(blocklist[meshelem[i].lbl].o);
+        else u=Im(1.e-6/blocklist[meshelem[i].lbl].o)/(2.*PI*Frequency);
+        for(k=0; k<3; k++) A[k]+=u*J[k];
+    }
+
+    for(k=0; k<3; k++) J[k]=J[k].Conj();
+    if(problemType==PLANAR) return PlnInt(a,A,J)*Depth;
+    return AxiInt(a,A,J,r);
+}
+
 CComplex FPProc::GetFluxLinkage(int circnum) const
 {
-    int i,k;
+    int i;
     CComplex FluxLinkage;
     CComplex A[3],J[3];
-    double a,r[3];
 
     // in the "normal" case, we can just use Integral of A.J
     // and divide through by i.conj to get the flux linkage.
@@ -5085,28 +5455,7 @@ CComplex FPProc::GetFluxLinkage(int circnum) const
             if(blocklist[meshelem[i].lbl].InCircuit==circnum)
             {
                 GetJA(i,J,A);
-                a=ElmArea(i)*LengthConv[LengthUnits]*LengthConv[LengthUnits];
-                if(problemType==AXISYMMETRIC)
-                {
-                    for(k=0; k<3; k++)
-                        r[k]=meshnode[meshelem[i].p[k]].x*LengthConv[LengthUnits];
-                }
-
-                // for a multiturn region, there can be some "local" flux linkage due to the complex-valued
-                // part of the conductivity.
-                if(Im(blocklist[meshelem[i].lbl].o)!=0)
-                {
-                    double u;
-                    if(Frequency==0) u=Im(blocklist[meshelem[i].lbl].o);
-                    else u=Im(1.e-6/blocklist[meshelem[i].lbl].o)/(2.*PI*Frequency);
-                    for(k=0; k<3; k++) A[k]+=u*J[k];
-                }
-
-                for(k=0; k<3; k++) J[k]=J[k].Conj();
-                if(problemType==PLANAR) FluxLinkage+=PlnInt(a,A,J)*Depth;
-                else FluxLinkage+=AxiInt(a,A,J,r);
-
-
+                FluxLinkage+=circuitElementLinkage(i,J,A);
             }
         }
 
@@ -48,7 +48,10 @@
 #include "CNode.h"
 #include "CPointProp.h"
 #include "CSegment.h"
+#include "FemmProblem.h"
+#include "MagneticsSolution.h"
 #include "PostProcessor.h"
+#include "spars.h"
 
 #include <vector>
 
@@ -124,6 +127,8 @@ public:
     bool d_ShiftH;
     bool bHasMask;
     int bIncremental;
+    CBigLinProb::PreconditionerType MaskPreconditioner; ///< preconditioner of the Laplace problem of makeMask()
+    int NumThreads; ///< number of threads of BlockIntegrals(), default 1; the results don't depend on it
 
     // lists of nodes, segments, and block labels
     std::vector< femm::CNode >        nodelist;
@@ -134,6 +139,8 @@ public:
     // vectors containing the mesh information
     std::vector< femmsolver::CMMeshNode > meshnode;
     std::vector< femmpostproc::CPostProcMElement >  meshelem;
+    /// area of each element of meshelem, filled by processSolution()
+    std::vector< double > elementArea;
     std::vector< femmsolver::CAirGapElement >   agelist;
 
     // List of elements connected to each node;
@@ -218,6 +225,16 @@ public:
      * @return the requested block integral
      */
     CComplex BlockIntegral(const int inttype) const;
+    /**
+     * @brief Compute several block integrals in a single pass over the mesh.
+     * Quantities that the integrals have in common are computed once per element.
+     * The elements are summed in blocks of a fixed size on #NumThreads threads.
+     * @param inttypes identifiers of the block integrals, see BlockIntegral()
+     * @param circnum circuit whose flux linkage is computed in the same pass, or -1
+     * @param fluxLinkage receives the flux linkage of \p circnum, see GetFluxLinkage()
+     * @return one result per entry of \p inttypes
+     */
+    std::vector<CComplex> BlockIntegrals(const std::vector<int> &inttypes, const int circnum = -1, CComplex *fluxLinkage = NULL) const;
     void LineIntegral(int inttype, CComplex *z) const;
 
     int ClosestNode(const double x, const double y) const;
@@ -274,6 +291,14 @@ public:
     bool NewDocument();
 //     virtual void Serialize(CArchive& ar);
     bool OpenDocument(std::string lpszPathName) override;
+    /**
+     * @brief Load a solution that was kept in memory by the solver.
+     * Neither the \c .fem file nor the \c .ans file is needed.
+     * @param problem the problem that was solved
+     * @param solution the solution as stored by FSolver
+     * @return \c true on success, \c false otherwise.
+     */
+    bool OpenDocument(const femm::FemmProblem &problem, const femm::MagneticsSolution &solution);
     bool MakeMask();
     //bool LoadMeshNodesFromSolution(bool loadA, FILE* fp);
     //bool LoadMeshElementsFromSolution(FILE* fp);
@@ -287,6 +312,66 @@ public:
 
 private:
 
+    /**
+     * @brief Parse the problem description part of a \c .fem or \c .ans file.
+     * @param fp the open file
+     * @param foundSolution is set to \c true, if a \c [solution] section follows
+     * @return \c false on error
+     */
+    bool parseProblemHeader(FILE *fp, bool &foundSolution);
+    /**
+     * @brief Copy the problem description from a magnetics document.
+     * This is the in-memory equivalent of parseProblemHeader().
+     * @param problem
+     * @return \c false if \p problem does not hold magnetics properties
+     */
+    bool loadProblem(const femm::FemmProblem &problem);
+    /**
+     * @brief Prepare the BH curve of a material for the problem frequency.
+     * @param prop
+     */
+    void prepareMaterial(femm::CMMaterialProp &prop);
+    /**
+     * @brief Compute derived quantities after the solution has been loaded.
+     * @return \c true on success
+     */
+    bool processSolution();
+
+    /**
+     * @brief Per-element quantities shared by the block integrals over selected blocks.
+     */
+    struct BlockIntegralElement
+    {
+        CComplex J;
+        CComplex Jn[3];
+        CComplex A[3];
+        double a = 0;
+        double r[3] = {0, 0, 0};
+        double R = 0;
+    };
+    /**
+     * @brief Contribution of a selected element to a block integral (all types except 18 to 23).
+     */
+    CComplex selectedElementIntegral(const int inttype, const int i, const BlockIntegralElement &e) const;
+    /**
+     * @brief Contribution of an element to a weighted stress tensor integral (types 18 to 23).
+     * @param a element area, resp. volume for axisymmetric problems
+     * @param c HenrotteVector() of the element
+     * @param aecf AECF() of the element
+     */
+    CComplex weightedStressTensorIntegral(const int inttype, const int i, const double a, CComplex c, const double aecf) const;
+    /**
+     * @brief Sum the element contributions of BlockIntegrals() over the elements of one block.
+     * @param sums receives one sum per entry of \p types, followed by the A.J integral of circuit \p circnum
+     */
+    void sumBlockIntegrals(const std::vector<int> &types, const int circnum, const int first, const int last, CComplex *sums) const;
+    /**
+     * @brief Contribution of an element of a circuit to the integral of A.J that gives the flux linkage.
+     * @param J current densities at the nodes, see GetJA()
+     * @param A vector potentials at the nodes, see GetJA()
+     */
+    CComplex circuitElementLinkage(const int i, const CComplex *J, const CComplex *A) const;
+
     char warnBuf [1028];
 
 //#ifdef _DEBUG
@@ -335,7 +335,7 @@ bool FPProc::MakeMask()
 		for (j=0;j<3;j++)
 		{
 			for (k=j;k<3;k++)
-				if(Me[j][k]!=0)	L.Put(L.Get(n[j],n[k])-Me[j][k],n[j],n[k]);
+				if(Me[j][k]!=0)	L.AddTo(-Me[j][k],n[j],n[k]);
 			L.b[n[j]]-=be[j];
 		}
 	}
@@ -343,6 +343,8 @@ bool FPProc::MakeMask()
 	// solve the problem;
 	//bLinehook=BuildMask;
 	L.Precision = Precision;
+	L.Preconditioner = MaskPreconditioner;
+	L.WarnMessage = WarnMessage;
 
     if (L.PCGSolve(0)==false)
 	{
@@ -34,6 +34,7 @@
 #include <femmcomplex.h>
 #include <fparse.h>
 #include <fsolver.h>
+#include <FemmProblem.h>
 #include <LuaInstance.h>
 #include <spars.h>
 
@@ -88,6 +89,9 @@ FSolver::FSolver()
     Relax = 0.0;
     ACSolver=0;
     NumCircPropsOrig = 0;
+    writeSolutionFile = true;
+    NumThreads = 1;
+    MaxNewtonIterations = 200;
 
     //meshnode = NULL;
 
@@ -220,6 +224,34 @@ bool FSolver::LoadProblemFile ()
         return false;
     }
 
+    return prepareProblem();
+}
+
+bool FSolver::loadFromProblem(const femm::FemmProblem &problem)
+{
+    // there are no files involved, so there can't be a mesh from a previous solution
+    meshLoadedFromPrevSolution = false;
+
+    // define some defaults
+    Relax=1.;
+
+    if (!FEASolver_type::loadFromProblem(problem))
+    {
+        return false;
+    }
+    Frequency = problem.Frequency;
+
+    // the document may hold curves that were already prepared for another frequency
+    for (auto &prop : blockproplist)
+    {
+        prop.clearSlopes();
+    }
+
+    return prepareProblem();
+}
+
+bool FSolver::prepareProblem()
+{
     // if there's a "previous solution" specified, slurp of the mesh and
     // possibly the previous vector potential values out of that file.
     if (!previousSolutionFile.empty())
@@ -350,7 +382,7 @@ bool FSolver::LoadProblemFile ()
 
 LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
 {
-    int i,j,k,q,n0,n1;
+    int i,j,k;
     char infile[256];
     FILE *fp;
     char s[1024];
@@ -360,6 +392,8 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
         return NOERROR;
     }
 
+    femm::MeshData mesh;
+
     //read meshnodes;
     sprintf(infile,"%s.node",PathName.c_str());
     if((fp=fopen(infile,"rt"))==NULL)
@@ -368,27 +402,14 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
     }
     fgets(s,1024,fp);
     sscanf(s,"%i",&k);
-    NumNodes = k;
 
-    meshnode.clear();
-    meshnode.shrink_to_fit();
-    meshnode.reserve(k);
-    CNode node;
+    mesh.nodes.resize(k);
     for(i=0; i<k; i++)
     {
         fscanf(fp,"%i",&j);
-        fscanf(fp,"%lf",&node.x);
-        fscanf(fp,"%lf",&node.y);
-        fscanf(fp,"%i",&j);
-        if(j>1) j=j-2;
-        else j=-1;
-        node.BoundaryMarker=j;
-
-        // convert all lengths to centimeters (better conditioning this way...)
-        node.x *= 100 * LengthConvMeters[LengthUnits];
-        node.y *= 100 * LengthConvMeters[LengthUnits];
-
-        meshnode.push_back (node);
+        fscanf(fp,"%lf",&mesh.nodes[i].x);
+        fscanf(fp,"%lf",&mesh.nodes[i].y);
+        fscanf(fp,"%i",&mesh.nodes[i].marker);
     }
     fclose(fp);
 
@@ -399,47 +420,41 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
         return BADPBCFILE;
     }
     fgets(s,1024,fp);
-    sscanf(s,"%i",&NumPBCs);
+    sscanf(s,"%i",&k);
 
-    if (NumPBCs!=0)
-    {
-        pbclist.clear();
-        pbclist.shrink_to_fit();
-        pbclist.reserve(NumPBCs);
-    }
+    mesh.pbcs.reserve(k);
     CCommonPoint pbc;
-    for(i=0; i<NumPBCs; i++)
+    for(i=0; i<k; i++)
     {
         fgets(s,1024,fp);
         sscanf(s,"%i %i %i %i",&j,&pbc.x,&pbc.y,&pbc.t);
-        pbclist.push_back(pbc);
+        mesh.pbcs.push_back(pbc);
     }
 
 #ifdef DEBUG
     {
-        char buf[1048]; SNPRINTF(buf, sizeof(buf), "Read in %i pbcs\n", pbclist.size ());
+        char buf[1048]; SNPRINTF(buf, sizeof(buf), "Read in %i pbcs\n", mesh.pbcs.size ());
         WarnMessage(buf);
     }
 #endif // DEBUG
 
-    // read in air gap element info
-    fgets(s,1024,fp);
-    sscanf(s,"%i", &NumAirGapElems);
+    // read in air gap element info; older files end after the pbcs
+    k = 0;
+    if (fgets(s,1024,fp) != NULL)
+        sscanf(s,"%i", &k);
 
 #ifdef DEBUG
     {
-        char buf[1048]; SNPRINTF(buf, sizeof(buf), "Found %i ages, line was: \"%s\"\n", NumAirGapElems, s);
+        char buf[1048]; SNPRINTF(buf, sizeof(buf), "Found %i ages, line was: \"%s\"\n", k, s);
         WarnMessage(buf);
     }
 #endif // DEBUG
 
     CAirGapElement age;
 
-    agelist.clear();
-    agelist.shrink_to_fit();
-    agelist.reserve(NumAirGapElems);
+    mesh.agelist.reserve(k);
 
-    for(i=0;i<NumAirGapElems;i++)
+    for(i=0;i<k;i++)
     {
         fgets(s,80,fp);
 #ifdef DEBUG
@@ -479,7 +494,7 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
         age.quadNode.shrink_to_fit();
         age.quadNode.reserve(age.totalArcElements+1);
 
-        for(k=0;k<=age.totalArcElements;k++)
+        for(int q=0;q<=age.totalArcElements;q++)
         {
             fgets(s,1024,fp);
 
@@ -493,7 +508,7 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
 
             age.quadNode.push_back(qp);
         }
-        agelist.push_back (age);
+        mesh.agelist.push_back (age);
     }
 
     fclose(fp);
@@ -512,11 +527,104 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
     }
     fgets(s,1024,fp);
     sscanf(s,"%i",&k);
-    NumEls = k;
+
+    mesh.elements.resize(k);
+    for(i=0; i<k; i++)
+    {
+        fscanf(fp,"%i",&j);
+        fscanf(fp,"%i",&mesh.elements[i].p[0]);
+        fscanf(fp,"%i",&mesh.elements[i].p[1]);
+        fscanf(fp,"%i",&mesh.elements[i].p[2]);
+        fscanf(fp,"%i",&mesh.elements[i].label);
+    }
+    fclose(fp);
+
+    // read in edges to which boundary conditions are applied;
+    sprintf(infile,"%s.edge",PathName.c_str());
+    if((fp=fopen(infile,"rt"))==NULL)
+    {
+        return BADEDGEFILE;
+    }
+    fscanf(fp,"%i",&k);// read in number of lines
+
+    fscanf(fp,"%i",&j);// read in boundarymarker flag;
+    mesh.edges.resize(k);
+    for(i=0; i<k; i++)
+    {
+        fscanf(fp,"%i",&j);
+        fscanf(fp,"%i",&mesh.edges[i].n0);
+        fscanf(fp,"%i",&mesh.edges[i].n1);
+        fscanf(fp,"%i",&mesh.edges[i].marker);
+    }
+    fclose(fp);
+
+    LoadMeshErr err = LoadMesh(mesh);
+
+    if (deleteFiles)
+    {
+        // clear out temporary files
+        sprintf(infile,"%s.ele",PathName.c_str());
+        remove(infile);
+        sprintf(infile,"%s.node",PathName.c_str());
+        remove(infile);
+        sprintf(infile,"%s.pbc",PathName.c_str());
+        remove(infile);
+        sprintf(infile,"%s.poly",PathName.c_str());
+        remove(infile);
+        if (err != NOERROR)
+        {
+            // Cuthill() won't get to read it
+            sprintf(infile,"%s.edge",PathName.c_str());
+            remove(infile);
+        }
+    }
+
+    return err;
+}
+
+LoadMeshErr FSolver::LoadMesh(const femm::MeshData &mesh)
+{
+    int i,j,k,q,n0,n1;
+
+    if (meshLoadedFromPrevSolution)
+    {
+        return NOERROR;
+    }
+
+    NumNodes = (int)mesh.nodes.size();
+
+    meshnode.clear();
+    meshnode.shrink_to_fit();
+    meshnode.reserve(NumNodes);
+    CNode node;
+    for (const auto &meshNode : mesh.nodes)
+    {
+        node.x = meshNode.x;
+        node.y = meshNode.y;
+        j = meshNode.marker;
+        if(j>1) j=j-2;
+        else j=-1;
+        node.BoundaryMarker=j;
+
+        // convert all lengths to centimeters (better conditioning this way...)
+        node.x *= 100 * LengthConvMeters[LengthUnits];
+        node.y *= 100 * LengthConvMeters[LengthUnits];
+
+        meshnode.push_back (node);
+    }
+
+    // periodic boundary conditions and air gap elements;
+    NumPBCs = (int)mesh.pbcs.size();
+    pbclist = mesh.pbcs;
+    NumAirGapElems = (int)mesh.agelist.size();
+    agelist = mesh.agelist;
+
+    // elements;
+    NumEls = (int)mesh.elements.size();
 
     meshele.clear();
     meshele.shrink_to_fit();
-    meshele.reserve(k);
+    meshele.reserve(NumEls);
     femmsolver::CMElement elm;
 
     // get the default label for unlabelled blocks
@@ -529,13 +637,12 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
         }
     }
 
-    for(i=0; i<k; i++)
+    for(i=0; i<NumEls; i++)
     {
-        fscanf(fp,"%i",&j);
-        fscanf(fp,"%i",&elm.p[0]);
-        fscanf(fp,"%i",&elm.p[1]);
-        fscanf(fp,"%i",&elm.p[2]);
-        fscanf(fp,"%i",&elm.lbl);
+        elm.p[0] = mesh.elements[i].p[0];
+        elm.p[1] = mesh.elements[i].p[1];
+        elm.p[2] = mesh.elements[i].p[2];
+        elm.lbl = mesh.elements[i].label;
         elm.lbl--;
 
         if(elm.lbl<0)
@@ -550,20 +657,6 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
             char buf[1028]; SNPRINTF(buf, sizeof(buf), "The element number %i had label %i\n", i, elm.lbl);
             msg += std::string (buf);
             WarnMessage(msg.c_str());
-            fclose(fp);
-            if (deleteFiles)
-            {
-                sprintf(infile,"%s.ele",PathName.c_str());
-                remove(infile);
-                sprintf(infile,"%s.node",PathName.c_str());
-                remove(infile);
-                sprintf(infile,"%s.pbc",PathName.c_str());
-                remove(infile);
-                sprintf(infile,"%s.poly",PathName.c_str());
-                remove(infile);
-                sprintf(infile,"%s.edge",PathName.c_str());
-                remove(infile);
-            }
             return MISSINGMATPROPS;
         }
 
@@ -572,20 +665,6 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
             char buf[1028];
             SNPRINTF(buf, sizeof(buf), "The element number %i had label %i which is greater than the number of available labels (%i)\n", i+1, elm.lbl+1, (int)labellist.size());
             WarnMessage(buf);
-            fclose(fp);
-            if (deleteFiles)
-            {
-                sprintf(infile,"%s.ele",PathName.c_str());
-                remove(infile);
-                sprintf(infile,"%s.node",PathName.c_str());
-                remove(infile);
-                sprintf(infile,"%s.pbc",PathName.c_str());
-                remove(infile);
-                sprintf(infile,"%s.poly",PathName.c_str());
-                remove(infile);
-                sprintf(infile,"%s.edge",PathName.c_str());
-                remove(infile);
-            }
             return ELMLABELTOOBIG;
         }
 
@@ -594,7 +673,6 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
 
         meshele.push_back(elm);
     }
-    fclose(fp);
 
     // initialize edge bc's and element permeabilities;
     for(i=0; i<NumEls; i++)
@@ -605,7 +683,7 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
             meshele[i].mu2  = -1.;
         }
 
-    // read in edges to which boundary conditions are applied;
+    // apply boundary conditions to edges;
 
     // first, do a little bookkeeping so that element
     // associated with a given edge can be identified fast
@@ -638,20 +716,11 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
             nmbr[k]++;
         }
 
-    sprintf(infile,"%s.edge",PathName.c_str());
-    if((fp=fopen(infile,"rt"))==NULL)
+    for (const auto &edge : mesh.edges)
     {
-        return BADEDGEFILE;
-    }
-    fscanf(fp,"%i",&k);// read in number of lines
-
-    fscanf(fp,"%i",&j);// read in boundarymarker flag;
-    for(i=0; i<k; i++)
-    {
-        fscanf(fp,"%i",&j);
-        fscanf(fp,"%i",&n0);
-        fscanf(fp,"%i",&n1);
-        fscanf(fp,"%i",&j);
+        n0 = edge.n0;
+        n1 = edge.n1;
+        j = edge.marker;
 
         if(j<0)
         {
@@ -676,26 +745,12 @@ LoadMeshErr FSolver::LoadMesh(bool deleteFiles)
         }
 
     }
-    fclose(fp);
 
     // free up the connectivity information
     free(nmbr);
     for(i=0; i<NumNodes; i++) free(mbr[i]);
     free(mbr);
 
-    if (deleteFiles)
-    {
-        // clear out temporary files
-        sprintf(infile,"%s.ele",PathName.c_str());
-        remove(infile);
-        sprintf(infile,"%s.node",PathName.c_str());
-        remove(infile);
-        sprintf(infile,"%s.pbc",PathName.c_str());
-        remove(infile);
-        sprintf(infile,"%s.poly",PathName.c_str());
-        remove(infile);
-    }
-
     return NOERROR;
 }
 
@@ -1197,6 +1252,148 @@ bool FSolver::runSolver(bool verbose)
         }
     }
 
+    return solveProblem(verbose);
+}
+
+bool FSolver::runSolver(const femm::MeshData &mesh, bool verbose)
+{
+    // load mesh
+    LoadMeshErr err = LoadMesh(mesh);
+    if (err != NOERROR)
+    {
+        WarnMessage(getErrorString(err).c_str());
+        return false;
+    }
+
+    // renumber using Cuthill-McKee
+    if (previousSolutionFile.empty ())
+    {
+        if (verbose) PrintMessage("renumbering nodes using Cuthill-McKee method\n");
+
+        if (!Cuthill(mesh))
+        {
+            WarnMessage("problem renumbering node points\n");
+            return false;
+        }
+    }
+
+    return solveProblem(verbose);
+}
+
+bool FSolver::runCurrentSweep(const femm::MeshData &mesh, const std::string &circuit, const std::vector<double> &currents,
+                              std::vector<femm::MagneticsSolution> &solutions, bool verbose)
+{
+    solutions.clear();
+
+    if (Frequency != 0 || !previousSolutionFile.empty())
+    {
+        WarnMessage("Current sweeps are only supported for static problems without previous solution.\n");
+        return false;
+    }
+
+    // load mesh
+    LoadMeshErr err = LoadMesh(mesh);
+    if (err != NOERROR)
+    {
+        WarnMessage(getErrorString(err).c_str());
+        return false;
+    }
+
+    // renumber using Cuthill-McKee
+    if (verbose) PrintMessage("renumbering nodes using Cuthill-McKee method\n");
+    if (!Cuthill(mesh))
+    {
+        WarnMessage("problem renumbering node points\n");
+        return false;
+    }
+
+    CBigLinProb L;
+    L.Precision = Precision;
+    L.NumThreads = NumThreads;
+    L.Preconditioner = Preconditioner;
+    L.MaxIterations = MaxLinearIterations;
+    L.WarnMessage = WarnMessage;
+
+    // initialize the problem, allocating the space required to solve it.
+    if (L.Create(NumNodes, BandWidth) == false)
+    {
+        WarnMessage("couldn't allocate enough space for matrices\n");
+        return false;
+    }
+
+    solutions.reserve(currents.size());
+    for (std::size_t k=0; k<currents.size(); k++)
+    {
+        if (!setCircuitCurrent(circuit, currents[k]))
+        {
+            WarnMessage("Unknown circuit in current sweep\n");
+            return false;
+        }
+        Relax = 1.;
+
+        // start from the previous potential, scaled to the new current
+        const bool warmStart = (k > 0);
+        if (warmStart && currents[k-1] != 0)
+        {
+            const double scale = currents[k] / currents[k-1];
+            for (int i=0; i<NumNodes; i++)
+                L.V[i] *= scale;
+        }
+        if (ProblemType == PLANAR)
+        {
+            if (Static2D(L, warmStart) == false)
+            {
+                WarnMessage("Couldn't solve the problem\n");
+                return false;
+            }
+        } else {
+            if (StaticAxisymmetric(L, warmStart) == false)
+            {
+                WarnMessage("Couldn't solve the problem\n");
+                return false;
+            }
+        }
+        if (verbose)
+        {
+            std::string msg = "solved for " + to_string(currents[k]) + " A\n";
+            PrintMessage(msg.c_str());
+        }
+
+        StoreStatic2D(L);
+        solutions.push_back(solution);
+    }
+    return true;
+}
+
+bool FSolver::setCircuitCurrent(const std::string &circuit, double amps)
+{
+    bool found = false;
+    for(int k=0; k<NumCircProps; k++)
+    {
+        if (circproplist[k].OrigCirc < 0 && circproplist[k].CircName == circuit)
+        {
+            circproplist[k].Amps = amps;
+            found = true;
+        }
+    }
+
+    // serial circuits are split into one circuit per block label,
+    // carrying the total current of all turns (see prepareProblem())
+    for(int k=0; k<NumBlockLabels; k++)
+    {
+        int ic = labellist[k].InCircuit;
+        if (ic >= 0 && circproplist[ic].OrigCirc >= 0
+                && circproplist[circproplist[ic].OrigCirc].CircName == circuit)
+        {
+            circproplist[ic].Amps = amps;
+            circproplist[ic].Amps.re *= labellist[k].Turns;
+        }
+    }
+    return found;
+}
+
+bool FSolver::solveProblem(bool verbose)
+{
     if (verbose)
     {
         PrintMessage("solving...\n");
@@ -1216,6 +1413,10 @@ bool FSolver::runSolver(bool verbose)
         }
         CBigLinProb L;
         L.Precision = Precision;
+        L.NumThreads = NumThreads;
+        L.Preconditioner = Preconditioner;
+        L.MaxIterations = MaxLinearIterations;
+        L.WarnMessage = WarnMessage;
 
         // initialize the problem, allocating the space required to solve it.
         if (L.Create(NumNodes, BandWidth) == false)
@@ -1238,20 +1439,24 @@ bool FSolver::runSolver(bool verbose)
         } else {
             if (StaticAxisymmetric(L) == false)
             {
-                WarnMessage("Couldn't solve the problem");
+                WarnMessage("Couldn't solve the problem\n");
                 return false;
             }
             if (verbose)
                 PrintMessage("Static axisymmetric problem solved\n");
         }
 
-        if (WriteStatic2D(L) == false)
+        StoreStatic2D(L);
+        if (writeSolutionFile)
         {
-            WarnMessage("couldn't write results to disk\n");
-            return false;
+            if (WriteStatic2D(L) == false)
+            {
+                WarnMessage("couldn't write results to disk\n");
+                return false;
+            }
+            if (verbose)
+                PrintMessage("results written to disk\n");
         }
-        if (verbose)
-            PrintMessage("results written to disk\n");
     } else {
         CBigComplexLinProb L;
         L.Precision = Precision;
@@ -1292,17 +1497,49 @@ bool FSolver::runSolver(bool verbose)
             if (verbose){ PrintMessage("Harmonic axisymmetric problem solved\n"); }
         }
 
-        if (!WriteHarmonic2D(L))
+        StoreHarmonic2D(L);
+        if (writeSolutionFile)
         {
-            WarnMessage("couldn't write results to disk\n");
-            return false;
+            if (!WriteHarmonic2D(L))
+            {
+                WarnMessage("couldn't write results to disk\n");
+                return false;
+            }
+            if (verbose){ PrintMessage("results written to disk.\n"); }
         }
-        if (verbose){ PrintMessage("results written to disk.\n"); }
     }
     return true;
 }
 
 // SortNodes: sorts mesh nodes based on a new numbering
+void FSolver::colourElements(const std::vector<int> &elements, std::vector<int> &order, std::vector<int> &groupStart) const
+{
+    // mark[n] is the last group that contains node n
+    std::vector<int> mark(NumNodes, -1);
+    std::vector<int> pending(elements);
+    std::vector<int> next;
+    next.reserve(pending.size());
+
+    // greedy: each pass takes every remaining element that doesn't touch the nodes of the group
+    for (int group=0; !pending.empty(); group++)
+    {
+        groupStart.push_back((int)order.size());
+        next.clear();
+        for (int i : pending)
+        {
+            const int *p = meshele[i].p;
+            if (mark[p[0]]==group || mark[p[1]]==group || mark[p[2]]==group)
+            {
+                next.push_back(i);
+                continue;
+            }
+            mark[p[0]] = mark[p[1]] = mark[p[2]] = group;
+            order.push_back(i);
+        }
+        pending.swap(next);
+    }
+}
+
 void FSolver::SortNodes (int* newnum)
 {
     // sort mesh nodes based on newnum;
@@ -42,6 +42,7 @@
 #include "CMaterialProp.h"
 #include "CNode.h"
 #include "CPointProp.h"
+#include "MagneticsSolution.h"
 
 namespace femm {
 class LuaInstance;
@@ -71,11 +72,30 @@ public:
     std::vector <femm::CNode> meshnode;
     int NumCircPropsOrig;
 
+    /// \brief If \c false, runSolver() does not write the \c .ans file. The solution is still kept in #solution.
+    bool writeSolutionFile;
+    /// \brief Number of threads of static problems: the assembly and the linear solver.
+    /// The results don't depend on it.
+    int NumThreads;
+    /**
+     * \brief Static problems fail if the Newton iteration doesn't converge within this many iterations. Default 200.
+     * The iteration also fails if its residual stops decreasing, even after a stronger relaxation.
+     */
+    int MaxNewtonIterations;
+    /// \brief The solution of the last successful runSolver() call.
+    femm::MagneticsSolution solution;
+
 
 // Operations
 public:
 
     LoadMeshErr LoadMesh(bool deleteFiles=true) override;
+    /**
+     * @brief Load the mesh from memory instead of the mesh files.
+     * @param mesh the triangulation as produced by the mesher
+     * @return \c NOERROR on success, an error code otherwise
+     */
+    LoadMeshErr LoadMesh(const femm::MeshData &mesh);
     /**
      * @brief loadPreviousSolution
      * @return \c true on success, \c false otherwise.
@@ -91,7 +111,21 @@ public:
     bool LoadPBCFromSolution(FILE* fp);
     bool LoadAGEsFromSolution(FILE* fp);
     bool LoadProblemFile();
-    int Static2D(CBigLinProb &L);
+    /**
+     * @brief Load the problem description from an in-memory document instead of the \c .fem file.
+     * Apart from skipping the file, this does the same as LoadProblemFile().
+     * @param problem a magnetics problem
+     * @return \c true on success, \c false otherwise.
+     */
+    bool loadFromProblem(const femm::FemmProblem &problem);
+    /**
+     * @brief Assemble and solve a static planar problem.
+     * @param L the linear problem
+     * @param warmStart if \c true, \p L and the mesh elements must hold the solution of
+     * a previous call on the same mesh. It is used as starting point of the Newton iteration.
+     * @return \c true on success, \c false otherwise.
+     */
+    int Static2D(CBigLinProb &L, bool warmStart=false);
     /**
      * @brief WriteStatic2D
      * @param L
@@ -102,17 +136,139 @@ public:
      * \endinternal
      */
     int WriteStatic2D(CBigLinProb &L);
+    /**
+     * @brief Copy the static solution into #solution.
+     * This stores the same information that WriteStatic2D() writes into the \c [Solution] section.
+     * @param L
+     */
+    void StoreStatic2D(CBigLinProb &L);
     int Harmonic2D(CBigComplexLinProb &L);
     int WriteHarmonic2D(CBigComplexLinProb &L);
-    int StaticAxisymmetric(CBigLinProb &L);
+    /**
+     * @brief Copy the harmonic solution into #solution.
+     * This stores the same information that WriteHarmonic2D() writes into the \c [Solution] section.
+     * @param L
+     */
+    void StoreHarmonic2D(CBigComplexLinProb &L);
+    /**
+     * @brief Assemble and solve a static axisymmetric problem.
+     * @param L the linear problem
+     * @param warmStart see Static2D()
+     * @return \c true on success, \c false otherwise.
+     */
+    int StaticAxisymmetric(CBigLinProb &L, bool warmStart=false);
     int HarmonicAxisymmetric(CBigComplexLinProb &L);
     void GetFillFactor(int lbl);
     double ElmArea(int i);
 
     virtual bool runSolver(bool verbose=false) override;
+    /**
+     * @brief Solve the problem on a mesh that was handed over in memory.
+     * This does the same as runSolver(bool), but doesn't read any mesh files.
+     * @param mesh
+     * @param verbose
+     * @return \c true on success, \c false on error.
+     */
+    bool runSolver(const femm::MeshData &mesh, bool verbose=false);
+    /**
+     * @brief Solve a static problem for a list of currents in one circuit.
+     * The mesh is loaded and renumbered once, and the sparsity pattern of the matrix is kept.
+     * Each solution after the first one starts the Newton iteration from the previous solution.
+     * No \c .ans files are written.
+     * @param mesh
+     * @param circuit name of the circuit
+     * @param currents total currents of the circuit [A]
+     * @param solutions receives one solution per current
+     * @param verbose
+     * @return \c true on success, \c false on error.
+     */
+    bool runCurrentSweep(const femm::MeshData &mesh, const std::string &circuit, const std::vector<double> &currents,
+                         std::vector<femm::MagneticsSolution> &solutions, bool verbose=false);
+    /**
+     * @brief Change the total current of a circuit after the problem has been loaded.
+     * This takes care of the per-label circuits that are created for serial circuits.
+     * @param circuit name of the circuit
+     * @param amps total current [A]
+     * @return \c false, if there is no such circuit.
+     */
+    bool setCircuitCurrent(const std::string &circuit, double amps);
 
 private:
 
+    /**
+     * @brief Solve the loaded and renumbered mesh and write the results.
+     * @param verbose
+     * @return \c true on success, \c false on error.
+     */
+    bool solveProblem(bool verbose);
+
+    /**
+     * @brief Process the problem description after it has been loaded.
+     * This loads the previous solution (if any), prepares the BH curves and splits serial circuits.
+     * @return \c true on success, \c false otherwise.
+     */
+    bool prepareProblem();
+
+    /**
+     * @brief Geometry of the elements of an axisymmetric problem, one array per quantity.
+     * Everything in here depends only on the node coordinates, so it is computed once per
+     * solution instead of once per Newton iteration.
+     * Symmetric 3x3 matrices are stored as their upper triangle in the order
+     * (0,0), (0,1), (0,2), (1,1), (1,2), (2,2).
+     */
+    struct AxiGeometry
+    {
+        std::vector<int> node[3];   ///< node numbers
+        std::vector<double> l[3];   ///< side lengths
+        std::vector<double> area;   ///< element area
+        std::vector<double> R;      ///< radius of the centroid
+        std::vector<double> vol;    ///< volume of revolution divided by pi
+        std::vector<double> Mx[6];  ///< Mr contribution
+        std::vector<double> My[6];  ///< Mz contribution
+        std::vector<double> Mxy[6]; ///< Mrz contribution
+        /// elements in assembly order: the linear elements first, then the nonlinear ones, each set split into groups
+        std::vector<int> order;
+        /// index of the first element of each group in #order, plus the size of #order
+        std::vector<int> groupStart;
+        /// number of groups of linear elements
+        int numLinearGroups;
+    };
+    /// \brief Element geometry used by StaticAxisymmetric()
+    AxiGeometry axiGeometry;
+    /// \brief Fill #axiGeometry from the current mesh and materials.
+    void buildAxiGeometry();
+    /**
+     * @brief Add the element matrix and right hand side of one element of a static axisymmetric problem to \p L.
+     * Elements that share no nodes can be added from several threads at the same time,
+     * as long as all their matrix entries are part of the sparsity pattern already, or \p L isn't compressed.
+     * @param L the linear problem
+     * @param i element
+     * @param Iter Newton iteration, see StaticAxisymmetric()
+     * @param bIncremental type of the previous solution, 0 if there is none
+     * @return \c false, if the magnetization direction function of the element fails.
+     */
+    bool assembleAxiElement(CBigLinProb &L, int i, int Iter, int bIncremental);
+    /**
+     * @brief Add the element matrix and right hand side of one element of a static planar problem to \p L.
+     * Elements that share no nodes can be added from several threads at the same time.
+     * @param L the linear problem
+     * @param i element
+     * @param Iter Newton iteration, see Static2D()
+     * @param bIncremental type of the previous solution, MS_LEGACY_FALSE if there is none
+     * @return \c false, if the magnetization direction function of the element fails.
+     */
+    bool assemble2DElement(CBigLinProb &L, int i, int Iter, int bIncremental);
+    /**
+     * @brief Split elements into groups of elements that share no nodes.
+     * The elements of a group can be assembled in parallel without two threads writing to the same matrix entry.
+     * The groups are appended to \p order, and the first index of each group is appended to \p groupStart.
+     * Within a group, the elements keep their order in \p elements.
+     * @param elements the elements
+     * @param order
+     * @param groupStart
+     */
+    void colourElements(const std::vector<int> &elements, std::vector<int> &order, std::vector<int> &groupStart) const;
+
     virtual void CleanUp() override;
 
     /**
@@ -1034,6 +1034,66 @@ int FSolver::WriteHarmonic2D(CBigComplexLinProb &L)
     return true;
 }
 
+void FSolver::StoreHarmonic2D(CBigComplexLinProb &L)
+{
+    double unitconv[]= {2.54,0.1,1.,100.,0.00254,1.e-04};
+    double cf = unitconv[LengthUnits];
+
+    solution.clear();
+
+    solution.nodes.resize(NumNodes);
+    for(int i=0; i<NumNodes; i++)
+    {
+        solution.nodes[i].x = meshnode[i].x/cf;
+        solution.nodes[i].y = meshnode[i].y/cf;
+        solution.nodes[i].A = L.b[i];
+        solution.nodes[i].marker = meshnode[i].BoundaryMarker;
+    }
+    solution.Aprev = Aprev;
+
+    solution.elements.resize(NumEls);
+    for(int i=0; i<NumEls; i++)
+    {
+        for(int j=0; j<3; j++)
+            solution.elements[i].p[j] = meshele[i].p[j];
+        solution.elements[i].lbl = meshele[i].lbl;
+        solution.elements[i].Jprev = Aprev.empty() ? 0 : meshele[i].Jprev;
+    }
+
+    // circuit info on a blocklabel by blocklabel basis;
+    solution.blocks.resize(NumBlockLabels);
+    for(int k=0; k<NumBlockLabels; k++)
+    {
+        int i=labellist[k].InCircuit;
+
+        // blocks that are not associated with any particular circuit
+        // get a fixed additional current density of zero
+        solution.blocks[k].Case = 1;
+        solution.blocks[k].value = 0;
+        if(i>=0)
+        {
+            if (circproplist[i].Case==0)
+            {
+                solution.blocks[k].Case = 0;
+                solution.blocks[k].value = circproplist[i].dV;
+            }
+            if (circproplist[i].Case==1)
+            {
+                solution.blocks[k].Case = 1;
+                solution.blocks[k].value = circproplist[i].J;
+            }
+            if (circproplist[i].Case==2)
+            {
+                solution.blocks[k].Case = 0;
+                solution.blocks[k].value = L.b[NumNodes+i];
+            }
+        }
+    }
+
+    solution.pbcs = pbclist;
+    solution.agelist = agelist;
+}
+
 
 
 
@@ -26,12 +26,15 @@
 #include "fsolver.h"
 #include "lua.h"
 #include "LuaInstance.h"
+#include "ThreadTeam.h"
 
 #include <stdio.h>
 #include <math.h>
 #include <malloc.h>
 #include <string>
+#include <cmath>
 #include <cstdio>
+#include <vector>
 
 #include <csignal>
 
@@ -45,30 +48,499 @@
   #endif
 #endif
 
+// length units of the problem in centimetres
+static const double units[]= {2.54,0.1,1.,100.,0.00254,1.e-04};
+
 double Power(double x, int y)
 {
 	return pow(x,(double) y);
 }
 
-int FSolver::Static2D(CBigLinProb &L)
+bool FSolver::assemble2DElement(CBigLinProb &L, int i, int Iter, int bIncremental)
 {
-
-    int i,j,k,w,s;
+    int j,k,w;
     double Me[3][3],be[3];      // element matrices;
     double Mx[3][3],My[3][3],Mxy[3][3],Mn[3][3];
     double l[3],p[3],q[3];      // element shape parameters;
     int n[3];                   // numbers of nodes for a particular element;
-    double a,K,Ki,r,t,x,y,B,B1,B2,mu,v[3],u[3],dv,res,lastres,Cduct;
+    double a,K,t,B,B1,B2,mu,v[3],u[3],dv;
+    const double c=PI*4.e-05;
+    double murel, muinc;
+    femmsolver::CMElement *El;
+
+    // zero out Me, be;
+    for(j = 0; j < 3; j++)
+    {
+        for(k = 0; k < 3; k++)
+        {
+            Me[j][k] = 0.;
+            Mx[j][k] = 0.;
+            My[j][k] = 0.;
+            Mn[j][k] = 0.;
+            Mxy[j][k] = 0.;
+        }
+        be[j] = 0.;
+    }
+
+    // Determine shape parameters.
+    // l == element side lengths;
+    // p corresponds to the `b' parameter in Allaire
+    // q corresponds to the `c' parameter in Allaire
+    El = &meshele[i];
+
+    for(k = 0; k<3; k++)
+    {
+        n[k] = El->p[k];
+    }
+
+    p[0] = meshnode[n[1]].y - meshnode[n[2]].y;
+    p[1] = meshnode[n[2]].y - meshnode[n[0]].y;
+    p[2] = meshnode[n[0]].y - meshnode[n[1]].y;
+    q[0] = meshnode[n[2]].x - meshnode[n[1]].x;
+    q[1] = meshnode[n[0]].x - meshnode[n[2]].x;
+    q[2] = meshnode[n[1]].x - meshnode[n[0]].x;
+
+    for(j = 0,k = 1; j<3; k++, j++)
+    {
+        if (k == 3)
+        {
+            k = 0;
+        }
+
+        l[j] = sqrt( pow(meshnode[n[k]].x-meshnode[n[j]].x,2.) +
+                     pow(meshnode[n[k]].y-meshnode[n[j]].y,2.) );
+
+    }
+
+    a = (p[0]*q[1] - p[1]*q[0]) / 2.;
+
+    // x-contribution; only need to do main diagonal and above;
+    K = (-1. / (4.*a));
+
+    for(j = 0; j<3; j++)
+    {
+        for(k = j; k<3; k++)
+        {
+            Mx[j][k] += K * p[j] * p[k];
+            if (j != k)
+            {
+                Mx[k][j] += K * p[j] * p[k];
+            }
+        }
+    }
+
+    // y-contribution; only need to do main diagonal and above;
+    K = (-1. / (4.*a));
+    for(j = 0; j < 3; j++)
+    {
+        for(k = j; k < 3; k++)
+        {
+            My[j][k] +=K*q[j]*q[k];
+            if (j != k)
+            {
+                My[k][j] += K * q[j] * q[k];
+            }
+        }
+    }
+
+    // xy-contribution;
+    K = (-1. / (4.*a));
+    for (j = 0; j < 3; j++)
+    {
+        for (k = j; k < 3; k++)
+        {
+            Mxy[j][k] += K*(p[j] * q[k] + p[k] * q[j]);
+            if (j != k)
+            {
+                Mxy[k][j] += K*(p[j] * q[k] + p[k] * q[j]);
+            }
+        }
+    }
+
+    // contributions to Me, be from derivative boundary conditions;
+    for(j = 0; j<3; j++)
+    {
+        if (El->e[j] >= 0)
+        {
+            if (lineproplist[El->e[j]].BdryFormat==2)
+            {
+                // conversion factor is 10^(-4) (I think...)
+                K = -0.0001*c*lineproplist[ El->e[j] ].c0.re*l[j]/6.;
+                k = j+1;
+                if(k==3) k = 0;
+                Me[j][j]+=K*2.;
+                Me[k][k]+=K*2.;
+                Me[j][k]+=K;
+                Me[k][j]+=K;
+
+                K = (lineproplist[ El->e[j] ].c1.re*l[j]/2.)*0.0001;
+                be[j]+=K;
+                be[k]+=K;
+            }
+        }
+    }
+
+    // contribution to be from current density in the block
+    for(j = 0; j<3; j++)
+    {
+        t = 0;
+        if ( labellist[El->lbl].InCircuit >= 0 )
+        {
+            k = labellist[El->lbl].InCircuit;
+
+            if(circproplist[k].Case==1)
+            {
+                t = circproplist[k].J.Re();
+            }
+
+            if(circproplist[k].Case==0)
+            {
+                t = -circproplist[k].dV.Re()*blockproplist[El->blk].Cduct;
+            }
+        }
+
+        K = -(blockproplist[El->blk].J.re+t)*a/3.;
+
+        be[j]+=K;
+
+        // record avg current density in the block for use in incremental solutions
+        if (bIncremental==MS_LEGACY_FALSE) El->Jprev+=(blockproplist[El->blk].J.Re()+t)/3.;
+    }
+
+    // contribution to be from magnetization in the block;
+    t = labellist[El->lbl].MagDir;
+    // create the formatter object in case of a lua defined mag direction
+//                boost::format fmatter("x=%.17g\ny=%.17g\nr=x\nz=y\ntheta=%.17g\nR=%.17g\nreturn %s");
+    if (!labellist[El->lbl].MagDirFctn.empty()) // functional magnetization direction
+    {
+
+        char magbuff[4096];
+        std::string str;
+        CComplex X;
+        int top1,top2,lua_error_code;
+
+        for (j = 0,X = 0; j<3; j++)
+        {
+            X += (CComplex)(meshnode[n[j]].x + I * meshnode[n[j]].y);
+        }
+        X = X/units[LengthUnits]/3.;
+        // generate the string using boost::format
+//                    fmatter % (X.re) % (X.im) % (arg(X)*180/PI) % (abs(X)) % (labellist[El->lbl].MagDirFctn);
+        // get the created string
+//                    str = fmatter.str();
+        SNPRINTF(magbuff, sizeof magbuff, "x=%.17g\ny=%.17g\nr=x\nz=y\ntheta=%.17g\nR=%.17g\nreturn %s",
+                      (X.re) , (X.im) , (arg(X)*180/PI) , (abs(X)) , (labellist[El->lbl].MagDirFctn.c_str()));
+        str = magbuff;
+        lua_State * lua = theLua->getLuaState();
+
+        top1 = lua_gettop(lua);
+
+        lua_error_code = theLua->doString(str, femm::LuaInstance::LuaStackMode::Unsafe);
+
+        if(lua_error_code != 0)
+        {
+            if (lua_error_code==LUA_ERRRUN)
+                WarnMessage("Lua run Error (LUA_ERRRUN) when evaluating magnetization direction function");
+            if (lua_error_code==LUA_ERRMEM)
+                WarnMessage("Lua memory Error (LUA_ERRMEM) when evaluating magnetization direction function");
+            if (lua_error_code==LUA_ERRERR)
+                WarnMessage("Lua user error error (LUA_ERRERR) when evaluating magnetization direction function");
+            if (lua_error_code==LUA_ERRFILE)
+                WarnMessage("Lua file error (LUA_ERRFILE) when evaluating magnetization direction function");
+
+            SNPRINTF(magbuff, sizeof magbuff,
+                     "Lua error occurred when evaluating:\n\"%s\"",
+                     labellist[El->lbl].MagDirFctn.c_str());
+
+            WarnMessage (magbuff);
+
+            return false;
+        }
+
+        top2 = lua_gettop(lua);
+
+        if (top2!=top1)
+        {
+            str = lua_tostring(lua,-1);
+
+            if (str.length()==0)
+            {
+                SNPRINTF(magbuff, sizeof magbuff,
+                         "\"%s\" does not evaluate to a numerical value",
+                         labellist[El->lbl].MagDirFctn.c_str());
+
+                WarnMessage (magbuff);
+
+                return false;
+            }
+            else
+            {
+                t = Re(lua_tonumber(lua,-1));
+            }
+
+            lua_pop(lua, 1);
+        }
+
+    }
+    for(j = 0; j<3; j++)
+    {
+        k = j+1;
+        if(k==3)
+        {
+            k = 0;
+        }
+        // need to scale so that everything is in proper units...
+        // conversion is 0.0001
+        K = 0.0001*blockproplist[El->blk].H_c*(
+                cos(t*PI/180.)*(meshnode[n[k]].x-meshnode[n[j]].x) +
+                sin(t*PI/180.)*(meshnode[n[k]].y-meshnode[n[j]].y) )/2.;
+        be[j]+=K;
+        be[k]+=K;
+    }
+
+//////// Nonlinear Part
+
+    // update permeability for the element;
+    if (Iter==0)
+    {
+        k = meshele[i].blk;
+
+        if (blockproplist[k].LamType==0)
+        {
+            t = blockproplist[k].LamFill;
+            meshele[i].mu1 = blockproplist[k].mu_x*t + (1.-t);
+            meshele[i].mu2 = blockproplist[k].mu_y*t + (1.-t);
+        }
+        if (blockproplist[k].LamType==1)
+        {
+            t = blockproplist[k].LamFill;
+            mu = blockproplist[k].mu_x;
+            meshele[i].mu1 = mu*t + (1.-t);
+            meshele[i].mu2 = mu/(t + mu*(1.-t));
+        }
+        if (blockproplist[k].LamType==2)
+        {
+            t = blockproplist[k].LamFill;
+            mu = blockproplist[k].mu_y;
+            meshele[i].mu2 = mu*t + (1.-t);
+            meshele[i].mu1 = mu/(t + mu*(1.-t));
+        }
+        if (blockproplist[k].LamType>2)
+        {
+            meshele[i].mu1 = 1;
+            meshele[i].mu2 = 1;
+        }
+
+        if (blockproplist[k].BHpoints != 0)
+        {
+            // without a previous solution this is a standard nonlinear problem,
+            // see LinearFlag in Static2D()
+            if (bIncremental != MS_LEGACY_FALSE)
+            {
+                double B1p, B2p;
+
+                // too lazy to consistently code incremental/frozen formulation for on-edge lams.
+                // detect this condition, throw an error, and exit.
+                if (blockproplist[k].LamType > 0)
+                {
+                    PrintMessage("On-edge Lam Types not yet supported in\nincremental/frozen permeability problems");
+                    exit(0);
+                }
+
+                //	Get B from previous solution
+                getPrev2DB(i, B1p, B2p);
+                B = sqrt(B1p*B1p + B2p*B2p);
+
+                // look up incremental permeability and assign it to the element;
+                blockproplist[k].IncrementalPermeability(B, muinc, murel);
+
+                if (B == 0)
+                {
+                    meshele[i].mu1 = muinc;
+                    meshele[i].mu2 = muinc;
+                    meshele[i].v12 = 0;
+                }
+                else {
+                    if (bIncremental == 1)
+                    {
+                        // Need to actually compute B1 and B2 to build incremental permeability tensor
+                        meshele[i].mu1 = B*B*muinc*murel / (B1p*B1p*murel + B2p*B2p*muinc);
+                        meshele[i].mu2 = B*B*muinc*murel / (B1p*B1p*muinc + B2p*B2p*murel);
+                        meshele[i].v12 = -B1p*B2p*(murel - muinc) / (B*B*murel*muinc);
+                    }
+                    else {
+                        // Define "frozen permeability"
+                        meshele[i].mu1 = murel;
+                        meshele[i].mu2 = murel;
+                        meshele[i].v12 = 0;
+                    }
+                }
+            }
+        }
+
+    }
+    else
+    {
+        k = meshele[i].blk;
+
+        if ((blockproplist[k].LamType==0) &&
+                (meshele[i].mu1==meshele[i].mu2)
+                &&(blockproplist[k].BHpoints>0))
+        {
+            for(j = 0,B1 = 0.,B2 = 0.; j<3; j++)
+            {
+                B1+=L.V[n[j]]*q[j];
+                B2+=L.V[n[j]]*p[j];
+            }
+            B = c*sqrt(B1*B1+B2*B2)/(0.02*a);
+            // correction for lengths in cm of 1/0.02
+
+            // find out new mu from saturation curve;
+            blockproplist[k].GetBHProps(B,mu,dv);
+            mu = 1./(muo*mu);
+            meshele[i].mu1 = mu;
+            meshele[i].mu2 = mu;
+            for(j = 0; j<3; j++)
+            {
+                for(w = 0,v[j] = 0; w<3; w++)
+                    v[j]+=(Mx[j][w]+My[j][w])*L.V[n[w]];
+            }
+            K = -200.*c*c*c*dv/a;
+            for(j = 0; j<3; j++)
+            {
+                for(w = 0; w<3; w++)
+                {
+                    Mn[j][w] = K*v[j]*v[w];
+                }
+            }
+        }
+
+        if ((blockproplist[k].LamType==1) && (blockproplist[k].BHpoints>0))
+        {
+            t = blockproplist[k].LamFill;
+
+            for(j = 0,B1 = 0.,B2 = 0.; j<3; j++)
+            {
+                B1+=L.V[n[j]]*q[j];
+                B2+=L.V[n[j]]*p[j]/t;
+            }
+
+            B = c*sqrt(B1*B1+B2*B2)/(0.02*a);
+
+            blockproplist[k].GetBHProps(B,mu,dv);
+
+            mu = 1./(muo*mu);
+
+            meshele[i].mu1 = mu*t;
+
+            meshele[i].mu2 = mu/(t+mu*(1.-t));
+
+            for(j = 0; j<3; j++)
+            {
+                for(w = 0,v[j] = 0,u[j] = 0; w<3; w++)
+                {
+                    v[j]+=(My[j][w]/t+Mx[j][w])*L.V[n[w]];
+                    u[j]+=(My[j][w]/t + t*Mx[j][w])*L.V[n[w]];
+                }
+            }
+
+            K = -100.*c*c*c*dv/(a);
+
+            for(j = 0; j<3; j++)
+            {
+                for(w = 0; w<3; w++)
+                {
+                    Mn[j][w] = K*(v[j]*u[w]+v[w]*u[j]);
+                }
+            }
+        }
+        if ((blockproplist[k].LamType==2) && (blockproplist[k].BHpoints>0))
+        {
+            t = blockproplist[k].LamFill;
+
+            for(j = 0,B1 = 0.,B2 = 0.; j<3; j++)
+            {
+                B1+=(L.V[n[j]]*q[j])/t;
+                B2+=L.V[n[j]]*p[j];
+            }
+
+            B = c*sqrt(B1*B1+B2*B2)/(0.02*a);
+
+            blockproplist[k].GetBHProps(B,mu,dv);
+
+            mu = 1./(muo*mu);
+
+            meshele[i].mu2 = mu*t;
+
+            meshele[i].mu1 = mu/(t+mu*(1.-t));
+
+            for(j = 0; j<3; j++)
+            {
+                for(w = 0,v[j] = 0,u[j] = 0; w<3; w++)
+                {
+                    v[j]+=(Mx[j][w]/t + My[j][w])*L.V[n[w]];
+                    u[j]+=(Mx[j][w]/t + t*My[j][w])*L.V[n[w]];
+                }
+            }
+
+            K = -100.*c*c*c*dv/(a);
+
+            for(j = 0; j<3; j++)
+            {
+                for(w = 0; w<3; w++)
+                {
+                    Mn[j][w] = K*(v[j]*u[w]+v[w]*u[j]);
+                }
+            }
+        }
+    }
+
+    // combine block matrices into global matrices;
+    for (j = 0; j<3; j++)
+        for (k = 0; k<3; k++)
+        {
+            Me[j][k]+= (Mx[j][k]/Re(El->mu2) + My[j][k]/Re(El->mu1) + Mxy[j][k] * Re(El->v12) + Mn[j][k]);
+            be[j]+=Mn[j][k]*L.V[n[k]];
+        }
+
+    for (j = 0; j<3; j++)
+    {
+        for (k = j; k<3; k++)
+        {
+            L.AddTo(-Me[j][k],n[j],n[k]);
+        }
+
+        L.b[n[j]]-=be[j];
+    }
+
+    return true;
+}
+
+int FSolver::Static2D(CBigLinProb &L, bool warmStart)
+{
+
+    int i,j,k,m,g,s;
+    double p[3],q[3];           // element shape parameters;
+    int n[3];                   // numbers of nodes for a particular element;
+    double a,K,Ki,r,t,x,y,res,lastres,Cduct;
+    double bestres=-1.;
+    double minRelax=0.125;
     double *V_old=nullptr;
     double *CircInt1=nullptr;
     double *CircInt2=nullptr;
     double *CircInt3=nullptr;
     double c=PI*4.e-05;
-    double units[]= {2.54,0.1,1.,100.,0.00254,1.e-04};
     int Iter=0;
     bool LinearFlag=true;
     int bIncremental = MS_LEGACY_FALSE;
-	double murel, muinc;
+    // the Newton iteration fails if its residual doesn't halve within this many iterations
+    const int newtonStagnation=50;
+    int progress=0;
+    bool solved=true;
+    char msg[256];
+    int numGroups;
+    bool serial;
+    femm::ThreadTeam team(NumThreads);
 
 	if (!previousSolutionFile.empty()) bIncremental = PrevType;
 
@@ -172,6 +644,53 @@ int FSolver::Static2D(CBigLinProb &L)
     // copied from the associated block definition, but nonlinear
     // permeability must be updated from iteration to iteration...
 
+    // a warm start skips the initial linear solution and continues the
+    // Newton iteration from the potential and permeabilities of the last solution
+    if (warmStart)
+    {
+        Iter = 1;
+        for(i = 0; i < NumEls; i++)
+        {
+            if (blockproplist[meshele[i].blk].BHpoints > 0)
+            {
+                LinearFlag = false;
+            }
+        }
+    }
+
+    // There's no previous solution.  This is a standard nonlinear problem
+    if (bIncremental == MS_LEGACY_FALSE)
+    {
+        for(i = 0; i < NumEls; i++)
+        {
+            if (blockproplist[meshele[i].blk].BHpoints != 0)
+            {
+                LinearFlag = false;
+            }
+        }
+    }
+
+    // The elements are split into groups of elements that share no nodes, see colourElements().
+    // The elements of a group can be assembled in parallel.
+    std::vector<int> elements(NumEls), order, groupStart;
+    for(i = 0; i < NumEls; i++)
+    {
+        elements[i] = i;
+    }
+    colourElements(elements, order, groupStart);
+    groupStart.push_back((int)order.size());
+    numGroups = (int)groupStart.size()-1;
+
+    // lua isn't thread safe
+    serial = (team.size()==1);
+    for(i = 0; i < NumBlockLabels; i++)
+    {
+        if (!labellist[i].MagDirFctn.empty())
+        {
+            serial = true;
+        }
+    }
+
     // build element matrices using the matrices derived in Allaire's book.
 
     do
@@ -349,470 +868,38 @@ int FSolver::Static2D(CBigLinProb &L)
 
         }
 
-        for(i = 0; i < NumEls; i++)
+        // The elements of a group share no nodes, so their matrix entries can be written from
+        // several threads, and the result doesn't depend on the threads. The groups only touch
+        // different rows of the matrix, so this works before the sparsity pattern is complete, too.
+        for(g = 0; (g < numGroups) && solved; g++)
         {
-
-//            // update ``building matrix'' progress bar...
-//            j = (i*20) / NumEls + 1;
-//            if(j > pctr)
-//            {
-//                j = pctr * 5;
-//                if (j>100)
-//                {
-//                    j = 100;
-//                }
-//                TheView->m_prog1.SetPos(j);
-//                pctr++;
-//            }
-
-            // zero out Me, be;
-            for(j = 0; j < 3; j++)
-            {
-                for(k = 0; k < 3; k++)
-                {
-                    Me[j][k] = 0.;
-                    Mx[j][k] = 0.;
-                    My[j][k] = 0.;
-                    Mn[j][k] = 0.;
-                    Mxy[j][k] = 0.;
-                }
-                be[j] = 0.;
-            }
-
-            // Determine shape parameters.
-            // l == element side lengths;
-            // p corresponds to the `b' parameter in Allaire
-            // q corresponds to the `c' parameter in Allaire
-            El = &meshele[i];
-
-            for(k = 0; k<3; k++)
-            {
-                n[k] = El->p[k];
-            }
-
-            p[0] = meshnode[n[1]].y - meshnode[n[2]].y;
-            p[1] = meshnode[n[2]].y - meshnode[n[0]].y;
-            p[2] = meshnode[n[0]].y - meshnode[n[1]].y;
-            q[0] = meshnode[n[2]].x - meshnode[n[1]].x;
-            q[1] = meshnode[n[0]].x - meshnode[n[2]].x;
-            q[2] = meshnode[n[1]].x - meshnode[n[0]].x;
-
-            for(j = 0,k = 1; j<3; k++, j++)
-            {
-                if (k == 3)
-                {
-                    k = 0;
-                }
-
-                l[j] = sqrt( pow(meshnode[n[k]].x-meshnode[n[j]].x,2.) +
-                             pow(meshnode[n[k]].y-meshnode[n[j]].y,2.) );
-
-            }
-
-            a = (p[0]*q[1] - p[1]*q[0]) / 2.;
-
-            r = (meshnode[n[0]].x + meshnode[n[1]].x + meshnode[n[2]].x) / 3.;
-
-            // x-contribution; only need to do main diagonal and above;
-            K = (-1. / (4.*a));
-
-            for(j = 0; j<3; j++)
-            {
-                for(k = j; k<3; k++)
-                {
-                    Mx[j][k] += K * p[j] * p[k];
-                    if (j != k)
-                    {
-                        Mx[k][j] += K * p[j] * p[k];
-                    }
-                }
-            }
-
-            // y-contribution; only need to do main diagonal and above;
-            K = (-1. / (4.*a));
-            for(j = 0; j < 3; j++)
-            {
-                for(k = j; k < 3; k++)
-                {
-                    My[j][k] +=K*q[j]*q[k];
-                    if (j != k)
-                    {
-                        My[k][j] += K * q[j] * q[k];
-                    }
-                }
-            }
-
-            // xy-contribution;
-            K = (-1. / (4.*a));
-            for (j = 0; j < 3; j++)
-            {
-                for (k = j; k < 3; k++)
-                {
-                    Mxy[j][k] += K*(p[j] * q[k] + p[k] * q[j]);
-                    if (j != k)
-                    {
-                        Mxy[k][j] += K*(p[j] * q[k] + p[k] * q[j]);
-                    }
-                }
-            }
-
-            // contributions to Me, be from derivative boundary conditions;
-            for(j = 0; j<3; j++)
-            {
-                if (El->e[j] >= 0)
-                {
-                    if (lineproplist[El->e[j]].BdryFormat==2)
-                    {
-                        // conversion factor is 10^(-4) (I think...)
-                        K = -0.0001*c*lineproplist[ El->e[j] ].c0.re*l[j]/6.;
-                        k = j+1;
-                        if(k==3) k = 0;
-                        Me[j][j]+=K*2.;
-                        Me[k][k]+=K*2.;
-                        Me[j][k]+=K;
-                        Me[k][j]+=K;
-
-                        K = (lineproplist[ El->e[j] ].c1.re*l[j]/2.)*0.0001;
-                        be[j]+=K;
-                        be[k]+=K;
-                    }
-                }
-            }
-
-            // contribution to be from current density in the block
-            for(j = 0; j<3; j++)
-            {
-                t = 0;
-                if ( labellist[El->lbl].InCircuit >= 0 )
-                {
-                    k = labellist[El->lbl].InCircuit;
-
-                    if(circproplist[k].Case==1)
-                    {
-                        t = circproplist[k].J.Re();
-                    }
-
-                    if(circproplist[k].Case==0)
-                    {
-                        t = -circproplist[k].dV.Re()*blockproplist[El->blk].Cduct;
-                    }
-                }
-
-                K = -(blockproplist[El->blk].J.re+t)*a/3.;
-
-                be[j]+=K;
-
-                // record avg current density in the block for use in incremental solutions
-                if (bIncremental==MS_LEGACY_FALSE) El->Jprev+=(blockproplist[El->blk].J.Re()+t)/3.;
-            }
-
-            // contribution to be from magnetization in the block;
-            t = labellist[El->lbl].MagDir;
-            // create the formatter object in case of a lua defined mag direction
-//                boost::format fmatter("x=%.17g\ny=%.17g\nr=x\nz=y\ntheta=%.17g\nR=%.17g\nreturn %s");
-            if (!labellist[El->lbl].MagDirFctn.empty()) // functional magnetization direction
-            {
-
-                char magbuff[4096];
-                std::string str;
-                CComplex X;
-                int top1,top2,lua_error_code;
-
-                for (j = 0,X = 0; j<3; j++)
-                {
-                    X += (CComplex)(meshnode[n[j]].x + I * meshnode[n[j]].y);
-                }
-                X = X/units[LengthUnits]/3.;
-                // generate the string using boost::format
-//                    fmatter % (X.re) % (X.im) % (arg(X)*180/PI) % (abs(X)) % (labellist[El->lbl].MagDirFctn);
-                // get the created string
-//                    str = fmatter.str();
-                SNPRINTF(magbuff, sizeof magbuff, "x=%.17g\ny=%.17g\nr=x\nz=y\ntheta=%.17g\nR=%.17g\nreturn %s",
-                              (X.re) , (X.im) , (arg(X)*180/PI) , (abs(X)) , (labellist[El->lbl].MagDirFctn.c_str()));
-                str = magbuff;
-                lua_State * lua = theLua->getLuaState();
-
-                top1 = lua_gettop(lua);
-
-                lua_error_code = theLua->doString(str, femm::LuaInstance::LuaStackMode::Unsafe);
-
-                if(lua_error_code != 0)
-                {
-                    if (lua_error_code==LUA_ERRRUN)
-                        WarnMessage("Lua run Error (LUA_ERRRUN) when evaluating magnetization direction function");
-                    if (lua_error_code==LUA_ERRMEM)
-                        WarnMessage("Lua memory Error (LUA_ERRMEM) when evaluating magnetization direction function");
-                    if (lua_error_code==LUA_ERRERR)
-                        WarnMessage("Lua user error error (LUA_ERRERR) when evaluating magnetization direction function");
-                    if (lua_error_code==LUA_ERRFILE)
-                        WarnMessage("Lua file error (LUA_ERRFILE) when evaluating magnetization direction function");
-
-                    SNPRINTF(magbuff, sizeof magbuff,
-                             "Lua error occurred when evaluating:\n\"%s\"",
-                             labellist[El->lbl].MagDirFctn.c_str());
-
-                    WarnMessage (magbuff);
-
-                    return -7;
-                }
-
-                top2 = lua_gettop(lua);
-
-                if (top2!=top1)
-                {
-                    str = lua_tostring(lua,-1);
-
-                    if (str.length()==0)
-                    {
-                        SNPRINTF(magbuff, sizeof magbuff,
-                                 "\"%s\" does not evaluate to a numerical value",
-                                 labellist[El->lbl].MagDirFctn.c_str());
-
-                        WarnMessage (magbuff);
-
-                        return -7;
-                    }
-                    else
-                    {
-                        t = Re(lua_tonumber(lua,-1));
-                    }
-
-                    lua_pop(lua, 1);
-                }
-
-            }
-            for(j = 0; j<3; j++)
+            const int first = groupStart[g];
+            const int last = groupStart[g+1];
+            if (serial || (last-first < 256*team.size()))
             {
-                k = j+1;
-                if(k==3)
+                for(m = first; (m < last) && solved; m++)
                 {
-                    k = 0;
+                    solved = assemble2DElement(L, order[m], Iter, bIncremental);
                 }
-                // need to scale so that everything is in proper units...
-                // conversion is 0.0001
-                K = 0.0001*blockproplist[El->blk].H_c*(
-                        cos(t*PI/180.)*(meshnode[n[k]].x-meshnode[n[j]].x) +
-                        sin(t*PI/180.)*(meshnode[n[k]].y-meshnode[n[j]].y) )/2.;
-                be[j]+=K;
-                be[k]+=K;
-            }
-
-//////// Nonlinear Part
-
-            // update permeability for the element;
-            if (Iter==0)
-            {
-                k = meshele[i].blk;
-
-                if (blockproplist[k].LamType==0)
-                {
-                    t = blockproplist[k].LamFill;
-                    meshele[i].mu1 = blockproplist[k].mu_x*t + (1.-t);
-                    meshele[i].mu2 = blockproplist[k].mu_y*t + (1.-t);
-                }
-                if (blockproplist[k].LamType==1)
-                {
-                    t = blockproplist[k].LamFill;
-                    mu = blockproplist[k].mu_x;
-                    meshele[i].mu1 = mu*t + (1.-t);
-                    meshele[i].mu2 = mu/(t + mu*(1.-t));
-                }
-                if (blockproplist[k].LamType==2)
-                {
-                    t = blockproplist[k].LamFill;
-                    mu = blockproplist[k].mu_y;
-                    meshele[i].mu2 = mu*t + (1.-t);
-                    meshele[i].mu1 = mu/(t + mu*(1.-t));
-                }
-                if (blockproplist[k].LamType>2)
-                {
-                    meshele[i].mu1 = 1;
-                    meshele[i].mu2 = 1;
-                }
-
-                if (blockproplist[k].BHpoints != 0)
-                {
-                    if (bIncremental == MS_LEGACY_FALSE)
-                    {
-                        // There's no previous solution.  This is a standard nonlinear problem
-                        LinearFlag = false;
-                    }
-                    else {
-                        double B1p, B2p;
-
-                        // too lazy to consistently code incremental/frozen formulation for on-edge lams.
-                        // detect this condition, throw an error, and exit.
-                        if (blockproplist[k].LamType > 0)
-                        {
-                            PrintMessage("On-edge Lam Types not yet supported in\nincremental/frozen permeability problems");
-                            exit(0);
-                        }
-
-                        //	Get B from previous solution
-                        getPrev2DB(i, B1p, B2p);
-                        B = sqrt(B1p*B1p + B2p*B2p);
-
-                        // look up incremental permeability and assign it to the element;
-                        blockproplist[k].IncrementalPermeability(B, muinc, murel);
-
-                        if (B == 0)
-                        {
-                            meshele[i].mu1 = muinc;
-                            meshele[i].mu2 = muinc;
-                            meshele[i].v12 = 0;
-                        }
-                        else {
-                            if (bIncremental == 1)
-                            {
-                                // Need to actually compute B1 and B2 to build incremental permeability tensor
-                                meshele[i].mu1 = B*B*muinc*murel / (B1p*B1p*murel + B2p*B2p*muinc);
-                                meshele[i].mu2 = B*B*muinc*murel / (B1p*B1p*muinc + B2p*B2p*murel);
-                                meshele[i].v12 = -B1p*B2p*(murel - muinc) / (B*B*murel*muinc);
-                            }
-                            else {
-                                // Define "frozen permeability"
-                                meshele[i].mu1 = murel;
-                                meshele[i].mu2 = murel;
-                                meshele[i].v12 = 0;
-                            }
-                        }
-                    }
-                }
-
             }
             else
             {
-                k = meshele[i].blk;
-
-                if ((blockproplist[k].LamType==0) &&
-                        (meshele[i].mu1==meshele[i].mu2)
-                        &&(blockproplist[k].BHpoints>0))
-                {
-                    for(j = 0,B1 = 0.,B2 = 0.; j<3; j++)
-                    {
-                        B1+=L.V[n[j]]*q[j];
-                        B2+=L.V[n[j]]*p[j];
-                    }
-                    B = c*sqrt(B1*B1+B2*B2)/(0.02*a);
-                    // correction for lengths in cm of 1/0.02
-
-                    // find out new mu from saturation curve;
-                    blockproplist[k].GetBHProps(B,mu,dv);
-                    mu = 1./(muo*mu);
-                    meshele[i].mu1 = mu;
-                    meshele[i].mu2 = mu;
-                    for(j = 0; j<3; j++)
-                    {
-                        for(w = 0,v[j] = 0; w<3; w++)
-                            v[j]+=(Mx[j][w]+My[j][w])*L.V[n[w]];
-                    }
-                    K = -200.*c*c*c*dv/a;
-                    for(j = 0; j<3; j++)
-                    {
-                        for(w = 0; w<3; w++)
-                        {
-                            Mn[j][w] = K*v[j]*v[w];
-                        }
-                    }
-                }
-
-                if ((blockproplist[k].LamType==1) && (blockproplist[k].BHpoints>0))
+                team.run([&](int thread)
                 {
-                    t = blockproplist[k].LamFill;
-
-                    for(j = 0,B1 = 0.,B2 = 0.; j<3; j++)
-                    {
-                        B1+=L.V[n[j]]*q[j];
-                        B2+=L.V[n[j]]*p[j]/t;
-                    }
-
-                    B = c*sqrt(B1*B1+B2*B2)/(0.02*a);
-
-                    blockproplist[k].GetBHProps(B,mu,dv);
-
-                    mu = 1./(muo*mu);
-
-                    meshele[i].mu1 = mu*t;
-
-                    meshele[i].mu2 = mu/(t+mu*(1.-t));
-
-                    for(j = 0; j<3; j++)
-                    {
-                        for(w = 0,v[j] = 0,u[j] = 0; w<3; w++)
-                        {
-                            v[j]+=(My[j][w]/t+Mx[j][w])*L.V[n[w]];
-                            u[j]+=(My[j][w]/t + t*Mx[j][w])*L.V[n[w]];
-                        }
-                    }
-
-                    K = -100.*c*c*c*dv/(a);
-
-                    for(j = 0; j<3; j++)
+                    int begin,end;
+                    femm::ThreadTeam::split(thread, team.size(), first, last, begin, end);
+                    for(int e = begin; e < end; e++)
                     {
-                        for(w = 0; w<3; w++)
-                        {
-                            Mn[j][w] = K*(v[j]*u[w]+v[w]*u[j]);
-                        }
-                    }
-                }
-                if ((blockproplist[k].LamType==2) && (blockproplist[k].BHpoints>0))
-                {
-                    t = blockproplist[k].LamFill;
-
-                    for(j = 0,B1 = 0.,B2 = 0.; j<3; j++)
-                    {
-                        B1+=(L.V[n[j]]*q[j])/t;
-                        B2+=L.V[n[j]]*p[j];
+                        assemble2DElement(L, order[e], Iter, bIncremental);
                     }
-
-                    B = c*sqrt(B1*B1+B2*B2)/(0.02*a);
-
-                    blockproplist[k].GetBHProps(B,mu,dv);
-
-                    mu = 1./(muo*mu);
-
-                    meshele[i].mu2 = mu*t;
-
-                    meshele[i].mu1 = mu/(t+mu*(1.-t));
-
-                    for(j = 0; j<3; j++)
-                    {
-                        for(w = 0,v[j] = 0,u[j] = 0; w<3; w++)
-                        {
-                            v[j]+=(Mx[j][w]/t + My[j][w])*L.V[n[w]];
-                            u[j]+=(Mx[j][w]/t + t*My[j][w])*L.V[n[w]];
-                        }
-                    }
-
-                    K = -100.*c*c*c*dv/(a);
-
-                    for(j = 0; j<3; j++)
-                    {
-                        for(w = 0; w<3; w++)
-                        {
-                            Mn[j][w] = K*(v[j]*u[w]+v[w]*u[j]);
-                        }
-                    }
-                }
+                });
             }
+        }
 
-            // combine block matrices into global matrices;
-            for (j = 0; j<3; j++)
-                for (k = 0; k<3; k++)
-                {
-                    Me[j][k]+= (Mx[j][k]/Re(El->mu2) + My[j][k]/Re(El->mu1) + Mxy[j][k] * Re(El->v12) + Mn[j][k]);
-                    be[j]+=Mn[j][k]*L.V[n[k]];
-                }
-
-            for (j = 0; j<3; j++)
-            {
-                for (k = j; k<3; k++)
-                {
-                    L.AddTo(-Me[j][k],n[j],n[k]);
-                }
-
-                L.b[n[j]]-=be[j];
-            }
+        // a magnetization direction couldn't be evaluated
+        if (!solved)
+        {
+            break;
         }
 
         // add in contribution from point currents;
@@ -947,7 +1034,8 @@ int FSolver::Static2D(CBigLinProb &L)
 
         if (L.PCGSolve(Iter)==false)
         {
-            return false;
+            solved = false;
+            break;
         }
 
         if (LinearFlag==false)
@@ -973,7 +1061,7 @@ int FSolver::Static2D(CBigLinProb &L)
             // relaxation if we need it
             if(Iter>5)
             {
-                if ((res>lastres) && (Relax>0.125))
+                if ((res>lastres) && (Relax>minRelax))
                 {
                     Relax/=2.;
                 }
@@ -988,6 +1076,35 @@ int FSolver::Static2D(CBigLinProb &L)
                 }
             }
 
+            // if the residual stops decreasing, allow a stronger relaxation once before giving up
+            if (!std::isfinite(res))
+            {
+                WarnMessage("Newton iteration diverged\n");
+                solved = false;
+                break;
+            }
+            if ((bestres<0) || (res<0.5*bestres))
+            {
+                bestres = res;
+                progress = Iter;
+            }
+            else if (Iter-progress>=newtonStagnation)
+            {
+                if (minRelax<0.125)
+                {
+                    SNPRINTF(msg, sizeof(msg), "Newton iteration stagnates at a residual of %g\n", res);
+                    WarnMessage(msg);
+                    solved = false;
+                    break;
+                }
+                minRelax = 0.125/8.;
+                if (Relax>0.125)
+                {
+                    Relax = 0.125;
+                }
+                progress = Iter;
+            }
+
 
             // report some results
             // char outstr[256];
@@ -1012,6 +1129,13 @@ int FSolver::Static2D(CBigLinProb &L)
 
         Iter++;
 
+        if ((LinearFlag==false) && (Iter>=MaxNewtonIterations))
+        {
+            SNPRINTF(msg, sizeof(msg), "Newton iteration didn't converge within %i iterations\n", Iter);
+            WarnMessage(msg);
+            solved = false;
+            break;
+        }
     }
     while(LinearFlag==false);
 
@@ -1029,7 +1153,7 @@ int FSolver::Static2D(CBigLinProb &L)
         free(CircInt3);
     }
 
-    return true;
+    return solved;
 }
 
 //=========================================================================
@@ -1194,3 +1318,59 @@ int FSolver::WriteStatic2D(CBigLinProb &L)
     return true;
 }
 
+void FSolver::StoreStatic2D(CBigLinProb &L)
+{
+    double unitconv[]= {2.54,0.1,1.,100.,0.00254,1.e-04};
+    double cf = unitconv[LengthUnits];
+
+    solution.clear();
+
+    solution.nodes.resize(NumNodes);
+    for(int i = 0; i<NumNodes; i++)
+    {
+        solution.nodes[i].x = meshnode[i].x/cf;
+        solution.nodes[i].y = meshnode[i].y/cf;
+        solution.nodes[i].A = L.b[i];
+        solution.nodes[i].marker = meshnode[i].BoundaryMarker;
+    }
+    solution.Aprev = Aprev;
+
+    solution.elements.resize(NumEls);
+    for(int i = 0; i<NumEls; i++)
+    {
+        for(int j = 0; j<3; j++)
+            solution.elements[i].p[j] = meshele[i].p[j];
+        solution.elements[i].lbl = meshele[i].lbl;
+        solution.elements[i].Jprev = 0;
+    }
+
+    // circuit info on a blocklabel by blocklabel basis;
+    solution.blocks.resize(NumBlockLabels);
+    for(int k = 0; k<NumBlockLabels; k++)
+    {
+        int i = labellist[k].InCircuit;
+
+        // blocks that are not associated with any particular circuit
+        // get a fixed additional current density of zero
+        solution.blocks[k].Case = 1;
+        solution.blocks[k].value = 0;
+        if(i>=0)
+        {
+            if (circproplist[i].Case==0)
+            {
+                solution.blocks[k].Case = 0;
+                solution.blocks[k].value = circproplist[i].dV.Re();
+            }
+
+            if (circproplist[i].Case==1)
+            {
+                solution.blocks[k].Case = 1;
+                solution.blocks[k].value = circproplist[i].J.Re();
+            }
+        }
+    }
+
+    solution.pbcs = pbclist;
+    solution.agelist = agelist;
+}
+
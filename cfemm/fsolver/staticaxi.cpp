@@ -26,11 +26,14 @@
 #include "lua.h"
 #include "LuaInstance.h"
 #include "spars.h"
+#include "ThreadTeam.h"
 
+#include <cmath>
 #include <cstdio>
 #include <malloc.h>
 #include <math.h>
 #include <string>
+#include <vector>
 
 #ifdef _WIN32
   #ifndef SNPRINTF
@@ -42,20 +45,584 @@
   #endif
 #endif
 
-int FSolver::StaticAxisymmetric(CBigLinProb &L)
+// length units of the problem in centimetres
+static const double units[]= {2.54,0.1,1.,100.,0.00254,1.e-04};
+
+// expand a symmetric matrix of FSolver::AxiGeometry
+static void unpackSymmetric(const std::vector<double> *packed, int i, double M[3][3])
+{
+    M[0][0]=packed[0][i];
+    M[0][1]=M[1][0]=packed[1][i];
+    M[0][2]=M[2][0]=packed[2][i];
+    M[1][1]=packed[3][i];
+    M[1][2]=M[2][1]=packed[4][i];
+    M[2][2]=packed[5][i];
+}
+
+void FSolver::buildAxiGeometry()
+{
+    int i,j,k;
+    int n[3];
+    double l[3],p[3],q[3],g[3],rn[3];
+    double a,K,R,a_hat,R_hat=0.;
+    double Mx[3][3],My[3][3],Mxy[3][3];
+    int flag;
+    AxiGeometry &geo = axiGeometry;
+
+    for(j=0; j<3; j++)
+    {
+        geo.node[j].resize(NumEls);
+        geo.l[j].resize(NumEls);
+    }
+    geo.area.resize(NumEls);
+    geo.R.resize(NumEls);
+    geo.vol.resize(NumEls);
+    for(j=0; j<6; j++)
+    {
+        geo.Mx[j].resize(NumEls);
+        geo.My[j].resize(NumEls);
+        geo.Mxy[j].resize(NumEls);
+    }
+
+    for(i=0; i<NumEls; i++)
+    {
+        // Determine shape parameters.
+        // l == element side lengths;
+        // p corresponds to the `b' parameter in Allaire
+        // q corresponds to the `c' parameter in Allaire
+        for(k=0; k<3; k++)
+        {
+            n[k]=meshele[i].p[k];
+            rn[k]=meshnode[n[k]].x;
+        }
+
+        p[0]=meshnode[n[1]].y - meshnode[n[2]].y;
+        p[1]=meshnode[n[2]].y - meshnode[n[0]].y;
+        p[2]=meshnode[n[0]].y - meshnode[n[1]].y;
+        q[0]=meshnode[n[2]].x - meshnode[n[1]].x;
+        q[1]=meshnode[n[0]].x - meshnode[n[2]].x;
+        q[2]=meshnode[n[1]].x - meshnode[n[0]].x;
+        g[0]=(meshnode[n[2]].x + meshnode[n[1]].x)/2.;
+        g[1]=(meshnode[n[0]].x + meshnode[n[2]].x)/2.;
+        g[2]=(meshnode[n[1]].x + meshnode[n[0]].x)/2.;
+
+        for(j=0,k=1; j<3; k++,j++)
+        {
+            if (k==3) k=0;
+            l[j]=sqrt( pow(meshnode[n[k]].x-meshnode[n[j]].x,2.) +
+                       pow(meshnode[n[k]].y-meshnode[n[j]].y,2.) );
+        }
+
+        a=(p[0]*q[1]-p[1]*q[0])/2.;
+        R=(meshnode[n[0]].x+meshnode[n[1]].x+meshnode[n[2]].x)/3.;
+
+        for(j=0,a_hat=0; j<3; j++) a_hat+=(rn[j]*rn[j]*p[j]/(4.*R));
+
+        for(j=0,flag=0; j<3; j++) if(rn[j]<1.e-06) flag++;
+        switch(flag)
+        {
+        case 2:
+            R_hat=R;
+
+            break;
+
+        case 1:
+
+            if(rn[0]<1.e-06)
+            {
+                if (fabs(rn[1]-rn[2])<1.e-06) R_hat=rn[2]/2.;
+                else R_hat=(rn[1] - rn[2])/(2.*log(rn[1]) - 2.*log(rn[2]));
+            }
+            if(rn[1]<1.e-06)
+            {
+                if (fabs(rn[2]-rn[0])<1.e-06) R_hat=rn[0]/2.;
+                else R_hat=(rn[2] - rn[0])/(2.*log(rn[2]) - 2.*log(rn[0]));
+            }
+            if(rn[2]<1.e-06)
+            {
+                if (fabs(rn[0]-rn[1])<1.e-06) R_hat=rn[1]/2.;
+                else R_hat=(rn[0] - rn[1])/(2.*log(rn[0]) - 2.*log(rn[1]));
+            }
+
+            break;
+
+        default:
+
+            if (fabs(q[0])<1.e-06)
+                R_hat=(q[1]*q[1])/(2.*(-q[1] + rn[0]*log(rn[0]/rn[2])));
+            else if (fabs(q[1])<1.e-06)
+                R_hat=(q[2]*q[2])/(2.*(-q[2] + rn[1]*log(rn[1]/rn[0])));
+            else if (fabs(q[2])<1.e-06)
+                R_hat=(q[0]*q[0])/(2.*(-q[0] + rn[2]*log(rn[2]/rn[1])));
+            else
+                R_hat=-(q[0]*q[1]*q[2])/
+                      (2.*(q[0]*rn[0]*log(rn[0]) +
+                           q[1]*rn[1]*log(rn[1]) +
+                           q[2]*rn[2]*log(rn[2])));
+
+            break;
+        }
+
+        for(j=0; j<3; j++)
+            for(k=0; k<3; k++)
+            {
+                Mx[j][k]=0.;
+                My[j][k]=0.;
+                Mxy[j][k]=0.;
+            }
+
+        // Mr Contribution
+        // Derived from flux formulation with c0 + c1 r^2 + c2 z
+        // interpolation in the element.
+        K=(-1./(2.*a_hat*R));
+        for(j=0; j<3; j++)
+            for(k=j; k<3; k++)
+                Mx[j][k] += K*p[j]*rn[j]*p[k]*rn[k];
+
+        // need this loop to avoid singularities.  This just puts something
+        // on the main diagonal of nodes that are on the r=0 line.
+        // The program later sets these nodes to zero, but it's good to
+        // for scaling reasons to grab entries from the neighboring diagonals
+        // rather than just setting these entries to 1 or something....
+        for(j=0; j<3; j++)
+            if (rn[j]<1.e-06) Mx[j][j]+=Mx[0][0]+Mx[1][1]+Mx[2][2];
+
+        // Mz Contribution;
+        // Derived from flux formulation with c0 + c1 r^2 + c2 z
+        // interpolation in the element.
+        K=(-1./(2.*a_hat*R_hat));
+        for(j=0; j<3; j++)
+            for(k=j; k<3; k++)
+                My[j][k] += K*(q[j]*rn[j])*(q[k]*rn[k])*
+                            (g[j]/R)*(g[k]/R);
+
+        // Mrz Contribution;
+        // Derived from flux formulation with c0 + c1 r^2 + c2 z
+        // interpolation in the element.
+        K = (-1. / (2.*a_hat*R_hat));
+        for (j = 0;j<3;j++)
+            for (k = j;k<3;k++)
+                Mxy[j][k] += K*((q[j] * rn[j])*(g[j] / R))*(p[k] * rn[k]) + K*((q[k] * rn[k])*(g[k] / R))*(p[j] * rn[j]);
+
+        for(j=0; j<3; j++)
+        {
+            geo.node[j][i]=n[j];
+            geo.l[j][i]=l[j];
+        }
+        geo.area[i]=a;
+        geo.R[i]=R;
+        geo.vol[i]=2.*R*a_hat;
+        for(j=0,k=0; j<3; j++)
+            for(int w=j; w<3; w++,k++)
+            {
+                geo.Mx[k][i]=Mx[j][w];
+                geo.My[k][i]=My[j][w];
+                geo.Mxy[k][i]=Mxy[j][w];
+            }
+    }
+
+    // assembly order: the linear elements first, see StaticAxisymmetric()
+    std::vector<int> elements;
+    elements.reserve(NumEls);
+    geo.order.clear();
+    geo.groupStart.clear();
+    for(i=0; i<NumEls; i++)
+        if (blockproplist[meshele[i].blk].BHpoints==0) elements.push_back(i);
+    colourElements(elements,geo.order,geo.groupStart);
+    geo.numLinearGroups=(int)geo.groupStart.size();
+    elements.clear();
+    for(i=0; i<NumEls; i++)
+        if (blockproplist[meshele[i].blk].BHpoints!=0) elements.push_back(i);
+    colourElements(elements,geo.order,geo.groupStart);
+    geo.groupStart.push_back((int)geo.order.size());
+}
+
+bool FSolver::assembleAxiElement(CBigLinProb &L, int i, int Iter, int bIncremental)
 {
-    int i,j,k,s,w;
+    int j,k,w;
     double Me[3][3],Mx[3][3],My[3][3],Mxy[3][3],Mn[3][3];
-    double l[3],p[3]={0.,0.,0.},q[3]={0.,0.,0.},g[3],be[3],u[3],v[3],res,lastres=0.,dv,vol;
-    int n[3] = { 0, 0, 0}; // numbers of nodes for a particular element;
-    double a,K,r,t=0.,x,y,B,mu,R,rn[3],a_hat,R_hat=0.,Cduct;
+    double l[3],be[3],u[3],v[3],dv,vol;
+    int n[3];
+    double a,K,r,t=0.,B,mu,R;
+    const double c=PI*4.e-05;
+    double murel, muinc;
+    const AxiGeometry &geo = axiGeometry;
+    femmsolver::CMElement *El;
+
+    // zero out Me, be;
+    for(j=0; j<3; j++)
+    {
+        for(k=0; k<3; k++)
+        {
+            Me[j][k] = 0.;
+            Mn[j][k] = 0.;
+        }
+        be[j]=0.;
+    }
+
+    El=&meshele[i];
+
+    // geometry of the element, see buildAxiGeometry()
+    for(j=0; j<3; j++)
+    {
+        n[j]=geo.node[j][i];
+        l[j]=geo.l[j][i];
+    }
+    a=geo.area[i];
+    R=geo.R[i];
+    vol=geo.vol[i];
+    unpackSymmetric(geo.Mx,i,Mx);
+    unpackSymmetric(geo.My,i,My);
+    unpackSymmetric(geo.Mxy,i,Mxy);
+
+    // contributions to Me, be from derivative boundary conditions;
+    for(j=0; j<3; j++)
+    {
+        if (El->e[j] >= 0)
+            if (lineproplist[El->e[j]].BdryFormat==2)
+            {
+                // conversion factor is 10^(-4) (I think...)
+                k=j+1;
+                if(k==3) k=0;
+                r=(meshnode[n[j]].x+meshnode[n[k]].x)/2.;
+                K=-0.0001*c*2.*r*lineproplist[ El->e[j] ].c0.re*l[j]/6.;
+                k=j+1;
+                if(k==3) k=0;
+                Me[j][j]+=K*2.;
+                Me[k][k]+=K*2.;
+                Me[j][k]+=K;
+                Me[k][j]+=K;
+
+                K=(lineproplist[ El->e[j] ].c1.re*l[j]/2.)*0.0001*2*r;
+                be[j]+=K;
+                be[k]+=K;
+            }
+    }
+
+    // contribution to be from current density in the block
+    for(j=0; j<3; j++)
+    {
+        if(labellist[El->lbl].InCircuit>=0)
+        {
+            k=labellist[El->lbl].InCircuit;
+            if(circproplist[k].Case==1) t=circproplist[k].J.Re();
+            if(circproplist[k].Case==0)
+                t=-100.*circproplist[k].dV.Re()*blockproplist[El->blk].Cduct/R;
+        }
+        else t=0;
+        K=-2.*R*(blockproplist[El->blk].J.re+t)*a/3.;
+        be[j]+=K;
+
+        // record avg current density in the block for use in incremental solutions
+        if (bIncremental==0) El->Jprev+=(blockproplist[El->blk].J.re+t)/3.;
+
+    }
+
+    // contribution to be from magnetization in the block;
+    t=labellist[El->lbl].MagDir;
+    // create the formatter object in case of a lua defined mag direction
+//                boost::format fmatter("r=%.17g\nz=%.17g\nx=r\ny=z\ntheta=%.17g\nR=%.17g\nreturn %s");
+    if (!labellist[El->lbl].MagDirFctn.empty()) // functional magnetization direction
+    {
+        char magbuff[4096];
+        std::string str;
+        CComplex X;
+        int top1,top2;
+        for (j=0,X=0; j<3; j++) X+=(meshnode[n[j]].x + I*meshnode[n[j]].y);
+        X=X/units[LengthUnits]/3.;
+        // generate the string using boost::format
+//                    fmatter % (X.re) % (X.im) % (arg(X)*180/PI) % (abs(X)) % (labellist[El->lbl].MagDirFctn);
+        // get the created string
+//                    str = fmatter.str();
+        SNPRINTF(magbuff, sizeof magbuff, "r=%.17g\nz=%.17g\nx=r\ny=z\ntheta=%.17g\nR=%.17g\nreturn %s",
+                     (X.re) , (X.im) , (arg(X)*180/PI) , (abs(X)) , (labellist[El->lbl].MagDirFctn.c_str()));
+        str = magbuff;
+
+        lua_State *lua = theLua->getLuaState();
+
+        top1=lua_gettop(lua);
+
+        int lua_error_code = theLua->doString(str, femm::LuaInstance::LuaStackMode::Unsafe);
+
+        if(lua_error_code != 0)
+        {
+            if (lua_error_code==LUA_ERRRUN)
+                WarnMessage("Lua run Error (LUA_ERRRUN) when evaluating magnetization direction function");
+            if (lua_error_code==LUA_ERRMEM)
+                WarnMessage("Lua memory Error (LUA_ERRMEM) when evaluating magnetization direction function");
+            if (lua_error_code==LUA_ERRERR)
+                WarnMessage("Lua user error error (LUA_ERRERR) when evaluating magnetization direction function");
+            if (lua_error_code==LUA_ERRFILE)
+                WarnMessage("Lua file error (LUA_ERRFILE) when evaluating magnetization direction function");
+
+            SNPRINTF(magbuff, sizeof magbuff,
+                     "Lua error occurred when evaluating:\n\"%s\"",
+                     labellist[El->lbl].MagDirFctn.c_str());
+
+            WarnMessage(magbuff);
+
+            return false;
+        }
+
+        top2=lua_gettop(lua);
+        if (top2!=top1)
+        {
+            str=lua_tostring(lua,-1);
+            if (str.length()==0)
+            {
+                SNPRINTF(magbuff, sizeof magbuff,
+                         "\"%s\" does not evaluate to a numerical value",
+                         labellist[El->lbl].MagDirFctn.c_str());
+
+                WarnMessage (magbuff);
+
+                return false;
+            }
+            else t=Re(lua_tonumber(lua,-1));
+        }
+    }
+    for(j=0; j<3; j++)
+    {
+        k=j+1;
+        if(k==3) k=0;
+        r=(meshnode[n[j]].x+meshnode[n[k]].x)/2.;
+        // need to scale so that everything is in proper units...
+        // conversion is 0.0001
+        K=-0.0001*r*blockproplist[El->blk].H_c*(
+              cos(t*PI/180.)*(meshnode[n[k]].x-meshnode[n[j]].x) +
+              sin(t*PI/180.)*(meshnode[n[k]].y-meshnode[n[j]].y) );
+        be[j]+=K;
+        be[k]+=K;
+    }
+
+    // update permeability for the element;
+    if (Iter==0){
+        k=meshele[i].blk;
+
+        if (blockproplist[k].LamType == 0) {
+            mu = blockproplist[k].LamFill;
+            meshele[i].mu1 = blockproplist[k].mu_x*mu;
+            meshele[i].mu2 = blockproplist[k].mu_y*mu;
+        }
+        if (blockproplist[k].LamType == 1) {
+            mu = blockproplist[k].LamFill;
+            K = blockproplist[k].mu_x;
+            meshele[i].mu1 = K*mu + (1. - mu);
+            meshele[i].mu2 = K / (mu + K*(1. - mu));
+        }
+        if (blockproplist[k].LamType == 2) {
+            mu = blockproplist[k].LamFill;
+            K = blockproplist[k].mu_y;
+            meshele[i].mu1 = K*mu + (1. - mu);
+            meshele[i].mu2 = K / (mu + K*(1. - mu));
+        }
+        if (blockproplist[k].LamType>2)
+        {
+            meshele[i].mu1 = 1;
+            meshele[i].mu2 = 1;
+        }
+
+        if (blockproplist[k].BHpoints != 0)
+        {
+            // without a previous solution this is a standard nonlinear problem,
+            // see LinearFlag in StaticAxisymmetric()
+            if (bIncremental != 0)
+            {
+                double B1p, B2p;
+
+                // too lazy to consistently code incremental/frozen formulation for on-edge lams.
+                // detect this condition, throw an error, and exit.
+                if (blockproplist[k].LamType > 0)
+                {
+                    PrintMessage("On-edge Lam Types not yet supported in incremental/frozen permeability problems");
+                    exit(0);
+                }
+
+                //	Get B from previous solution
+                getPrevAxiB(i,B1p,B2p);
+                B = sqrt(B1p*B1p + B2p*B2p);
+
+                // look up incremental permeability and assign it to the element;
+                blockproplist[k].IncrementalPermeability(B, muinc, murel);
+                if (B == 0)
+                {
+                    meshele[i].mu1 = muinc;
+                    meshele[i].mu2 = muinc;
+                    meshele[i].v12 = 0;
+                }
+                else {
+                    if (bIncremental == 1)
+                    {
+                    //	MsgBox("muinc = %g, murel=%g",muinc,murel);
+                        // Need to actually compute B1 and B2 to build incremental permeability tensor
+                        meshele[i].mu1 = B*B*muinc*murel / (B1p*B1p*murel + B2p*B2p*muinc);
+                        meshele[i].mu2 = B*B*muinc*murel / (B1p*B1p*muinc + B2p*B2p*murel);
+                        meshele[i].v12 = -B1p*B2p*(murel - muinc) / (B*B*murel*muinc);
+                    }
+                    else {
+                        // Define "frozen permeability"
+                        meshele[i].mu1 = murel;
+                        meshele[i].mu2 = murel;
+                        meshele[i].v12 = 0;
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        k=meshele[i].blk;
+
+        if ((blockproplist[k].LamType==0) &&
+                (meshele[i].mu1==meshele[i].mu2)
+                &&(blockproplist[k].BHpoints>0))
+        {
+            //	Derive B directly from energy;
+            v[0]=0;
+            v[1]=0;
+            v[2]=0;
+            for(j=0; j<3; j++)
+                for(w=0; w<3; w++)
+                    v[j]+=(Mx[j][w]+My[j][w])*L.V[n[w]];
+            for(j=0,dv=0; j<3; j++) dv+=L.V[n[j]]*v[j];
+            dv*=(10000.*c*c/vol);
+            B=sqrt(fabs(dv));
+
+            // find out new mu from saturation curve;
+            blockproplist[k].GetBHProps(B,mu,dv);
+            mu=1./(muo*mu);
+            meshele[i].mu1=mu;
+            meshele[i].mu2=mu;
+            for(j=0; j<3; j++)
+            {
+                for(w=0,v[j]=0; w<3; w++)
+                    v[j]+=(Mx[j][w]+My[j][w])*L.V[n[w]];
+            }
+
+            K=-200.*c*c*c*dv/vol;
+            for(j=0; j<3; j++)
+                for(w=0; w<3; w++)
+                    Mn[j][w]=K*v[j]*v[w];
+        }
+
+        if ((blockproplist[k].LamType==1) && (blockproplist[k].BHpoints>0))
+        {
+
+            //	Derive B directly from energy;
+            t=blockproplist[k].LamFill;
+            v[0]=0;
+            v[1]=0;
+            v[2]=0;
+            for(j=0; j<3; j++)
+                for(w=0; w<3; w++)
+                    v[j]+=(Mx[j][w]+My[j][w]/(t*t))*L.V[n[w]];
+            for(j=0,dv=0; j<3; j++) dv+=L.V[n[j]]*v[j];
+            dv*=(10000.*c*c/vol);
+            B=sqrt(fabs(dv));
+
+            // Evaluate BH curve
+            blockproplist[k].GetBHProps(B,mu,dv);
+            mu=1./(muo*mu);
+            meshele[i].mu1=mu*t;
+            meshele[i].mu2=mu/(t+mu*(1.-t));
+            for(j=0; j<3; j++)
+            {
+                for(w=0,v[j]=0,u[j]=0; w<3; w++)
+                {
+                    v[j]+=(My[j][w]/t+Mx[j][w])*L.V[n[w]];
+                    u[j]+=(My[j][w]/t + t*Mx[j][w])*L.V[n[w]];
+                }
+            }
+            K=-100.*c*c*c*dv/(vol);
+            for(j=0; j<3; j++)
+                for(w=0; w<3; w++)
+                    Mn[j][w]=K*(v[j]*u[w]+v[w]*u[j]);
+        }
+        if ((blockproplist[k].LamType==2) && (blockproplist[k].BHpoints>0))
+        {
+
+            //	Derive B directly from energy;
+            t=blockproplist[k].LamFill;
+            v[0]=0;
+            v[1]=0;
+            v[2]=0;
+            for(j=0; j<3; j++)
+                for(w=0; w<3; w++)
+                    v[j]+=(Mx[j][w]/(t*t)+My[j][w])*L.V[n[w]];
+            for(j=0,dv=0; j<3; j++) dv+=L.V[n[j]]*v[j];
+            dv*=(10000.*c*c/vol);
+            B=sqrt(fabs(dv));
+
+            // Evaluate BH curve
+            blockproplist[k].GetBHProps(B,mu,dv);
+            mu=1./(muo*mu);
+            meshele[i].mu2=mu*t;
+            meshele[i].mu1=mu/(t+mu*(1.-t));
+
+            for(j=0; j<3; j++)
+            {
+                for(w=0,v[j]=0,u[j]=0; w<3; w++)
+                {
+                    v[j]+=(Mx[j][w]/t + My[j][w])*L.V[n[w]];
+                    u[j]+=(Mx[j][w]/t + t*My[j][w])*L.V[n[w]];
+                }
+            }
+            K=-100.*c*c*c*dv/(vol);
+            for(j=0; j<3; j++)
+                for(w=0; w<3; w++)
+                    Mn[j][w]=K*(v[j]*u[w]+v[w]*u[j]);
+
+        }
+    }
+
+    // "Warp" the permeability of this element if part of
+    // the conformally mapped external region
+    if((labellist[meshele[i].lbl].IsExternal) && (Iter==0))
+    {
+        double Z=(meshnode[n[0]].y+meshnode[n[1]].y+meshnode[n[2]].y)/3. - extZo;
+        double kludge=(R*R+Z*Z)*extRi/(extRo*extRo*extRo);
+        meshele[i].mu1/=kludge;
+        meshele[i].mu2/=kludge;
+    }
+
+    // combine block matrices into global matrices;
+    for(j=0; j<3; j++)
+        for(k=0; k<3; k++)
+        {
+            Me[j][k]+= (Mx[j][k]/Re(El->mu2) + My[j][k]/Re(El->mu1) + Mxy[j][k] * Re(El->v12) + Mn[j][k]);
+            be[j]+=Mn[j][k]*L.V[n[k]];
+        }
+
+    for (j=0; j<3; j++)
+    {
+        for (k=j; k<3; k++)
+            L.AddTo(-Me[j][k],n[j],n[k]);
+        L.b[n[j]]-=be[j];
+    }
+
+    return true;
+}
+
+int FSolver::StaticAxisymmetric(CBigLinProb &L, bool warmStart)
+{
+    int i,j,k,m,g,s;
+    double res,lastres=0.,bestres=-1.;
+    double minRelax=0.125;
+    double a,r,t=0.,x,y,Cduct;
     double c=PI*4.e-05;
-    double units[]= {2.54,0.1,1.,100.,0.00254,1.e-04};
     double *V_old=NULL,*CircInt1=NULL,*CircInt2=NULL,*CircInt3=NULL;
-    int flag,Iter=0;
+    int Iter=0;
     int LinearFlag=true;
     int bIncremental = 0;
-	double murel, muinc;
+    int numGroups;
+    // the Newton iteration fails if its residual doesn't halve within this many iterations
+    const int newtonStagnation=50;
+    int progress=0;
+    bool solved=true;
+    char msg[256];
+    bool serial;
+    bool linearPartStored=false;
+    femm::ThreadTeam team(NumThreads);
 
 	if (!previousSolutionFile.empty()) bIncremental = PrevType;
 
@@ -66,9 +633,17 @@ int FSolver::StaticAxisymmetric(CBigLinProb &L)
 
     for(i=0; i<NumBlockLabels; i++) GetFillFactor(i);
 
-    extRo*=units[LengthUnits];
-    extRi*=units[LengthUnits];
-    extZo*=units[LengthUnits];
+    // the mesh doesn't change during a current sweep
+    if (!warmStart || ((int)axiGeometry.R.size()!=NumEls)) buildAxiGeometry();
+    const AxiGeometry &geo = axiGeometry;
+
+    // the exterior region is set up by the first (cold) solution only
+    if (!warmStart)
+    {
+        extRo*=units[LengthUnits];
+        extRi*=units[LengthUnits];
+        extZo*=units[LengthUnits];
+    }
 
     // check to see if any circuits have been defined and process them;
     if (NumCircProps>0)
@@ -84,15 +659,8 @@ int FSolver::StaticAxisymmetric(CBigLinProb &L)
                     El=&meshele[i];
 
                     // get element area;
-                    for(k=0; k<3; k++) n[k]=El->p[k];
-                    p[0]=meshnode[n[1]].y - meshnode[n[2]].y;
-                    p[1]=meshnode[n[2]].y - meshnode[n[0]].y;
-                    p[2]=meshnode[n[0]].y - meshnode[n[1]].y;
-                    q[0]=meshnode[n[2]].x - meshnode[n[1]].x;
-                    q[1]=meshnode[n[0]].x - meshnode[n[2]].x;
-                    q[2]=meshnode[n[1]].x - meshnode[n[0]].x;
-                    a=(p[0]*q[1]-p[1]*q[0])/2.;
-                    r=(meshnode[n[0]].x+meshnode[n[1]].x+meshnode[n[2]].x)/3.;
+                    a=geo.area[i];
+                    r=geo.R[i];
 
                     // if coils are wound, they act like they have
                     // a zero "bulk" conductivity...
@@ -141,6 +709,35 @@ int FSolver::StaticAxisymmetric(CBigLinProb &L)
     // copied from the associated block definition, but nonlinear
     // permeability must be updated from iteration to iteration...
 
+    // a warm start skips the initial linear solution and continues the
+    // Newton iteration from the potential and permeabilities of the last solution
+    if (warmStart) Iter=1;
+
+    // There's no previous solution.  This is a standard nonlinear problem
+    if (bIncremental==0)
+        for(i=0; i<NumEls; i++)
+            if (blockproplist[meshele[i].blk].BHpoints!=0) LinearFlag=false;
+
+    // Only the elements with a nonlinear material change between Newton iterations.
+    // The linear elements are assembled first and stored, so that the following
+    // iterations start from the stored matrix and only add the nonlinear elements.
+    // Both sets are split into groups of elements that can be assembled in parallel,
+    // see buildAxiGeometry().
+    numGroups=(int)geo.groupStart.size()-1;
+
+    // lua isn't thread safe
+    serial=(team.size()==1);
+    for(i=0; i<NumBlockLabels; i++)
+        if (!labellist[i].MagDirFctn.empty()) serial=true;
+
+    // Threads must not insert entries into the compressed matrix of StoreAssembly(),
+    // so the sparsity pattern of all elements is built first.
+    if (!serial && !warmStart)
+        for(i=0; i<NumEls; i++)
+            for(j=0; j<3; j++)
+                for(k=j; k<3; k++)
+                    L.AddTo(0.,geo.node[j][i],geo.node[k][i]);
+
     // build element matrices using the matrices derived in Allaire's book.
 
     do
@@ -151,487 +748,44 @@ int FSolver::StaticAxisymmetric(CBigLinProb &L)
         //printf("Matrix Construction\n");
 //        pctr=0;
 
-        if(Iter>0) L.Wipe();
-
-        for(i=0; i<NumEls; i++)
+        if(Iter>0)
         {
+            if (linearPartStored) L.RestoreAssembly();
+            else L.Wipe();
+        }
 
-//            // update ``building matrix'' progress bar...
-//            j=(i*20)/NumEls+1;
-//            if(j>pctr)
-//            {
-//                j=pctr*5;
-//                if (j>100) j=100;
-//                TheView->m_prog1.SetPos(j);
-//                pctr++;
-//            }
-
-            // zero out Me, be;
-            for(j=0; j<3; j++)
-            {
-                for(k=0; k<3; k++)
-                {
-                    Me[j][k] = 0.;
-                    Mx[j][k] = 0.;
-                    My[j][k] = 0.;
-                    Mxy[j][k] = 0.;
-                    Mn[j][k] = 0.;
-                }
-                be[j]=0.;
-            }
-
-            // Determine shape parameters.
-            // l == element side lengths;
-            // p corresponds to the `b' parameter in Allaire
-            // q corresponds to the `c' parameter in Allaire
-            El=&meshele[i];
-
-            for(k=0; k<3; k++)
-            {
-                n[k]=El->p[k];
-                rn[k]=meshnode[n[k]].x;
-            }
-
-            p[0]=meshnode[n[1]].y - meshnode[n[2]].y;
-            p[1]=meshnode[n[2]].y - meshnode[n[0]].y;
-            p[2]=meshnode[n[0]].y - meshnode[n[1]].y;
-            q[0]=meshnode[n[2]].x - meshnode[n[1]].x;
-            q[1]=meshnode[n[0]].x - meshnode[n[2]].x;
-            q[2]=meshnode[n[1]].x - meshnode[n[0]].x;
-            g[0]=(meshnode[n[2]].x + meshnode[n[1]].x)/2.;
-            g[1]=(meshnode[n[0]].x + meshnode[n[2]].x)/2.;
-            g[2]=(meshnode[n[1]].x + meshnode[n[0]].x)/2.;
-
-            for(j=0,k=1; j<3; k++,j++)
-            {
-                if (k==3) k=0;
-                l[j]=sqrt( pow(meshnode[n[k]].x-meshnode[n[j]].x,2.) +
-                           pow(meshnode[n[k]].y-meshnode[n[j]].y,2.) );
-            }
-
-            a=(p[0]*q[1]-p[1]*q[0])/2.;
-            R=(meshnode[n[0]].x+meshnode[n[1]].x+meshnode[n[2]].x)/3.;
-
-            for(j=0,a_hat=0; j<3; j++) a_hat+=(rn[j]*rn[j]*p[j]/(4.*R));
-            vol=2.*R*a_hat;
-
-            for(j=0,flag=0; j<3; j++) if(rn[j]<1.e-06) flag++;
-            switch(flag)
-            {
-            case 2:
-                R_hat=R;
-
-                break;
-
-            case 1:
-
-                if(rn[0]<1.e-06)
-                {
-                    if (fabs(rn[1]-rn[2])<1.e-06) R_hat=rn[2]/2.;
-                    else R_hat=(rn[1] - rn[2])/(2.*log(rn[1]) - 2.*log(rn[2]));
-                }
-                if(rn[1]<1.e-06)
-                {
-                    if (fabs(rn[2]-rn[0])<1.e-06) R_hat=rn[0]/2.;
-                    else R_hat=(rn[2] - rn[0])/(2.*log(rn[2]) - 2.*log(rn[0]));
-                }
-                if(rn[2]<1.e-06)
-                {
-                    if (fabs(rn[0]-rn[1])<1.e-06) R_hat=rn[1]/2.;
-                    else R_hat=(rn[0] - rn[1])/(2.*log(rn[0]) - 2.*log(rn[1]));
-                }
-
-                break;
-
-            default:
-
-                if (fabs(q[0])<1.e-06)
-                    R_hat=(q[1]*q[1])/(2.*(-q[1] + rn[0]*log(rn[0]/rn[2])));
-                else if (fabs(q[1])<1.e-06)
-                    R_hat=(q[2]*q[2])/(2.*(-q[2] + rn[1]*log(rn[1]/rn[0])));
-                else if (fabs(q[2])<1.e-06)
-                    R_hat=(q[0]*q[0])/(2.*(-q[0] + rn[2]*log(rn[2]/rn[1])));
-                else
-                    R_hat=-(q[0]*q[1]*q[2])/
-                          (2.*(q[0]*rn[0]*log(rn[0]) +
-                               q[1]*rn[1]*log(rn[1]) +
-                               q[2]*rn[2]*log(rn[2])));
-
-                break;
-            }
-
-            // Mr Contribution
-            // Derived from flux formulation with c0 + c1 r^2 + c2 z
-            // interpolation in the element.
-            K=(-1./(2.*a_hat*R));
-            for(j=0; j<3; j++)
-                for(k=j; k<3; k++)
-                    Mx[j][k] += K*p[j]*rn[j]*p[k]*rn[k];
-
-            // need this loop to avoid singularities.  This just puts something
-            // on the main diagonal of nodes that are on the r=0 line.
-            // The program later sets these nodes to zero, but it's good to
-            // for scaling reasons to grab entries from the neighboring diagonals
-            // rather than just setting these entries to 1 or something....
-            for(j=0; j<3; j++)
-                if (rn[j]<1.e-06) Mx[j][j]+=Mx[0][0]+Mx[1][1]+Mx[2][2];
-
-            // Mz Contribution;
-            // Derived from flux formulation with c0 + c1 r^2 + c2 z
-            // interpolation in the element.
-            K=(-1./(2.*a_hat*R_hat));
-            for(j=0; j<3; j++)
-                for(k=j; k<3; k++)
-                    My[j][k] += K*(q[j]*rn[j])*(q[k]*rn[k])*
-                                (g[j]/R)*(g[k]/R);
-
-            // Mrz Contribution;
-            // Derived from flux formulation with c0 + c1 r^2 + c2 z
-            // interpolation in the element.
-            K = (-1. / (2.*a_hat*R_hat));
-            for (j = 0;j<3;j++)
-                for (k = j;k<3;k++)
-                    Mxy[j][k] += K*((q[j] * rn[j])*(g[j] / R))*(p[k] * rn[k]) + K*((q[k] * rn[k])*(g[k] / R))*(p[j] * rn[j]);
-
-            // Fill out rest of entries of Mx and My;
-            Mx[1][0]=Mx[0][1];
-            Mx[2][0]=Mx[0][2];
-            Mx[2][1]=Mx[1][2];
-            My[1][0]=My[0][1];
-            My[2][0]=My[0][2];
-            My[2][1]=My[1][2];
-            Mxy[1][0] = Mxy[0][1];
-            Mxy[2][0] = Mxy[0][2];
-            Mxy[2][1] = Mxy[1][2];
-
-            // contributions to Me, be from derivative boundary conditions;
-            for(j=0; j<3; j++)
-            {
-                if (El->e[j] >= 0)
-                    if (lineproplist[El->e[j]].BdryFormat==2)
-                    {
-                        // conversion factor is 10^(-4) (I think...)
-                        k=j+1;
-                        if(k==3) k=0;
-                        r=(meshnode[n[j]].x+meshnode[n[k]].x)/2.;
-                        K=-0.0001*c*2.*r*lineproplist[ El->e[j] ].c0.re*l[j]/6.;
-                        k=j+1;
-                        if(k==3) k=0;
-                        Me[j][j]+=K*2.;
-                        Me[k][k]+=K*2.;
-                        Me[j][k]+=K;
-                        Me[k][j]+=K;
-
-                        K=(lineproplist[ El->e[j] ].c1.re*l[j]/2.)*0.0001*2*r;
-                        be[j]+=K;
-                        be[k]+=K;
-                    }
-            }
-
-            // contribution to be from current density in the block
-            for(j=0; j<3; j++)
+        for(g=(linearPartStored ? geo.numLinearGroups : 0); (g<numGroups) && solved; g++)
+        {
+            if ((g==geo.numLinearGroups) && !linearPartStored)
             {
-                if(labellist[El->lbl].InCircuit>=0)
-                {
-                    k=labellist[El->lbl].InCircuit;
-                    if(circproplist[k].Case==1) t=circproplist[k].J.Re();
-                    if(circproplist[k].Case==0)
-                        t=-100.*circproplist[k].dV.Re()*blockproplist[El->blk].Cduct/R;
-                }
-                else t=0;
-                K=-2.*R*(blockproplist[El->blk].J.re+t)*a/3.;
-                be[j]+=K;
-
-                // record avg current density in the block for use in incremental solutions
-                if (bIncremental==0) El->Jprev+=(blockproplist[El->blk].J.re+t)/3.;
-
+                L.StoreAssembly();
+                linearPartStored=true;
             }
 
-            // contribution to be from magnetization in the block;
-            t=labellist[El->lbl].MagDir;
-            // create the formatter object in case of a lua defined mag direction
-//                boost::format fmatter("r=%.17g\nz=%.17g\nx=r\ny=z\ntheta=%.17g\nR=%.17g\nreturn %s");
-            if (!labellist[El->lbl].MagDirFctn.empty()) // functional magnetization direction
-            {
-                char magbuff[4096];
-                std::string str;
-                CComplex X;
-                int top1,top2;
-                for (j=0,X=0; j<3; j++) X+=(meshnode[n[j]].x + I*meshnode[n[j]].y);
-                X=X/units[LengthUnits]/3.;
-                // generate the string using boost::format
-//                    fmatter % (X.re) % (X.im) % (arg(X)*180/PI) % (abs(X)) % (labellist[El->lbl].MagDirFctn);
-                // get the created string
-//                    str = fmatter.str();
-                SNPRINTF(magbuff, sizeof magbuff, "r=%.17g\nz=%.17g\nx=r\ny=z\ntheta=%.17g\nR=%.17g\nreturn %s",
-                             (X.re) , (X.im) , (arg(X)*180/PI) , (abs(X)) , (labellist[El->lbl].MagDirFctn.c_str()));
-                str = magbuff;
-
-                lua_State *lua = theLua->getLuaState();
-
-                top1=lua_gettop(lua);
-
-                int lua_error_code = theLua->doString(str, femm::LuaInstance::LuaStackMode::Unsafe);
-
-                if(lua_error_code != 0)
-                {
-                    if (lua_error_code==LUA_ERRRUN)
-                        WarnMessage("Lua run Error (LUA_ERRRUN) when evaluating magnetization direction function");
-                    if (lua_error_code==LUA_ERRMEM)
-                        WarnMessage("Lua memory Error (LUA_ERRMEM) when evaluating magnetization direction function");
-                    if (lua_error_code==LUA_ERRERR)
-                        WarnMessage("Lua user error error (LUA_ERRERR) when evaluating magnetization direction function");
-                    if (lua_error_code==LUA_ERRFILE)
-                        WarnMessage("Lua file error (LUA_ERRFILE) when evaluating magnetization direction function");
-
-                    SNPRINTF(magbuff, sizeof magbuff,
-                             "Lua error occurred when evaluating:\n\"%s\"",
-                             labellist[El->lbl].MagDirFctn.c_str());
-
-                    WarnMessage(magbuff);
-
-                    return -7;
-                }
-
-                top2=lua_gettop(lua);
-                if (top2!=top1)
-                {
-                    str=lua_tostring(lua,-1);
-                    if (str.length()==0)
-                    {
-                        SNPRINTF(magbuff, sizeof magbuff,
-                                 "\"%s\" does not evaluate to a numerical value",
-                                 labellist[El->lbl].MagDirFctn.c_str());
-
-                        WarnMessage (magbuff);
-
-                        return -7;
-                    }
-                    else t=Re(lua_tonumber(lua,-1));
-                }
-            }
-            for(j=0; j<3; j++)
+            // the elements of a group share no nodes, so their matrix entries can be
+            // written from several threads, and the result doesn't depend on the threads
+            const int first=geo.groupStart[g];
+            const int last=geo.groupStart[g+1];
+            if (serial || (last-first < 256*team.size()))
             {
-                k=j+1;
-                if(k==3) k=0;
-                r=(meshnode[n[j]].x+meshnode[n[k]].x)/2.;
-                // need to scale so that everything is in proper units...
-                // conversion is 0.0001
-                K=-0.0001*r*blockproplist[El->blk].H_c*(
-                      cos(t*PI/180.)*(meshnode[n[k]].x-meshnode[n[j]].x) +
-                      sin(t*PI/180.)*(meshnode[n[k]].y-meshnode[n[j]].y) );
-                be[j]+=K;
-                be[k]+=K;
-            }
-
-            // update permeability for the element;
-            if (Iter==0){
-                k=meshele[i].blk;
-
-                if (blockproplist[k].LamType == 0) {
-                    mu = blockproplist[k].LamFill;
-                    meshele[i].mu1 = blockproplist[k].mu_x*mu;
-                    meshele[i].mu2 = blockproplist[k].mu_y*mu;
-                }
-                if (blockproplist[k].LamType == 1) {
-                    mu = blockproplist[k].LamFill;
-                    K = blockproplist[k].mu_x;
-                    meshele[i].mu1 = K*mu + (1. - mu);
-                    meshele[i].mu2 = K / (mu + K*(1. - mu));
-                }
-                if (blockproplist[k].LamType == 2) {
-                    mu = blockproplist[k].LamFill;
-                    K = blockproplist[k].mu_y;
-                    meshele[i].mu1 = K*mu + (1. - mu);
-                    meshele[i].mu2 = K / (mu + K*(1. - mu));
-                }
-                if (blockproplist[k].LamType>2)
-                {
-                    meshele[i].mu1 = 1;
-                    meshele[i].mu2 = 1;
-                }
-
-                if (blockproplist[k].BHpoints != 0)
-                {
-                    if (bIncremental == 0)
-                    {
-                        // There's no previous solution.  This is a standard nonlinear problem
-                        LinearFlag = 0;
-                    }
-                    else {
-                        double B1p, B2p;
-
-                        // too lazy to consistently code incremental/frozen formulation for on-edge lams.
-                        // detect this condition, throw an error, and exit.
-                        if (blockproplist[k].LamType > 0)
-                        {
-                            PrintMessage("On-edge Lam Types not yet supported in incremental/frozen permeability problems");
-                            exit(0);
-                        }
-
-                        //	Get B from previous solution
-                        getPrevAxiB(i,B1p,B2p);
-                        B = sqrt(B1p*B1p + B2p*B2p);
-
-                        // look up incremental permeability and assign it to the element;
-                        blockproplist[k].IncrementalPermeability(B, muinc, murel);
-                        if (B == 0)
-                        {
-                            meshele[i].mu1 = muinc;
-                            meshele[i].mu2 = muinc;
-                            meshele[i].v12 = 0;
-                        }
-                        else {
-                            if (bIncremental == 1)
-                            {
-                            //	MsgBox("muinc = %g, murel=%g",muinc,murel);
-                                // Need to actually compute B1 and B2 to build incremental permeability tensor
-                                meshele[i].mu1 = B*B*muinc*murel / (B1p*B1p*murel + B2p*B2p*muinc);
-                                meshele[i].mu2 = B*B*muinc*murel / (B1p*B1p*muinc + B2p*B2p*murel);
-                                meshele[i].v12 = -B1p*B2p*(murel - muinc) / (B*B*murel*muinc);
-                            }
-                            else {
-                                // Define "frozen permeability"
-                                meshele[i].mu1 = murel;
-                                meshele[i].mu2 = murel;
-                                meshele[i].v12 = 0;
-                            }
-                        }
-                    }
-                }
+                for(m=first; (m<last) && solved; m++)
+                    solved=assembleAxiElement(L,geo.order[m],Iter,bIncremental);
             }
             else
             {
-                k=meshele[i].blk;
-
-                if ((blockproplist[k].LamType==0) &&
-                        (meshele[i].mu1==meshele[i].mu2)
-                        &&(blockproplist[k].BHpoints>0))
+                team.run([&](int thread)
                 {
-                    //	Derive B directly from energy;
-                    v[0]=0;
-                    v[1]=0;
-                    v[2]=0;
-                    for(j=0; j<3; j++)
-                        for(w=0; w<3; w++)
-                            v[j]+=(Mx[j][w]+My[j][w])*L.V[n[w]];
-                    for(j=0,dv=0; j<3; j++) dv+=L.V[n[j]]*v[j];
-                    dv*=(10000.*c*c/vol);
-                    B=sqrt(fabs(dv));
-
-                    // find out new mu from saturation curve;
-                    blockproplist[k].GetBHProps(B,mu,dv);
-                    mu=1./(muo*mu);
-                    meshele[i].mu1=mu;
-                    meshele[i].mu2=mu;
-                    for(j=0; j<3; j++)
-                    {
-                        for(w=0,v[j]=0; w<3; w++)
-                            v[j]+=(Mx[j][w]+My[j][w])*L.V[n[w]];
-                    }
-
-                    K=-200.*c*c*c*dv/vol;
-                    for(j=0; j<3; j++)
-                        for(w=0; w<3; w++)
-                            Mn[j][w]=K*v[j]*v[w];
-                }
-
-                if ((blockproplist[k].LamType==1) && (blockproplist[k].BHpoints>0))
-                {
-
-                    //	Derive B directly from energy;
-                    t=blockproplist[k].LamFill;
-                    v[0]=0;
-                    v[1]=0;
-                    v[2]=0;
-                    for(j=0; j<3; j++)
-                        for(w=0; w<3; w++)
-                            v[j]+=(Mx[j][w]+My[j][w]/(t*t))*L.V[n[w]];
-                    for(j=0,dv=0; j<3; j++) dv+=L.V[n[j]]*v[j];
-                    dv*=(10000.*c*c/vol);
-                    B=sqrt(fabs(dv));
-
-                    // Evaluate BH curve
-                    blockproplist[k].GetBHProps(B,mu,dv);
-                    mu=1./(muo*mu);
-                    meshele[i].mu1=mu*t;
-                    meshele[i].mu2=mu/(t+mu*(1.-t));
-                    for(j=0; j<3; j++)
-                    {
-                        for(w=0,v[j]=0,u[j]=0; w<3; w++)
-                        {
-                            v[j]+=(My[j][w]/t+Mx[j][w])*L.V[n[w]];
-                            u[j]+=(My[j][w]/t + t*Mx[j][w])*L.V[n[w]];
-                        }
-                    }
-                    K=-100.*c*c*c*dv/(vol);
-                    for(j=0; j<3; j++)
-                        for(w=0; w<3; w++)
-                            Mn[j][w]=K*(v[j]*u[w]+v[w]*u[j]);
-                }
-                if ((blockproplist[k].LamType==2) && (blockproplist[k].BHpoints>0))
-                {
-
-                    //	Derive B directly from energy;
-                    t=blockproplist[k].LamFill;
-                    v[0]=0;
-                    v[1]=0;
-                    v[2]=0;
-                    for(j=0; j<3; j++)
-                        for(w=0; w<3; w++)
-                            v[j]+=(Mx[j][w]/(t*t)+My[j][w])*L.V[n[w]];
-                    for(j=0,dv=0; j<3; j++) dv+=L.V[n[j]]*v[j];
-                    dv*=(10000.*c*c/vol);
-                    B=sqrt(fabs(dv));
-
-                    // Evaluate BH curve
-                    blockproplist[k].GetBHProps(B,mu,dv);
-                    mu=1./(muo*mu);
-                    meshele[i].mu2=mu*t;
-                    meshele[i].mu1=mu/(t+mu*(1.-t));
-
-                    for(j=0; j<3; j++)
-                    {
-                        for(w=0,v[j]=0,u[j]=0; w<3; w++)
-                        {
-                            v[j]+=(Mx[j][w]/t + My[j][w])*L.V[n[w]];
-                            u[j]+=(Mx[j][w]/t + t*My[j][w])*L.V[n[w]];
-                        }
-                    }
-                    K=-100.*c*c*c*dv/(vol);
-                    for(j=0; j<3; j++)
-                        for(w=0; w<3; w++)
-                            Mn[j][w]=K*(v[j]*u[w]+v[w]*u[j]);
-
-                }
-            }
-
-            // "Warp" the permeability of this element if part of
-            // the conformally mapped external region
-            if((labellist[meshele[i].lbl].IsExternal) && (Iter==0))
-            {
-                double Z=(meshnode[n[0]].y+meshnode[n[1]].y+meshnode[n[2]].y)/3. - extZo;
-                double kludge=(R*R+Z*Z)*extRi/(extRo*extRo*extRo);
-                meshele[i].mu1/=kludge;
-                meshele[i].mu2/=kludge;
-            }
-
-            // combine block matrices into global matrices;
-            for(j=0; j<3; j++)
-                for(k=0; k<3; k++)
-                {
-                    Me[j][k]+= (Mx[j][k]/Re(El->mu2) + My[j][k]/Re(El->mu1) + Mxy[j][k] * Re(El->v12) + Mn[j][k]);
-                    be[j]+=Mn[j][k]*L.V[n[k]];
-                }
-
-            for (j=0; j<3; j++)
-            {
-                for (k=j; k<3; k++)
-                    L.Put(L.Get(n[j],n[k])-Me[j][k],n[j],n[k]);
-                L.b[n[j]]-=be[j];
+                    int begin,end;
+                    femm::ThreadTeam::split(thread,team.size(),first,last,begin,end);
+                    for(int e=begin; e<end; e++)
+                        assembleAxiElement(L,geo.order[e],Iter,bIncremental);
+                });
             }
         }
 
+        // a magnetization direction couldn't be evaluated
+        if (!solved) break;
+
         // add in contribution from point currents;
         for(i=0; i<NumNodes; i++)
             if(meshnode[i].BoundaryMarker>=0)
@@ -726,7 +880,11 @@ int FSolver::StaticAxisymmetric(CBigLinProb &L)
 
         // solve the problem;
         for(j=0;j<NumNodes;j++) V_old[j]=L.V[j];
-        if (L.PCGSolve(Iter)==false) return false;
+        if (L.PCGSolve(Iter)==false)
+        {
+            solved=false;
+            break;
+        }
 
         if (LinearFlag==false)
         {
@@ -748,12 +906,38 @@ int FSolver::StaticAxisymmetric(CBigLinProb &L)
             // relaxation if we need it
             if(Iter>5)
             {
-                if ((res>lastres) && (Relax>0.125)) Relax/=2.;
+                if ((res>lastres) && (Relax>minRelax)) Relax/=2.;
                 else Relax+= 0.1 * (1. - Relax);
 
                 for(j=0; j<NumNodes; j++) L.V[j]=Relax*L.V[j]+(1.0-Relax)*V_old[j];
             }
 
+            // if the residual stops decreasing, allow a stronger relaxation once before giving up
+            if (!std::isfinite(res))
+            {
+                WarnMessage("Newton iteration diverged\n");
+                solved=false;
+                break;
+            }
+            if ((bestres<0) || (res<0.5*bestres))
+            {
+                bestres=res;
+                progress=Iter;
+            }
+            else if (Iter-progress>=newtonStagnation)
+            {
+                if (minRelax<0.125)
+                {
+                    SNPRINTF(msg, sizeof(msg), "Newton iteration stagnates at a residual of %g\n", res);
+                    WarnMessage(msg);
+                    solved=false;
+                    break;
+                }
+                minRelax=0.125/8.;
+                if (Relax>0.125) Relax=0.125;
+                progress=Iter;
+            }
+
 
             // report some results
             //char outstr[256];
@@ -772,6 +956,13 @@ int FSolver::StaticAxisymmetric(CBigLinProb &L)
 
         Iter++;
 
+        if ((LinearFlag==false) && (Iter>=MaxNewtonIterations))
+        {
+            SNPRINTF(msg, sizeof(msg), "Newton iteration didn't converge within %i iterations\n", Iter);
+            WarnMessage(msg);
+            solved=false;
+            break;
+        }
     }
     while(LinearFlag==false);
 
@@ -790,5 +981,5 @@ int FSolver::StaticAxisymmetric(CBigLinProb &L)
         free(CircInt3);
     }
 
-    return true;
+    return solved;
 }
@@ -0,0 +1,125 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+/*
+ * Solves a premeshed problem with a preconditioner and with SSOR, and compares the vector potentials.
+ * Usage: fsolver-preconditioner-test <directory> <problem> <preconditioner>
+ * The problem files are copied into the working directory first, because the solver deletes the mesh files.
+ * The exit code is 0 if the solutions agree.
+ */
+
+#include "fsolver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// bound of the largest difference to the solution with SSOR, relative to the largest potential
+const double agreementTolerance = 1e-5;
+
+bool copyFile(const std::string &from, const std::string &to)
+{
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary);
+    if (!in || !out)
+    {
+        fprintf(stderr, "couldn't copy %s\n", from.c_str());
+        return false;
+    }
+    out << in.rdbuf();
+    return true;
+}
+
+/**
+ * @brief Solve a copy of the problem with the given preconditioner.
+ * @param local name of the copy
+ * @param A receives the vector potential of every node
+ */
+bool solve(const std::string &dir, const std::string &name, const std::string &local,
+           CBigLinProb::PreconditionerType preconditioner, std::vector<double> &A)
+{
+    for (const char *ext : {".fem", ".node", ".ele", ".edge", ".pbc"})
+        if (!copyFile(dir + "/" + name + ext, local + ext))
+            return false;
+
+    FSolver solver;
+    solver.PathName = local;
+    solver.writeSolutionFile = false;
+    if (!solver.LoadProblemFile())
+    {
+        fprintf(stderr, "problem loading %s.fem\n", local.c_str());
+        return false;
+    }
+    solver.Preconditioner = preconditioner;
+    if (!solver.runSolver())
+        return false;
+
+    A.clear();
+    for (const femm::MagneticsSolution::Node &node : solver.solution.nodes)
+        A.push_back(node.A.re);
+    return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "Usage: fsolver-preconditioner-test <directory> <problem> <preconditioner>\n");
+        return 2;
+    }
+
+    const std::string dir = argv[1];
+    const std::string name = argv[2];
+    const std::string pcName = argv[3];
+    CBigLinProb::PreconditionerType preconditioner;
+    if (pcName == "amg")
+        preconditioner = CBigLinProb::PreconditionerAMG;
+    else if (pcName == "ic0")
+        preconditioner = CBigLinProb::PreconditionerIC0;
+    else if (pcName == "ict")
+        preconditioner = CBigLinProb::PreconditionerICT;
+    else if (pcName == "cholesky")
+        preconditioner = CBigLinProb::PreconditionerCholesky;
+    else
+    {
+        fprintf(stderr, "unknown preconditioner %s\n", pcName.c_str());
+        return 2;
+    }
+
+    std::vector<double> A, Assor;
+    if (!solve(dir, name, name + "_ssor_" + pcName, CBigLinProb::PreconditionerSSOR, Assor))
+        return 1;
+    if (!solve(dir, name, name + "_" + pcName, preconditioner, A))
+        return 1;
+    if (A.size() != Assor.size())
+    {
+        fprintf(stderr, "different number of nodes\n");
+        return 1;
+    }
+
+    double scale=0, difference=0;
+    for(size_t i=0; i<A.size(); i++)
+    {
+        scale = std::max(scale, std::fabs(Assor[i]));
+        difference = std::max(difference, std::fabs(A[i]-Assor[i]));
+    }
+    printf("largest difference to SSOR %g, relative %g\n", difference, difference/scale);
+    if (!(difference <= agreementTolerance*scale))
+    {
+        fprintf(stderr, "solution differs from SSOR\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,444 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+#include "AmgPreconditioner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace femm;
+
+namespace {
+// a connection is strong if a_ij^2 > theta^2 * a_ii * a_jj
+const double strengthThreshold = 0.08;
+// no further level is built below this many rows
+const int maxCoarseRows = 50;
+// the coarsest matrix is factored if it isn't larger than this, otherwise it is smoothed
+const int maxDenseRows = 1000;
+const int coarseSweeps = 10;
+const int maxLevels = 20;
+}
+
+AmgPreconditioner::AmgPreconditioner()
+{
+}
+
+bool AmgPreconditioner::setup(int n, const int *rowStart, const int *colIdx, const double *values)
+{
+    int i,l;
+
+    const int nnz = rowStart[n];
+    const bool samePattern = !levels.empty()
+            && (levels[0].A.rows == n)
+            && std::equal(rowStart, rowStart+n+1, levels[0].A.rowStart.begin())
+            && std::equal(colIdx, colIdx+nnz, levels[0].A.colIdx.begin());
+    if (samePattern && std::equal(values, values+nnz, levels[0].A.values.begin()))
+        return true;
+
+    if (!samePattern)
+    {
+        levels.clear();
+        levels.reserve(maxLevels);
+        levels.resize(1);
+        Matrix &A = levels[0].A;
+        A.rows = n;
+        A.cols = n;
+        A.rowStart.assign(rowStart, rowStart+n+1);
+        A.colIdx.assign(colIdx, colIdx+nnz);
+    }
+    levels[0].A.values.assign(values, values+nnz);
+
+    // the aggregates of the coarser levels are kept as long as the pattern is the same
+    for(l=0; ; l++)
+    {
+        Level &level = levels[l];
+        const Matrix &A = level.A;
+        level.diag.assign(A.rows, 0.);
+        for(i=0; i<A.rows; i++)
+            for(int k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+                if (A.colIdx[k] == i) level.diag[i] += A.values[k];
+        for(i=0; i<A.rows; i++)
+        {
+            if (!(level.diag[i] > 0))
+            {
+                levels.clear();
+                return false;
+            }
+        }
+        level.x.assign(A.rows, 0.);
+        level.b.assign(A.rows, 0.);
+        level.r.assign(A.rows, 0.);
+
+        if (!samePattern)
+        {
+            if ((A.rows <= maxCoarseRows) || (l+1 >= maxLevels))
+                break;
+            aggregate(level);
+            // stop if the coarsening stagnates
+            if ((level.numAggregates == 0) || (level.numAggregates > 0.8*A.rows))
+                break;
+            levels.emplace_back();
+        }
+        else if (l+1 == (int)levels.size())
+            break;
+
+        buildCoarseLevel(l);
+    }
+
+    factorCoarsest();
+    return true;
+}
+
+void AmgPreconditioner::aggregate(Level &level) const
+{
+    int i,j,k;
+
+    const Matrix &A = level.A;
+    const int n = A.rows;
+    const double theta2 = strengthThreshold*strengthThreshold;
+    auto strong = [&](int i, int k) {
+        const int j = A.colIdx[k];
+        return (j != i) && (A.values[k]*A.values[k] > theta2*level.diag[i]*level.diag[j]);
+    };
+
+    // -1: not aggregated yet, -2: no strong connection, these rows don't get a coarse node
+    std::vector<int> &agg = level.aggregate;
+    agg.assign(n, -2);
+    for(i=0; i<n; i++)
+        for(k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+            if (strong(i,k)) agg[i] = -1;
+
+    // 1) rows whose strong neighbours are all free form an aggregate with them
+    int numAggregates = 0;
+    for(i=0; i<n; i++)
+    {
+        if (agg[i] != -1)
+            continue;
+        bool free = true;
+        for(k=A.rowStart[i]; (k<A.rowStart[i+1]) && free; k++)
+            if (strong(i,k) && (agg[A.colIdx[k]] != -1)) free = false;
+        if (!free)
+            continue;
+        agg[i] = numAggregates;
+        for(k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+            if (strong(i,k)) agg[A.colIdx[k]] = numAggregates;
+        numAggregates++;
+    }
+
+    // 2) the remaining rows join the aggregate of step 1) they are connected to most strongly
+    std::vector<int> firstPass(agg);
+    for(i=0; i<n; i++)
+    {
+        if (firstPass[i] != -1)
+            continue;
+        double best = 0;
+        for(k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+        {
+            j = A.colIdx[k];
+            if (strong(i,k) && (firstPass[j] >= 0) && (std::fabs(A.values[k]) > best))
+            {
+                best = std::fabs(A.values[k]);
+                agg[i] = firstPass[j];
+            }
+        }
+    }
+
+    // 3) rows that are still left form aggregates with their free strong neighbours
+    for(i=0; i<n; i++)
+    {
+        if (agg[i] != -1)
+            continue;
+        agg[i] = numAggregates;
+        for(k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+            if (strong(i,k) && (agg[A.colIdx[k]] == -1)) agg[A.colIdx[k]] = numAggregates;
+        numAggregates++;
+    }
+
+    for(i=0; i<n; i++)
+        if (agg[i] < 0) agg[i] = -1;
+    level.numAggregates = numAggregates;
+}
+
+void AmgPreconditioner::buildCoarseLevel(int l)
+{
+    int i,j,k,m;
+
+    Level &fine = levels[l];
+    Level &coarse = levels[l+1];
+    const Matrix &A = fine.A;
+    const int n = A.rows;
+    const int nc = fine.numAggregates;
+    const std::vector<int> &agg = fine.aggregate;
+
+    // damping of the prolongator smoother, with a Gershgorin bound of the spectral radius of D^-1*A
+    double rho = 0;
+    for(i=0; i<n; i++)
+    {
+        double s = 0;
+        for(k=A.rowStart[i]; k<A.rowStart[i+1]; k++) s += std::fabs(A.values[k]);
+        rho = std::max(rho, s/fine.diag[i]);
+    }
+    const double omega = 4./(3.*rho);
+
+    // P = (I - omega*D^-1*A) * P0, the tentative prolongator P0 is 1 at (i, aggregate of i)
+    position.assign(std::max(n, nc), -1);
+    Matrix &P = fine.P;
+    P.rows = n;
+    P.cols = nc;
+    P.rowStart.assign(1, 0);
+    P.colIdx.clear();
+    P.values.clear();
+    for(i=0; i<n; i++)
+    {
+        const int first = (int)P.colIdx.size();
+        auto add = [&](int c, double v) {
+            if (position[c] < first)
+            {
+                position[c] = (int)P.colIdx.size();
+                P.colIdx.push_back(c);
+                P.values.push_back(v);
+            }
+            else
+                P.values[position[c]] += v;
+        };
+        if (agg[i] >= 0) add(agg[i], 1.);
+        for(k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+        {
+            j = A.colIdx[k];
+            if (agg[j] >= 0) add(agg[j], -omega*A.values[k]/fine.diag[i]);
+        }
+        P.rowStart.push_back((int)P.colIdx.size());
+    }
+    transpose(P, fine.R);
+
+    // A*P
+    Matrix &AP = fine.AP;
+    AP.rows = n;
+    AP.cols = nc;
+    AP.rowStart.assign(1, 0);
+    AP.colIdx.clear();
+    AP.values.clear();
+    std::fill(position.begin(), position.end(), -1);
+    for(i=0; i<n; i++)
+    {
+        const int first = (int)AP.colIdx.size();
+        for(k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+        {
+            j = A.colIdx[k];
+            for(m=P.rowStart[j]; m<P.rowStart[j+1]; m++)
+            {
+                const int c = P.colIdx[m];
+                if (position[c] < first)
+                {
+                    position[c] = (int)AP.colIdx.size();
+                    AP.colIdx.push_back(c);
+                    AP.values.push_back(A.values[k]*P.values[m]);
+                }
+                else
+                    AP.values[position[c]] += A.values[k]*P.values[m];
+            }
+        }
+        AP.rowStart.push_back((int)AP.colIdx.size());
+    }
+
+    // the Galerkin product R*A*P
+    const Matrix &R = fine.R;
+    Matrix &Ac = coarse.A;
+    Ac.rows = nc;
+    Ac.cols = nc;
+    Ac.rowStart.assign(1, 0);
+    Ac.colIdx.clear();
+    Ac.values.clear();
+    std::fill(position.begin(), position.end(), -1);
+    for(i=0; i<nc; i++)
+    {
+        const int first = (int)Ac.colIdx.size();
+        for(k=R.rowStart[i]; k<R.rowStart[i+1]; k++)
+        {
+            j = R.colIdx[k];
+            for(m=AP.rowStart[j]; m<AP.rowStart[j+1]; m++)
+            {
+                const int c = AP.colIdx[m];
+                if (position[c] < first)
+                {
+                    position[c] = (int)Ac.colIdx.size();
+                    Ac.colIdx.push_back(c);
+                    Ac.values.push_back(R.values[k]*AP.values[m]);
+                }
+                else
+                    Ac.values[position[c]] += R.values[k]*AP.values[m];
+            }
+        }
+        Ac.rowStart.push_back((int)Ac.colIdx.size());
+    }
+}
+
+void AmgPreconditioner::factorCoarsest()
+{
+    int i,j,k;
+
+    const Matrix &A = levels.back().A;
+    const int n = A.rows;
+    coarseFactor.clear();
+    if (n > maxDenseRows)
+        return;
+
+    // dense Cholesky factor in the lower triangle
+    std::vector<double> &L = coarseFactor;
+    L.assign((size_t)n*n, 0.);
+    for(i=0; i<n; i++)
+        for(k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+            L[(size_t)i*n+A.colIdx[k]] += A.values[k];
+    for(j=0; j<n; j++)
+    {
+        double d = L[(size_t)j*n+j];
+        for(k=0; k<j; k++) d -= L[(size_t)j*n+k]*L[(size_t)j*n+k];
+        if (!(d > 0))
+        {
+            // not positive definite, e.g. because of rounding; smooth instead
+            coarseFactor.clear();
+            return;
+        }
+        d = std::sqrt(d);
+        L[(size_t)j*n+j] = d;
+        for(i=j+1; i<n; i++)
+        {
+            double s = L[(size_t)i*n+j];
+            for(k=0; k<j; k++) s -= L[(size_t)i*n+k]*L[(size_t)j*n+k];
+            L[(size_t)i*n+j] = s/d;
+        }
+    }
+}
+
+void AmgPreconditioner::apply(const double *X, double *Y)
+{
+    if (levels.empty())
+        return;
+
+    Level &top = levels[0];
+    std::copy(X, X+top.A.rows, top.b.begin());
+    cycle(0);
+    std::copy(top.x.begin(), top.x.end(), Y);
+}
+
+void AmgPreconditioner::cycle(int l)
+{
+    int i,k;
+
+    Level &level = levels[l];
+    const int n = level.A.rows;
+
+    if (l+1 == (int)levels.size())
+    {
+        if (coarseFactor.empty())
+        {
+            std::fill(level.x.begin(), level.x.end(), 0.);
+            for(i=0; i<coarseSweeps; i++)
+            {
+                forwardGaussSeidel(level);
+                backwardGaussSeidel(level);
+            }
+            return;
+        }
+
+        // solve L*L^T*x=b
+        const double *L = coarseFactor.data();
+        std::vector<double> &x = level.x;
+        for(i=0; i<n; i++)
+        {
+            double s = level.b[i];
+            for(k=0; k<i; k++) s -= L[(size_t)i*n+k]*x[k];
+            x[i] = s/L[(size_t)i*n+i];
+        }
+        for(i=n-1; i>=0; i--)
+        {
+            double s = x[i];
+            for(k=i+1; k<n; k++) s -= L[(size_t)k*n+i]*x[k];
+            x[i] = s/L[(size_t)i*n+i];
+        }
+        return;
+    }
+
+    Level &coarse = levels[l+1];
+
+    // pre smoothing, starting from zero
+    std::fill(level.x.begin(), level.x.end(), 0.);
+    forwardGaussSeidel(level);
+
+    // restrict the residual
+    multiply(level.A, level.x.data(), level.r.data());
+    for(i=0; i<n; i++) level.r[i] = level.b[i]-level.r[i];
+    multiply(level.R, level.r.data(), coarse.b.data());
+
+    cycle(l+1);
+
+    // prolongate the correction
+    multiply(level.P, coarse.x.data(), level.r.data());
+    for(i=0; i<n; i++) level.x[i] += level.r[i];
+
+    // post smoothing in the opposite direction, so that the cycle is symmetric
+    backwardGaussSeidel(level);
+}
+
+void AmgPreconditioner::forwardGaussSeidel(Level &level) const
+{
+    const Matrix &A = level.A;
+    double *x = level.x.data();
+    for(int i=0; i<A.rows; i++)
+    {
+        double s = level.b[i];
+        for(int k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+            if (A.colIdx[k] != i) s -= A.values[k]*x[A.colIdx[k]];
+        x[i] = s/level.diag[i];
+    }
+}
+
+void AmgPreconditioner::backwardGaussSeidel(Level &level) const
+{
+    const Matrix &A = level.A;
+    double *x = level.x.data();
+    for(int i=A.rows-1; i>=0; i--)
+    {
+        double s = level.b[i];
+        for(int k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+            if (A.colIdx[k] != i) s -= A.values[k]*x[A.colIdx[k]];
+        x[i] = s/level.diag[i];
+    }
+}
+
+void AmgPreconditioner::multiply(const Matrix &A, const double *x, double *y)
+{
+    for(int i=0; i<A.rows; i++)
+    {
+        double s = 0;
+        for(int k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+            s += A.values[k]*x[A.colIdx[k]];
+        y[i] = s;
+    }
+}
+
+void AmgPreconditioner::transpose(const Matrix &A, Matrix &T)
+{
+    int i,k;
+
+    T.rows = A.cols;
+    T.cols = A.rows;
+    T.rowStart.assign(T.rows+1, 0);
+    for(k=0; k<A.rowStart[A.rows]; k++) T.rowStart[A.colIdx[k]+1]++;
+    for(i=0; i<T.rows; i++) T.rowStart[i+1] += T.rowStart[i];
+    T.colIdx.resize(A.rowStart[A.rows]);
+    T.values.resize(A.rowStart[A.rows]);
+    std::vector<int> pos(T.rowStart.begin(), T.rowStart.end()-1);
+    for(i=0; i<A.rows; i++)
+        for(k=A.rowStart[i]; k<A.rowStart[i+1]; k++)
+        {
+            T.colIdx[pos[A.colIdx[k]]] = i;
+            T.values[pos[A.colIdx[k]]++] = A.values[k];
+        }
+}
@@ -0,0 +1,100 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+#ifndef AMG_PRECONDITIONER_H
+#define AMG_PRECONDITIONER_H
+
+#include <vector>
+
+namespace femm {
+
+/**
+ * @brief Smoothed aggregation algebraic multigrid for symmetric positive definite matrices.
+ *
+ * apply() performs one V-cycle with a symmetric Gauss-Seidel smoother, so it can be used
+ * as preconditioner of the conjugate gradient method.
+ * The number of iterations hardly grows with the size of the mesh.
+ *
+ * setup() keeps as much of the hierarchy as possible:
+ *  - if the matrix didn't change, e.g. for the currents of a sweep, nothing is done,
+ *  - if only the values changed, e.g. in a Newton iteration, the aggregates are kept
+ *    and only the prolongators and the coarse matrices are computed again,
+ *  - if the pattern changed, the hierarchy is built from scratch.
+ */
+class AmgPreconditioner
+{
+public:
+    AmgPreconditioner();
+
+    /**
+     * @brief Build the hierarchy for the matrix A.
+     * A is given in CSR layout with both triangles.
+     * @param n number of rows
+     * @param rowStart index of the first entry of each row, plus end marker
+     * @param colIdx column of each entry
+     * @param values value of each entry
+     * @return \c false, if a diagonal entry is not positive
+     */
+    bool setup(int n, const int *rowStart, const int *colIdx, const double *values);
+
+    /**
+     * @brief Y = M^-1 * X, with the preconditioner M.
+     */
+    void apply(const double *X, double *Y);
+
+    /**
+     * @return the number of levels, including the finest one
+     */
+    int numLevels() const { return (int)levels.size(); }
+
+private:
+    /// A sparse matrix in CSR layout
+    struct Matrix
+    {
+        int rows = 0;
+        int cols = 0;
+        std::vector<int> rowStart;
+        std::vector<int> colIdx;
+        std::vector<double> values;
+    };
+
+    struct Level
+    {
+        Matrix A;
+        std::vector<double> diag;
+        std::vector<int> aggregate; ///< aggregate of each row, -1 for rows without a coarse node
+        int numAggregates = 0;
+        Matrix P;  ///< smoothed prolongator to this level from the next one
+        Matrix R;  ///< transpose of P
+        Matrix AP; ///< A*P, only kept so that its memory is reused
+        // work vectors of the cycle
+        std::vector<double> x;
+        std::vector<double> b;
+        std::vector<double> r;
+    };
+
+    /// Group the rows of level \p l into aggregates.
+    void aggregate(Level &level) const;
+    /// Compute the prolongator of level \p l and the matrix of level \p l+1.
+    void buildCoarseLevel(int l);
+    /// Factor the matrix of the last level, or prepare smoothing if it is too large.
+    void factorCoarsest();
+    void cycle(int l);
+    void forwardGaussSeidel(Level &level) const;
+    void backwardGaussSeidel(Level &level) const;
+
+    static void multiply(const Matrix &A, const double *x, double *y);
+    static void transpose(const Matrix &A, Matrix &T);
+
+    std::vector<Level> levels;
+    std::vector<int> position; ///< work array of the sparse products
+    std::vector<double> coarseFactor; ///< dense Cholesky factor of the coarsest matrix, if small enough
+};
+
+} // namespace femm
+
+#endif
@@ -116,17 +116,131 @@ CMMaterialProp::CMMaterialProp( const CMMaterialProp& other )
     WireD = other.WireD;
     LamFill = other.LamFill;            // lamination fill factor;
     LamType = other.LamType;            // type of lamination;
+    compiledCurve = other.compiledCurve;
+    preparedSlopes = other.preparedSlopes;
+}
+
+/**
+ * @brief The real part of a B-H curve, prepared for fast evaluation.
+ * Interval i starts at b0[i]; with z = (b-b0[i])*invL[i], H = c0 + z*(c1 + z*(c2 + z*c3)).
+ * The last interval starts at the end of the curve and continues it linearly.
+ */
+struct CMMaterialProp::CompiledCurve
+{
+    std::vector<double> b0;
+    std::vector<double> invL;
+    std::vector<double> c0;
+    std::vector<double> c1;
+    std::vector<double> c2;
+    std::vector<double> c3;
+    /// the curve from b0[0] to the end is split into cells of equal width
+    double invCellWidth;
+    /// interval that contains the start of each cell
+    std::vector<int> cellInterval;
+
+    int find(double b) const
+    {
+        const int last = (int)b0.size()-1;
+        if (b > b0[last])
+            return last;
+        int cell = (int)((b-b0[0])*invCellWidth);
+        if (cell < 0)
+            cell = 0;
+        if (cell >= (int)cellInterval.size())
+            cell = (int)cellInterval.size()-1;
+        int i = cellInterval[cell];
+        while (i+1 < last && b > b0[i+1])
+            i++;
+        return i;
+    }
+};
+
+/**
+ * @brief The curve of a CMMaterialProp after GetSlopes, together with the input it was computed from.
+ */
+struct CMMaterialProp::PreparedSlopes
+{
+    // input
+    double omega;
+    std::vector<double> rawB;
+    std::vector<CComplex> rawH;
+    int LamType;
+    double LamFill;
+    double Lam_d;
+    double Cduct;
+    double Theta_hn;
+    // result
+    std::vector<double> Bdata;
+    std::vector<CComplex> Hdata;
+    std::vector<CComplex> slope;
+    std::shared_ptr<const CompiledCurve> compiledCurve;
+    double mu_x;
+    double mu_y;
+    double MuMax;
+
+    bool matches(const CMMaterialProp &prop, double w) const
+    {
+        return omega == w && rawB == prop.Bdata && rawH == prop.Hdata
+                && LamType == prop.LamType && LamFill == prop.LamFill
+                && Lam_d == prop.Lam_d && Cduct == prop.Cduct && Theta_hn == prop.Theta_hn;
+    }
+};
+
+void CMMaterialProp::prepareSlopes(double omega)
+{
+    if (BHpoints==0) return;
+
+    CMMaterialProp prepared(*this);
+    prepared.preparedSlopes.reset();
+    prepared.slope.clear();
+    prepared.GetSlopes(omega);
+
+    std::shared_ptr<PreparedSlopes> result = std::make_shared<PreparedSlopes>();
+    result->omega = omega;
+    result->rawB = Bdata;
+    result->rawH = Hdata;
+    result->LamType = LamType;
+    result->LamFill = LamFill;
+    result->Lam_d = Lam_d;
+    result->Cduct = Cduct;
+    result->Theta_hn = Theta_hn;
+    result->Bdata = prepared.Bdata;
+    result->Hdata = prepared.Hdata;
+    result->slope = prepared.slope;
+    result->compiledCurve = prepared.compiledCurve;
+    result->mu_x = prepared.mu_x;
+    result->mu_y = prepared.mu_y;
+    // MuMax is only set for harmonic problems
+    result->MuMax = (omega!=0) ? prepared.MuMax : 0;
+    preparedSlopes = result;
 }
 
 void CMMaterialProp::clearSlopes()
 {
     slope.clear();
+    compiledCurve.reset();
 }
 
 void CMMaterialProp::GetSlopes(double omega)
 {
     if (BHpoints==0) return; // catch trivial case;
     if (!slope.empty()) return; // already have computed the slopes;
+    if (preparedSlopes && preparedSlopes->matches(*this, omega))
+    {
+        // same result as the computation below, see prepareSlopes()
+        Bdata = preparedSlopes->Bdata;
+        Hdata = preparedSlopes->Hdata;
+        slope = preparedSlopes->slope;
+        compiledCurve = preparedSlopes->compiledCurve;
+        mu_x = preparedSlopes->mu_x;
+        mu_y = preparedSlopes->mu_y;
+        Theta_hx = Theta_hn;
+        Theta_hy = Theta_hn;
+        if (omega!=0)
+            MuMax = preparedSlopes->MuMax;
+        return;
+    }
+    compiledCurve.reset();
 
     int i,k;
     bool CurveOK=false;
@@ -343,9 +457,70 @@ void CMMaterialProp::GetSlopes(double omega)
 
     free(bn);
     free(hn);
+    compileCurve();
     return;
 }
 
+void CMMaterialProp::compileCurve()
+{
+    compiledCurve.reset();
+    if (BHpoints<2 || (int)slope.size()!=BHpoints)
+        return;
+
+    std::shared_ptr<CompiledCurve> curve = std::make_shared<CompiledCurve>();
+    const int n = BHpoints-1;
+    for (int i=0; i<n; i++)
+    {
+        const double l = Bdata[i+1]-Bdata[i];
+        // the interval search needs an ascending curve
+        if (!(l>0))
+            return;
+        // Hermite form of GetH, expanded in powers of z
+        const double h0 = Re(Hdata[i]);
+        const double h1 = Re(Hdata[i+1]);
+        const double s0 = Re(slope[i])*l;
+        const double s1 = Re(slope[i+1])*l;
+        curve->b0.push_back(Bdata[i]);
+        curve->invL.push_back(1./l);
+        curve->c0.push_back(h0);
+        curve->c1.push_back(s0);
+        curve->c2.push_back(-3.*h0 - 2.*s0 + 3.*h1 - s1);
+        curve->c3.push_back(2.*h0 + s0 - 2.*h1 + s1);
+    }
+    // linear continuation above the curve
+    curve->b0.push_back(Bdata[n]);
+    curve->invL.push_back(1.);
+    curve->c0.push_back(Re(Hdata[n]));
+    curve->c1.push_back(Re(slope[n]));
+    curve->c2.push_back(0.);
+    curve->c3.push_back(0.);
+
+    // a few cells per interval keep the search after the cell lookup short
+    const int numCells = 4*n;
+    curve->invCellWidth = numCells/(Bdata[n]-Bdata[0]);
+    curve->cellInterval.resize(numCells);
+    for (int cell=0, i=0; cell<numCells; cell++)
+    {
+        const double cellStart = Bdata[0] + cell/curve->invCellWidth;
+        while (i+1<n && Bdata[i+1]<=cellStart)
+            i++;
+        curve->cellInterval[cell] = i;
+    }
+    compiledCurve = curve;
+}
+
+bool CMMaterialProp::evaluateCompiled(double b, double &h, double &dh) const
+{
+    if (!compiledCurve || slope.empty())
+        return false;
+    const CompiledCurve &curve = *compiledCurve;
+    const int i = curve.find(b);
+    const double z = (b-curve.b0[i])*curve.invL[i];
+    h = curve.c0[i] + z*(curve.c1[i] + z*(curve.c2[i] + z*curve.c3[i]));
+    dh = (curve.c1[i] + z*(2.*curve.c2[i] + 3.*z*curve.c3[i]))*curve.invL[i];
+    return true;
+}
+
 
 CComplex CMMaterialProp::LaminatedBH(double w, int i)
 {
@@ -486,6 +661,9 @@ CComplex CMMaterialProp::GetdHdB(const double B) const
 
 double CMMaterialProp::GetH(const double x) const
 {
+    double h,dh;
+    if ((BHpoints>0) && (x!=0) && evaluateCompiled(fabs(x),h,dh))
+        return (x>0) ? h : -h;
     return Re(GetH(CComplex(x)));
 }
 
@@ -909,6 +1087,15 @@ void CMSolverMaterialProp::GetBHProps(double B, double &v, double &dv)
 {
     // version to use in the magnetostatic case in
     // which we know that v and dv ought to be real-valued.
+    double b=fabs(B);
+    double h,dh;
+    if ((BHpoints>0) && (b!=0) && evaluateCompiled(b,h,dh))
+    {
+        v=h/b;
+        dv=0.5*(dh/(b*b) - h/(b*b*b));
+        return;
+    }
+
     CComplex vc,dvc;
 
     GetBHProps(B,vc,dvc);
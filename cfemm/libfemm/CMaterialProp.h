@@ -29,6 +29,7 @@
 
 #include "femmcomplex.h"
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -85,6 +86,13 @@ public:
 
     virtual void clearSlopes();
     virtual void GetSlopes(double omega=0.);
+    /**
+     * @brief Compute the slopes for \p omega once and share the result with all copies of this material.
+     * GetSlopes(omega) then copies the prepared curve instead of computing it again,
+     * as long as the B-H data and the lamination properties are unchanged.
+     * The curve of this material itself is not modified.
+     */
+    void prepareSlopes(double omega=0.);
     virtual CComplex LaminatedBH(double w, int i);
 
     double GetH(const double b) const;
@@ -145,8 +153,25 @@ public:
      * @param out
      */
     virtual void toStream( std::ostream &out ) const override;
+protected:
+    struct CompiledCurve;
+    /**
+     * @brief Real part of the curve as one cubic polynomial per interval, with a uniform index over B.
+     * Built by GetSlopes(); only valid while \c slope is not empty.
+     */
+    std::shared_ptr<const CompiledCurve> compiledCurve;
+    /**
+     * @brief Evaluate the compiled curve at \p b >= 0.
+     * Values above the last point use the linear continuation of the curve.
+     * @return \c false, if there is no compiled curve.
+     */
+    bool evaluateCompiled(double b, double &h, double &dh) const;
 private:
+    void compileCurve();
 
+    struct PreparedSlopes;
+    /// result of prepareSlopes(), shared by all copies
+    std::shared_ptr<const PreparedSlopes> preparedSlopes;
 };
 
 /**
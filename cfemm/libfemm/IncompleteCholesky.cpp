@@ -0,0 +1,319 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+#include "IncompleteCholesky.h"
+#include "ThreadTeam.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <utility>
+
+using namespace femm;
+
+namespace {
+// ICT keeps at most this many fill-in entries per row of U, the largest ones
+const int maxFillPerRow = 10;
+// shifts tried when a pivot isn't positive
+const double firstShift = 1e-3;
+const int maxShifts = 12;
+// a level is solved in parallel if every thread gets at least this many rows
+const int levelGrain = 512;
+}
+
+IncompleteCholesky::IncompleteCholesky()
+    : n(0)
+    , aDropTolerance(0)
+    , shift(0)
+    , factorValid(false)
+{
+}
+
+bool IncompleteCholesky::factor(int n, const int *rowStart, const int *colIdx, const double *values, double dropTolerance)
+{
+    const int nnz = rowStart[n];
+    const bool samePattern = factorValid
+            && (this->n == n)
+            && (aDropTolerance == dropTolerance)
+            && std::equal(rowStart, rowStart+n+1, aRowStart.begin())
+            && std::equal(colIdx, colIdx+nnz, aColIdx.begin());
+    if (samePattern && std::equal(values, values+nnz, aValues.begin()))
+        return true;
+
+    if (!samePattern)
+    {
+        this->n = n;
+        aDropTolerance = dropTolerance;
+        aRowStart.assign(rowStart, rowStart+n+1);
+        aColIdx.assign(colIdx, colIdx+nnz);
+        uRowStart.clear();
+        shift = 0;
+    }
+    aValues.assign(values, values+nnz);
+
+    // start with the shift that worked last time
+    double alpha = shift;
+    factorValid = false;
+    for(int attempt=0; attempt<=maxShifts; attempt++)
+    {
+        bool ok;
+        if (uRowStart.empty())
+        {
+            if (dropTolerance > 0)
+            {
+                ok = thresholdPattern(values, alpha);
+            }
+            else
+            {
+                uRowStart = aRowStart;
+                uColIdx = aColIdx;
+                aToU.resize(nnz);
+                for(int k=0; k<nnz; k++) aToU[k] = k;
+                ok = true;
+            }
+            if (ok) buildSolveStructure();
+        }
+        ok = !uRowStart.empty() && numericFactor(values, alpha);
+        if (ok)
+        {
+            shift = alpha;
+            factorValid = true;
+            return true;
+        }
+        alpha = (alpha == 0) ? firstShift : 2*alpha;
+    }
+    return false;
+}
+
+bool IncompleteCholesky::thresholdPattern(const double *values, double alpha)
+{
+    int i,j,k,p;
+
+    // right looking factorization with rows that can grow;
+    // a row is pruned when it is complete, i.e. when it is eliminated
+    std::vector< std::vector< std::pair<int,double> > > rows(n);
+    std::vector<char> original(n, 0);
+    std::vector<int> where(n, -1);
+    for(i=0; i<n; i++)
+    {
+        rows[i].reserve(2*(aRowStart[i+1]-aRowStart[i]));
+        for(p=aRowStart[i]; p<aRowStart[i+1]; p++)
+            rows[i].push_back(std::make_pair(aColIdx[p], values[p]));
+        rows[i][0].second *= (1.+alpha);
+    }
+
+    for(k=0; k<n; k++)
+    {
+        std::vector< std::pair<int,double> > &row = rows[k];
+        std::sort(row.begin()+1, row.end());
+
+        // keep the entries of A and the largest fill-in above the tolerance
+        double norm = 0;
+        for(p=aRowStart[k]; p<aRowStart[k+1]; p++)
+        {
+            norm += values[p]*values[p];
+            original[aColIdx[p]] = 1;
+        }
+        norm = std::sqrt(norm);
+        std::vector< std::pair<double,int> > fill;
+        for(p=1; p<(int)row.size(); p++)
+        {
+            if (!original[row[p].first] && (std::fabs(row[p].second) > aDropTolerance*norm))
+                fill.push_back(std::make_pair(-std::fabs(row[p].second), row[p].first));
+        }
+        if ((int)fill.size() > maxFillPerRow)
+            std::nth_element(fill.begin(), fill.begin()+maxFillPerRow, fill.end());
+        for(p=0; (p<(int)fill.size()) && (p<maxFillPerRow); p++)
+            original[fill[p].second] = 1;
+        int m = 1;
+        for(p=1; p<(int)row.size(); p++)
+            if (original[row[p].first]) row[m++] = row[p];
+        row.resize(m);
+        for(p=0; p<m; p++) original[row[p].first] = 0;
+
+        // eliminate the row
+        if (!(row[0].second > 0))
+            return false;
+        const double d = std::sqrt(row[0].second);
+        row[0].second = d;
+        for(p=1; p<m; p++) row[p].second /= d;
+        for(p=1; p<m; p++)
+        {
+            std::vector< std::pair<int,double> > &target = rows[row[p].first];
+            const double uki = row[p].second;
+            for(j=0; j<(int)target.size(); j++) where[target[j].first] = j;
+            for(int q=p; q<m; q++)
+            {
+                const int c = row[q].first;
+                if (where[c] >= 0)
+                    target[where[c]].second -= uki*row[q].second;
+                else
+                {
+                    where[c] = (int)target.size();
+                    target.push_back(std::make_pair(c, -uki*row[q].second));
+                }
+            }
+            for(j=0; j<(int)target.size(); j++) where[target[j].first] = -1;
+        }
+    }
+
+    // the pattern of U
+    uRowStart.assign(1, 0);
+    uColIdx.clear();
+    for(i=0; i<n; i++)
+    {
+        for(const auto &e : rows[i]) uColIdx.push_back(e.first);
+        uRowStart.push_back((int)uColIdx.size());
+    }
+
+    // the entries of A are part of it
+    aToU.resize(aRowStart[n]);
+    for(i=0; i<n; i++)
+    {
+        p = uRowStart[i];
+        for(k=aRowStart[i]; k<aRowStart[i+1]; k++)
+        {
+            while (uColIdx[p] != aColIdx[k]) p++;
+            aToU[k] = p;
+        }
+    }
+    return true;
+}
+
+bool IncompleteCholesky::numericFactor(const double *values, double alpha)
+{
+    int i,k,p,q,r;
+
+    const int *rs = uRowStart.data();
+    const int *col = uColIdx.data();
+    uValues.assign(uColIdx.size(), 0.);
+    double *u = uValues.data();
+    for(k=0; k<aRowStart[n]; k++) u[aToU[k]] = values[k];
+    for(i=0; i<n; i++) u[rs[i]] *= (1.+alpha);
+
+    for(k=0; k<n; k++)
+    {
+        if (!(u[rs[k]] > 0))
+            return false;
+        const double d = std::sqrt(u[rs[k]]);
+        u[rs[k]] = d;
+        for(p=rs[k]+1; p<rs[k+1]; p++) u[p] /= d;
+
+        // U(i,j) -= U(k,i)*U(k,j) for all j>=i that are part of the pattern
+        for(p=rs[k]+1; p<rs[k+1]; p++)
+        {
+            i = col[p];
+            const double uki = u[p];
+            r = rs[i];
+            for(q=p; q<rs[k+1]; q++)
+            {
+                while ((r < rs[i+1]) && (col[r] < col[q])) r++;
+                if (r == rs[i+1])
+                    break;
+                if (col[r] == col[q])
+                    u[r] -= uki*u[q];
+            }
+        }
+    }
+    return true;
+}
+
+void IncompleteCholesky::buildSolveStructure()
+{
+    int i,k;
+
+    // U^T, row i holds column i of U
+    lRowStart.assign(n+1, 0);
+    for(k=0; k<uRowStart[n]; k++) lRowStart[uColIdx[k]+1]++;
+    for(i=0; i<n; i++) lRowStart[i+1] += lRowStart[i];
+    lColIdx.resize(uRowStart[n]);
+    lSource.resize(uRowStart[n]);
+    std::vector<int> pos(lRowStart.begin(), lRowStart.end()-1);
+    for(i=0; i<n; i++)
+        for(k=uRowStart[i]; k<uRowStart[i+1]; k++)
+        {
+            lColIdx[pos[uColIdx[k]]] = i;
+            lSource[pos[uColIdx[k]]++] = k;
+        }
+
+    // a row is one level after the latest row it depends on
+    std::vector<int> level(n, 0);
+    for(i=0; i<n; i++)
+        for(k=lRowStart[i]; k<lRowStart[i+1]-1; k++)
+            level[i] = std::max(level[i], level[lColIdx[k]]+1);
+    buildLevels(level, forwardStart, forwardRows);
+
+    std::fill(level.begin(), level.end(), 0);
+    for(i=n-1; i>=0; i--)
+        for(k=uRowStart[i]+1; k<uRowStart[i+1]; k++)
+            level[i] = std::max(level[i], level[uColIdx[k]]+1);
+    buildLevels(level, backwardStart, backwardRows);
+}
+
+void IncompleteCholesky::buildLevels(const std::vector<int> &level, std::vector<int> &levelStart, std::vector<int> &levelRows)
+{
+    int i;
+
+    const int numLevels = level.empty() ? 0 : *std::max_element(level.begin(), level.end())+1;
+    levelStart.assign(numLevels+1, 0);
+    for(i=0; i<(int)level.size(); i++) levelStart[level[i]+1]++;
+    for(i=0; i<numLevels; i++) levelStart[i+1] += levelStart[i];
+    std::vector<int> pos(levelStart.begin(), levelStart.end()-1);
+    levelRows.resize(level.size());
+    for(i=0; i<(int)level.size(); i++) levelRows[pos[level[i]]++] = i;
+}
+
+void IncompleteCholesky::apply(const double *X, double *Y, ThreadTeam *team) const
+{
+    const double *u = uValues.data();
+    const int numThreads = team ? team->size() : 1;
+
+    // calls body for the rows of a level, in parallel if the level is large enough
+    auto forLevel = [&](int first, int last, const std::function<void(int,int)> &body) {
+        if ((numThreads == 1) || (last-first < levelGrain*numThreads))
+        {
+            body(first, last);
+            return;
+        }
+        team->run([&](int thread) {
+            int begin,end;
+            ThreadTeam::split(thread, numThreads, first, last, begin, end);
+            body(begin, end);
+        });
+    };
+
+    // U^T*Y=X
+    for(int l=0; l+1<(int)forwardStart.size(); l++)
+    {
+        forLevel(forwardStart[l], forwardStart[l+1], [&](int first, int last) {
+            for(int m=first; m<last; m++)
+            {
+                const int i = forwardRows[m];
+                double yi = X[i];
+                for(int k=lRowStart[i]; k<lRowStart[i+1]-1; k++)
+                    yi -= u[lSource[k]]*Y[lColIdx[k]];
+                Y[i] = yi/u[uRowStart[i]];
+            }
+        });
+    }
+
+    // U*Y=Y
+    for(int l=0; l+1<(int)backwardStart.size(); l++)
+    {
+        forLevel(backwardStart[l], backwardStart[l+1], [&](int first, int last) {
+            for(int m=first; m<last; m++)
+            {
+                const int i = backwardRows[m];
+                double yi = Y[i];
+                for(int k=uRowStart[i]+1; k<uRowStart[i+1]; k++)
+                    yi -= u[k]*Y[uColIdx[k]];
+                Y[i] = yi/u[uRowStart[i]];
+            }
+        });
+    }
+}
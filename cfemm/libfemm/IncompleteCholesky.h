@@ -0,0 +1,102 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+#ifndef INCOMPLETE_CHOLESKY_H
+#define INCOMPLETE_CHOLESKY_H
+
+#include <vector>
+
+namespace femm {
+
+class ThreadTeam;
+
+/**
+ * @brief Incomplete Cholesky factorization A ~ U^T*U of a symmetric positive definite matrix.
+ *
+ * Without a drop tolerance, U has the pattern of the upper triangle of A (IC(0)).
+ * With a drop tolerance, the first factorization also keeps fill-in that is large enough (ICT);
+ * the pattern it finds is then kept like the pattern of IC(0).
+ *
+ * The pattern only depends on the pattern of A, so the factorizations of the following
+ * matrices, e.g. the Newton iterations of a nonlinear problem, only compute the values.
+ * If the matrix didn't change at all, e.g. for the currents of a sweep, the factor is kept.
+ *
+ * If a pivot isn't positive, the factorization is repeated for A + alpha*diag(A)
+ * with a growing shift alpha.
+ *
+ * The triangular solves of apply() process the rows in levels: the rows of a level only
+ * depend on rows of earlier levels, so large levels are solved in parallel.
+ * The result doesn't depend on the number of threads.
+ */
+class IncompleteCholesky
+{
+public:
+    IncompleteCholesky();
+
+    /**
+     * @brief Factor the matrix A.
+     * A is given by its upper triangle in CSR layout, sorted by column with the diagonal first.
+     * @param n number of rows
+     * @param rowStart index of the first entry of each row, plus end marker
+     * @param colIdx column of each entry
+     * @param values value of each entry
+     * @param dropTolerance 0 for IC(0); otherwise fill-in below dropTolerance times the norm of the row of A is dropped
+     * @return \c false, if even a shifted matrix couldn't be factored
+     */
+    bool factor(int n, const int *rowStart, const int *colIdx, const double *values, double dropTolerance);
+
+    /**
+     * @brief Y = (U^T*U)^-1 * X
+     * @param team threads for the large levels of the triangular solves, or \c NULL
+     */
+    void apply(const double *X, double *Y, ThreadTeam *team) const;
+
+    /**
+     * @return \c true, if a factor is available
+     */
+    bool valid() const { return factorValid; }
+
+private:
+    /// Find the pattern of U by a factorization with dropping.
+    bool thresholdPattern(const double *values, double alpha);
+    /// Compute the values of U for the current pattern.
+    bool numericFactor(const double *values, double alpha);
+    /// Build the lower triangle and the levels of the triangular solves for the current pattern.
+    void buildSolveStructure();
+    static void buildLevels(const std::vector<int> &level, std::vector<int> &levelStart, std::vector<int> &levelRows);
+
+    int n;
+    // pattern of A when the pattern of U was built
+    std::vector<int> aRowStart;
+    std::vector<int> aColIdx;
+    std::vector<double> aValues;  ///< values of the current factor
+    double aDropTolerance;
+
+    // U in CSR layout, sorted by column with the diagonal first
+    std::vector<int> uRowStart;
+    std::vector<int> uColIdx;
+    std::vector<double> uValues;
+    std::vector<int> aToU;        ///< index in U of each entry of A
+
+    // U^T in CSR layout, sorted by column with the diagonal last; the values are taken from U
+    std::vector<int> lRowStart;
+    std::vector<int> lColIdx;
+    std::vector<int> lSource;     ///< index in U of each entry
+
+    // rows grouped by level
+    std::vector<int> forwardStart;
+    std::vector<int> forwardRows;
+    std::vector<int> backwardStart;
+    std::vector<int> backwardRows;
+
+    double shift;                 ///< diagonal shift of the last successful factorization
+    bool factorValid;
+};
+
+} // namespace femm
+
+#endif
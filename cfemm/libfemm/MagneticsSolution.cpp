@@ -0,0 +1,30 @@
+/*
+ * The source code in this file is heavily derived from
+ * FEMM by David Meeker <dmeeker@ieee.org>.
+ * For more information on FEMM see http://www.femm.info
+ * This modified version is not endorsed in any way by the original
+ * authors of FEMM.
+ *
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+#include "MagneticsSolution.h"
+
+void femm::MagneticsSolution::clear()
+{
+    nodes.clear();
+    Aprev.clear();
+    elements.clear();
+    blocks.clear();
+    pbcs.clear();
+    agelist.clear();
+}
+
+bool femm::MagneticsSolution::empty() const
+{
+    return nodes.empty() || elements.empty();
+}
@@ -0,0 +1,77 @@
+/*
+ * The source code in this file is heavily derived from
+ * FEMM by David Meeker <dmeeker@ieee.org>.
+ * For more information on FEMM see http://www.femm.info
+ * This modified version is not endorsed in any way by the original
+ * authors of FEMM.
+ *
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+#ifndef FEMM_MAGNETICSSOLUTION_H
+#define FEMM_MAGNETICSSOLUTION_H
+
+#include "CAirGapElement.h"
+#include "CCommonPoint.h"
+#include "femmcomplex.h"
+
+#include <vector>
+
+namespace femm {
+
+/**
+ * @brief The MagneticsSolution class holds the \c [Solution] section of a \c .ans file in memory.
+ *
+ * The fields correspond one to one to what FSolver writes to the \c .ans file,
+ * i.e. node coordinates are in problem units and the circuit information is
+ * stored on a block label by block label basis.
+ * This allows FPProc to take over a solution without writing and parsing the \c .ans file.
+ */
+class MagneticsSolution
+{
+public:
+    struct Node
+    {
+        double x;
+        double y;
+        CComplex A; ///< vector potential (only the real part is used for static problems)
+        int marker;
+    };
+
+    struct Element
+    {
+        int p[3];
+        int lbl;
+        double Jprev; ///< current density of the previous solution (incremental problems only)
+    };
+
+    struct BlockCircuit
+    {
+        int Case;  ///< 0: \c value is the voltage gradient, 1: \c value is the current density
+        CComplex value;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<double> Aprev; ///< previous solution (incremental problems only)
+    std::vector<Element> elements;
+    std::vector<BlockCircuit> blocks; ///< circuit information, one entry per block label
+    std::vector<CCommonPoint> pbcs;
+    std::vector<femmsolver::CAirGapElement> agelist;
+
+    /**
+     * @brief Remove all solution data.
+     */
+    void clear();
+
+    /**
+     * @return \c true, if no solution has been stored.
+     */
+    bool empty() const;
+};
+
+}
+#endif
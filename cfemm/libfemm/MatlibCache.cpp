@@ -0,0 +1,81 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+#include "MatlibCache.h"
+
+#include "CMaterialProp.h"
+#include "make_unique.h"
+
+#include <sstream>
+
+using namespace femm;
+
+MatlibCache &MatlibCache::instance()
+{
+    static MatlibCache cache;
+    return cache;
+}
+
+std::unique_ptr<CMaterialProp> MatlibCache::cloneMaterial(FileType type, const std::string &libraryFile, const std::string &materialName, std::ostream &err)
+{
+    std::shared_ptr<Library> library;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<Library> &entry = libraries[std::make_pair(type, libraryFile)];
+        if (!entry)
+            entry = std::make_shared<Library>();
+        library = entry;
+    }
+
+    // only one thread parses, the others wait for it
+    std::call_once(library->parsed, [&]() {
+        MatlibReader reader(type);
+        std::stringstream parseErrors;
+        library->result = reader.parse(libraryFile, parseErrors);
+        library->errors = parseErrors.str();
+        if (library->result != MatlibParseResult::OK)
+            return;
+        for (const auto &name : reader.materialNames())
+        {
+            std::unique_ptr<CMaterialProp> prop(reader.takeMaterial(name));
+            CMMaterialProp *magneticProp = dynamic_cast<CMMaterialProp*>(prop.get());
+            if (magneticProp)
+                magneticProp->prepareSlopes(0);
+            library->materials[name] = std::move(prop);
+        }
+    });
+
+    if (library->result != MatlibParseResult::OK)
+    {
+        err << library->errors;
+        return nullptr;
+    }
+    const auto entry = library->materials.find(materialName);
+    if (entry == library->materials.end())
+        return nullptr;
+    const CMaterialProp *prop = entry->second.get();
+
+    switch (type) {
+    case FileType::ElectrostaticsFile:
+        return MAKE_UNIQUE<CSMaterialProp>(*dynamic_cast<const CSMaterialProp*>(prop));
+    case FileType::HeatFlowFile:
+        return MAKE_UNIQUE<CHMaterialProp>(*dynamic_cast<const CHMaterialProp*>(prop));
+    case FileType::MagneticsFile:
+        return MAKE_UNIQUE<CMSolverMaterialProp>(*dynamic_cast<const CMSolverMaterialProp*>(prop));
+    default:
+        return nullptr;
+    }
+}
+
+void MatlibCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    libraries.clear();
+}
+
+// vi:expandtab:tabstop=4 shiftwidth=4:
@@ -0,0 +1,76 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+#ifndef MATLIB_CACHE_H
+#define MATLIB_CACHE_H
+
+#include "femmenums.h"
+#include "MatlibReader.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace femm {
+
+class CMaterialProp;
+
+/**
+ * @brief The MatlibCache class parses each material library only once per process.
+ * Materials are copied from the parsed library, which is never modified afterwards.
+ * Magnetic materials with a B-H curve get their DC slopes prepared once (see CMMaterialProp::prepareSlopes()),
+ * so that the solvers don't have to compute them again for every copy.
+ *
+ * The cache can be used from several threads.
+ */
+class MatlibCache
+{
+public:
+    /**
+     * @return the cache of the process
+     */
+    static MatlibCache &instance();
+
+    /**
+     * @brief Get a copy of a material from a material library.
+     * The library is parsed on first use.
+     * @param type The file/problem type determines the material type
+     * @param libraryFile a file name
+     * @param materialName
+     * @param err receives the parse errors of the library
+     * @return the material, or \c nullptr if the library can't be parsed or doesn't contain the material.
+     */
+    std::unique_ptr<CMaterialProp> cloneMaterial(FileType type, const std::string &libraryFile, const std::string &materialName, std::ostream &err);
+
+    /**
+     * @brief Forget all parsed libraries, so that changed files are parsed again.
+     */
+    void clear();
+
+private:
+    MatlibCache() = default;
+    MatlibCache(const MatlibCache &) = delete;
+    MatlibCache &operator=(const MatlibCache &) = delete;
+
+    struct Library
+    {
+        std::once_flag parsed;
+        MatlibParseResult result = MatlibParseResult::FileError;
+        std::string errors;
+        std::unordered_map<std::string,std::unique_ptr<CMaterialProp>> materials;
+    };
+
+    std::mutex mutex;
+    std::map<std::pair<FileType,std::string>, std::shared_ptr<Library>> libraries;
+};
+}
+
+#endif
+// vi:expandtab:tabstop=4 shiftwidth=4:
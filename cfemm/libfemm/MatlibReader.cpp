@@ -119,4 +119,13 @@ CMaterialProp *MatlibReader::takeMaterial(const std::string &materialName)
     }
 }
 
+std::vector<std::string> MatlibReader::materialNames() const
+{
+    std::vector<std::string> names;
+    names.reserve(m_library.size());
+    for (const auto &entry : m_library)
+        names.push_back(entry.first);
+    return names;
+}
+
 // vi:expandtab:tabstop=4 shiftwidth=4:
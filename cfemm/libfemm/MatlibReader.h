@@ -22,6 +22,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace femm {
 
@@ -70,6 +71,11 @@ public:
      * @return
      */
     CMaterialProp *takeMaterial(const std::string &materialName);
+    /**
+     * @brief Get the names of all materials that were stored by parse().
+     * @return
+     */
+    std::vector<std::string> materialNames() const;
 private:
     const FileType type;
     std::unordered_map<std::string,std::unique_ptr<CMaterialProp>> m_library;
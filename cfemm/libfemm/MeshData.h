@@ -0,0 +1,77 @@
+/*
+ * The source code in this file is heavily derived from
+ * FEMM by David Meeker <dmeeker@ieee.org>.
+ * For more information on FEMM see http://www.femm.info
+ * This modified version is not endorsed in any way by the original
+ * authors of FEMM.
+ *
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+#ifndef FEMM_MESHDATA_H
+#define FEMM_MESHDATA_H
+
+#include "CAirGapElement.h"
+#include "CCommonPoint.h"
+
+#include <vector>
+
+namespace femm {
+
+/**
+ * @brief The MeshData class holds the output of the mesher in memory.
+ *
+ * The content mirrors the \c .node, \c .ele, \c .edge and \c .pbc files that are
+ * written by the mesher, i.e. coordinates are in problem units, node and edge
+ * markers are the raw triangle markers and element labels are the region
+ * attributes (block label index + 1, or 0 for unlabelled regions).
+ *
+ * This allows the solvers to skip the round trip through the file system
+ * when mesher and solver run in the same process.
+ */
+class MeshData
+{
+public:
+    struct Node
+    {
+        double x;
+        double y;
+        int marker;
+    };
+
+    struct Element
+    {
+        int p[3];
+        int label;
+    };
+
+    struct Edge
+    {
+        int n0;
+        int n1;
+        int marker;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Element> elements;
+    std::vector<Edge> edges;
+    std::vector<CCommonPoint> pbcs; ///< (anti)periodic boundary node pairs
+    std::vector<femmsolver::CAirGapElement> agelist; ///< air gap elements
+
+    /**
+     * @brief Remove all mesh data.
+     */
+    void clear();
+
+    /**
+     * @return \c true, if no mesh has been stored.
+     */
+    bool empty() const;
+};
+
+}
+#endif
@@ -522,6 +522,7 @@ bool PostProcessor::makeMask()
     bw++;
 
     int NumNodes=(int) meshnodes.size();
+    L.WarnMessage = WarnMessage;
     L.Create(NumNodes,bw);
 
     // Sort through materials to see if they denote air;
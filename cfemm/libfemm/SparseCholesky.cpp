@@ -0,0 +1,568 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+#include "SparseCholesky.h"
+
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <mutex>
+#include <utility>
+
+using namespace femm;
+
+namespace {
+// a column joins the supernode of its child if at most this fraction of the supernode are zeros
+const double maxRelaxedZeros = 0.2;
+const int maxSupernodeColumns = 256;
+// number of patterns whose analysis is kept
+const std::size_t symbolicCacheSize = 4;
+}
+
+/// The result of the symbolic analysis, only depends on the pattern of A.
+struct SparseCholesky::Symbolic
+{
+    int n;
+    // pattern of A
+    std::vector<int> rowStart;
+    std::vector<int> colIdx;
+    std::vector<int> perm;           ///< row of A of each row of L
+    std::vector<int> superStart;     ///< first column of each supernode, plus end marker
+    std::vector<int> superRowStart;  ///< index of the first row of each supernode in superRows, plus end marker
+    std::vector<int> superRows;      ///< rows of the supernodes, starting with their own columns
+    std::vector<std::size_t> valueStart; ///< index of the block of each supernode in L, plus end marker
+    std::vector<int> columnSuper;    ///< supernode of each column
+    std::vector<std::size_t> aToL;   ///< index in L of each entry of A
+    double factorOperations;
+};
+
+SparseCholesky::SparseCholesky()
+    : factorValid(false)
+{
+}
+
+bool SparseCholesky::samePattern(int n, const int *rowStart, const int *colIdx) const
+{
+    return symbolic
+            && (symbolic->n == n)
+            && std::equal(rowStart, rowStart+n+1, symbolic->rowStart.begin())
+            && std::equal(colIdx, colIdx+rowStart[n], symbolic->colIdx.begin());
+}
+
+bool SparseCholesky::sameValues(const double *values) const
+{
+    return factorValid && std::equal(factorValues.begin(), factorValues.end(), values);
+}
+
+double SparseCholesky::factorOperations() const
+{
+    return symbolic ? symbolic->factorOperations : 0;
+}
+
+double SparseCholesky::solveOperations() const
+{
+    return symbolic ? 2.*symbolic->valueStart.back() : 0;
+}
+
+std::shared_ptr<const SparseCholesky::Symbolic> SparseCholesky::analyze(int n, const int *rowStart, const int *colIdx)
+{
+    static std::mutex cacheMutex;
+    static std::list< std::shared_ptr<const Symbolic> > cache;
+
+    const int nnz = rowStart[n];
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        for (auto it = cache.begin(); it != cache.end(); ++it)
+        {
+            const Symbolic &s = **it;
+            if ((s.n == n)
+                    && std::equal(rowStart, rowStart+n+1, s.rowStart.begin())
+                    && std::equal(colIdx, colIdx+nnz, s.colIdx.begin()))
+            {
+                cache.splice(cache.begin(), cache, it);
+                return cache.front();
+            }
+        }
+    }
+
+    int i,j,k,c,r,s;
+    std::shared_ptr<Symbolic> result = std::make_shared<Symbolic>();
+    Symbolic &S = *result;
+    S.n = n;
+    S.rowStart.assign(rowStart, rowStart+n+1);
+    S.colIdx.assign(colIdx, colIdx+nnz);
+
+    // graph of A
+    std::vector<int> adjStart(n+1, 0);
+    for(i=0; i<n; i++)
+        for(k=rowStart[i]+1; k<rowStart[i+1]; k++)
+        {
+            adjStart[i+1]++;
+            adjStart[colIdx[k]+1]++;
+        }
+    for(i=0; i<n; i++) adjStart[i+1] += adjStart[i];
+    std::vector<int> adj(adjStart[n]);
+    std::vector<int> pos(adjStart.begin(), adjStart.end()-1);
+    for(i=0; i<n; i++)
+        for(k=rowStart[i]+1; k<rowStart[i+1]; k++)
+        {
+            adj[pos[i]++] = colIdx[k];
+            adj[pos[colIdx[k]]++] = i;
+        }
+
+    std::vector<int> order;
+    minimumDegree(n, adjStart, adj, order);
+    std::vector<int> inverse(n);
+    for(i=0; i<n; i++) inverse[order[i]] = i;
+
+    // lower triangle of the reordered matrix, row by row
+    auto lowerTriangle = [&](std::vector<int> &lowStart, std::vector<int> &low) {
+        lowStart.assign(n+1, 0);
+        for(i=0; i<n; i++)
+            for(k=adjStart[i]; k<adjStart[i+1]; k++)
+                if (inverse[adj[k]] < inverse[i]) lowStart[inverse[i]+1]++;
+        for(i=0; i<n; i++) lowStart[i+1] += lowStart[i];
+        low.resize(lowStart[n]);
+        std::vector<int> next(lowStart.begin(), lowStart.end()-1);
+        for(i=0; i<n; i++)
+            for(k=adjStart[i]; k<adjStart[i+1]; k++)
+                if (inverse[adj[k]] < inverse[i]) low[next[inverse[i]]++] = inverse[adj[k]];
+    };
+    std::vector<int> lowStart, low;
+    lowerTriangle(lowStart, low);
+
+    // elimination tree
+    std::vector<int> parent(n, -1), ancestor(n, -1);
+    for(i=0; i<n; i++)
+        for(k=lowStart[i]; k<lowStart[i+1]; k++)
+        {
+            for(r=low[k]; (ancestor[r] != -1) && (ancestor[r] != i); )
+            {
+                const int t = ancestor[r];
+                ancestor[r] = i;
+                r = t;
+            }
+            if (ancestor[r] == -1)
+            {
+                ancestor[r] = i;
+                parent[r] = i;
+            }
+        }
+
+    // postorder the tree, so that the columns of a supernode are consecutive
+    std::vector<int> firstChild(n, -1), sibling(n, -1), post;
+    post.reserve(n);
+    for(j=n-1; j>=0; j--)
+        if (parent[j] != -1)
+        {
+            sibling[j] = firstChild[parent[j]];
+            firstChild[parent[j]] = j;
+        }
+    std::vector<int> stack;
+    for(j=0; j<n; j++)
+    {
+        if (parent[j] != -1) continue;
+        stack.push_back(j);
+        while (!stack.empty())
+        {
+            const int p = stack.back();
+            const int child = firstChild[p];
+            if (child != -1)
+            {
+                firstChild[p] = sibling[child];
+                stack.push_back(child);
+            } else {
+                stack.pop_back();
+                post.push_back(p);
+            }
+        }
+    }
+    std::vector<int> postInverse(n);
+    for(i=0; i<n; i++) postInverse[post[i]] = i;
+    S.perm.resize(n);
+    for(i=0; i<n; i++) S.perm[i] = order[post[i]];
+    for(i=0; i<n; i++) inverse[S.perm[i]] = i;
+    std::vector<int> treeParent(n);
+    for(i=0; i<n; i++) treeParent[i] = (parent[post[i]] == -1) ? -1 : postInverse[parent[post[i]]];
+    parent.swap(treeParent);
+    lowerTriangle(lowStart, low);
+
+    // entries of each column of L: row i has an entry in every column on the path from
+    // each of its entries in A up to i
+    std::vector<int> count(n, 1), mark(n, -1);
+    for(i=0; i<n; i++)
+    {
+        mark[i] = i;
+        for(k=lowStart[i]; k<lowStart[i+1]; k++)
+            for(j=low[k]; mark[j] != i; j=parent[j])
+            {
+                mark[j] = i;
+                count[j]++;
+            }
+    }
+
+    // supernodes: a column joins the supernode of its only or last child, if that adds few zeros
+    S.superStart.assign(1, 0);
+    long long entries = count[0];
+    for(c=1; c<n; c++)
+    {
+        const int first = S.superStart.back();
+        const long long cols = c-first+1;
+        const long long rows = cols+count[c]-1;
+        const long long storage = cols*rows-cols*(cols-1)/2;
+        const bool fundamental = (count[c-1] == count[c]+1);
+        if ((parent[c-1] == c) && (cols <= maxSupernodeColumns)
+                && (fundamental || (storage-entries-count[c] <= maxRelaxedZeros*storage)))
+        {
+            entries += count[c];
+        } else {
+            S.superStart.push_back(c);
+            entries = count[c];
+        }
+    }
+    S.superStart.push_back(n);
+    const int numSuper = (int)S.superStart.size()-1;
+    S.columnSuper.resize(n);
+    for(s=0; s<numSuper; s++)
+        for(c=S.superStart[s]; c<S.superStart[s+1]; c++) S.columnSuper[c] = s;
+
+    // rows of the supernodes: its columns, the entries of A below them, and the rows of
+    // the child supernodes below them
+    std::vector<int> upStart(n+1, 0), up(low.size());
+    for(k=0; k<(int)low.size(); k++) upStart[low[k]+1]++;
+    for(i=0; i<n; i++) upStart[i+1] += upStart[i];
+    std::copy(upStart.begin(), upStart.end()-1, pos.begin());
+    for(i=0; i<n; i++)
+        for(k=lowStart[i]; k<lowStart[i+1]; k++) up[pos[low[k]]++] = i;
+    std::vector<int> superChild(numSuper, -1), superSibling(numSuper, -1);
+    for(s=numSuper-1; s>=0; s--)
+    {
+        const int p = parent[S.superStart[s+1]-1];
+        if (p != -1)
+        {
+            superSibling[s] = superChild[S.columnSuper[p]];
+            superChild[S.columnSuper[p]] = s;
+        }
+    }
+    std::fill(mark.begin(), mark.end(), -1);
+    S.superRowStart.assign(1, 0);
+    S.valueStart.assign(1, 0);
+    S.factorOperations = 0;
+    for(s=0; s<numSuper; s++)
+    {
+        const int first = S.superStart[s];
+        const int last = S.superStart[s+1];
+        const int begin = (int)S.superRows.size();
+        for(c=first; c<last; c++) S.superRows.push_back(c);
+        for(c=first; c<last; c++)
+            for(k=upStart[c]; k<upStart[c+1]; k++)
+                if ((up[k] >= last) && (mark[up[k]] != s))
+                {
+                    mark[up[k]] = s;
+                    S.superRows.push_back(up[k]);
+                }
+        for(int t=superChild[s]; t!=-1; t=superSibling[t])
+            for(k=S.superRowStart[t]; k<S.superRowStart[t+1]; k++)
+            {
+                r = S.superRows[k];
+                if ((r >= last) && (mark[r] != s))
+                {
+                    mark[r] = s;
+                    S.superRows.push_back(r);
+                }
+            }
+        std::sort(S.superRows.begin()+begin+(last-first), S.superRows.end());
+        S.superRowStart.push_back((int)S.superRows.size());
+        const int numRows = (int)S.superRows.size()-begin;
+        S.valueStart.push_back(S.valueStart.back() + (std::size_t)(last-first)*numRows);
+        for(c=0; c<last-first; c++) S.factorOperations += 0.5*(numRows-c)*(numRows-c+1.);
+    }
+
+    // where the entries of A go
+    S.aToL.resize(nnz);
+    for(i=0; i<n; i++)
+        for(k=rowStart[i]; k<rowStart[i+1]; k++)
+        {
+            r = std::max(inverse[i], inverse[colIdx[k]]);
+            c = std::min(inverse[i], inverse[colIdx[k]]);
+            s = S.columnSuper[c];
+            const int *rows = S.superRows.data()+S.superRowStart[s];
+            const int numRows = S.superRowStart[s+1]-S.superRowStart[s];
+            const int p = (int)(std::lower_bound(rows, rows+numRows, r)-rows);
+            S.aToL[k] = S.valueStart[s] + (std::size_t)(c-S.superStart[s])*numRows + p;
+        }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cache.push_front(result);
+    if (cache.size() > symbolicCacheSize)
+        cache.pop_back();
+    return result;
+}
+
+void SparseCholesky::minimumDegree(int n, const std::vector<int> &adjStart, const std::vector<int> &adj, std::vector<int> &order)
+{
+    int i,j,k;
+
+    // Quotient graph: the eliminated nodes form elements, i.e. cliques of the nodes they are connected to.
+    // Every node keeps the nodes and the elements it is adjacent to. The element of a pivot absorbs the
+    // elements adjacent to the pivot, so the nodes of a live element are never eliminated.
+    // An element is identified by its pivot.
+    std::vector< std::vector<int> > nodes(n), elements(n), members(n);
+    for(i=0; i<n; i++) nodes[i].assign(adj.begin()+adjStart[i], adj.begin()+adjStart[i+1]);
+    std::vector<int> degree(n);
+    for(i=0; i<n; i++) degree[i] = (int)nodes[i].size();
+    std::vector<char> eliminated(n, 0), absorbed(n, 0);
+    std::vector<int> mark(n, -1), outside(n, -1);
+
+    // the nodes in doubly linked lists by degree
+    std::vector<int> head(n, -1), next(n, -1), previous(n, -1);
+    auto insert = [&](int v) {
+        next[v] = head[degree[v]];
+        previous[v] = -1;
+        if (next[v] != -1) previous[next[v]] = v;
+        head[degree[v]] = v;
+    };
+    auto remove = [&](int v) {
+        if (previous[v] != -1) next[previous[v]] = next[v]; else head[degree[v]] = next[v];
+        if (next[v] != -1) previous[next[v]] = previous[v];
+    };
+    for(i=n-1; i>=0; i--) insert(i);
+    int minDegree = 0;
+
+    order.clear();
+    order.reserve(n);
+    while ((int)order.size() < n)
+    {
+        while (head[minDegree] == -1) minDegree++;
+        const int p = head[minDegree];
+        remove(p);
+        eliminated[p] = 1;
+        order.push_back(p);
+
+        // the new element: the neighbours of p and the nodes of its elements
+        std::vector<int> &Lp = members[p];
+        mark[p] = p;
+        for (int v : nodes[p])
+            if (!eliminated[v] && (mark[v] != p))
+            {
+                mark[v] = p;
+                Lp.push_back(v);
+            }
+        for (int e : elements[p])
+        {
+            if (absorbed[e]) continue;
+            for (int v : members[e])
+                if (mark[v] != p)
+                {
+                    mark[v] = p;
+                    Lp.push_back(v);
+                }
+            absorbed[e] = 1;
+            std::vector<int>().swap(members[e]);
+        }
+        std::vector<int>().swap(nodes[p]);
+        std::vector<int>().swap(elements[p]);
+
+        // the members of the new element replace the absorbed elements by it,
+        // and no longer need their edges to other members
+        for (int v : Lp)
+        {
+            std::vector<int> &Ev = elements[v];
+            for(j=0,k=0; j<(int)Ev.size(); j++)
+                if (!absorbed[Ev[j]]) Ev[k++] = Ev[j];
+            Ev.resize(k);
+            Ev.push_back(p);
+            std::vector<int> &Av = nodes[v];
+            for(j=0,k=0; j<(int)Av.size(); j++)
+                if (!eliminated[Av[j]] && (mark[Av[j]] != p)) Av[k++] = Av[j];
+            Av.resize(k);
+        }
+
+        // |Le \ Lp| for the other elements of the members
+        for (int v : Lp)
+            for (int e : elements[v])
+            {
+                if (e == p) continue;
+                if (outside[e] < 0) outside[e] = (int)members[e].size();
+                outside[e]--;
+            }
+
+        // approximate external degree of the members; elements inside Lp are absorbed as well
+        const int remaining = n-(int)order.size();
+        for (int v : Lp)
+        {
+            std::vector<int> &Ev = elements[v];
+            long long approx = (long long)nodes[v].size() + (long long)Lp.size()-1;
+            for(j=0,k=0; j<(int)Ev.size(); j++)
+            {
+                const int e = Ev[j];
+                if ((e != p) && (outside[e] == 0))
+                {
+                    absorbed[e] = 1;
+                    continue;
+                }
+                if (e != p) approx += outside[e];
+                Ev[k++] = e;
+            }
+            Ev.resize(k);
+            approx = std::min(approx, (long long)degree[v]+(long long)Lp.size()-1);
+            approx = std::min(approx, (long long)remaining-1);
+            remove(v);
+            degree[v] = (int)approx;
+            insert(v);
+            minDegree = std::min(minDegree, degree[v]);
+        }
+        for (int v : Lp)
+            for (int e : elements[v]) outside[e] = -1;
+    }
+}
+
+bool SparseCholesky::factor(int n, const int *rowStart, const int *colIdx, const double *values)
+{
+    if (!samePattern(n, rowStart, colIdx))
+    {
+        symbolic = analyze(n, rowStart, colIdx);
+        factorValid = false;
+    }
+    else if (sameValues(values))
+        return true;
+
+    const Symbolic &S = *symbolic;
+    const int numSuper = (int)S.superStart.size()-1;
+    factorValid = false;
+    factorValues.assign(values, values+rowStart[n]);
+    L.assign(S.valueStart.back(), 0.);
+    for(int k=0; k<rowStart[n]; k++) L[S.aToL[k]] = values[k];
+    // all pivots of a definite matrix have the sign of the diagonal
+    const bool positive = (n == 0) || (values[rowStart[0]] > 0);
+
+    // left looking: every supernode is updated by the supernodes that have entries in its columns.
+    // Those are kept in a list for each supernode, with the first row that is still to be used.
+    std::vector<int> head(numSuper, -1), next(numSuper, -1), nextRow(numSuper, 0);
+    position.resize(n);
+    for(int s=0; s<numSuper; s++)
+    {
+        const int first = S.superStart[s];
+        const int last = S.superStart[s+1];
+        const int cols = last-first;
+        const int *rows = S.superRows.data()+S.superRowStart[s];
+        const int numRows = S.superRowStart[s+1]-S.superRowStart[s];
+        double *Ls = L.data()+S.valueStart[s];
+        for(int k=0; k<numRows; k++) position[rows[k]] = k;
+
+        for(int d=head[s]; d!=-1; )
+        {
+            const int nextD = next[d];
+            const int *rowsD = S.superRows.data()+S.superRowStart[d];
+            const int numRowsD = S.superRowStart[d+1]-S.superRowStart[d];
+            const int colsD = S.superStart[d+1]-S.superStart[d];
+            const double *Ld = L.data()+S.valueStart[d];
+            const int p = nextRow[d];
+            int p2 = p;
+            while ((p2 < numRowsD) && (rowsD[p2] < last)) p2++;
+
+            // L(i,j) -= sum_k L(i,k)*D(k)*L(j,k) for the columns k of d, the columns j of s and all rows i of d from j on
+            const int m = numRowsD-p;
+            update.resize(m);
+            for(int jj=0; jj<p2-p; jj++)
+            {
+                std::fill(update.begin()+jj, update.end(), 0.);
+                for(int kk=0; kk<colsD; kk++)
+                {
+                    const double *ld = Ld+(std::size_t)kk*numRowsD+p;
+                    const double ljk = ld[jj]*Ld[(std::size_t)kk*numRowsD+kk];
+                    if (ljk == 0) continue;
+                    for(int ii=jj; ii<m; ii++) update[ii] += ld[ii]*ljk;
+                }
+                double *ls = Ls+(std::size_t)(rowsD[p+jj]-first)*numRows;
+                for(int ii=jj; ii<m; ii++) ls[position[rowsD[p+ii]]] -= update[ii];
+            }
+
+            nextRow[d] = p2;
+            if (p2 < numRowsD)
+            {
+                const int t = S.columnSuper[rowsD[p2]];
+                next[d] = head[t];
+                head[t] = d;
+            }
+            d = nextD;
+        }
+
+        // dense factorization of the supernode
+        for(int j=0; j<cols; j++)
+        {
+            double *lj = Ls+(std::size_t)j*numRows;
+            const double d = lj[j];
+            if ((d == 0) || ((d > 0) != positive) || !std::isfinite(d))
+                return false;
+            for(int jj=j+1; jj<cols; jj++)
+            {
+                double *lk = Ls+(std::size_t)jj*numRows;
+                const double f = lj[jj]/d;
+                for(int i=jj; i<numRows; i++) lk[i] -= lj[i]*f;
+            }
+            for(int i=j+1; i<numRows; i++) lj[i] /= d;
+        }
+
+        if (cols < numRows)
+        {
+            nextRow[s] = cols;
+            const int t = S.columnSuper[rows[cols]];
+            next[s] = head[t];
+            head[t] = s;
+        }
+    }
+
+    factorValid = true;
+    return true;
+}
+
+void SparseCholesky::solve(const double *X, double *Y)
+{
+    const Symbolic &S = *symbolic;
+    const int n = S.n;
+    const int numSuper = (int)S.superStart.size()-1;
+
+    y.resize(n);
+    for(int i=0; i<n; i++) y[i] = X[S.perm[i]];
+
+    // L*y=X
+    for(int s=0; s<numSuper; s++)
+    {
+        const int first = S.superStart[s];
+        const int cols = S.superStart[s+1]-first;
+        const int *rows = S.superRows.data()+S.superRowStart[s];
+        const int numRows = S.superRowStart[s+1]-S.superRowStart[s];
+        const double *Ls = L.data()+S.valueStart[s];
+        for(int j=0; j<cols; j++)
+        {
+            const double *lj = Ls+(std::size_t)j*numRows;
+            const double yj = y[first+j];
+            for(int i=j+1; i<numRows; i++) y[rows[i]] -= lj[i]*yj;
+        }
+    }
+
+    // D*L^T*y=y
+    for(int s=numSuper-1; s>=0; s--)
+    {
+        const int first = S.superStart[s];
+        const int cols = S.superStart[s+1]-first;
+        const int *rows = S.superRows.data()+S.superRowStart[s];
+        const int numRows = S.superRowStart[s+1]-S.superRowStart[s];
+        const double *Ls = L.data()+S.valueStart[s];
+        for(int j=cols-1; j>=0; j--)
+        {
+            const double *lj = Ls+(std::size_t)j*numRows;
+            double yj = y[first+j]/lj[j];
+            for(int i=j+1; i<numRows; i++) yj -= lj[i]*y[rows[i]];
+            y[first+j] = yj;
+        }
+    }
+
+    for(int i=0; i<n; i++) Y[S.perm[i]] = y[i];
+}
@@ -0,0 +1,91 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+#ifndef SPARSE_CHOLESKY_H
+#define SPARSE_CHOLESKY_H
+
+#include <memory>
+#include <vector>
+
+namespace femm {
+
+/**
+ * @brief Supernodal sparse Cholesky factorization A = L*D*L^T of a symmetric definite matrix.
+ *
+ * The factorization doesn't take square roots, so it works for negative definite matrices, too.
+ *
+ * The rows are reordered by approximate minimum degree, which needs much less fill-in than the
+ * Cuthill-McKee numbering of the nodes. Columns of the factor with the same pattern are
+ * grouped into supernodes that are stored and updated as dense blocks.
+ *
+ * The symbolic analysis (ordering, elimination tree, supernodes) only depends on the pattern.
+ * The analyses of the last few patterns are shared by all instances, so e.g. the solution
+ * of a mesh that is solved again only computes the values of the factor.
+ * If the values didn't change either, e.g. for the currents of a sweep, factor() keeps the factor,
+ * and solve() can be called for any number of right hand sides.
+ */
+class SparseCholesky
+{
+public:
+    SparseCholesky();
+
+    /**
+     * @brief Factor the matrix A.
+     * A is given by its upper triangle in CSR layout, sorted by column with the diagonal first.
+     * @param n number of rows
+     * @param rowStart index of the first entry of each row, plus end marker
+     * @param colIdx column of each entry
+     * @param values value of each entry
+     * @return \c false, if A is not definite
+     */
+    bool factor(int n, const int *rowStart, const int *colIdx, const double *values);
+
+    /**
+     * @brief Y = A^-1 * X, for the matrix A of the last successful factor().
+     */
+    void solve(const double *X, double *Y);
+
+    /**
+     * @return \c true, if a factor is available
+     */
+    bool valid() const { return factorValid; }
+
+    /**
+     * @return \c true, if the factor was computed for a matrix with the given pattern
+     */
+    bool samePattern(int n, const int *rowStart, const int *colIdx) const;
+
+    /**
+     * @return \c true, if the factor was computed for the given values of a matrix with the same pattern
+     */
+    bool sameValues(const double *values) const;
+
+    /**
+     * @return the number of multiply-adds of factor() and solve(), respectively
+     */
+    double factorOperations() const;
+    double solveOperations() const;
+
+private:
+    struct Symbolic;
+
+    static std::shared_ptr<const Symbolic> analyze(int n, const int *rowStart, const int *colIdx);
+    static void minimumDegree(int n, const std::vector<int> &adjStart, const std::vector<int> &adj, std::vector<int> &order);
+
+    std::shared_ptr<const Symbolic> symbolic;
+    std::vector<double> factorValues; ///< values of A of the current factor
+    std::vector<double> L;            ///< the supernodes, each a dense column major block
+    // work arrays
+    std::vector<double> y;
+    std::vector<double> update;
+    std::vector<int> position;
+    bool factorValid;
+};
+
+} // namespace femm
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+#include "ThreadTeam.h"
+
+using namespace femm;
+
+ThreadTeam::ThreadTeam(int numThreads)
+    : numThreads(numThreads < 1 ? 1 : numThreads)
+    , task(nullptr)
+    , generation(0)
+    , numBusy(0)
+    , stop(false)
+{
+    threads.reserve(this->numThreads-1);
+    for (int i=1; i<this->numThreads; i++)
+        threads.emplace_back(&ThreadTeam::threadLoop, this, i);
+}
+
+ThreadTeam::~ThreadTeam()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    taskReady.notify_all();
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+void ThreadTeam::run(const std::function<void(int)> &task)
+{
+    if (threads.empty())
+    {
+        task(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = &task;
+        numBusy = (int)threads.size();
+        generation++;
+    }
+    taskReady.notify_all();
+
+    task(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    taskDone.wait(lock, [this] { return numBusy == 0; });
+    this->task = nullptr;
+}
+
+void ThreadTeam::split(int part, int numParts, int begin, int end, int &first, int &last)
+{
+    const long long count = end - begin;
+    first = begin + (int)((count*part)/numParts);
+    last = begin + (int)((count*(part+1))/numParts);
+}
+
+void ThreadTeam::threadLoop(int index)
+{
+    unsigned done = 0;
+    for (;;)
+    {
+        const std::function<void(int)> *current;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskReady.wait(lock, [this, done] { return stop || generation != done; });
+            if (stop)
+                return;
+            done = generation;
+            current = task;
+        }
+
+        (*current)(index);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            last = (--numBusy == 0);
+        }
+        if (last)
+            taskDone.notify_one();
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+#ifndef THREAD_TEAM_H
+#define THREAD_TEAM_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace femm {
+
+/**
+ * @brief A fixed group of threads that work on the same task together.
+ *
+ * run() calls the task once for each thread of the team, with the thread index as argument,
+ * and returns when all calls have finished.
+ * The calling thread takes index 0, so a team of one thread doesn't start any thread.
+ * Between two tasks the threads sleep, so one team can run many short tasks,
+ * e.g. one per Newton iteration of a solver.
+ *
+ * A team must only be used by one thread at a time.
+ */
+class ThreadTeam
+{
+public:
+    /**
+     * @param numThreads number of threads, including the calling thread; values below 1 are treated as 1.
+     */
+    explicit ThreadTeam(int numThreads);
+    ~ThreadTeam();
+
+    ThreadTeam(const ThreadTeam &) = delete;
+    ThreadTeam &operator=(const ThreadTeam &) = delete;
+
+    /**
+     * @return the number of threads, including the calling thread
+     */
+    int size() const { return numThreads; }
+
+    /**
+     * @brief Call \p task(0) ... \p task(size()-1) in parallel and wait for all of them.
+     * The task must not throw.
+     */
+    void run(const std::function<void(int)> &task);
+
+    /**
+     * @brief Split the range [\p begin, \p end) into \p numParts contiguous parts of about the same size.
+     * @param part index of the part
+     * @param numParts number of parts
+     * @param first receives the first index of the part
+     * @param last receives the index behind the last index of the part
+     */
+    static void split(int part, int numParts, int begin, int end, int &first, int &last);
+
+private:
+    void threadLoop(int index);
+
+    int numThreads;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::condition_variable taskDone;
+    const std::function<void(int)> *task;
+    unsigned generation; ///< incremented for every task
+    int numBusy;         ///< threads that haven't finished the current task
+    bool stop;
+};
+
+} // namespace femm
+
+#endif
@@ -30,6 +30,8 @@
 //#include "spars.h"
 #include "feasolver.h"
 
+#include <vector>
+
 template< class PointPropT
           , class BoundaryPropT
           , class BlockPropT
@@ -96,10 +98,8 @@ int FEASolver<PointPropT,BoundaryPropT,BlockPropT,CircuitPropT,BlockLabelT,MeshE
 {
 
     FILE *fp;
-    int i,n0,n1,n;
+    int i,n0,n1;
     long int j,k;
-    int newwide,*newnum,**ocon;
-    int  *numcon,*nxtnum;
     char infile[256];
 
     // read in connectivity from nodefile
@@ -113,6 +113,65 @@ int FEASolver<PointPropT,BoundaryPropT,BlockPropT,CircuitPropT,BlockLabelT,MeshE
     fscanf(fp,"%li",&k);	// read in number of lines
     fscanf(fp,"%li",&j);	// read in boundarymarker flag;
 
+    std::vector<int> edges;
+    edges.reserve(2*k);
+    for(i=0; i<k; i++)
+    {
+        fscanf(fp,"%li",&j);
+        fscanf(fp,"%i",&n0);
+        fscanf(fp,"%i",&n1);
+        fscanf(fp,"%li",&j);
+
+        edges.push_back(n0);
+        edges.push_back(n1);
+    }
+    fclose(fp);
+    if (deletefiles)
+    {
+        remove(infile);
+    }
+
+    return CuthillFromEdges(k, edges.data());
+}
+
+template< class PointPropT
+          , class BoundaryPropT
+          , class BlockPropT
+          , class CircuitPropT
+          , class BlockLabelT
+          , class MeshElementT
+          >
+int FEASolver<PointPropT,BoundaryPropT,BlockPropT,CircuitPropT,BlockLabelT,MeshElementT>
+::Cuthill(const femm::MeshData &mesh)
+{
+    std::vector<int> edges;
+    edges.reserve(2*mesh.edges.size());
+    for (const auto &edge : mesh.edges)
+    {
+        edges.push_back(edge.n0);
+        edges.push_back(edge.n1);
+    }
+
+    return CuthillFromEdges((int)mesh.edges.size(), edges.data());
+}
+
+template< class PointPropT
+          , class BoundaryPropT
+          , class BlockPropT
+          , class CircuitPropT
+          , class BlockLabelT
+          , class MeshElementT
+          >
+int FEASolver<PointPropT,BoundaryPropT,BlockPropT,CircuitPropT,BlockLabelT,MeshElementT>
+::CuthillFromEdges(int numEdges, const int *edges)
+{
+    int i,n0,n1,n;
+    long int j,k;
+    int newwide,*newnum,**ocon;
+    int  *numcon,*nxtnum;
+
+    k = numEdges;
+
     // allocate storage for numbering
     nxtnum=(int *)calloc(NumNodes,sizeof(int));
     newnum=(int *)calloc(NumNodes,sizeof(int));
@@ -132,10 +191,8 @@ int FEASolver<PointPropT,BoundaryPropT,BlockPropT,CircuitPropT,BlockLabelT,MeshE
     // there are for each node;
     for(i=0; i<k; i++)
     {
-        fscanf(fp,"%li",&j);
-        fscanf(fp,"%i",&n0);
-        fscanf(fp,"%i",&n1);
-        fscanf(fp,"%li",&j);
+        n0=edges[2*i];
+        n1=edges[2*i+1];
 
         numcon[n0]++;
         numcon[n1]++;
@@ -148,27 +205,17 @@ int FEASolver<PointPropT,BoundaryPropT,BlockPropT,CircuitPropT,BlockLabelT,MeshE
         ocon[i]=ocon[0]+n;
     }
 
-    // on second pass through file, store connections;
-    rewind(fp);
-    fscanf(fp,"%li",&k);	// read in number of lines
-    fscanf(fp,"%li",&j);	// read in boundarymarker flag;
+    // on second pass, store connections;
     for(i=0; i<k; i++)
     {
-        fscanf(fp,"%li",&j);
-        fscanf(fp,"%i",&n0);
-        fscanf(fp,"%i",&n1);
-        fscanf(fp,"%li",&j);
+        n0=edges[2*i];
+        n1=edges[2*i+1];
 
         ocon[n0][nxtnum[n0]]=n1;
         nxtnum[n0]++;
         ocon[n1][nxtnum[n1]]=n0;
         nxtnum[n1]++;
     }
-    fclose(fp);
-    if (deletefiles)
-    {
-        remove(infile);
-    }
 
 
     // sort connections in order of increasing connectivity;
@@ -32,6 +32,7 @@
 #include "spars.h"
 #include "fparse.h"
 #include "feasolver.h"
+#include "FemmProblem.h"
 #include "stringTools.h"
 
 #include <assert.h>
@@ -68,6 +69,8 @@ FEASolver<PointPropT,BoundaryPropT,BlockPropT,CircuitPropT,BlockLabelT,MeshEleme
 ::FEASolver()
     : FileFormat(-1)
     , Precision(1.e-08)
+    , Preconditioner(CBigLinProb::PreconditionerSSOR)
+    , MaxLinearIterations(10000)
     , MinAngle(0.)
     , Depth(-1)
     , LengthUnits(LengthInches)
@@ -560,6 +563,106 @@ bool FEASolver<PointPropT,BoundaryPropT,BlockPropT,CircuitPropT,BlockLabelT,Mesh
     return true;
 }
 
+template< class PointPropT
+          , class BoundaryPropT
+          , class BlockPropT
+          , class CircuitPropT
+          , class BlockLabelT
+          , class MeshElementT
+          >
+bool FEASolver<PointPropT,BoundaryPropT,BlockPropT,CircuitPropT,BlockLabelT,MeshElementT>
+::loadFromProblem(const femm::FemmProblem &problem)
+{
+    // define some defaults
+    CleanUp();
+
+    FileFormat = problem.FileFormat;
+    Precision = problem.Precision;
+    MinAngle = problem.MinAngle;
+    Depth = problem.Depth;
+    LengthUnits = problem.LengthUnits;
+    Coords = problem.Coords;
+    ProblemType = problem.problemType;
+    extZo = problem.extZo;
+    extRo = problem.extRo;
+    extRi = problem.extRi;
+    comment = problem.comment;
+    ACSolver = problem.ACSolver;
+    PrevType = problem.PrevType;
+    previousSolutionFile = problem.previousSolutionFile;
+    DoForceMaxMeshArea = problem.DoForceMaxMeshArea;
+    DoSmartMesh = problem.DoSmartMesh;
+
+    // the document stores the same property classes as FemmReader creates,
+    // so the properties can be copied directly
+    nodeproplist.reserve(problem.nodeproplist.size());
+    for (const auto &prop : problem.nodeproplist)
+    {
+        const PointPropT *p = dynamic_cast<const PointPropT*>(prop.get());
+        if (!p)
+        {
+            WarnMessage("Point property has the wrong type for this solver\n");
+            return false;
+        }
+        nodeproplist.push_back(*p);
+    }
+    NumPointProps = (int)nodeproplist.size();
+
+    lineproplist.reserve(problem.lineproplist.size());
+    for (const auto &prop : problem.lineproplist)
+    {
+        const BoundaryPropT *p = dynamic_cast<const BoundaryPropT*>(prop.get());
+        if (!p)
+        {
+            WarnMessage("Boundary property has the wrong type for this solver\n");
+            return false;
+        }
+        lineproplist.push_back(*p);
+    }
+    NumLineProps = (int)lineproplist.size();
+
+    blockproplist.reserve(problem.blockproplist.size());
+    for (const auto &prop : problem.blockproplist)
+    {
+        const BlockPropT *p = dynamic_cast<const BlockPropT*>(prop.get());
+        if (!p)
+        {
+            WarnMessage("Material property has the wrong type for this solver\n");
+            return false;
+        }
+        blockproplist.push_back(*p);
+    }
+    NumBlockProps = (int)blockproplist.size();
+
+    circproplist.reserve(problem.circproplist.size());
+    for (const auto &prop : problem.circproplist)
+    {
+        const CircuitPropT *p = dynamic_cast<const CircuitPropT*>(prop.get());
+        if (!p)
+        {
+            WarnMessage("Circuit property has the wrong type for this solver\n");
+            return false;
+        }
+        circproplist.push_back(*p);
+    }
+    NumCircProps = (int)circproplist.size();
+
+    labellist.reserve(problem.labellist.size());
+    for (const auto &label : problem.labellist)
+    {
+        const BlockLabelT *l = dynamic_cast<const BlockLabelT*>(label.get());
+        if (!l)
+        {
+            WarnMessage("Block label has the wrong type for this solver\n");
+            return false;
+        }
+        labellist.push_back(*l);
+    }
+    NumBlockLabels = (int)labellist.size();
+
+    return true;
+}
+
 template< class PointPropT
           , class BoundaryPropT
           , class BlockPropT
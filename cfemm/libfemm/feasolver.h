@@ -39,10 +39,15 @@
 #include "CBoundaryProp.h"
 #include "CCommonPoint.h"
 #include "CNode.h"
+#include "MeshData.h"
 
 #include <string>
 #include <vector>
 
+namespace femm {
+class FemmProblem;
+}
+
 #ifndef _WIN32
 #define _strnicmp strncasecmp
 #ifndef SNPRINTF
@@ -92,6 +97,10 @@ public:
     // General problem attributes
     double FileFormat; ///< \brief format version of the file
     double Precision;  ///< \brief Computing precision within FEMM
+    /// \brief Preconditioner of the real valued linear problems. Not part of the problem file, so CleanUp() keeps it.
+    CBigLinProb::PreconditionerType Preconditioner;
+    /// \brief Iteration limit of the real valued linear problems, see CBigLinProb::MaxIterations. Kept by CleanUp(), too.
+    int MaxLinearIterations;
     double MinAngle;   ///< \brief angle restriction for triangulation [deg]
     double Depth;      ///< \brief typical length in z-direction [lfac]
     femm::LengthUnit  LengthUnits;  ///< \brief Unit for lengths. Also referred to as \em lfac.
@@ -160,6 +169,13 @@ public:
     static std::string getErrorString(LoadMeshErr err);
 
     int Cuthill(bool deleteFiles=true);
+    /**
+     * @brief Renumber the nodes using the edge list of an in-memory mesh.
+     * This is equivalent to Cuthill(bool), but does not read the \c .edge file.
+     * @param mesh
+     * @return \c true on success, \c false on error.
+     */
+    int Cuthill(const femm::MeshData &mesh);
     int SortElements();
 
     // pointer to function to call when issuing warning messages
@@ -172,6 +188,14 @@ protected:
 
     bool meshLoadedFromPrevSolution;
 
+    /**
+     * @brief Cuthill-McKee renumbering on a list of node connections.
+     * @param numEdges number of edges
+     * @param edges node numbers of the edges, two per edge
+     * @return \c true on success, \c false on error.
+     */
+    int CuthillFromEdges(int numEdges, const int *edges);
+
 protected:
     /**
      * @brief LoadProblemFile
@@ -185,6 +209,15 @@ protected:
      * \endinternal
      */
     bool LoadProblemFile(std::string &file);
+    /**
+     * @brief Take over the problem description from an in-memory document.
+     * This is the equivalent of LoadProblemFile(), but copies the properties
+     * and block labels directly from \p problem instead of parsing a file.
+     * The solver specific header entries (e.g. the frequency) must be copied by the caller.
+     * @param problem
+     * @return \c true on success, \c false if \p problem holds properties of the wrong type.
+     */
+    bool loadFromProblem(const femm::FemmProblem &problem);
     /**
      * @brief handleToken is called by LoadProblemFile() when a token is encountered that it can not handle.
      *
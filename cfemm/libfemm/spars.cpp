@@ -20,9 +20,16 @@
 */
 
 #include "femmcomplex.h"
+#include "fparse.h"
 #include "spars.h"
+#include "AmgPreconditioner.h"
+#include "IncompleteCholesky.h"
+#include "SparseCholesky.h"
+#include "ThreadTeam.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <utility>
@@ -31,10 +38,30 @@ using std::swap;
 
 #define KLUDGE
 
+namespace {
+// below this many rows per thread, waking the threads costs more than it saves
+const int rowGrain = 2048;
+// rows per partial sum of CBigLinProb::parallelSum()
+const int sumBlockSize = 1024;
+// CBigLinProb::multColouredSSOR() uses at most this many blocks of rows,
+// but the blocks have at least minColourBlockSize rows. Larger blocks converge better.
+const int maxColourBlocks = 64;
+const int minColourBlockSize = 2048;
+// PreconditionerICT drops fill-in below this fraction of the norm of the row
+const double ictDropTolerance = 1e-3;
+// CBigLinProb::PCGSolve() gives up if the residual didn't halve within MaxIterations/stagnationDivisor
+// iterations, but at least minStagnationIterations, or if it grows to divergenceFactor times its
+// smallest value. At that rate the residual would shrink by less than 2^-20 (about 1e-6) within
+// MaxIterations, so a solution that stagnates that long would almost certainly hit the limit anyway.
+// The residual of CG isn't monotonic, so the window must not be too short either.
+const int stagnationDivisor = 20;
+const int minStagnationIterations = 50;
+const double divergenceFactor = 1e6;
+}
+
 
 CEntry::CEntry()
 {
-    next=NULL;
     x=0;
     c=0;
 }
@@ -42,17 +69,23 @@ CEntry::CEntry()
 CBigLinProb::CBigLinProb()
 {
     n=0;
+    compressed=false;
+    patternRevision=0;
+    storedRevision=0;
     // Best guess for relaxation parameter
     Lambda = 1.5;
+    NumThreads = 1;
+    Preconditioner = PreconditionerSSOR;
+    MaxIterations = 10000;
+    WarnMessage = &femm::PrintWarningMsg;
+    fullColoured = false;
+    colourBlockSize = 0;
 }
 
 CBigLinProb::~CBigLinProb()
 {
     if (n==0) return;
 
-    int i;
-    CEntry *uo,*ui;
-
     free(b);
     free(P);
     free(R);
@@ -60,19 +93,6 @@ CBigLinProb::~CBigLinProb()
     free(U);
     free(Z);
 
-    for(i=0; i<n; i++)
-    {
-        ui=M[i];
-        do
-        {
-            uo=ui;
-            ui=uo->next;
-            delete uo;
-        }
-        while(ui!=NULL);
-    }
-
-    free(M);
     free(Q);
     n = 0;
 }
@@ -89,56 +109,122 @@ int CBigLinProb::Create(int d, int bw)
     U=(double *)calloc(d,sizeof(double));
     Z=(double *)calloc(d,sizeof(double));
 
-    M=(CEntry **)calloc(d,sizeof(CEntry *));
     n=d;
 
+    // every row starts with its diagonal entry;
+    // a node of a triangle mesh typically has about 6 neighbours,
+    // half of which end up in the upper triangle
+    compressed=false;
+    patternRevision++;
+    rows.assign(d, std::vector<CEntry>());
+    storedB.clear();
     for(i=0; i<d; i++)
     {
-        M[i] = new CEntry;
-        M[i]->c = i;
+        rows[i].reserve(8);
+        rows[i].push_back(CEntry());
+        rows[i][0].c = i;
     }
     Q = (int *)  calloc(d,sizeof(int));
 
     return 1;
 }
 
-void CBigLinProb::Put(double v, int p, int q)
+double *CBigLinProb::findEntry(int p, int q, bool create)
 {
-    CEntry *e,*l = NULL;
+    if (compressed)
+    {
+        const int *first = colIdx.data() + rowStart[p];
+        const int *last = colIdx.data() + rowStart[p+1];
+        const int *pos = std::lower_bound(first, last, q);
+        if ((pos != last) && (*pos == q))
+            return values.data() + (pos - colIdx.data());
 
-    if (q<p)
-        swap(p,q);
+        if (!create)
+            return NULL;
 
-    e = M[p];
+        // the entry is not part of the sparsity pattern
+        expand();
+    }
+
+    std::vector<CEntry> &row = rows[p];
+    std::vector<CEntry>::iterator pos = std::lower_bound(row.begin(), row.end(), q,
+            [](const CEntry &e, int col) { return e.c < col; });
+    if ((pos != row.end()) && (pos->c == q))
+        return &pos->x;
+
+    if (!create)
+        return NULL;
+
+    CEntry m;
+    m.c = q;
+    pos = row.insert(pos, m);
+    return &pos->x;
+}
+
+void CBigLinProb::compress()
+{
+    int i,k;
 
-    while ((e->c < q) && (e->next != NULL))
+    rowStart.resize(n+1);
+    for(i=0,k=0; i<n; i++)
     {
-        l = e;
-        e = e->next;
+        rowStart[i] = k;
+        k += (int)rows[i].size();
     }
+    rowStart[n] = k;
 
-    if (e->c == q)
+    colIdx.resize(k);
+    values.resize(k);
+    for(i=0; i<n; i++)
     {
-        e->x = v;
-        return;
+        k = rowStart[i];
+        for (const CEntry &e : rows[i])
+        {
+            colIdx[k] = e.c;
+            values[k] = e.x;
+            k++;
+        }
     }
 
-    CEntry *m = new CEntry;
+    rows.clear();
+    rows.shrink_to_fit();
+    compressed = true;
+    patternRevision++;
 
-    if ((e->next == NULL) && (q > e->c))
-    {
-        e->next = m;
-        m->c = q;
-        m->x = v;
-    }
-    else
+    // the pattern may have changed
+    fullRowStart.clear();
+}
+
+void CBigLinProb::expand()
+{
+    int i,k;
+
+    rows.assign(n, std::vector<CEntry>());
+    for(i=0; i<n; i++)
     {
-        l->next = m;
-        m->next = e;
-        m->c = q;
-        m->x = v;
+        rows[i].resize(rowStart[i+1]-rowStart[i]);
+        for(k=rowStart[i]; k<rowStart[i+1]; k++)
+        {
+            rows[i][k-rowStart[i]].c = colIdx[k];
+            rows[i][k-rowStart[i]].x = values[k];
+        }
     }
-    return;
+
+    rowStart.clear();
+    colIdx.clear();
+    colIdx.shrink_to_fit();
+    values.clear();
+    values.shrink_to_fit();
+    compressed = false;
+    patternRevision++;
+}
+
+void CBigLinProb::Put(double v, int p, int q)
+{
+    if (q<p)
+        swap(p,q);
+
+    *findEntry(p,q,true) = v;
 }
 
 double CBigLinProb::Get(int p, int q)
@@ -148,62 +234,90 @@ double CBigLinProb::Get(int p, int q)
         swap(p,q);
     }
 
-    CEntry *e = M[p];
-    while ((e->c < q) && (e->next != NULL))
-    {
-        e = e->next;
-    }
-
-    if (e->c == q) return e->x;
+    const double *e = findEntry(p,q,false);
+    if (e != NULL) return *e;
 
     return 0;
 }
 
 void CBigLinProb::AddTo(double v, int p, int q)
 {
-	Put(Get(p,q)+v,p,q);
+    if (q<p)
+        swap(p,q);
+
+    *findEntry(p,q,true) += v;
 }
 
 void CBigLinProb::MultA(double *X, double *Y)
 {
-    int i;
-    CEntry *e;
+    prepareKernels();
+    parallelFor(0, n, rowGrain, [this,X,Y](int first, int last) {
+        multiplyRows(X, Y, first, last);
+    });
+}
+
+void CBigLinProb::multiplyRows(const double *X, double *Y, int first, int last) const
+{
+    int i,k;
+    double yi;
 
-    for(i=0; i<n; i++) Y[i]=0;
+    const int *rs = fullRowStart.data();
+    const int *col = fullColIdx.data();
+    const double *val = fullValues.data();
 
-    for(i=0; i<n; i++)
+    // if the columns are sorted, the sum has the same order as in
+    // a product with the upper triangle
+    for(i=first; i<last; i++)
     {
-        Y[i]+=M[i]->x*X[i];
-        e=M[i]->next;
-        while(e!=NULL)
-        {
-            Y[i]+=e->x*X[e->c];
-            Y[e->c]+=e->x*X[i];
-            e=e->next;
-        }
+        yi = 0;
+        for(k=rs[i]; k<rs[i+1]; k++)
+            yi += val[k]*X[col[k]];
+        Y[i] = yi;
     }
 }
 
 double CBigLinProb::Dot(double *X, double *Y)
 {
-    int i;
-    double z;
+    return parallelSum([X,Y](int first, int last) {
+        double z=0;
+        for(int i=first; i<last; i++) z+=X[i]*Y[i];
+        return z;
+    });
+}
 
-    for(i=0,z=0; i<n; i++) z+=X[i]*Y[i];
+void CBigLinProb::MultPC(const double *X, double *Y)
+{
+    prepareKernels();
+    applyPC(X,Y);
+}
 
-    return z;
+void CBigLinProb::applyPC(const double *X, double *Y)
+{
+    if (Preconditioner == PreconditionerColouredSSOR)
+        multColouredSSOR(X,Y);
+    else if ((Preconditioner == PreconditionerAMG) && (amg->numLevels() > 0))
+        amg->apply(X,Y);
+    else if (((Preconditioner == PreconditionerIC0) || (Preconditioner == PreconditionerICT)) && ic->valid())
+        ic->apply(X,Y,team.get());
+    else if ((Preconditioner == PreconditionerCholesky) && cholesky->valid())
+        cholesky->solve(X,Y);
+    else
+        multSSOR(X,Y);
 }
 
-void CBigLinProb::MultPC(const double *X, double *Y)
+void CBigLinProb::multSSOR(const double *X, double *Y) const
 {
     // Jacobi preconditioner:
     //	int i;
     // for(i=0;i<n;i++) Y[i]=X[i]/M[i]->x;
 
     // SSOR preconditioner:
-    int i;
-    double c;
-    CEntry *e;
+    int i,k;
+    double c,yi;
+
+    const int *rs = rowStart.data();
+    const int *col = colIdx.data();
+    const double *val = values.data();
 
     c= Lambda*(2.-Lambda);
     for(i=0; i<n; i++) Y[i]=X[i]*c;
@@ -211,40 +325,295 @@ void CBigLinProb::MultPC(const double *X, double *Y)
     // invert Lower Triangle;
     for(i=0; i<n; i++)
     {
-        Y[i]/= M[i]->x;
-        e=M[i]->next;
-        while(e!=NULL)
+        Y[i]/= val[rs[i]];
+        yi = Y[i];
+        for(k=rs[i]+1; k<rs[i+1]; k++)
         {
-            Y[e->c] -= e->x * Y[i] * Lambda;
-            e=e->next;
+            Y[col[k]] -= val[k] * yi * Lambda;
         }
     }
 
-    for(i=0; i<n; i++) Y[i]*=M[i]->x;
+    for(i=0; i<n; i++) Y[i]*=val[rs[i]];
 
     // invert Upper Triangle
     for(i=n-1; i>=0; i--)
     {
-        e=M[i]->next;
-        while(e!=NULL)
+        yi = Y[i];
+        for(k=rs[i]+1; k<rs[i+1]; k++)
         {
-            Y[i] -= e->x * Y[e->c] * Lambda;
-            e=e->next;
+            yi -= val[k] * Y[col[k]] * Lambda;
         }
-        Y[i]/= M[i]->x;
+        Y[i] = yi / val[rs[i]];
     }
 }
 
+void CBigLinProb::multColouredSSOR(const double *X, double *Y)
+{
+    // The same sweeps as multSSOR(), with the blocks ordered by colour.
+    // The rows of the full matrix hold the entries that come before the row
+    // in this order, then the diagonal, then the entries that come after it.
+    const int numColours = (int)colourStart.size()-1;
+    const double c = Lambda*(2.-Lambda);
+    int g;
+
+    // invert Lower Triangle
+    for(g=0; g<numColours; g++)
+    {
+        parallelFor(colourStart[g], colourStart[g+1], 1, [this,X,Y,c](int first, int last) {
+            const int *col = fullColIdx.data();
+            const double *val = fullValues.data();
+            for(int m=first; m<last; m++)
+            {
+                const int end = std::min(n, (colourBlocks[m]+1)*colourBlockSize);
+                for(int i=colourBlocks[m]*colourBlockSize; i<end; i++)
+                {
+                    double yi = X[i]*c;
+                    for(int k=fullRowStart[i]; k<fullDiag[i]; k++)
+                        yi -= val[k] * Y[col[k]] * Lambda;
+                    Y[i] = yi / val[fullDiag[i]];
+                }
+            }
+        });
+    }
+
+    // invert Upper Triangle
+    for(g=numColours-1; g>=0; g--)
+    {
+        parallelFor(colourStart[g], colourStart[g+1], 1, [this,Y](int first, int last) {
+            const int *col = fullColIdx.data();
+            const double *val = fullValues.data();
+            for(int m=first; m<last; m++)
+            {
+                const int begin = colourBlocks[m]*colourBlockSize;
+                for(int i=std::min(n, begin+colourBlockSize)-1; i>=begin; i--)
+                {
+                    const double d = val[fullDiag[i]];
+                    double yi = Y[i]*d;
+                    for(int k=fullDiag[i]+1; k<fullRowStart[i+1]; k++)
+                        yi -= val[k] * Y[col[k]] * Lambda;
+                    Y[i] = yi / d;
+                }
+            }
+        });
+    }
+}
+
+void CBigLinProb::prepareKernels()
+{
+    int i,k,c;
+
+    if (!compressed) compress();
+
+    if (NumThreads > 1)
+    {
+        if (!team || (team->size() != NumThreads))
+            team.reset(new femm::ThreadTeam(NumThreads));
+    }
+    else
+        team.reset();
+
+    const bool coloured = (Preconditioner == PreconditionerColouredSSOR);
+    if (fullRowStart.empty() || (coloured != fullColoured))
+    {
+        // every row holds its upper triangle and the transposed entries of the rows above
+        fullRowStart.assign(n+1, 0);
+        for(i=0; i<n; i++)
+        {
+            fullRowStart[i+1] += rowStart[i+1]-rowStart[i];
+            for(k=rowStart[i]+1; k<rowStart[i+1]; k++)
+                fullRowStart[colIdx[k]+1]++;
+        }
+        for(i=0; i<n; i++) fullRowStart[i+1] += fullRowStart[i];
+
+        // row i gets its transposed entries from the rows above before its own entries,
+        // so the columns end up sorted
+        std::vector<int> pos(fullRowStart.begin(), fullRowStart.end()-1);
+        fullColIdx.resize(fullRowStart[n]);
+        fullSource.resize(fullRowStart[n]);
+        fullDiag.resize(n);
+        for(i=0; i<n; i++)
+        {
+            fullDiag[i] = pos[i];
+            for(k=rowStart[i]; k<rowStart[i+1]; k++)
+            {
+                fullColIdx[pos[i]] = colIdx[k];
+                fullSource[pos[i]++] = k;
+            }
+            for(k=rowStart[i]+1; k<rowStart[i+1]; k++)
+            {
+                c = colIdx[k];
+                fullColIdx[pos[c]] = i;
+                fullSource[pos[c]++] = k;
+            }
+        }
+        fullValues.resize(fullRowStart[n]);
+
+        fullColoured = coloured;
+        if (coloured) colourBlocksOfRows();
+    }
+
+    // the values change with every assembly
+    parallelFor(0, (int)fullValues.size(), 8*rowGrain, [this](int first, int last) {
+        for(int k=first; k<last; k++) fullValues[k] = values[fullSource[k]];
+    });
+
+    if (Preconditioner == PreconditionerAMG)
+    {
+        if (!amg) amg.reset(new femm::AmgPreconditioner);
+        // without a hierarchy applyPC() falls back to SSOR
+        if (!amg->setup(n, fullRowStart.data(), fullColIdx.data(), fullValues.data()))
+            warning("AMG setup failed, using SSOR\n");
+    }
+
+    if ((Preconditioner == PreconditionerIC0) || (Preconditioner == PreconditionerICT))
+    {
+        if (!ic) ic.reset(new femm::IncompleteCholesky);
+        // the factor works on the upper triangle; without it applyPC() falls back to SSOR
+        const double dropTolerance = (Preconditioner == PreconditionerICT) ? ictDropTolerance : 0;
+        if (!ic->factor(n, rowStart.data(), colIdx.data(), values.data(), dropTolerance))
+            warning("Incomplete Cholesky factorization failed, using SSOR\n");
+    }
+
+    if (Preconditioner == PreconditionerCholesky)
+    {
+        if (!cholesky) cholesky.reset(new femm::SparseCholesky);
+        // a factor of an earlier matrix with the same pattern is still a good preconditioner,
+        // PCGSolve() replaces it if it isn't
+        if (!cholesky->valid() || !cholesky->samePattern(n, rowStart.data(), colIdx.data()))
+            factorCholesky();
+    }
+}
+
+void CBigLinProb::factorCholesky()
+{
+    if (!cholesky->factor(n, rowStart.data(), colIdx.data(), values.data()))
+        warning("Cholesky factorization failed, using SSOR\n");
+}
+
+void CBigLinProb::warning(const char *format, ...) const
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    WarnMessage(buf);
+}
+
+void CBigLinProb::colourBlocksOfRows()
+{
+    int i,k,c,blk;
+
+    // Greedy colouring of the blocks: the smallest colour that no block above shares an entry with.
+    // The nodes are numbered by Cuthill-McKee, so a block usually only touches its neighbours
+    // and two colours are enough.
+    colourBlockSize = std::max(minColourBlockSize, (n+maxColourBlocks-1)/maxColourBlocks);
+    const int numBlocks = (n+colourBlockSize-1)/colourBlockSize;
+    std::vector<int> colour(n, -1);
+    std::vector<int> usedBy;
+    int numColours = 0;
+    for(blk=0; blk<numBlocks; blk++)
+    {
+        const int end = std::min(n, (blk+1)*colourBlockSize);
+        for(i=blk*colourBlockSize; i<end; i++)
+            for(k=fullRowStart[i]; k<fullRowStart[i+1]; k++)
+            {
+                c = colour[fullColIdx[k]];
+                if (c >= 0) usedBy[c] = blk;
+            }
+        for(c=0; (c<numColours) && (usedBy[c]==blk); c++);
+        if (c == numColours)
+        {
+            usedBy.push_back(-1);
+            numColours++;
+        }
+        for(i=blk*colourBlockSize; i<end; i++) colour[i] = c;
+    }
+
+    colourStart.assign(numColours+1, 0);
+    for(blk=0; blk<numBlocks; blk++) colourStart[colour[blk*colourBlockSize]+1]++;
+    for(c=0; c<numColours; c++) colourStart[c+1] += colourStart[c];
+    std::vector<int> pos(colourStart.begin(), colourStart.end()-1);
+    colourBlocks.resize(numBlocks);
+    for(blk=0; blk<numBlocks; blk++) colourBlocks[pos[colour[blk*colourBlockSize]]++] = blk;
+
+    // Reorder every row: the entries of earlier colours and the entries above it in its own block,
+    // the diagonal, then the rest. Blocks of the same colour don't share entries.
+    std::vector<int> rowCol, rowSource;
+    for(i=0; i<n; i++)
+    {
+        const int g = colour[i];
+        rowCol.assign(fullColIdx.begin()+fullRowStart[i], fullColIdx.begin()+fullRowStart[i+1]);
+        rowSource.assign(fullSource.begin()+fullRowStart[i], fullSource.begin()+fullRowStart[i+1]);
+
+        int m = fullRowStart[i];
+        for(k=0; k<(int)rowCol.size(); k++)
+        {
+            const int j = rowCol[k];
+            if ((colour[j] < g) || ((colour[j] == g) && (j < i)))
+            {
+                fullColIdx[m] = j;
+                fullSource[m++] = rowSource[k];
+            }
+        }
+        fullDiag[i] = m;
+        fullColIdx[m] = i;
+        fullSource[m++] = rowStart[i];
+        for(k=0; k<(int)rowCol.size(); k++)
+        {
+            const int j = rowCol[k];
+            if ((colour[j] > g) || ((colour[j] == g) && (j > i)))
+            {
+                fullColIdx[m] = j;
+                fullSource[m++] = rowSource[k];
+            }
+        }
+    }
+}
+
+void CBigLinProb::parallelFor(int begin, int end, int grain, const std::function<void(int,int)> &body)
+{
+    if (!team || (end-begin < grain*team->size()))
+    {
+        body(begin, end);
+        return;
+    }
+
+    team->run([&](int thread) {
+        int first,last;
+        femm::ThreadTeam::split(thread, team->size(), begin, end, first, last);
+        body(first, last);
+    });
+}
+
+double CBigLinProb::parallelSum(const std::function<double(int,int)> &body)
+{
+    int k;
+    double z;
+
+    const int numBlocks = (n+sumBlockSize-1)/sumBlockSize;
+    blockSums.resize(numBlocks);
+    parallelFor(0, numBlocks, 2, [this,&body](int first, int last) {
+        for(int k=first; k<last; k++)
+            blockSums[k] = body(k*sumBlockSize, std::min(n, (k+1)*sumBlockSize));
+    });
+
+    for(k=0,z=0; k<numBlocks; k++) z+=blockSums[k];
+
+    return z;
+}
+
 bool CBigLinProb::PCGSolve(int flag)
 {
     int i;
-    double res,res_o,res_new;
-    double er,del,rho,pAp;
+
+    // the sparsity pattern is complete now
+    prepareKernels();
 
     // quick check for most obvious sign of singularity;
-    for(i=0; i<n; i++) if(M[i]->x==0)
+    for(i=0; i<n; i++) if(values[rowStart[i]]==0)
         {
-            fprintf(stderr,"singular flag tripped at %i of %i\n", i,n);
+            warning("singular flag tripped at %i of %i\n", i,n);
             return 0;
         }
 
@@ -253,51 +622,140 @@ bool CBigLinProb::PCGSolve(int flag)
 //	TheView->m_prog1.SetPos(0);
     //printf("Conjugate Gradient Solver\n");
 
+    std::vector<double> start(V, V+n);
+    int iter;
+    PCGResult result = conjugateGradient(flag, iter);
+    if (result == PCGConverged) return true;
+
+    const char *reason = (result == PCGIterationLimit) ? "reached the iteration limit"
+                         : (result == PCGStagnation) ? "stagnated" : "diverged";
+    if (Preconditioner == PreconditionerCholesky)
+    {
+        warning("conjugate gradient solver %s after %i iterations\n", reason, iter);
+        return false;
+    }
+
+    // start again from the same guess with a factor of this matrix
+    warning("conjugate gradient solver %s after %i iterations, using Cholesky\n", reason, iter);
+    if (!cholesky) cholesky.reset(new femm::SparseCholesky);
+    if (!cholesky->factor(n, rowStart.data(), colIdx.data(), values.data()))
+    {
+        warning("Cholesky factorization failed\n");
+        return false;
+    }
+    // only for this solution, the following ones use the selected preconditioner again
+    const PreconditionerType selected = Preconditioner;
+    Preconditioner = PreconditionerCholesky;
+    std::copy(start.begin(), start.end(), V);
+    result = conjugateGradient(flag, iter);
+    Preconditioner = selected;
+    cholesky.reset();
+    if (result != PCGConverged)
+    {
+        warning("conjugate gradient solver with Cholesky didn't converge after %i iterations\n", iter);
+        return false;
+    }
+    return true;
+}
+
+CBigLinProb::PCGResult CBigLinProb::conjugateGradient(int flag, int &iter)
+{
+    int i;
+    double res,res_o,res_new;
+    double er,del,rho,pAp;
+
+    iter=0;
+
     // residual with V=0
-    MultPC(b,Z);
+    applyPC(b,Z);
     res_o=Dot(Z,b);
-    if(res_o==0) return true;
+    if(res_o==0) return PCGConverged;
 
     // if flag is false, initialize V with zeros;
     if (flag==0) for(i=0; i<n; i++) V[i]=0;
 
     // form residual;
-    MultA(V,R);
+    multiplyRows(V,R,0,n);
     for(i=0; i<n; i++) R[i]=b[i]-R[i];
 
     // form initial search direction;
-    MultPC(R,Z);
+    applyPC(R,Z);
     for(i=0; i<n; i++) P[i]=Z[i];
     res=Dot(Z,R);
 
+    // a PreconditionerCholesky factor of an earlier matrix is replaced once its iterations
+    // cost about as much as a new factor
+    int staleIterations=0;
+    if ((Preconditioner == PreconditionerCholesky) && cholesky->valid())
+        staleIterations=std::max(2, (int)(cholesky->factorOperations()/(cholesky->solveOperations()+fullValues.size())));
+
+    // the guess is the solution
+    if(res==0) return PCGConverged;
+
+    // smallest residual so far and the iteration that halved it
+    double best=sqrt(res/res_o);
+    int progress=0;
+    const int stagnationIterations=std::max(minStagnationIterations, MaxIterations/stagnationDivisor);
+
     // do iteration;
     do
     {
-        // step i)
-        MultA(P,U);
-        pAp=Dot(P,U);
+
+        // step i), the product and the dot product in one pass
+        pAp=parallelSum([this](int first, int last) {
+            multiplyRows(P,U,first,last);
+            double z=0;
+            for(int i=first; i<last; i++) z+=P[i]*U[i];
+            return z;
+        });
         del=res/pAp;
 
-        for(i=0; i<n; i++)
-        {
-            // step ii)
-            V[i]+=(del*P[i]);
+        parallelFor(0, n, rowGrain, [this,del](int first, int last) {
+            for(int i=first; i<last; i++)
+            {
+                // step ii)
+                V[i]+=(del*P[i]);
 
-            // step iii)
-            R[i]-=(del*U[i]);
-        }
+                // step iii)
+                R[i]-=(del*U[i]);
+            }
+        });
 
         // step iv)
-        MultPC(R,Z);
+        applyPC(R,Z);
         res_new=Dot(Z,R);
         rho=res_new/res;
         res=res_new;
 
         // step v)
-        for(i=0; i<n; i++) P[i]=Z[i]+(rho*P[i]);
+        parallelFor(0, n, rowGrain, [this,rho](int first, int last) {
+            for(int i=first; i<last; i++) P[i]=Z[i]+(rho*P[i]);
+        });
+
+        // the factor of an earlier matrix doesn't help enough: factor this one and start again from V
+        iter++;
+        if ((iter == staleIterations) && !cholesky->sameValues(values.data()))
+        {
+            factorCholesky();
+            applyPC(b,Z);
+            res_o=Dot(Z,b);
+            multiplyRows(V,R,0,n);
+            for(i=0; i<n; i++) R[i]=b[i]-R[i];
+            applyPC(R,Z);
+            for(i=0; i<n; i++) P[i]=Z[i];
+            res=Dot(Z,R);
+        }
 
         // have we converged yet?
         er=sqrt(res/res_o);
+        if (!(er < divergenceFactor*best)) return PCGDivergence;
+        if (er < 0.5*best)
+        {
+            best=er;
+            progress=iter;
+        }
+        else if (iter-progress >= stagnationIterations) return PCGStagnation;
+        if ((er>Precision) && (iter >= MaxIterations)) return PCGIterationLimit;
 //        prg2=(int) (20.*log10(er)/(log10(Precision)));
 //        if(prg2>prg1)
 //        {
@@ -312,7 +770,7 @@ bool CBigLinProb::PCGSolve(int flag)
     }
     while(er>Precision);
 
-    return true;
+    return PCGConverged;
 }
 
 void CBigLinProb::SetValue(int i, double x)
@@ -348,21 +806,60 @@ void CBigLinProb::SetValue(int i, double x)
 void CBigLinProb::Wipe()
 {
     int i;
-    CEntry *e;
 
-    for(i=0; i<n; i++)
+    // the sparsity pattern is kept
+    for(i=0; i<n; i++) b[i]=0.;
+
+    if (compressed)
     {
-        b[i]=0.;
-        e=M[i];
-        do
-        {
-            e->x=0;
-            e=e->next;
-        }
-        while(e!=NULL);
+        std::fill(values.begin(), values.end(), 0.);
+    }
+    else
+    {
+        for(i=0; i<n; i++)
+            for (CEntry &e : rows[i])
+                e.x=0;
     }
 }
 
+void CBigLinProb::StoreAssembly()
+{
+    if (!compressed) compress();
+    storedRowStart = rowStart;
+    storedColIdx = colIdx;
+    storedValues = values;
+    storedB.assign(b, b+n);
+    storedRevision = patternRevision;
+}
+
+void CBigLinProb::RestoreAssembly()
+{
+    int i,k;
+
+    if (storedB.size() != (size_t)n)
+    {
+        Wipe();
+        return;
+    }
+
+    // the pattern is still the one of StoreAssembly(), if it wasn't expanded or compressed since
+    if (compressed && (patternRevision == storedRevision))
+    {
+        std::copy(storedValues.begin(), storedValues.end(), values.begin());
+        std::copy(storedB.begin(), storedB.end(), b);
+        return;
+    }
+
+    // entries were inserted since StoreAssembly(), e.g. by boundary conditions;
+    // copy the stored entries into the current pattern and store that one
+    Wipe();
+    for(i=0; i<n; i++)
+        for(k=storedRowStart[i]; k<storedRowStart[i+1]; k++)
+            *findEntry(i,storedColIdx[k],true) = storedValues[k];
+    std::copy(storedB.begin(), storedB.end(), b);
+    StoreAssembly();
+}
+
 void CBigLinProb::AntiPeriodicity(int i, int j)
 {
     int k,fst,lst;
@@ -478,14 +975,13 @@ void CBigLinProb::Periodicity(int i, int j)
 // constructed matrix is actually consistent with a priori bandwidth.
 void CBigLinProb::ComputeBandwidth()
 {
-    CEntry *e;
     int k,bw,maxbw;
 
+    if (!compressed) compress();
+
     for(maxbw=0,k=0; k<n; k++)
     {
-        e=M[k];
-        while(e->next != NULL) e=e->next;
-        bw=e->c - k;
+        bw=colIdx[rowStart[k+1]-1] - k;
         if (bw>maxbw) maxbw=bw;
     }
 
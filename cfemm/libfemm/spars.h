@@ -22,23 +22,88 @@
 #ifndef SPARS_H
 #define SPARS_H
 
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace femm {
+class AmgPreconditioner;
+class IncompleteCholesky;
+class SparseCholesky;
+class ThreadTeam;
+}
+
 class CEntry
 {
 public:
 
     double x;				// value stored in the entry
     int c;					// column that the entry lives in
-    CEntry *next;			// pointer to next entry in row;
     CEntry();
 
 private:
 };
 
+/**
+ * @brief The CBigLinProb class holds a sparse symmetric linear problem and solves it
+ * using a preconditioned conjugate gradient method.
+ *
+ * Only the upper triangle of the matrix is stored, row by row and sorted by column,
+ * with the diagonal entry first.
+ * While the matrix is assembled for the first time, the rows are kept in separate
+ * vectors so that new entries can be inserted.
+ * Before solving, the matrix is compressed into a flat compressed sparse row (CSR) layout.
+ * Wipe() keeps the sparsity pattern, so the following assembly passes of a nonlinear
+ * solution write directly into the CSR arrays.
+ * Inserting an entry that is not part of the pattern expands the matrix again.
+ *
+ * StoreAssembly() remembers a partially assembled problem, e.g. the elements that don't
+ * change between nonlinear iterations. RestoreAssembly() then replaces Wipe(), so only the
+ * remaining elements have to be assembled again.
+ *
+ * PCGSolve() can use several threads, see #NumThreads. The matrix products work on a copy
+ * of the matrix that holds both triangles, so every thread computes its own rows.
+ * Dot products are summed in blocks of a fixed size, so the solution doesn't depend
+ * on the number of threads.
+ *
+ * PCGSolve() gives up after #MaxIterations, if the residual doesn't halve within a twentieth
+ * of #MaxIterations, or if it grows out of bounds. It then solves again with PreconditionerCholesky, the most robust of the
+ * preconditioners, before it fails.
+ */
+
 
 class CBigLinProb
 {
 public:
 
+    /// \brief Preconditioners of PCGSolve()
+    enum PreconditionerType {
+        /// \brief SSOR in the node order. The sweeps are sequential and use one thread.
+        PreconditionerSSOR = 0,
+        /// \brief SSOR on blocks of consecutive nodes, in the order of a colouring of the blocks.
+        /// Blocks of the same colour don't share a matrix entry, so they are relaxed in parallel.
+        /// Inside a block the nodes keep their order, so it converges almost like PreconditionerSSOR.
+        PreconditionerColouredSSOR = 1,
+        /// \brief Smoothed aggregation algebraic multigrid, see femm::AmgPreconditioner.
+        /// The number of iterations hardly depends on the size of the mesh. The aggregates are kept
+        /// for the following solutions, e.g. the iterations of a nonlinear problem, and the
+        /// hierarchy is kept as a whole while the matrix doesn't change, e.g. in a current sweep.
+        PreconditionerAMG = 2,
+        /// \brief Incomplete Cholesky factorization without fill-in, see femm::IncompleteCholesky.
+        /// Converges faster than SSOR at a fraction of the setup of PreconditionerAMG.
+        /// The values are factored again for every matrix, the pattern is kept.
+        PreconditionerIC0 = 3,
+        /// \brief Incomplete Cholesky factorization with the fill-in above a drop tolerance.
+        /// The pattern found for the first matrix is kept for the following ones.
+        PreconditionerICT = 4,
+        /// \brief Sparse Cholesky factorization, see femm::SparseCholesky.
+        /// For the factored matrix PCGSolve() converges in one iteration, so this is a direct solver.
+        /// The factor is kept for the following matrices of the same pattern, e.g. the iterations of
+        /// a nonlinear problem, as a preconditioner; PCGSolve() factors the current matrix if that
+        /// needs too many iterations.
+        PreconditionerCholesky = 5
+    };
+
     // data members
 
     double *V;				// solution
@@ -47,11 +112,14 @@ public:
     double *U;				// A * P;
     double *Z;
     double *b;				// RHS of linear equation
-    CEntry **M;				// pointer to list of matrix entries;
     int n;					// dimensions of the matrix;
     int bdw;				// Optional matrix bandwidth parameter;
     double Precision;		// error tolerance for solution
     double Lambda;			// relaxation factor;
+    int NumThreads;			///< number of threads of PCGSolve(), default 1
+    PreconditionerType Preconditioner; ///< default PreconditionerSSOR
+    int MaxIterations;		///< PCGSolve() gives up after this many iterations, default 10000
+    int (*WarnMessage)(const char*, ...); ///< receives the messages of PCGSolve(), default PrintWarningMsg()
 
     int *Q; ///< Used by esolver and hsolver.
 
@@ -65,14 +133,25 @@ public:
     void Put(double v, int p, int q);
     // use to create/set entries in the matrix
     double Get(int p, int q);
-    bool PCGSolve(int flag);	// flag==true if guess for V present;
-    void MultPC(const double *X, double *Y);
+    /**
+     * @brief Solve the problem with the preconditioned conjugate gradient method.
+     * If the iteration doesn't converge with the selected #Preconditioner, PCGSolve() starts again
+     * with PreconditionerCholesky. The following solutions of this problem use #Preconditioner again.
+     * @param flag \c true, if V holds an initial guess
+     * @return \c false, if the matrix is singular or the iteration didn't converge
+     */
+    bool PCGSolve(int flag);
+    void MultPC(const double *X, double *Y);
     void AddTo(double v, int p, int q);
     void MultA(double *X, double *Y);
     void SetValue(int i, double x);
     void Periodicity(int i, int j);
     void AntiPeriodicity(int i, int j);
     void Wipe();
+    /// \brief Remember the current matrix and right hand side for RestoreAssembly().
+    void StoreAssembly();
+    /// \brief Like Wipe(), but reset the matrix and right hand side to the values of StoreAssembly().
+    void RestoreAssembly();
     double Dot(double *X, double *Y);
     void ComputeBandwidth();
 
@@ -80,6 +159,94 @@ public:
 
 private:
 
+    /// \brief Outcome of conjugateGradient()
+    enum PCGResult {
+        PCGConverged,
+        PCGIterationLimit, ///< more than #MaxIterations
+        PCGStagnation,     ///< the residual stopped decreasing
+        PCGDivergence      ///< the residual grew out of bounds or isn't finite
+    };
+
+    /**
+     * @brief Find the matrix entry (p,q), with p<=q.
+     * @param p row
+     * @param q column
+     * @param create if \c true, a missing entry is inserted
+     * @return a pointer to the value, or \c NULL if the entry does not exist and \p create is \c false.
+     */
+    double *findEntry(int p, int q, bool create);
+    /// \brief Move the rows into the CSR arrays.
+    void compress();
+    /// \brief Move the CSR arrays back into separate rows, so that entries can be inserted.
+    void expand();
+
+    /// \brief Set up the threads, the full matrix and the colouring for the kernels below.
+    void prepareKernels();
+    /// \brief Colour the blocks of rows for PreconditionerColouredSSOR and reorder the rows of the full matrix.
+    void colourBlocksOfRows();
+    /**
+     * @brief Call \p body for parts of [\p begin, \p end), in parallel if the range is large enough.
+     * @param grain minimal number of indices per thread
+     */
+    void parallelFor(int begin, int end, int grain, const std::function<void(int,int)> &body);
+    /**
+     * @brief Sum \p body over blocks of rows of a fixed size.
+     * The blocks are summed in order, so the result doesn't depend on the number of threads.
+     * @param body returns the sum over the rows [first, last)
+     */
+    double parallelSum(const std::function<double(int,int)> &body);
+    /// \brief Y=A*X for the rows [first, last), using the full matrix.
+    void multiplyRows(const double *X, double *Y, int first, int last) const;
+    /**
+     * @brief The conjugate gradient iteration of PCGSolve() with the current #Preconditioner.
+     * @param flag see PCGSolve()
+     * @param iter number of iterations done
+     */
+    PCGResult conjugateGradient(int flag, int &iter);
+    /// \brief Apply the selected preconditioner.
+    void applyPC(const double *X, double *Y);
+    void multSSOR(const double *X, double *Y) const;
+    void multColouredSSOR(const double *X, double *Y);
+    /// \brief Factor the current matrix for PreconditionerCholesky; applyPC() falls back to SSOR if that fails.
+    void factorCholesky();
+    /// \brief Format a message and pass it to #WarnMessage.
+    void warning(const char *format, ...) const;
+
+    std::unique_ptr<femm::ThreadTeam> team; ///< threads of PCGSolve(), if #NumThreads > 1
+    std::unique_ptr<femm::AmgPreconditioner> amg; ///< hierarchy of PreconditionerAMG
+    std::unique_ptr<femm::IncompleteCholesky> ic; ///< factor of PreconditionerIC0 and PreconditionerICT
+    std::unique_ptr<femm::SparseCholesky> cholesky; ///< factor of PreconditionerCholesky
+
+    // both triangles of the matrix in CSR layout; the pattern is built after every compress(),
+    // the values are copied by prepareKernels().
+    // The rows are sorted by column, or in the order of multColouredSSOR() if #fullColoured.
+    std::vector<int> fullRowStart;
+    std::vector<int> fullColIdx;
+    std::vector<int> fullSource; ///< index of each entry in #values
+    std::vector<int> fullDiag;   ///< index of the diagonal entry of each row
+    std::vector<double> fullValues;
+    bool fullColoured;
+
+    // colouring of the row blocks for PreconditionerColouredSSOR
+    int colourBlockSize;
+    std::vector<int> colourBlocks; ///< blocks sorted by colour
+    std::vector<int> colourStart;  ///< index of the first block of each colour in #colourBlocks, plus end marker
+
+    std::vector<double> blockSums; ///< partial sums of parallelSum()
+
+    bool compressed; ///< \c true, if the matrix is stored in the CSR arrays
+    std::vector< std::vector<CEntry> > rows; ///< matrix rows while the pattern is built
+    std::vector<int> rowStart; ///< CSR: index of the first (diagonal) entry of each row, plus end marker
+    std::vector<int> colIdx;   ///< CSR: column of each entry
+    std::vector<double> values; ///< CSR: value of each entry
+    unsigned patternRevision;   ///< incremented whenever the pattern may change: Create(), compress() and expand()
+
+    // result of StoreAssembly(), in CSR layout
+    std::vector<int> storedRowStart;
+    std::vector<int> storedColIdx;
+    std::vector<double> storedValues;
+    std::vector<double> storedB;
+    unsigned storedRevision; ///< #patternRevision of the stored pattern
 };
 
 #endif
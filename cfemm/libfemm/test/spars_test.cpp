@@ -0,0 +1,303 @@
+/*
+ * License:
+ * This software is subject to the Aladdin Free Public Licence
+ * version 8, November 18, 1999.
+ * The full license text is available in the file LICENSE.txt supplied
+ * along with the source code.
+ */
+
+/*
+ * Solves small linear problems with the preconditioners of CBigLinProb.
+ * Usage: femm-spars-test <case>
+ * The exit code is 0 if the case passed.
+ */
+
+#include "spars.h"
+#include "SparseCholesky.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+// size of the grid of the Laplacian
+const int gridSize = 64;
+const double precision = 1e-10;
+// bounds of the relative residual and of the relative difference to the solution with SSOR
+const double residualTolerance = 1e-7;
+const double agreementTolerance = 1e-6;
+
+// messages of the last solution
+std::string messages;
+
+int recordMessage(const char *message, ...)
+{
+    messages += message;
+    return 0;
+}
+
+double norm(const std::vector<double> &x)
+{
+    double z=0;
+    for (double xi : x) z += xi*xi;
+    return std::sqrt(z);
+}
+
+double distance(const std::vector<double> &x, const std::vector<double> &y)
+{
+    double z=0;
+    for(size_t i=0; i<x.size(); i++) z += (x[i]-y[i])*(x[i]-y[i]);
+    return std::sqrt(z);
+}
+
+/// \brief Variations of the Laplacian problem
+struct LaplacianOptions
+{
+    double sign = 1.;         ///< -1 for the negative definite problem
+    double shift = 0.;        ///< subtracted from the diagonal; 0.05 makes the matrix indefinite
+    int maxIterations = 10000;
+};
+
+/**
+ * @brief Assemble the 5-point Laplacian of a grid with Dirichlet boundaries
+ * and the right hand side of a known solution.
+ * @param k number of nodes per side
+ */
+void assembleLaplacian(CBigLinProb &L, int k, const LaplacianOptions &options)
+{
+    const double sign = options.sign;
+    int i,j,p;
+
+    L.Create(k*k, k);
+    std::vector<double> x(k*k);
+    for(p=0; p<k*k; p++) x[p] = std::sin(0.37*(p/k)) * std::cos(0.23*(p%k)) + 1.;
+
+    for(i=0; i<k; i++)
+        for(j=0; j<k; j++)
+        {
+            p = i*k+j;
+            L.Put((4.-options.shift)*sign, p, p);
+            L.b[p] = (4.-options.shift)*x[p];
+            if (j > 0) L.b[p] -= x[p-1];
+            if (j+1 < k)
+            {
+                L.Put(-sign, p, p+1);
+                L.b[p] -= x[p+1];
+            }
+            if (i > 0) L.b[p] -= x[p-k];
+            if (i+1 < k)
+            {
+                L.Put(-sign, p, p+k);
+                L.b[p] -= x[p+k];
+            }
+            L.b[p] *= sign;
+        }
+}
+
+/**
+ * @brief Solve the Laplacian with the given preconditioner.
+ * @param V receives the solution
+ * @param residual receives |b-A*V|/|b|
+ * @return the result of PCGSolve()
+ */
+bool solveLaplacian(CBigLinProb::PreconditionerType preconditioner, const LaplacianOptions &options,
+                    std::vector<double> &V, double &residual)
+{
+    CBigLinProb L;
+    L.Precision = precision;
+    L.Preconditioner = preconditioner;
+    L.MaxIterations = options.maxIterations;
+    L.WarnMessage = &recordMessage;
+    assembleLaplacian(L, gridSize, options);
+
+    messages.clear();
+    const bool ok = L.PCGSolve(0);
+    V.assign(L.V, L.V+L.n);
+    if (L.Preconditioner != preconditioner)
+    {
+        messages += "PCGSolve() changed the preconditioner\n";
+        return false;
+    }
+
+    // MultA() prepares the preconditioner again, which may report the same messages
+    const std::string solveMessages = messages;
+    std::vector<double> b(L.b, L.b+L.n);
+    std::vector<double> AV(L.n);
+    L.MultA(L.V, AV.data());
+    residual = distance(AV, b) / norm(b);
+    messages = solveMessages;
+    return ok;
+}
+
+/**
+ * @brief Solve the Laplacian with \p preconditioner and with SSOR, and compare the solutions.
+ * @param expectedMessage the message that PCGSolve() must report, or \c NULL if it must not report any
+ */
+bool testPreconditioner(CBigLinProb::PreconditionerType preconditioner,
+                        const LaplacianOptions &options=LaplacianOptions(), const char *expectedMessage=NULL)
+{
+    std::vector<double> V, Vssor;
+    double residual, residualSSOR;
+
+    LaplacianOptions ssorOptions = options;
+    ssorOptions.maxIterations = 10000;
+    if (!solveLaplacian(CBigLinProb::PreconditionerSSOR, ssorOptions, Vssor, residualSSOR))
+    {
+        fprintf(stderr, "SSOR failed: %s", messages.c_str());
+        return false;
+    }
+    if (!solveLaplacian(preconditioner, options, V, residual))
+    {
+        fprintf(stderr, "PCGSolve() failed: %s", messages.c_str());
+        return false;
+    }
+    if (messages != (expectedMessage ? expectedMessage : ""))
+    {
+        fprintf(stderr, "unexpected messages: %s", messages.c_str());
+        return false;
+    }
+
+    const double difference = distance(V, Vssor) / norm(Vssor);
+    printf("residual %g, difference to SSOR %g\n", residual, difference);
+    if (!(residual < residualTolerance))
+    {
+        fprintf(stderr, "residual too large\n");
+        return false;
+    }
+    if (!(difference < agreementTolerance))
+    {
+        fprintf(stderr, "solution differs from SSOR\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Solve the Laplacian with \p preconditioner and check that PCGSolve() fails with \p expectedMessage.
+ */
+bool testFailure(CBigLinProb::PreconditionerType preconditioner, const LaplacianOptions &options, const char *expectedMessage)
+{
+    std::vector<double> V;
+    double residual;
+
+    if (solveLaplacian(preconditioner, options, V, residual))
+    {
+        fprintf(stderr, "PCGSolve() didn't fail, residual %g\n", residual);
+        return false;
+    }
+    if (messages != expectedMessage)
+    {
+        fprintf(stderr, "unexpected messages: %s", messages.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Factor a small matrix with femm::SparseCholesky and compare the solution with the known one.
+ */
+bool testCholeskyKnownAnswer()
+{
+    // upper triangle of [4 1 0 1; 1 4 1 0; 0 1 4 1; 1 0 1 4] and its product with x
+    const int rowStart[] = {0, 3, 5, 7, 8};
+    const int colIdx[] = {0, 1, 3, 1, 2, 2, 3, 3};
+    const double values[] = {4, 1, 1, 4, 1, 4, 1, 4};
+    const double b[] = {10, 12, 18, 20};
+    const double x[] = {1, 2, 3, 4};
+
+    femm::SparseCholesky cholesky;
+    if (!cholesky.factor(4, rowStart, colIdx, values))
+    {
+        fprintf(stderr, "factorization failed\n");
+        return false;
+    }
+    double y[4];
+    cholesky.solve(b, y);
+    for(int i=0; i<4; i++)
+        if (!(std::fabs(y[i]-x[i]) < 1e-12))
+        {
+            fprintf(stderr, "x[%i] = %g instead of %g\n", i, y[i], x[i]);
+            return false;
+        }
+
+    // [1 2; 2 1] is indefinite
+    const int rowStart2[] = {0, 2, 3};
+    const int colIdx2[] = {0, 1, 1};
+    const double values2[] = {1, 2, 1};
+    if (cholesky.factor(2, rowStart2, colIdx2, values2) || cholesky.valid())
+    {
+        fprintf(stderr, "an indefinite matrix was factored\n");
+        return false;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: femm-spars-test <case>\n");
+        return 2;
+    }
+
+    const std::string name = argv[1];
+    bool ok;
+    if (name == "amg")
+        ok = testPreconditioner(CBigLinProb::PreconditionerAMG);
+    else if (name == "ic0")
+        ok = testPreconditioner(CBigLinProb::PreconditionerIC0);
+    else if (name == "ict")
+        ok = testPreconditioner(CBigLinProb::PreconditionerICT);
+    else if (name == "ic0-fallback")
+    {
+        // no pivot of a negative definite matrix is positive, even with a shift,
+        // so PCGSolve() must fall back to SSOR, which works for negative definite matrices
+        LaplacianOptions options;
+        options.sign = -1.;
+        ok = testPreconditioner(CBigLinProb::PreconditionerIC0, options,
+                                "Incomplete Cholesky factorization failed, using SSOR\n");
+    }
+    else if (name == "cholesky-known-answer")
+        ok = testCholeskyKnownAnswer();
+    else if (name == "cholesky")
+        ok = testPreconditioner(CBigLinProb::PreconditionerCholesky);
+    else if (name == "cholesky-indefinite")
+    {
+        // the shifted Laplacian has a few negative eigenvalues, so PCGSolve() must fall back to SSOR,
+        // which still converges for this mildly indefinite matrix
+        LaplacianOptions options;
+        options.shift = 0.05;
+        ok = testPreconditioner(CBigLinProb::PreconditionerCholesky, options,
+                                "Cholesky factorization failed, using SSOR\n");
+    }
+    else if (name == "cholesky-retry")
+    {
+        // SSOR can't converge in 5 iterations, PCGSolve() must solve again with a Cholesky factor
+        LaplacianOptions options;
+        options.maxIterations = 5;
+        ok = testPreconditioner(CBigLinProb::PreconditionerSSOR, options,
+                                "conjugate gradient solver reached the iteration limit after 5 iterations, using Cholesky\n");
+    }
+    else if (name == "cholesky-retry-indefinite")
+    {
+        // the Cholesky factorization of the retry fails, too
+        LaplacianOptions options;
+        options.shift = 0.05;
+        options.maxIterations = 5;
+        ok = testFailure(CBigLinProb::PreconditionerSSOR, options,
+                         "conjugate gradient solver reached the iteration limit after 5 iterations, using Cholesky\n"
+                         "Cholesky factorization failed\n");
+    }
+    else
+    {
+        fprintf(stderr, "unknown case %s\n", name.c_str());
+        return 2;
+    }
+
+    return ok ? 0 : 1;
+}